@@ -0,0 +1,100 @@
+/*  Sirikata Cache Simulator
+ *  main.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <util/Standard.hh>
+#include <options/Options.hpp>
+#include <transfer/CacheSimulator.hpp>
+
+namespace Sirikata {
+namespace {
+OptionValue*sLog;
+OptionValue*sPolicies;
+OptionValue*sSizes;
+OptionValue*sMaxSizePct;
+InitializeGlobalOptions gCacheSimOptions("cachesim",
+    sLog=new OptionValue("log","",OptionValueType<std::string>(),"The access log to replay, as recorded by the accesslog option of transfer"),
+    sPolicies=new OptionValue("policies","lru,arc,gdsf",OptionValueType<std::string>(),"Comma separated cache policies to compare"),
+    sSizes=new OptionValue("sizes","16777216,67108864,268435456",OptionValueType<std::string>(),"Comma separated cache sizes in bytes to simulate"),
+    sMaxSizePct=new OptionValue("maxsizepct","0.5",OptionValueType<double>(),"The largest fraction of the cache one file may take"),
+    NULL);
+
+std::vector<std::string> splitList(const std::string&list) {
+    std::vector<std::string> retval;
+    std::string::size_type start=0;
+    while (start<=list.size()) {
+        std::string::size_type end=list.find(',',start);
+        if (end==std::string::npos)
+            end=list.size();
+        if (end>start)
+            retval.push_back(list.substr(start,end-start));
+        start=end+1;
+    }
+    return retval;
+}
+}
+}
+
+int main(int argc,const char**argv) {
+    using namespace Sirikata;
+    using namespace Sirikata::Transfer;
+    OptionSet::getOptions("cachesim")->parse(argc,argv);
+    std::string filename=sLog->as<std::string>();
+    std::vector<CacheAccessLog::Access> accesses;
+    if (!CacheAccessLog::read(filename,accesses)) {
+        if (accesses.empty()) {
+            std::cerr<<"Could not read an access log from \""<<filename<<"\"\n";
+            return 1;
+        }
+        std::cerr<<"Access log \""<<filename<<"\" has a bad line: replaying the first "<<accesses.size()<<" requests\n";
+    }
+    std::vector<std::string> policies=splitList(sPolicies->as<std::string>());
+    std::vector<std::string> sizes=splitList(sSizes->as<std::string>());
+    float maxSizePct=(float)sMaxSizePct->as<double>();
+    std::cout<<"policy,cachesize,requests,hits,hitratio,bytes,hitbytes,bytehitratio\n";
+    for (size_t i=0;i<sizes.size();++i) {
+        cache_usize_type size=(cache_usize_type)strtoull(sizes[i].c_str(),NULL,10);
+        for (size_t j=0;j<policies.size();++j) {
+            CachePolicy*policy=CachePolicy::makePolicy(policies[j],size,maxSizePct);
+            if (!policy) {
+                std::cerr<<"Unknown cache policy \""<<policies[j]<<"\"\n";
+                return 1;
+            }
+            CacheSimulator simulator(policy);
+            simulator.run(accesses);
+            const CacheSimulator::Result&result=simulator.getResult();
+            std::cout<<policies[j]<<','<<size<<','<<result.mRequests<<','<<result.mHits<<','<<result.hitRatio()<<','
+                     <<result.mBytes<<','<<result.mHitBytes<<','<<result.byteHitRatio()<<'\n';
+        }
+    }
+    return 0;
+}
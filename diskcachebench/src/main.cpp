@@ -0,0 +1,191 @@
+/*  Sirikata Disk Cache Benchmark
+ *  main.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <util/Standard.hh>
+#include <options/Options.hpp>
+#include <task/Time.hpp>
+#include <transfer/DiskCacheLayer.hpp>
+#include <transfer/LRUPolicy.hpp>
+#include <boost/thread.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Sirikata {
+namespace {
+OptionValue*sDir;
+OptionValue*sSizes;
+OptionValue*sMapSize;
+InitializeGlobalOptions gDiskCacheBenchOptions("diskcachebench",
+    sDir=new OptionValue("dir","diskcachebench",OptionValueType<std::string>(),"The directory to keep the benchmark's disk cache in"),
+    sSizes=new OptionValue("sizes","65536,1048576,16777216,67108864",OptionValueType<std::string>(),"Comma separated file sizes in bytes to read"),
+    sMapSize=new OptionValue("mapsize","65536",OptionValueType<size_t>(),"The diskmapsize to give the cache for the mapped reads"),
+    NULL);
+
+std::vector<std::string> splitList(const std::string&list) {
+    std::vector<std::string> retval;
+    std::string::size_type start=0;
+    while (start<=list.size()) {
+        std::string::size_type end=list.find(',',start);
+        if (end==std::string::npos)
+            end=list.size();
+        if (end>start)
+            retval.push_back(list.substr(start,end-start));
+        start=end+1;
+    }
+    return retval;
+}
+
+///Drops the pages of path from the page cache, so that the next read of it is cold. Returns false where that cannot be done
+bool dropFromPageCache(const std::string&path) {
+#ifdef __linux__
+    int fd=open(path.c_str(),O_RDONLY);
+    if (fd<0)
+        return false;
+    fdatasync(fd);
+    int err=posix_fadvise(fd,0,0,POSIX_FADV_DONTNEED);
+    close(fd);
+    return err==0;
+#else
+    return false;
+#endif
+}
+
+///Answers every request at once with made up contents, and offers them to the layers before it
+class SourceLayer:public Transfer::CacheLayer {
+    Transfer::Range::base_type mFileSize;
+public:
+    SourceLayer(Transfer::Range::base_type fileSize):Transfer::CacheLayer(NULL),mFileSize(fileSize) {
+    }
+    virtual void getData(const Transfer::RemoteFileId&fid,const Transfer::Range&requestedRange,const Transfer::TransferCallback&callback) {
+        Transfer::Range toSend(requestedRange);
+        if (toSend.goesToEndOfFile()) {
+            toSend.setLength((size_t)(mFileSize-toSend.startbyte()),true);
+        }
+        Transfer::MutableDenseDataPtr data(new Transfer::DenseData(toSend));
+        for (Transfer::Range::base_type i=0;i<toSend.length();++i) {
+            data->writableData()[i]=(unsigned char)(fid.fingerprint().rawData()[0]+(toSend.startbyte()+i)*7);
+        }
+        populateParentCaches(fid.fingerprint(),data);
+        Transfer::SparseData sparse;
+        sparse.addValidData(data);
+        callback(&sparse);
+    }
+};
+
+/**
+ * Reads a whole file from a DiskCacheLayer and waits for the answer, reading one byte of every page of it
+ * as a reader of the whole file would at least have to
+ */
+class TimedRead {
+    AtomicValue<int> mAnswered;
+    bool mRight;
+    Task::AbsTime mAnswerTime;
+    void touchPages(const Transfer::SparseData*data) {
+        unsigned int sum=0;
+        if (data) {
+            for (Transfer::DenseDataList::const_iterator iter=data->DenseDataList::begin();iter!=data->DenseDataList::end();++iter) {
+                const Transfer::DenseData&dense=*iter;
+                for (size_t i=0;i<(size_t)dense.length();i+=4096) {
+                    sum+=dense.data()[i];
+                }
+            }
+        }
+        mRight=(data!=NULL&&sum!=0xffffffff);
+        mAnswerTime=Task::AbsTime::now();
+        ++mAnswered;
+    }
+public:
+    TimedRead():mAnswered(0),mRight(false),mAnswerTime(Task::AbsTime::null()) {
+    }
+    ///Returns how long layer took to answer, or a negative number if it did not answer with data
+    double run(Transfer::CacheLayer*layer,const Transfer::RemoteFileId&fid) {
+        using std::tr1::placeholders::_1;
+        Task::AbsTime start=Task::AbsTime::now();
+        layer->getData(fid,Transfer::Range(true),std::tr1::bind(&TimedRead::touchPages,this,_1));
+        while (mAnswered.read()==0) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+        return mRight?(mAnswerTime-start).toSeconds():-1;
+    }
+};
+}
+}
+
+int main(int argc,const char**argv) {
+    using namespace Sirikata;
+    using namespace Sirikata::Transfer;
+    OptionSet::getOptions("diskcachebench")->parse(argc,argv);
+    std::string dir=sDir->as<std::string>();
+    std::vector<std::string> sizes=splitList(sSizes->as<std::string>());
+    std::ostringstream mapOption;
+    mapOption<<"--diskmapsize="<<sMapSize->as<size_t>();
+    std::cout<<"file,bytes,read,pass,ms,mbps\n";
+    for (size_t i=0;i<sizes.size();++i) {
+        Range::base_type size=(Range::base_type)strtoull(sizes[i].c_str(),NULL,10);
+        std::ostringstream name;
+        name<<"diskcachebench"<<size;
+        RemoteFileId fid(Fingerprint::computeDigest(name.str()),URI(URIContext(),"http://localhost/"));
+        std::string path=dir+"/"+fid.fingerprint().convertToHexString();
+        {
+            SourceLayer source(size);
+            LRUPolicy policy(size*4);
+            DiskCacheLayer disk(&policy,dir,&source);
+            if (TimedRead().run(&disk,fid)<0) {
+                std::cerr<<"Could not fill the disk cache in \""<<dir<<"\"\n";
+                return 1;
+            }
+            // leaving the scope finishes the write.
+        }
+        for (int mapped=0;mapped<2;++mapped) {
+            OptionSet::getOptions("transfer")->parse(mapped?mapOption.str():std::string("--diskmapsize=0"));
+            LRUPolicy policy(size*4);
+            DiskCacheLayer disk(&policy,dir,NULL);
+            for (int warm=0;warm<2;++warm) {
+                if (!warm&&!dropFromPageCache(path)) {
+                    std::cerr<<"Cannot drop \""<<path<<"\" from the page cache here: its cold read is warm\n";
+                }
+                double seconds=TimedRead().run(&disk,fid);
+                if (seconds<0) {
+                    std::cerr<<"Could not read \""<<path<<"\" back from the disk cache\n";
+                    return 1;
+                }
+                std::cout<<name.str()<<','<<size<<','<<(mapped?"mapped":"copied")<<','<<(warm?"warm":"cold")<<','
+                         <<seconds*1000<<','<<(seconds>0?size/seconds/1048576.:0)<<'\n';
+            }
+            if (mapped) {
+                disk.purgeFromCache(fid.fingerprint());
+            }
+        }
+    }
+    return 0;
+}
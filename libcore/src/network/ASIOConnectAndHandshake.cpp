@@ -35,6 +35,8 @@
 #include "TCPStream.hpp"
 #include "util/ThreadSafeQueue.hpp"
 #include "ASIOSocketWrapper.hpp"
+#include "ASIODatagramSocket.hpp"
+#include "StreamCompression.hpp"
 #include "TCPStream.hpp"
 #include "MultiplexedSocket.hpp"
 #include "ASIOConnectAndHandshake.hpp"
@@ -61,6 +63,14 @@ void ASIOConnectAndHandshake::checkHeaderContents(unsigned int whichSocket,
                 mFinishedCheckCount--;
                 if (mFinishedCheckCount==0) {
                     connection->connectedCallback();
+                    if (ASIODatagramSocket::offerDatagrams()) {
+                        MultiplexedSocket::offerDatagrams(connection);
+                    }
+                    MultiplexedSocket::offerFragmentation(connection);
+                    if (StreamCompressor::offerCompression()) {
+                        MultiplexedSocket::offerCompression(connection);
+                    }
+                    MultiplexedSocket::startKeepalive(connection);
                 }
                 MakeASIOReadBuffer(connection,whichSocket);
             }
@@ -87,6 +87,7 @@ public:
      *  It first performs a resolution on the address and handles the callback in handleResolve. 
      *  If the header checks out and matches with the other live sockets to the same sockets 
      *    - MultiplexedSocket::connectedCallback() is called
+     *    - A UDP side channel is offered to the other end if the tcpsst.datagrams option is set
      *    - An ASIOReadBuffer is created for handling future reads
      */
     static void connect(const std::tr1::shared_ptr<ASIOConnectAndHandshake> &thus,
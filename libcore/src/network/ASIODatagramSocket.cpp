@@ -0,0 +1,129 @@
+/*  Sirikata Network Utilities
+ *  ASIODatagramSocket.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "options/Options.hpp"
+#include "TCPDefinitions.hpp"
+#include "TCPStream.hpp"
+#include "ChunkPool.hpp"
+#include "util/ThreadSafeQueue.hpp"
+#include "ASIOSocketWrapper.hpp"
+#include "MultiplexedSocket.hpp"
+#include "ASIODatagramSocket.hpp"
+namespace Sirikata { namespace Network {
+using namespace boost::asio::ip;
+namespace {
+OptionValue*sOfferDatagrams;
+OptionValue*sMaxDatagramSize;
+InitializeGlobalOptions gDatagramOptions("tcpsst",
+    sOfferDatagrams=new OptionValue("datagrams","false",OptionValueType<bool>(),"Connecting streams offer the listener a UDP side channel for unreliable packets, which must be able to reach the connecting host directly"),
+    sMaxDatagramSize=new OptionValue("maxdatagramsize","1400",OptionValueType<size_t>(),"Unreliable packets up to this many bytes use the UDP side channel when there is one; longer ones go over TCP. The default avoids IP fragmentation on ethernet"),
+    NULL);
+}
+bool ASIODatagramSocket::offerDatagrams() {
+    return sOfferDatagrams->as<bool>();
+}
+size_t ASIODatagramSocket::defaultMaxDatagramSize() {
+    return sMaxDatagramSize->as<size_t>();
+}
+ASIODatagramSocket::ASIODatagramSocket(IOService&io):mIO(&io),mSocket(io),mMaxDatagramSize(defaultMaxDatagramSize()) {
+}
+unsigned short ASIODatagramSocket::open(const address&localAddress) {
+    ErrorCode error;
+    mSocket.open(localAddress.is_v4()?udp::v4():udp::v6(),error);
+    if (!error) {
+        mSocket.bind(udp::endpoint(localAddress,0),error);
+    }
+    if (!error) {
+        mSocket.non_blocking(true,error);
+    }
+    if (error) {
+        SILOG(tcpsst,warning,"Could not open datagram side channel: "<<error.message());
+        return 0;
+    }
+    udp::endpoint local=mSocket.local_endpoint(error);
+    return error?0:local.port();
+}
+bool ASIODatagramSocket::connect(const udp::endpoint&remote) {
+    ErrorCode error;
+    mSocket.connect(remote,error);
+    if (error) {
+        SILOG(tcpsst,warning,"Could not connect datagram side channel: "<<error.message());
+        return false;
+    }
+    return true;
+}
+void ASIODatagramSocket::send(const std::tr1::shared_ptr<ASIODatagramSocket>&thus,Chunk*packet) {
+    assert(packet->size()<=thus->mMaxDatagramSize);
+    std::tr1::shared_ptr<Chunk> toBeSent(packet,&ChunkPool::release);
+    thus->mIO->post(std::tr1::bind(&ASIODatagramSocket::sendNow,thus,toBeSent));
+}
+void ASIODatagramSocket::sendNow(const std::tr1::shared_ptr<ASIODatagramSocket>&thus,const std::tr1::shared_ptr<Chunk>&packet) {
+    ErrorCode error;
+    thus->mSocket.send(boost::asio::buffer(&*packet->begin(),packet->size()),0,error);
+    if (error&&error!=boost::asio::error::would_block) {
+        //the other end may not be listening yet or may be gone: either way the packet was unreliable
+        SILOG(tcpsst,insane,"Dropped datagram: "<<error.message());
+    }
+}
+void ASIODatagramSocket::startReceiving(const std::tr1::shared_ptr<ASIODatagramSocket>&thus,const std::tr1::weak_ptr<MultiplexedSocket>&parentSocket) {
+    //a fresh buffer each time since receivers may hold on to views of the last one
+    std::tr1::shared_ptr<Chunk> buffer=ChunkPool::allocateShared(thus->mMaxDatagramSize);
+    thus->mSocket.async_receive(boost::asio::buffer(&*buffer->begin(),buffer->size()),
+                                boost::bind(&ASIODatagramSocket::handleReceive,
+                                            thus,
+                                            parentSocket,
+                                            buffer,
+                                            boost::asio::placeholders::error,
+                                            boost::asio::placeholders::bytes_transferred));
+}
+void ASIODatagramSocket::handleReceive(const std::tr1::shared_ptr<ASIODatagramSocket>&thus,
+                                       const std::tr1::weak_ptr<MultiplexedSocket>&parentSocket,
+                                       const std::tr1::shared_ptr<Chunk>&buffer,
+                                       const ErrorCode&error,
+                                       std::size_t bytes_received) {
+    std::tr1::shared_ptr<MultiplexedSocket> parent=parentSocket.lock();
+    if (!parent||error==boost::asio::error::operation_aborted||!thus->mSocket.is_open()) {
+        return;
+    }
+    if (error) {
+        //ICMP errors from earlier sends surface here; the side channel carries on regardless
+        SILOG(tcpsst,insane,"Datagram receive error: "<<error.message());
+    }else {
+        parent->receiveDatagram(ChunkView(buffer,0,bytes_received));
+    }
+    startReceiving(thus,parentSocket);
+}
+void ASIODatagramSocket::close() {
+    ErrorCode error;
+    mSocket.close(error);
+}
+} }
@@ -0,0 +1,82 @@
+/*  Sirikata Network Utilities
+ *  ASIODatagramSocket.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_ASIODatagramSocket_HPP__
+#define SIRIKATA_ASIODatagramSocket_HPP__
+namespace Sirikata { namespace Network {
+/**
+ * The optional UDP side channel of a MultiplexedSocket, over which Unreliable packets small enough to fit a datagram
+ * are sent so that they do not wait behind TCP retransmissions.
+ * Each datagram carries exactly one packet, serialized just as it would be on a TCP socket (length, StreamID, payload).
+ * Sends are handed to the IO thread, which writes them without blocking: a datagram that does not fit in the kernel's buffer is dropped,
+ * as unreliable traffic may be. The socket is connected to the other end's side channel so that the kernel discards
+ * datagrams from anywhere else
+ */
+class ASIODatagramSocket {
+    typedef boost::asio::ip::udp::socket UDPSocket;
+    ///The IO service of the connection, whose thread does all reading and writing
+    IOService*mIO;
+    UDPSocket mSocket;
+    ///The longest packet sent over the side channel and the size of the buffer datagrams are received into
+    size_t mMaxDatagramSize;
+    typedef boost::system::error_code ErrorCode;
+    static void sendNow(const std::tr1::shared_ptr<ASIODatagramSocket>&thus,const std::tr1::shared_ptr<Chunk>&packet);
+    static void handleReceive(const std::tr1::shared_ptr<ASIODatagramSocket>&thus,
+                              const std::tr1::weak_ptr<MultiplexedSocket>&parentSocket,
+                              const std::tr1::shared_ptr<Chunk>&buffer,
+                              const ErrorCode&error,
+                              std::size_t bytes_received);
+public:
+    ///Whether connecting streams offer the other end a side channel: the tcpsst.datagrams option
+    static bool offerDatagrams();
+    ///The largest packet the side channel carries by default: the tcpsst.maxdatagramsize option
+    static size_t defaultMaxDatagramSize();
+    explicit ASIODatagramSocket(IOService&io);
+    /**
+     * Binds to an ephemeral port on localAddress, the address the connection's TCP sockets use.
+     * Returns the port, or 0 if no socket could be opened
+     */
+    unsigned short open(const boost::asio::ip::address&localAddress);
+    ///Only accepts datagrams from, and sends datagrams to, remote: returns false on failure
+    bool connect(const boost::asio::ip::udp::endpoint&remote);
+    ///The longest packet that may be passed to send
+    size_t getMaxDatagramSize()const {
+        return mMaxDatagramSize;
+    }
+    ///Sends a serialized packet no longer than getMaxDatagramSize() from the IO thread, releasing it afterwards. May be called from any thread
+    static void send(const std::tr1::shared_ptr<ASIODatagramSocket>&thus,Chunk*packet);
+    ///Starts handing every datagram received to parentSocket's receiveDatagram from the IO thread, until close() is called
+    static void startReceiving(const std::tr1::shared_ptr<ASIODatagramSocket>&thus,const std::tr1::weak_ptr<MultiplexedSocket>&parentSocket);
+    ///Stops receiving and closes the socket: must be called from the IO thread or once it has stopped
+    void close();
+};
+} }
+#endif
@@ -34,9 +34,13 @@
 #include "TCPDefinitions.hpp"
 #include "Stream.hpp"
 #include "TCPStream.hpp"
+#include "ChunkPool.hpp"
 #include "util/ThreadSafeQueue.hpp"
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
+#include "PacketCapture.hpp"
+#include "NetworkMetrics.hpp"
+#include "FrameScanner.hpp"
 #include "ASIOReadBuffer.hpp"
 namespace Sirikata { namespace Network {
 void MakeASIOReadBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,unsigned int whichSocket) {
@@ -46,17 +50,51 @@ void ASIOReadBuffer::processError(MultiplexedSocket*parentSocket, const boost::s
     parentSocket->hostDisconnectedCallback(mWhichBuffer,error);
     delete this;
 }
-void ASIOReadBuffer::processFullChunk(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket, unsigned int whichSocket, const Stream::StreamID&id, const Chunk&newChunk){
+void ASIOReadBuffer::processFullChunk(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket, unsigned int whichSocket, const Stream::StreamID&id, const ChunkView&newChunk){
+    NetworkMetrics::add(NetworkMetrics::PACKETS_RECEIVED);
+    if (mCapture) {
+        mCapture->record(parentSocket->getCaptureID(),whichSocket,id,newChunk);
+    }
     parentSocket->receiveFullChunk(whichSocket,id,newChunk);
 }
 
 
+void ASIOReadBuffer::prepareFixedBuffer(){
+    if (mSlabStart==mBufferPos) {
+        //everything read so far was handed out: start over at the front, of a fresh slab if receivers are still holding views of this one
+        if (!mSlab.unique()) {
+            mSlab=ChunkPool::allocateShared(sSlabLength);
+        }
+        mSlabStart=0;
+        mBufferPos=0;
+    }else if (mSlabStart!=0&&(mPendingPacketLength
+                              ?mSlabStart+mPendingPacketLength>sSlabLength
+                              :sSlabLength-mBufferPos<sLowWaterMark)) {
+        //the partial packet cannot be completed in the space left: move its remnants to the beginning
+        unsigned int remnant=mBufferPos-mSlabStart;
+        if (mSlab.unique()) {
+            std::memmove(&(*mSlab)[0],&(*mSlab)[mSlabStart],remnant);
+        }else {
+            std::tr1::shared_ptr<Chunk> slab(ChunkPool::allocateShared(sSlabLength));
+            std::memcpy(&(*slab)[0],&(*mSlab)[mSlabStart],remnant);
+            mSlab=slab;
+        }
+        mSlabStart=0;
+        mBufferPos=remnant;
+    }
+    assert(mBufferPos<sSlabLength);
+}
+void ASIOReadBuffer::countRead(const ErrorCode&error,std::size_t bytes_read) {
+    if (!error) {
+        NetworkMetrics::add(NetworkMetrics::SOCKET_READS);
+        NetworkMetrics::add(NetworkMetrics::BYTES_RECEIVED,bytes_read);
+    }
+}
 void ASIOReadBuffer::readIntoFixedBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket){
-     
-     
+    prepareFixedBuffer();
     parentSocket
         ->getASIOSocketWrapper(mWhichBuffer).getSocket()
-        .async_receive(boost::asio::buffer(mBuffer+mBufferPos,sBufferLength-mBufferPos),
+        .async_receive(boost::asio::buffer(&(*mSlab)[mBufferPos],sSlabLength-mBufferPos),
                        std::tr1::bind(&ASIOReadBuffer::asioReadIntoFixedBuffer,
                                    this,
                                    _1,
@@ -65,81 +103,113 @@ void ASIOReadBuffer::readIntoFixedBuffer(const std::tr1::shared_ptr<MultiplexedS
 void ASIOReadBuffer::readIntoChunk(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket){
      
      
-    assert(mNewChunk.size()>0);//otherwise should have been filtered out by caller
-    assert(mBufferPos<mNewChunk.size());
+    assert(mNewChunk&&mNewChunk->size()>0);//otherwise should have been filtered out by caller
+    assert(mNewChunkPos<mNewChunk->size());
     parentSocket
         ->getASIOSocketWrapper(mWhichBuffer).getSocket()
-        .async_receive(boost::asio::buffer(&*(mNewChunk.begin()+mBufferPos),mNewChunk.size()-mBufferPos),
+        .async_receive(boost::asio::buffer(&(*mNewChunk)[mNewChunkPos],mNewChunk->size()-mNewChunkPos),
                        std::tr1::bind(&ASIOReadBuffer::asioReadIntoChunk,
                                    this,
                                    _1,
                                    _2));
 }
 
-Stream::StreamID ASIOReadBuffer::processPartialChunk(uint8* dataBuffer, uint32 packetLength, uint32 &bufferReceived, Chunk&retval) {
+void ASIOReadBuffer::processPartialChunk(const uint8* dataBuffer, uint32 packetLength, uint32 bufferReceived) {
     unsigned int headerLength=bufferReceived;
-    Stream::StreamID retid;
-    retid.unserialize(dataBuffer,headerLength);
-    assert(headerLength<=bufferReceived&&"High water mark must be greater than maximum StreamID size");
-    bufferReceived-=headerLength;
-    assert(headerLength<=packetLength&&"High water mark must be greater than maximum StreamID size");
-    retval.resize(packetLength-headerLength);
-    if (packetLength>headerLength) {
-        std::memcpy(&*retval.begin(),dataBuffer+headerLength,bufferReceived);
+    mNewChunkID.unserialize(dataBuffer,headerLength);
+    assert(headerLength<=bufferReceived&&"Caller must wait for the whole StreamID");
+    assert(headerLength<packetLength&&"Only packets too large for a slab belong in their own chunk");
+    mNewChunkPos=bufferReceived-headerLength;
+    mNewChunk=ChunkPool::allocateShared(packetLength-headerLength);
+    if (mNewChunkPos) {
+        std::memcpy(&(*mNewChunk)[0],dataBuffer+headerLength,mNewChunkPos);
     }
-    return retid;
 }
 void ASIOReadBuffer::translateBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &thus) {
-        unsigned int chunkPos=0;
-        unsigned int packetHeaderLength;
+        const uint8*slab=&(*mSlab)[0];
+        unsigned int chunkPos=mSlabStart;
+        mPendingPacketLength=0;
+        FrameScanner::Frame frames[FrameScanner::MAX_FRAMES];
+        size_t numFrames;
+        do {
+            size_t consumed;
+            numFrames=FrameScanner::scan(slab+chunkPos,mBufferPos-chunkPos,frames,FrameScanner::MAX_FRAMES,consumed);
+            for (size_t i=0;i<numFrames;++i) {
+                processFullChunk(thus,mWhichBuffer,frames[i].mID,ChunkView(mSlab,chunkPos+frames[i].mOffset,frames[i].mLength));
+            }
+            chunkPos+=(unsigned int)consumed;
+        }while (numFrames==FrameScanner::MAX_FRAMES);
+        //whatever is left is the start of a packet that has not been received completely
+        unsigned int packetHeaderLength=mBufferPos-chunkPos;
         Stream::uint30 packetLength;
-        while ((packetHeaderLength=mBufferPos-chunkPos)!=0&&packetLength.unserialize(mBuffer+chunkPos,packetHeaderLength)) {
-            if (mBufferPos-chunkPos<packetLength.read()+packetHeaderLength) {
-                if (mBufferPos-chunkPos<sLowWaterMark) {
-                    break;//go directly to memmov code and move remnants to beginning of buffer to read a large portion at a time
-                }else {
-                    mBufferPos-=chunkPos;
-                    mBufferPos-=packetHeaderLength;
-                    assert(mNewChunk.size()==0);
-                    mNewChunkID = processPartialChunk(mBuffer+chunkPos+packetHeaderLength,packetLength.read(),mBufferPos,mNewChunk);
-                    readIntoChunk(thus);
-                    return;
-                }
-            }else {
-                uint32 chunkLength=packetLength.read();
-                Chunk resultChunk;
-                Stream::StreamID resultID=processPartialChunk(mBuffer+chunkPos+packetHeaderLength,packetLength.read(),chunkLength,resultChunk);
-                processFullChunk(thus,mWhichBuffer,resultID,resultChunk);
-                chunkPos+=packetHeaderLength+packetLength.read();
+        if (packetHeaderLength!=0&&packetLength.unserialize(slab+chunkPos,packetHeaderLength)) {
+            unsigned int available=mBufferPos-chunkPos-packetHeaderLength;
+            assert(available<packetLength.read());
+            mPendingPacketLength=packetHeaderLength+packetLength.read();
+            if (mPendingPacketLength>sSlabLength&&available>=Stream::StreamID::MAX_SERIALIZED_LENGTH) {
+                //would never fit in a slab: read the rest straight into a chunk of its own
+                processPartialChunk(slab+chunkPos+packetHeaderLength,packetLength.read(),available);
+                mSlabStart=mBufferPos;
+                mPendingPacketLength=0;
+                return;
             }
         }
-        if (chunkPos!=0&&mBufferPos!=chunkPos) {//move partial bytes to beginning
-            std::memmove(mBuffer,mBuffer+chunkPos,mBufferPos-chunkPos);
-        }
-        mBufferPos-=chunkPos;
+        mSlabStart=chunkPos;
+    }
+void ASIOReadBuffer::finishNewChunk(const std::tr1::shared_ptr<MultiplexedSocket> &thus) {
+    if (mNewChunkPos>=mNewChunk->size()){
+        assert(mNewChunkPos==mNewChunk->size());
+        std::tr1::shared_ptr<Chunk> fullChunk;
+        fullChunk.swap(mNewChunk);
+        mNewChunkPos=0;
+        processFullChunk(thus,mWhichBuffer,mNewChunkID,ChunkView(fullChunk));
+    }
+}
+void ASIOReadBuffer::readMore(const std::tr1::shared_ptr<MultiplexedSocket> &thus) {
+    if (mNewChunk) {
+        readIntoChunk(thus);
+    }else {
         readIntoFixedBuffer(thus);
     }
+}
+void ASIOReadBuffer::replayReceived(const std::tr1::shared_ptr<MultiplexedSocket> &thus,const uint8*data,size_t length) {
+    while (length) {
+        size_t received;
+        if (mNewChunk) {
+            received=mNewChunk->size()-mNewChunkPos;
+            if (received>length)
+                received=length;
+            std::memcpy(&(*mNewChunk)[mNewChunkPos],data,received);
+            mNewChunkPos+=received;
+            finishNewChunk(thus);
+        }else {
+            prepareFixedBuffer();
+            received=sSlabLength-mBufferPos;
+            if (received>length)
+                received=length;
+            std::memcpy(&(*mSlab)[mBufferPos],data,received);
+            mBufferPos+=received;
+            translateBuffer(thus);
+        }
+        data+=received;
+        length-=received;
+    }
+}
 
 
 
 void ASIOReadBuffer::asioReadIntoChunk(const ErrorCode&error,std::size_t bytes_read){
-    TCPSSTLOG(this,"rcv",&mNewChunk[mBufferPos],bytes_read,error);
-    mBufferPos+=bytes_read;
+    TCPSSTLOG(this,"rcv",&(*mNewChunk)[mNewChunkPos],bytes_read,error);
+    mNewChunkPos+=bytes_read;
+    countRead(error,bytes_read);
     std::tr1::shared_ptr<MultiplexedSocket> thus(mParentSocket.lock());
     
     if (thus) {
         if (error){
             processError(&*thus,error);
         }else {
-            if (mBufferPos>=mNewChunk.size()){
-                assert(mBufferPos==mNewChunk.size());
-                processFullChunk(thus,mWhichBuffer,mNewChunkID,mNewChunk);
-                mNewChunk.resize(0);
-                mBufferPos=0;
-                readIntoFixedBuffer(thus);
-            }else {
-                readIntoChunk(thus);
-            }
+            finishNewChunk(thus);
+            readMore(thus);
         }
     }else {
         delete this;
@@ -147,8 +217,9 @@ void ASIOReadBuffer::asioReadIntoChunk(const ErrorCode&error,std::size_t bytes_r
 }
 
 void ASIOReadBuffer::asioReadIntoFixedBuffer(const ErrorCode&error,std::size_t bytes_read){
-    TCPSSTLOG(this,"rcv",&mBuffer[mBufferPos],bytes_read,error);
+    TCPSSTLOG(this,"rcv",&(*mSlab)[mBufferPos],bytes_read,error);
     mBufferPos+=bytes_read;
+    countRead(error,bytes_read);
     std::tr1::shared_ptr<MultiplexedSocket> thus(mParentSocket.lock());
     
     if (thus) {
@@ -156,15 +227,26 @@ void ASIOReadBuffer::asioReadIntoFixedBuffer(const ErrorCode&error,std::size_t b
             processError(&*thus,error);
         }else {
             translateBuffer(thus);
+            readMore(thus);
         }
     }else {
         delete this;// the socket is deleted
     }
 }
-ASIOReadBuffer::ASIOReadBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,unsigned int whichSocket):mParentSocket(parentSocket){
+ASIOReadBuffer::ASIOReadBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,unsigned int whichSocket):mSlab(ChunkPool::allocateShared(sSlabLength)),mParentSocket(parentSocket),mCapture(PacketCapture::current()){
+    mSlabStart=0;
     mBufferPos=0;
+    mPendingPacketLength=0;
+    mNewChunkPos=0;
     mWhichBuffer=whichSocket;
     readIntoFixedBuffer(parentSocket);
 }
+ASIOReadBuffer::ASIOReadBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,unsigned int whichSocket,const PacketReplay&):mSlab(ChunkPool::allocateShared(sSlabLength)),mParentSocket(parentSocket){
+    mSlabStart=0;
+    mBufferPos=0;
+    mPendingPacketLength=0;
+    mNewChunkPos=0;
+    mWhichBuffer=whichSocket;
+}
 
 } }
@@ -31,73 +31,102 @@
  */
 
 namespace Sirikata { namespace Network {
-
+class PacketCapture;
+class PacketReplay;
 class ASIOReadBuffer {
+    friend class PacketReplay;
     enum {
-        ///The point at which the class switches from reading into a fixed buffer to filling a sole preallocated packet with data
+        ///The fewest free bytes at the end of the slab worth reading into before the unprocessed remnant is moved to a fresh slab
         sLowWaterMark=256,
-        ///The length of the fixed buffer
-        sBufferLength=1440        
+        ///The length of each receive slab: packets longer than this are read into a dedicated chunk instead
+        sSlabLength=16384
     };
-    ///A fixed length buffer to read incoming requests when the data is unknown in size or so far small in size
-    uint8 mBuffer[sBufferLength];
-    ///Where is ASIO writing to in mBuffer
+    /**
+     * The refcounted slab ASIO reads into when the size of the data is unknown or small.
+     * Complete packets are handed out as ChunkViews into the slab, so the slab is only reused in place
+     * once no receiver holds on to a view of it; otherwise a fresh slab is allocated.
+     */
+    std::tr1::shared_ptr<Chunk> mSlab;
+    ///Where the bytes in mSlab that have not been handed out yet begin
+    unsigned int mSlabStart;
+    ///Where is ASIO writing to in mSlab
     unsigned int mBufferPos;
+    ///The full length (header included) of the packet starting at mSlabStart if its header has arrived, otherwise 0
+    unsigned int mPendingPacketLength;
     ///Which actual low level tcp socket from the mParentSocket is used for communication
     unsigned int mWhichBuffer;
-    ///A new chunk being read directly into--usually this member is only used to hold a large packet of information, otherwise the fixed length buffer is used
-    Chunk mNewChunk;
+    ///A new chunk being read directly into--only used to hold a packet too large for a slab, and handed out whole once full
+    std::tr1::shared_ptr<Chunk> mNewChunk;
+    ///Where is ASIO writing to in mNewChunk
+    unsigned int mNewChunkPos;
     ///The StreamID of a new, partially examined new chunk
     Stream::StreamID mNewChunkID;
     ///The shared structure responsible for holding state about the associated TCPStream that this class reads and interprets data from
     std::tr1::weak_ptr<MultiplexedSocket> mParentSocket;
+    ///Where every packet received is recorded when the tcpsst.capture option named a file as this buffer was made
+    std::tr1::shared_ptr<PacketCapture> mCapture;
     typedef boost::system::error_code ErrorCode;
     /**
      * This forwards the error message to the MultiplexedSocket so the appropriate action may be taken 
      * (including,possibly, disconnecting and shutting down the socket connections and all associated streams
      */
     void processError(MultiplexedSocket*parentSocket, const ErrorCode &error);
+    ///Adds a completed read to the NetworkMetrics
+    void countRead(const ErrorCode&error,std::size_t bytes_read);
     /**
      * This function passes the contents of a chunk to the multiplexed socket for callback handling
      * \param parentSocket is the MultiplexedSocket responsible for this stream with the relevant callback information
      * \param whichSocket is the current ASIO socket responsible for having read the data. It must equal mWhichBuffer
      * \param sid is the StreamID that sent the data which made it to this socket and got processed. It will help determine which callback to call
-     * \param newChunk is the chunk that was sent from the other side to this side and is ready for client processing (or server processing if sid==Stream::StreamID())
+     * \param newChunk views the chunk that was sent from the other side to this side and is ready for client processing (or server processing if sid==Stream::StreamID())
      */
     void processFullChunk(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,
                           unsigned int whichSocket,
                           const Stream::StreamID& sid,
-                          const Chunk&newChunk);
+                          const ChunkView&newChunk);
+    /**
+     *  Makes room in mSlab for more data at mBufferPos: if the pending packet cannot finish within the slab, the unprocessed
+     *  bytes are moved to the front of the slab (or of a fresh slab if views of the current one are still held)
+     */
+    void prepareFixedBuffer();
     /**
      *  This function is called when either 0 information is known about the data to be read (such as size, etc)
-     *  or if the data is known but the packet is sufficiently small that other packets may be conjoined with it in the buffer
-     *  This function tells asio to read data from the socket into mBuffer at offset mBufferPos upto the end of the buffer
+     *  or if the data is known but the packet is sufficiently small that other packets may be conjoined with it in the slab.
+     *  It calls prepareFixedBuffer and then tells asio to read data from the socket into mSlab at offset mBufferPos upto the end of the slab
      */
     void readIntoFixedBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket);
     /**
-     *  This function is called when a sufficiently large chunk needs to be filled up from a previous readIntoFixedBuffer call.
-     *  This function will tell ASIO to read directly into the mNewChunk class, offset by the mBufferPos upto the value of mNewChunk.size()     
+     *  This function is called when a packet too large for a slab needs to be filled up from a previous readIntoFixedBuffer call.
+     *  This function will tell ASIO to read directly into the mNewChunk class, offset by the mNewChunkPos upto the value of mNewChunk->size()
      */
     void readIntoChunk(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket);
 
     /**
-     * Examines a buffer of bytes and converts it into a partially or totally filled chunk 
-     * and gives back information about unprocessed bytes and the StreamID that sent the chunk
-     * \param dataBuffer is the buffer to be read and turned into an active Chunk
-     * \param packetLength is the length of the to-be-returned Chunk plus the length of that chunk's streamID
-     * \param bufferReceived is the length of the dataBuffer, and the value returned in the bufferReceived is number of useful bytes copied to the returned chunk
-     * \param retval is the newly allocated chunk sized appropriately to hold all data that will ever be copied to it
-     * \returns the StreamID that this chunk was sent from
+     * Starts mNewChunk off with the beginning of a packet too large for a slab
+     * \param dataBuffer points just past the packet length header, at the StreamID
+     * \param packetLength is the length of the chunk plus the length of that chunk's streamID
+     * \param bufferReceived is the number of bytes available at dataBuffer: must cover the StreamID
      */
-    Stream::StreamID processPartialChunk(uint8* dataBuffer, uint32 packetLength, uint32 &bufferReceived, Chunk&retval);
+    void processPartialChunk(const uint8* dataBuffer, uint32 packetLength, uint32 bufferReceived);
 
     /**
-     * Examines the class variable mBuffer from the beginning to mBufferPos and translates all packets contained within to chunks and calls the appropriate callback
-     * If the information in the last unprocessed chunk is less than sLowWaterMark that excess information is moved to the front of the buffer and readIntoFixedBuffer is called
-     * If the information in the last unprocessed chunk is greater than the sLowWaterMark 
-     * then a new chunk is made specifically for the remaining data using the processPartialChunk function and readIntoChunk is called
+     * Examines mSlab from mSlabStart to mBufferPos, hands every complete packet within to the appropriate callback as a view
+     * into the slab, FrameScanner::MAX_FRAMES found by FrameScanner at a time, and records the length of the trailing partial packet, if any.
+     * If the trailing packet could never fit in a slab a new chunk is made specifically for it with processPartialChunk,
+     * so the rest of it must be read into mNewChunk next
      */
     void translateBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &thus);
+    ///Hands mNewChunk to the appropriate callback and goes back to reading into the slab if all of it has arrived
+    void finishNewChunk(const std::tr1::shared_ptr<MultiplexedSocket> &thus);
+    ///Asks asio for more data: into mNewChunk with readIntoChunk if a packet too large for a slab is arriving, otherwise with readIntoFixedBuffer
+    void readMore(const std::tr1::shared_ptr<MultiplexedSocket> &thus);
+    /**
+     * Processes length bytes from data exactly as if asio had read them from the socket, filling the slab (or mNewChunk) as
+     * far as it will go before each translation, without asking asio for more. Used by PacketReplay
+     */
+    void replayReceived(const std::tr1::shared_ptr<MultiplexedSocket> &thus,const uint8*data,size_t length);
+    ///Makes a buffer for PacketReplay, which does not read from its socket or capture what it is given
+    ASIOReadBuffer(const std::tr1::shared_ptr<MultiplexedSocket> &parentSocket,unsigned int whichSocket,const PacketReplay&replay);
 
     /**
      * The ASIO callback when ASIO was reading into a singleChunk
@@ -108,9 +137,9 @@ class ASIOReadBuffer {
      */
     void asioReadIntoChunk(const ErrorCode&error,std::size_t bytes_read);
     /**
-     * The ASIO callback when ASIO was reading into the mBuffer from mBufferPos
+     * The ASIO callback when ASIO was reading into the mSlab from mBufferPos
      * The function reacts to errors by calling processErrors or a missing MultiplexedSocket by deleting this
-     * Otherwise the function farms work off to translateBuffer
+     * Otherwise the function farms work off to translateBuffer and then readMore
      */
     void asioReadIntoFixedBuffer(const ErrorCode&error,std::size_t bytes_read);
 public:
@@ -34,9 +34,11 @@
 #include "util/Standard.hh"
 #include "TCPDefinitions.hpp"
 #include "TCPStream.hpp"
+#include "ChunkPool.hpp"
 #include "util/ThreadSafeQueue.hpp"
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
+#include "NetworkMetrics.hpp"
 
 namespace Sirikata { namespace Network {
 
@@ -57,13 +59,48 @@ void copyHeader(void * destination, const UUID&key, unsigned int num) {
                 UUID::static_size);
 }
 
+void ASIOSocketWrapper::beginAsyncSend(std::size_t bytesToSend) {
+    mInFlightBytes=(uint32)bytesToSend;
+    mSendStartTime=Task::AbsTime::now();
+}
+
+void ASIOSocketWrapper::endAsyncSend(std::size_t bytes_sent) {
+    uint32 latency=(uint32)((double)(Task::AbsTime::now()-mSendStartTime)*1000000.);
+    uint32 average=mAverageSendLatency.read();
+    //exponentially weighted so that a socket that recently stalled is remembered for a few sends
+    mAverageSendLatency=average?(average*7+latency)/8:latency;
+    mInFlightBytes=0;
+    mOutstandingBytes-=(uint32)bytes_sent;
+    NetworkMetrics::add(NetworkMetrics::SOCKET_SENDS);
+    NetworkMetrics::add(NetworkMetrics::BYTES_SENT,bytes_sent);
+}
+
+void ASIOSocketWrapper::sendPing(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket,uint32 sequence) {
+    mPingSequence=sequence;
+    mPingSentTime=Task::AbsTime::now();
+    //interactive so that a backlog of bulk packets does not count towards the round trip
+    rawSend(parentMultiSocket,constructControlPacket(TCPStream::TCPStreamPing,Stream::StreamID(sequence)),InteractivePriority);
+}
+
+bool ASIOSocketWrapper::pongReceived(uint32 sequence) {
+    if (mPingSentTime==Task::AbsTime::null()||sequence!=mPingSequence)
+        return false;
+    uint64 sample=(uint64)(Task::AbsTime::now()-mPingSentTime).toMicroseconds();
+    uint64 average=mRoundTripTime.read();
+    //weighted as TCP weights its round trip samples, and never 0 once there has been one
+    average=average?(average*7+sample)/8:sample;
+    mRoundTripTime=(uint32)(average?(average<0xffffffff?average:0xffffffff):1);
+    mPingSentTime=Task::AbsTime::null();
+    return true;
+}
+
 void ASIOSocketWrapper::finishAsyncSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket) {
     //When this function is called, the ASYNCHRONOUS_SEND_FLAG must be set because this particular context is the one finishing up a send
     assert(mSendingStatus.read()&ASYNCHRONOUS_SEND_FLAG);
     //Turn on the information that the queue is being checked and this means that further pushes to the queue may not be heeded if the queue happened to be empty
     mSendingStatus+=QUEUE_CHECK_FLAG;
     std::deque<Chunk*>toSend;
-    mSendQueue.swap(toSend);
+    scheduleSends(toSend);
     std::size_t num_packets=toSend.size();
     if (num_packets==0) {
         //if there are no packets in the queue, some other send() operation will need to take the torch to send further packets
@@ -78,90 +115,120 @@ void ASIOSocketWrapper::finishAsyncSend(const std::tr1::shared_ptr<MultiplexedSo
             sendToWire(parentMultiSocket,toSend);
     }
 }
+void ASIOSocketWrapper::scheduleSends(std::deque<Chunk*>&toSend) {
+    std::deque<QueuedChunk> arrived;
+    mSendQueue.popAll(arrived);
+    for (std::deque<QueuedChunk>::iterator i=arrived.begin(),ie=arrived.end();i!=ie;++i) {
+        mPendingSends[i->mPriority].push(i->mStream,i->mChunk);
+    }
+    size_t scheduledBytes=0;
+    //the number of classes in a row found with nothing to send: once every class has been, the queues are dry
+    unsigned int idleClasses=0;
+    while (idleClasses<NUM_STREAM_PRIORITIES&&toSend.size()<MAX_GATHER_BUFFERS&&scheduledBytes<MAX_GATHER_BYTES) {
+        PendingClass&pending=mPendingSends[mCurrentPriority];
+        if (pending.empty()) {
+            //an idle class may not hoard credit for later
+            mDeficit[mCurrentPriority]=0;
+            ++idleClasses;
+        }else {
+            idleClasses=0;
+            size_t size=pending.front()->size();
+            if (size<=mDeficit[mCurrentPriority]) {
+                mDeficit[mCurrentPriority]-=size;
+                scheduledBytes+=size;
+                toSend.push_back(pending.front());
+                pending.pop();
+                continue;
+            }
+        }
+        //this class has had its turn: credit the next one for its own
+        mCurrentPriority=(mCurrentPriority+1)%NUM_STREAM_PRIORITIES;
+        mDeficit[mCurrentPriority]+=priorityWeight(mCurrentPriority)*PRIORITY_QUANTUM;
+    }
+}
+
+void ASIOSocketWrapper::discardQueued() {
+    size_t discardedBytes=0;
+    std::deque<QueuedChunk> arrived;
+    mSendQueue.popAll(arrived);
+    for (std::deque<QueuedChunk>::iterator i=arrived.begin(),ie=arrived.end();i!=ie;++i) {
+        discardedBytes+=i->mChunk->size();
+        ChunkPool::release(i->mChunk);
+    }
+    for (unsigned int priority=0;priority<NUM_STREAM_PRIORITIES;++priority) {
+        PendingClass&pending=mPendingSends[priority];
+        while (!pending.empty()) {
+            discardedBytes+=pending.front()->size();
+            ChunkPool::release(pending.front());
+            pending.pop();
+        }
+    }
+    mOutstandingBytes-=(uint32)discardedBytes;
+}
+
 void ASIOSocketWrapper::sendLargeChunkItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent) {
     TCPSSTLOG(this,"snd",&*toSend->begin()+originalOffset,bytes_sent,error);
+    endAsyncSend(bytes_sent);
     if (error)  {
+        //the send flag stays with this context so nothing more is written: what was to be is retired now, and anything queued later when the socket closes
+        mOutstandingBytes-=(uint32)(toSend->size()-originalOffset-bytes_sent);
+        ChunkPool::release(toSend);
+        discardQueued();
         triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
         SILOG(tcpsst,debug,"Socket disconnected...waiting for recv to trigger error condition\n");
     }else if (bytes_sent+originalOffset!=toSend->size()) {
         sendToWire(parentMultiSocket,toSend,originalOffset+bytes_sent);
     }else {
-        delete toSend;
+        ChunkPool::release(toSend);
+        NetworkMetrics::add(NetworkMetrics::PACKETS_SENT);
         finishAsyncSend(parentMultiSocket);
     }
 }
 
-void ASIOSocketWrapper::sendLargeDequeItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*> &const_toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent) {
+void ASIOSocketWrapper::sendGatheredDeque(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*> &const_toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent) {
     TCPSSTLOG(this,"snd",&*const_toSend.front()->begin()+originalOffset,bytes_sent,error);
+    endAsyncSend(bytes_sent);
     if (error )   {
+        size_t unsentBytes=0;
+        for (std::deque<Chunk*>::const_iterator i=const_toSend.begin(),ie=const_toSend.end();i!=ie;++i) {
+            unsentBytes+=(*i)->size();
+            ChunkPool::release(*i);
+        }
+        mOutstandingBytes-=(uint32)(unsentBytes-originalOffset-bytes_sent);
+        discardQueued();
         triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
         SILOG(tcpsst,debug,"Socket disconnected...waiting for recv to trigger error condition\n");
-    } else if (bytes_sent+originalOffset!=const_toSend.front()->size()) {
-        sendToWire(parentMultiSocket,const_toSend,originalOffset+bytes_sent);
-    }else if (const_toSend.size()<2) {
-        //the entire packet got sent and there's no more items left: delete the front item
-        delete const_toSend.front();
-        //and send further items on the global queue if they are there
-        finishAsyncSend(parentMultiSocket);
-    }else {
+    } else {
         std::deque<Chunk*> toSend=const_toSend;
-        //the first item got sent out
-        delete toSend.front();
-        toSend.pop_front();
-        if (toSend.size()==1) {
+        size_t sentOffset=originalOffset+bytes_sent;
+        //retire every chunk that made it out to the network in its entirety
+        size_t retired=0;
+        while (!toSend.empty()&&sentOffset>=toSend.front()->size()) {
+            sentOffset-=toSend.front()->size();
+            ChunkPool::release(toSend.front());
+            toSend.pop_front();
+            ++retired;
+        }
+        if (retired) {
+            NetworkMetrics::add(NetworkMetrics::PACKETS_SENT,retired);
+        }
+        if (toSend.empty()) {
+            //and send further items on the global queue if they are there
+            finishAsyncSend(parentMultiSocket);
+        }else if (toSend.size()==1) {
             //if there's just one item left, it may be sent by itself
-            sendToWire(parentMultiSocket,toSend.front());
+            sendToWire(parentMultiSocket,toSend.front(),sentOffset);
         }else {
-            //otherwise send the whole queue
-            sendToWire(parentMultiSocket,toSend);
+            //otherwise gather the rest of the queue, starting partway through the front chunk
+            sendToWire(parentMultiSocket,toSend,sentOffset);
         }
     }
 }
 #define ASIOSocketWrapperBuffer(pointer,size) boost::asio::buffer(pointer,(size))
-void ASIOSocketWrapper::sendStaticBuffer(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&toSend, uint8* currentBuffer, size_t bufferSize, size_t lastChunkOffset,  const ErrorCode &error, std::size_t bytes_sent) {
-    TCPSSTLOG(this,"snd",current_buffer,bytes_sent,error);
-    if (!error) {
-        //mPacketLogger.insert(mPacketLogger.end(),currentBuffer,currentBuffer+bytes_sent);
-    }
-    if ( error ) {
-        triggerMultiplexedConnectionError(&*parentMultiSocket,this,error);
-        SILOG(tcpsst,debug,"Socket disconnected...waiting for recv to trigger error condition\n");
-    }else if (bytes_sent!=bufferSize) {
-		 
-		 
-        //if the previous send was not able to push the whole buffer out to the network, the rest must be sent
-        mSocket->async_send(ASIOSocketWrapperBuffer(currentBuffer+bytes_sent,bufferSize-bytes_sent),
-                            std::tr1::bind(&ASIOSocketWrapper::sendStaticBuffer,
-                                        this,
-                                        parentMultiSocket,
-                                        toSend,
-                                        currentBuffer+bytes_sent,
-                                        bufferSize-bytes_sent,
-                                        lastChunkOffset,
-                                          _1,
-                                          _2));        
-    }else {
-        if (!toSend.empty()) {
-            //if stray items are left in a deque
-            if (toSend.size()==1) {
-                //if there's one item send that
-                sendToWire(parentMultiSocket,toSend.front(),lastChunkOffset);
-            }else {
-                //otherwise send the whole lot
-                sendToWire(parentMultiSocket,toSend,lastChunkOffset);
-            }
-        }else {
-            //no items to send, check the new queue for any more and send those, otherwise sleep
-            finishAsyncSend(parentMultiSocket);
-        }
-    }
-}
-    
 
 void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t bytesSent) {
     //sending a single chunk is a straightforward call directly to asio
-     
-     
+    beginAsyncSend(toSend->size()-bytesSent);
     mSocket->async_send(ASIOSocketWrapperBuffer(&*toSend->begin()+bytesSent,toSend->size()-bytesSent),
                         std::tr1::bind(&ASIOSocketWrapper::sendLargeChunkItem,
                                     this,
@@ -173,52 +240,50 @@ void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>
 }
 
 void ASIOSocketWrapper::sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&const_toSend, size_t bytesSent){
-     
-     
-    if (const_toSend.front()->size()-bytesSent>PACKET_BUFFER_SIZE||const_toSend.size()==1) {
-        //if there's but a single packet, or a single big packet that is bigger than the mBuffer's size...send that one by itself 
-        mSocket->async_send(ASIOSocketWrapperBuffer(&*const_toSend.front()->begin()+bytesSent,const_toSend.front()->size()-bytesSent),
-                            std::tr1::bind(&ASIOSocketWrapper::sendLargeDequeItem,
-                                        this,
-                                        parentMultiSocket,
-                                        const_toSend,
-                                        bytesSent,
-                                          _1,
-                                          _2));
-    }else if (const_toSend.front()->size()){
-        //otherwise copy the packets onto the mBuffer and send from the fixed sized buffer
-        std::deque<Chunk*> toSend=const_toSend;
-        size_t bufferLocation=toSend.front()->size()-bytesSent;
-        std::memcpy(mBuffer,&*toSend.front()->begin()+bytesSent,toSend.front()->size()-bytesSent);
-        delete toSend.front();
-        toSend.pop_front();
-        bytesSent=0;
-        while (bufferLocation<PACKET_BUFFER_SIZE&&toSend.size()) {            
-            if (toSend.front()->size()>PACKET_BUFFER_SIZE-bufferLocation) {
-                //if the first packet is too large for the buffer, copy part of it but keep it around
-                bytesSent=PACKET_BUFFER_SIZE-bufferLocation;
-                std::memcpy(mBuffer+bufferLocation,&*toSend.front()->begin(),bytesSent);
-                bufferLocation=PACKET_BUFFER_SIZE;
+    std::vector<boost::asio::const_buffer> gather;
+    gather.reserve(const_toSend.size()<MAX_GATHER_BUFFERS?const_toSend.size():MAX_GATHER_BUFFERS);
+    size_t gatheredBytes=0;
+    size_t coalescedBytes=0;
+    bool lastCoalesced=false;
+    for (std::deque<Chunk*>::const_iterator i=const_toSend.begin(),ie=const_toSend.end();
+         i!=ie&&gather.size()<MAX_GATHER_BUFFERS&&gatheredBytes<MAX_GATHER_BYTES;
+         ++i) {
+        //only the front chunk may have been partially sent already
+        size_t offset=(i==const_toSend.begin())?bytesSent:0;
+        size_t size=(*i)->size()-offset;
+        if (size==0) {
+            continue;
+        }
+        if (size<COALESCE_THRESHOLD) {
+            if (coalescedBytes+size>COALESCE_BUFFER_SIZE) {
+                //the scratch space is full: the rest waits for the next send rather than costing a buffer apiece
+                break;
+            }
+            std::memcpy(mCoalesceBuffer+coalescedBytes,&*(*i)->begin()+offset,size);
+            if (lastCoalesced) {
+                //extend the scratch buffer already in the sequence rather than adding another
+                size_t runStart=coalescedBytes-boost::asio::buffer_size(gather.back());
+                gather.back()=ASIOSocketWrapperBuffer(mCoalesceBuffer+runStart,coalescedBytes+size-runStart);
             }else {
-                //if the entire packets fits in the buffer, copy it there and delete the packet
-                std::memcpy(mBuffer+bufferLocation,&*toSend.front()->begin(),toSend.front()->size());
-                bufferLocation+=toSend.front()->size();
-                delete toSend.front();
-                toSend.pop_front();
+                gather.push_back(ASIOSocketWrapperBuffer(mCoalesceBuffer+coalescedBytes,size));
             }
+            coalescedBytes+=size;
+            lastCoalesced=true;
+        }else {
+            gather.push_back(ASIOSocketWrapperBuffer(&*(*i)->begin()+offset,size));
+            lastCoalesced=false;
         }
-        //send the buffer filled with possibly many packets
-        mSocket->async_send(ASIOSocketWrapperBuffer(mBuffer,bufferLocation),
-                            std::tr1::bind(&ASIOSocketWrapper::sendStaticBuffer,
-                                          this,
-                                          parentMultiSocket,
-                                          toSend,
-                                          mBuffer,
-                                          bufferLocation,
-                                          bytesSent,
-                                          _1,
-                                          _2));
+        gatheredBytes+=size;
     }
+    beginAsyncSend(gatheredBytes);
+    mSocket->async_send(gather,
+                        std::tr1::bind(&ASIOSocketWrapper::sendGatheredDeque,
+                                       this,
+                                       parentMultiSocket,
+                                       const_toSend,
+                                       bytesSent,
+                                       _1,
+                                       _2));
 }
 #undef ASIOSocketWrapperBuffer
 void ASIOSocketWrapper::retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, uint32 current_status) {
@@ -234,8 +299,8 @@ void ASIOSocketWrapper::retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSo
                 //then this thread should take the torch, check the queue and if not empty be willing to send
                 mSendingStatus+=(QUEUE_CHECK_FLAG+ASYNCHRONOUS_SEND_FLAG-1);
                 std::deque<Chunk*>toSend;
-                mSendQueue.swap(toSend);
-                if (toSend.empty()) {//the chunk that we put on the queue must have been sent by someone else
+                scheduleSends(toSend);
+                if (toSend.empty()) {//the chunk that we put on the queue must have been sent by someone else (or sits behind a push still in progress, whose thread will come around to send it)
                     //nothing to send, let another thread take up the torch if something was placed there by it
                     mSendingStatus-=(QUEUE_CHECK_FLAG+ASYNCHRONOUS_SEND_FLAG);
                     return;
@@ -266,6 +331,8 @@ void ASIOSocketWrapper::retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSo
 }
 
 void ASIOSocketWrapper::shutdownAndClose() {
+    //nothing is in flight once the connection is being torn down, since every send holds a reference to it
+    discardQueued();
     try {
         mSocket->shutdown(boost::asio::ip::tcp::socket::shutdown_both);
     }catch (boost::system::system_error&err) {
@@ -288,15 +355,18 @@ void ASIOSocketWrapper::destroySocket() {
 }
 
 
-void ASIOSocketWrapper::rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk) {
+void ASIOSocketWrapper::rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk, StreamPriority priority, const Stream::StreamID&stream) {
     TCPSSTLOG(this,"raw",&*chunk->begin(),chunk->size(),false);
+    mOutstandingBytes+=(uint32)chunk->size();
+    NetworkMetrics::add(NetworkMetrics::PACKETS_QUEUED);
+    NetworkMetrics::add(NetworkMetrics::BYTES_QUEUED,chunk->size());
     uint32 current_status=++mSendingStatus;
     if (current_status==1) {//we are teh chosen thread
         mSendingStatus+=(ASYNCHRONOUS_SEND_FLAG-1);//committed to be the sender thread
         sendToWire(parentMultiSocket, chunk);
     }else {//if someone else is possibly sending a packet
         //push the packet on the queue
-        mSendQueue.push(chunk);
+        mSendQueue.push(QueuedChunk(chunk,priority,stream));
         current_status=--mSendingStatus;
         //the packet is out of our hands now...
         //but the other thread could just have been finishing up and we have missed the send
@@ -322,13 +392,13 @@ Chunk*ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamControlCodes
         unsigned int retval=streamSize.serialize(dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength,Stream::uint30::MAX_SERIALIZED_LENGTH);
         assert(retval==actualHeaderLength);
     }
-    return new Chunk(dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength,dataStream+size+cur);
+    return ChunkPool::allocate(dataStream+Stream::uint30::MAX_SERIALIZED_LENGTH-actualHeaderLength,dataStream+size+cur);
 }
 
 void ASIOSocketWrapper::sendProtocolHeader(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const UUID&value, unsigned int numConnections) {
     UUID return_value=UUID::random();
     
-    Chunk *headerData=new Chunk(TCPStream::TcpSstHeaderSize);
+    Chunk *headerData=ChunkPool::allocate(TCPStream::TcpSstHeaderSize);
     copyHeader(&*headerData->begin(),value,numConnections);
     rawSend(parentMultiSocket,headerData);
 }
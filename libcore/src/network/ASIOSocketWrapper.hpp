@@ -30,6 +30,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "util/UUID.hpp"
+#include "task/Time.hpp"
+#include "util/MPSCRingQueue.hpp"
 
 namespace Sirikata { namespace Network {
 class ASIOSocketWrapper;
@@ -45,18 +47,109 @@ class ASIOSocketWrapper {
      * unless a thread takes up the torch and does it
      */
     AtomicValue<uint32> mSendingStatus;
+    ///A packet waiting in mSendQueue along with the class of traffic it is to be scheduled in and the stream it queues behind
+    class QueuedChunk {
+    public:
+        Chunk*mChunk;
+        StreamPriority mPriority;
+        Stream::StreamID mStream;
+        QueuedChunk():mChunk(NULL),mPriority(NormalPriority){}
+        QueuedChunk(Chunk*chunk,StreamPriority priority,const Stream::StreamID&stream):mChunk(chunk),mPriority(priority),mStream(stream){}
+    };
     /**
-     * The queue of packets to send while an active async_send is doing its job
+     * The packets of one priority class waiting to be scheduled, in a FIFO per stream. The streams with packets waiting take turns
+     * a packet at a time, so the frames of one long message cannot hold up a packet another stream queues after them
      */
-    ThreadSafeQueue<Chunk*>mSendQueue;
+    class PendingClass {
+        typedef std::map<Stream::StreamID,std::deque<Chunk*> > StreamQueues;
+        StreamQueues mStreams;
+        ///The streams with packets waiting, the one whose turn it is first
+        std::deque<StreamQueues::iterator> mTurns;
+    public:
+        bool empty()const {
+            return mTurns.empty();
+        }
+        void push(const Stream::StreamID&stream,Chunk*chunk) {
+            StreamQueues::iterator where=mStreams.insert(StreamQueues::value_type(stream,std::deque<Chunk*>())).first;
+            if (where->second.empty()) {
+                mTurns.push_back(where);
+            }
+            where->second.push_back(chunk);
+        }
+        ///The packet of the stream whose turn it is
+        Chunk*front()const {
+            return mTurns.front()->second.front();
+        }
+        ///Takes the front packet off and passes the turn on to the next stream
+        void pop() {
+            StreamQueues::iterator where=mTurns.front();
+            mTurns.pop_front();
+            where->second.pop_front();
+            if (where->second.empty()) {
+                mStreams.erase(where);
+            }else {
+                mTurns.push_back(where);
+            }
+        }
+    };
+    /**
+     * The queue of packets to send while an active async_send is doing its job.
+     * Any thread may push, but only the context holding the ASYNCHRONOUS_SEND_FLAG pops, so a lock-free ring serves
+     */
+    MPSCRingQueue<QueuedChunk>mSendQueue;
+    ///Packets taken off mSendQueue but not yet scheduled, by priority class: only touched by the context holding the ASYNCHRONOUS_SEND_FLAG
+    PendingClass mPendingSends[NUM_STREAM_PRIORITIES];
+    ///The bytes each priority class may still send in the current round of deficit round robin
+    size_t mDeficit[NUM_STREAM_PRIORITIES];
+    ///The priority class deficit round robin is currently serving
+    unsigned int mCurrentPriority;
+    ///The number of bytes handed to rawSend that asio has not yet reported as written (includes mInFlightBytes)
+    AtomicValue<uint32> mOutstandingBytes;
+    ///The number of bytes in the async_send currently posted to asio, or 0 if the socket is idle
+    AtomicValue<uint32> mInFlightBytes;
+    ///Smoothed number of microseconds an async_send takes to complete: only written by the context holding the ASYNCHRONOUS_SEND_FLAG
+    AtomicValue<uint32> mAverageSendLatency;
+    ///The time at which the currently in flight async_send was handed to asio
+    Task::AbsTime mSendStartTime;
+    ///Smoothed number of microseconds a keepalive ping on this socket takes to be answered: 0 until one has been
+    AtomicValue<uint32> mRoundTripTime;
+    ///The sequence number of the ping awaiting its answer: only touched by the IO reactor thread
+    uint32 mPingSequence;
+    ///When the ping awaiting its answer was sent, or null if none is: only touched by the IO reactor thread
+    Task::AbsTime mPingSentTime;
 	enum {
 		ASYNCHRONOUS_SEND_FLAG=(1<<29),
 		QUEUE_CHECK_FLAG=(1<<30),
-		PACKET_BUFFER_SIZE=1400
+        ///The most Chunks that will be handed to a single gathered async_send (well under IOV_MAX)
+        MAX_GATHER_BUFFERS=64,
+        ///Once this many bytes are in a gathered async_send no further Chunks will be added to it
+        MAX_GATHER_BYTES=65536,
+        ///Chunks smaller than this are copied into mCoalesceBuffer rather than given their own buffer since the kernel pays per buffer
+        COALESCE_THRESHOLD=512,
+        ///The size of the scratch space runs of tiny Chunks are copied into
+        COALESCE_BUFFER_SIZE=4096,
+        ///The number of Chunks mSendQueue holds before pushes fall back to its locked overflow
+        SEND_QUEUE_CAPACITY=1024,
+        ///The bytes a priority class is credited per round of deficit round robin for each unit of its weight
+        PRIORITY_QUANTUM=1024
 	};
-    uint8 mBuffer[PACKET_BUFFER_SIZE];
+    ///The number of PRIORITY_QUANTUMs a priority class is credited each round: each class gets 4 times the share of the one below it
+    static size_t priorityWeight(unsigned int priority) {
+        return (size_t)1<<(2*priority);
+    }
+    ///Scratch space holding copies of runs of tiny Chunks for the gathered async_send in flight (only one is ever in flight)
+    uint8 mCoalesceBuffer[COALESCE_BUFFER_SIZE];
 
     typedef boost::system::error_code ErrorCode;
+    /**
+     * Records that an async_send of bytesToSend bytes is about to be posted so that load queries can tell queued from in flight data
+     */
+    void beginAsyncSend(std::size_t bytesToSend);
+    /**
+     * Records the completion of the in flight async_send, retiring bytes_sent from the outstanding count and folding the time it took
+     * into mAverageSendLatency
+     */
+    void endAsyncSend(std::size_t bytes_sent);
     /**
      * This function sets the QUEUE_CHECK_FLAG and checks the sendQueue for additional packets to send out.
      * If nothing is in the queue then it unsets the ASYNCHRONOUS_SEND_FLAG and QUEUE_CHECK_FLAGS
@@ -64,6 +157,22 @@ class ASIOSocketWrapper {
      */
     void finishAsyncSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket);
 
+    /**
+     * Moves everything on mSendQueue to its priority class then picks the packets for the next async_send by deficit round robin:
+     * each class in turn is credited priorityWeight*PRIORITY_QUANTUM bytes and sends packets, taking a packet from each of its streams in turn, while its credit covers them,
+     * carrying unused credit over to its next turn unless it runs dry. Stops once the batch is as large as a single gathered send may be,
+     * resuming with the same class next time, so a backlog of bulk packets delays a newly queued interactive packet by at most one batch.
+     * Leaves toSend empty only if no packets are waiting at all
+     */
+    void scheduleSends(std::deque<Chunk*>&toSend);
+
+    /**
+     * Releases every packet waiting in mSendQueue and mPendingSends, so that the send windows of their streams are credited
+     * for data that will never be written. Only called by the context holding the ASYNCHRONOUS_SEND_FLAG once a send failed,
+     * or when the socket is closed and nothing else may send on it
+     */
+    void discardQueued();
+
     /**
      * The callback for when a single Chunk was sent.
      * If the whole Chunk was not sent then the rest of the Chunk is passed back to sendToWire
@@ -72,20 +181,12 @@ class ASIOSocketWrapper {
     void sendLargeChunkItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent);
 
     /**
-     * The callback for when a single large Chunk at the front of a chunk deque was sent.
-     * If the whole large Chunk was not sent then the rest of the Chunk is passed back to sendToWire
-     * If the whole Chunk was shipped off, the sendToWire function is called with the rest of the queue unless it is empty in which case the finishAsyncSend is called
-     */
-    void sendLargeDequeItem(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*> &const_toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent);
-
-    /**
-     * The callback for when a static buffer was shipped to the network.
-     * If the whole static buffer was not sent then the rest of the static buffer is passed back to async_send and the currentBuffer is offset by the necessary ammt to finish off
-     * sending it. This could be slightly inefficient if there are tons of other packets in the deque toSend but generally the buffer size should be chosen so that it can be sent
-     * in one go.
-     * If the whole buffer was shipped off, the sendToWire function is called with the rest of the queue unless it is empty
+     * The callback for when a gathered send of the front of a chunk deque completed.
+     * Every Chunk that was completely written is deleted and popped off the deque.
+     * If anything remains it is passed back to sendToWire with the offset into the partially sent front Chunk
+     * otherwise finishAsyncSend is called to check the global queue for further packets
      */
-    void sendStaticBuffer(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&toSend, uint8* currentBuffer, size_t bufferSize, size_t lastChunkOffset,  const ErrorCode &error, std::size_t bytes_sent);
+    void sendGatheredDeque(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*> &const_toSend, size_t originalOffset, const ErrorCode &error, std::size_t bytes_sent);
 
 /**
  * When there's a single packet to be sent to the network, mSocket->async_send is simply called upon the Chunk to be sent
@@ -93,11 +194,13 @@ class ASIOSocketWrapper {
     void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk *toSend, size_t bytesSent=0);
 
 /**
- *  This function sends a while queue of packets to the network
- * The function first checks to see if the front packet is too large to fit in the packet-sized buffer.
- * If it's too large it sends the packet individually much like a chunk would be sent individually and it is left on the queue for data storage purposes
- * If the packet is not too large it and all subsequent packets that can fit are jammed into the packet sized mBuffer
- *  and then those packets are deleted from the queue and shipped to the network partial packets are left on the queue in that case
+ *  This function sends a whole queue of packets to the network
+ * Rather than copying packets into an intermediate buffer, asio is handed a buffer sequence pointing directly at the queued Chunks
+ * (the remainder of the front Chunk followed by as many whole Chunks as fit under MAX_GATHER_BUFFERS and MAX_GATHER_BYTES)
+ * so a burst of small packets leaves in a single system call and a large front Chunk still carries the small packets behind it.
+ * Consecutive Chunks under COALESCE_THRESHOLD are copied into mCoalesceBuffer and sent as one buffer, since a buffer per 64 byte
+ * packet costs the kernel more than the copy does; the gather stops once that scratch space is full.
+ * The Chunks stay on the queue until sendGatheredDeque learns how much of them was written
  */
     void sendToWire(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, const std::deque<Chunk*>&const_toSend, size_t bytesSent=0);
 
@@ -112,14 +215,23 @@ class ASIOSocketWrapper {
  */
     void retryQueuedSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, uint32 current_status);
 
+    ///Withdraws the credit of every priority class, as at the start of the first round
+    void clearDeficits() {
+        for (unsigned int i=0;i<NUM_STREAM_PRIORITIES;++i) {
+            mDeficit[i]=0;
+        }
+    }
+
 public:
 
-    ASIOSocketWrapper(TCPSocket* socket) :mSocket(socket),mSendingStatus(0){
+    ASIOSocketWrapper(TCPSocket* socket) :mSocket(socket),mSendingStatus(0),mSendQueue(SEND_QUEUE_CAPACITY),mCurrentPriority(0),mOutstandingBytes(0),mInFlightBytes(0),mAverageSendLatency(0),mSendStartTime(Task::AbsTime::null()),mRoundTripTime(0),mPingSequence(0),mPingSentTime(Task::AbsTime::null()){
         //mPacketLogger.reserve(268435456);
+        clearDeficits();
     }
 
-    ASIOSocketWrapper(const ASIOSocketWrapper& socket) :mSocket(socket.mSocket),mSendingStatus(0){
+    ASIOSocketWrapper(const ASIOSocketWrapper& socket) :mSocket(socket.mSocket),mSendingStatus(0),mSendQueue(SEND_QUEUE_CAPACITY),mCurrentPriority(0),mOutstandingBytes(0),mInFlightBytes(0),mAverageSendLatency(0),mSendStartTime(Task::AbsTime::null()),mRoundTripTime(0),mPingSequence(0),mPingSentTime(Task::AbsTime::null()){
         //mPacketLogger.reserve(268435456);
+        clearDeficits();
     }
 
     ASIOSocketWrapper&operator=(const ASIOSocketWrapper& socket){
@@ -127,14 +239,37 @@ public:
         return *this;
     }
 
-    ASIOSocketWrapper() :mSocket(NULL),mSendingStatus(0){
+    ASIOSocketWrapper() :mSocket(NULL),mSendingStatus(0),mSendQueue(SEND_QUEUE_CAPACITY),mCurrentPriority(0),mOutstandingBytes(0),mInFlightBytes(0),mAverageSendLatency(0),mSendStartTime(Task::AbsTime::null()),mRoundTripTime(0),mPingSequence(0),mPingSentTime(Task::AbsTime::null()){
+        clearDeficits();
     }
 
     TCPSocket&getSocket() {return *mSocket;}
 
     const TCPSocket&getSocket()const {return *mSocket;}
 
-    ///close this socket by disallowing sends, then closing
+    ///The number of bytes sitting in the send queue that have not yet been handed to asio
+    uint32 getQueuedBytes()const {
+        uint32 outstanding=mOutstandingBytes.read();
+        uint32 inFlight=mInFlightBytes.read();
+        return outstanding>inFlight?outstanding-inFlight:0;
+    }
+    ///The number of bytes asio is currently in the process of writing to the socket
+    uint32 getInFlightBytes()const {return mInFlightBytes.read();}
+    ///Smoothed number of microseconds recent async_sends have taken to complete
+    uint32 getAverageSendLatency()const {return mAverageSendLatency.read();}
+    ///Smoothed number of microseconds keepalive pings on this socket have taken to be answered: 0 until one has been
+    uint32 getRoundTripTime()const {return mRoundTripTime.read();}
+    ///When the ping awaiting its answer was sent, or null if none is
+    const Task::AbsTime&getPingSentTime()const {return mPingSentTime;}
+    ///Sends a keepalive ping ahead of normal traffic, for the other end to answer with a pong carrying the same sequence number
+    void sendPing(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket,uint32 sequence);
+    /**
+     * Folds the time since the ping awaiting its answer was sent into the round trip time if sequence is that ping's.
+     * Returns whether it was
+     */
+    bool pongReceived(uint32 sequence);
+
+    ///close this socket by disallowing sends, then closing, releasing the packets still queued on it
     void shutdownAndClose();
 
     ///Creates a lowlevel TCPSocket using the following io service
@@ -145,8 +280,10 @@ public:
     /**
      * Sends the exact bytes contained within the typedeffed vector
      * \param chunk is the exact bytes to put on the network (including streamID and framing data)
+     * \param priority is the class of traffic the chunk waits in should the socket be busy
+     * \param stream is the stream whose packets the chunk waits behind, taking turns with the other streams of its class
      */
-    void rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk);
+    void rawSend(const std::tr1::shared_ptr<MultiplexedSocket>&parentMultiSocket, Chunk * chunk, StreamPriority priority=NormalPriority, const Stream::StreamID&stream=Stream::StreamID());
 
     static Chunk*constructControlPacket(TCPStream::TCPStreamControlCodes code,const Stream::StreamID&sid);
     /**
@@ -37,6 +37,12 @@
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
 #include "TCPSetCallbacks.hpp"
+#include "StreamCompression.hpp"
+#include "IOServicePool.hpp"
+#include <boost/thread.hpp>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 namespace Sirikata { namespace Network { namespace ASIOStreamBuilder{
 
 class IncompleteStreamState {
@@ -49,11 +55,102 @@ namespace {
 typedef std::map<UUID,IncompleteStreamState> IncompleteStreamMap;
 std::deque<UUID> sStaleUUIDs;
 IncompleteStreamMap sIncompleteStreams;
+///Guards sStaleUUIDs and sIncompleteStreams since listeners on different IOServices may be matching up sockets at once
+boost::mutex sIncompleteStreamsMutex;
+
+/**
+ * Moves a socket with no operations pending onto io by handing its native handle over to a new socket there.
+ * Returns NULL if it cannot be moved, leaving socket where it was, or closed if the handle could not be given back to it
+ */
+TCPSocket*moveSocket(TCPSocket*socket,IOService*io) {
+#if BOOST_VERSION>=106600
+    boost::system::error_code error;
+    boost::asio::ip::tcp::endpoint local=socket->local_endpoint(error);
+    if (error)
+        return NULL;
+    TCPSocket::native_handle_type handle=socket->release(error);
+    if (error)
+        return NULL;
+    TCPSocket*moved=new TCPSocket(*io);
+    moved->assign(local.protocol(),handle,error);
+    if (error) {
+        SILOG(tcpsst,error,"Could not move accepted socket to another IOService: "<<error.message());
+        delete moved;
+        socket->assign(local.protocol(),handle,error);
+        if (error) {
+#ifdef _WIN32
+            closesocket(handle);
+#else
+            ::close(handle);
+#endif
+        }
+        return NULL;
+    }
+    delete socket;
+    return moved;
+#else
+    return NULL;
+#endif
+}
+enum MoveResult {
+    MOVED,
+    STAYED,
+    BROKEN
+};
+/**
+ * Moves all of a connection's sockets onto io so that one thread services the whole connection.
+ * Returns STAYED, leaving the sockets where they were, if any of them could not be moved,
+ * or BROKEN if a socket was closed or left on to, so that the connection cannot be built
+ */
+MoveResult moveSockets(std::vector<TCPSocket*>&sockets,IOService*from,IOService*to) {
+    for (size_t i=0;i<sockets.size();++i) {
+        TCPSocket*moved=moveSocket(sockets[i],to);
+        if (moved==NULL) {
+            bool intact=sockets[i]->is_open();
+            //put back the ones already moved so the connection still shares a single IOService
+            while (i--) {
+                TCPSocket*back=moveSocket(sockets[i],from);
+                if (back)
+                    sockets[i]=back;
+                else
+                    intact=false;
+            }
+            return intact?STAYED:BROKEN;
+        }
+        sockets[i]=moved;
+    }
+    return MOVED;
+}
+}
+///Creates the MultiplexedSocket for a connection whose sockets have all arrived and offers its first stream to the substream callback
+void finishStream(IOService*ioService,
+                  const UUID&context,
+                  const std::vector<TCPSocket*>&sockets,
+                  const Stream::SubstreamCallback&callback) {
+    std::tr1::shared_ptr<MultiplexedSocket> shared_socket(
+        MultiplexedSocket::construct<MultiplexedSocket>(ioService,context,sockets,callback));
+    MultiplexedSocket::sendAllProtocolHeaders(shared_socket,UUID::random());
+    MultiplexedSocket::offerFragmentation(shared_socket);
+    if (StreamCompressor::offerCompression()) {
+        MultiplexedSocket::offerCompression(shared_socket);
+    }
+    MultiplexedSocket::startKeepalive(shared_socket);
+    Stream::StreamID newID=Stream::StreamID(1);
+    NetworkMetrics::add(NetworkMetrics::STREAMS_OPENED);
+    TCPStream * strm=new TCPStream(shared_socket,newID);
+
+    TCPSetCallbacks setCallbackFunctor(&*shared_socket,strm);
+    callback(strm,setCallbackFunctor);
+    if (setCallbackFunctor.mCallbacks==NULL) {
+        SILOG(tcpsst,error,"Client code for stream "<<newID.read()<<" did not set listener on socket");
+        shared_socket->closeStream(shared_socket,newID);
+    }
 }
 ///gets called when a complete 24 byte header is actually received: uses the UUID within to match up appropriate sockets
 void buildStream(Array<uint8,TCPStream::TcpSstHeaderSize> *buffer,
                  TCPSocket *socket,
                  IOService *ioService,
+                 IOServicePool *pool,
                  Stream::SubstreamCallback callback,
                  const boost::system::error_code &error,
                  std::size_t bytes_transferred) {
@@ -61,6 +158,7 @@ void buildStream(Array<uint8,TCPStream::TcpSstHeaderSize> *buffer,
         SILOG(tcpsst,warning,"Connection received with incomprehensible header");
     }else {
         UUID context=UUID(buffer->begin()+(TCPStream::TcpSstHeaderSize-16),16);
+        boost::unique_lock<boost::mutex> incompleteStreamsLock(sIncompleteStreamsMutex);
         IncompleteStreamMap::iterator where=sIncompleteStreams.find(context);
         unsigned int numConnections=(((*buffer)[TCPStream::STRING_PREFIX_LENGTH]-'0')%10)*10+(((*buffer)[TCPStream::STRING_PREFIX_LENGTH+1]-'0')%10);
         if (numConnections>99) numConnections=99;//FIXME: some option in options
@@ -75,18 +173,22 @@ void buildStream(Array<uint8,TCPStream::TcpSstHeaderSize> *buffer,
         }else {
             where->second.mSockets.push_back(socket);
             if (numConnections==(unsigned int)where->second.mSockets.size()) {
-                std::tr1::shared_ptr<MultiplexedSocket> shared_socket(
-                    MultiplexedSocket::construct<MultiplexedSocket>(ioService,context,where->second.mSockets,callback));
-                MultiplexedSocket::sendAllProtocolHeaders(shared_socket,UUID::random());
+                std::vector<TCPSocket*> sockets;
+                sockets.swap(where->second.mSockets);
                 sIncompleteStreams.erase(where);
-                Stream::StreamID newID=Stream::StreamID(1);
-                TCPStream * strm=new TCPStream(shared_socket,newID);
-
-                TCPSetCallbacks setCallbackFunctor(&*shared_socket,strm);
-                callback(strm,setCallbackFunctor);
-                if (setCallbackFunctor.mCallbacks==NULL) {
-                    SILOG(tcpsst,error,"Client code for stream "<<newID.read()<<" did not set listener on socket");
-                    shared_socket->closeStream(shared_socket,newID);
+                incompleteStreamsLock.unlock();
+                IOService*connectionService=pool?&pool->nextService():ioService;
+                MoveResult moved=(connectionService!=ioService?moveSockets(sockets,ioService,connectionService):STAYED);
+                if (moved==MOVED) {
+                    //the connection is built on the thread that will service it so its callbacks never come from two threads
+                    connectionService->post(std::tr1::bind(&finishStream,connectionService,context,sockets,callback));
+                }else if (moved==STAYED) {
+                    finishStream(ioService,context,sockets,callback);
+                }else {
+                    SILOG(tcpsst,error,"Dropping connection whose sockets could not all be kept on one IOService");
+                    for (size_t i=0;i<sockets.size();++i) {
+                        delete sockets[i];
+                    }
                 }
             }else{
                 sStaleUUIDs.push_back(context);
@@ -96,14 +198,14 @@ void buildStream(Array<uint8,TCPStream::TcpSstHeaderSize> *buffer,
     delete buffer;
 }
 
-void beginNewStream(TCPSocket * socket, IOService*ioService,const Stream::SubstreamCallback& cb) {
+void beginNewStream(TCPSocket * socket, IOService*ioService,IOServicePool*pool,const Stream::SubstreamCallback& cb) {
     Array<uint8,TCPStream::TcpSstHeaderSize> *buffer=new Array<uint8,TCPStream::TcpSstHeaderSize>;
 
 
     boost::asio::async_read(*socket,
                             boost::asio::buffer(buffer->begin(),TCPStream::TcpSstHeaderSize),
                             boost::asio::transfer_at_least(TCPStream::TcpSstHeaderSize),
-                            std::tr1::bind(&ASIOStreamBuilder::buildStream,buffer,socket,ioService,cb,_1,_2));
+                            std::tr1::bind(&ASIOStreamBuilder::buildStream,buffer,socket,ioService,pool,cb,_1,_2));
 }
 
 } } }
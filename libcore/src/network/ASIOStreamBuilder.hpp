@@ -30,12 +30,15 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-namespace Sirikata { namespace Network { namespace ASIOStreamBuilder {
+namespace Sirikata { namespace Network {
+class IOServicePool;
+namespace ASIOStreamBuilder {
 /**
  * Begins a new stream based on a TCPSocket connection acception with the following substream callback for stream creation
  * Only creates the stream if the handshake is complete and it has all the resources (udp, tcp sockets, etc) necessary at the time
+ * If pool is not NULL the finished connection's sockets are moved to the pool's next IOService, which then creates the stream
  */
-void beginNewStream(TCPSocket *socket,IOService*ioService,const Stream::SubstreamCallback&);
+void beginNewStream(TCPSocket *socket,IOService*ioService,IOServicePool*pool,const Stream::SubstreamCallback&);
 
 
 } }  }
@@ -0,0 +1,278 @@
+/*  Sirikata Network Utilities
+ *  ChunkPool.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TCPDefinitions.hpp"
+#include "ChunkPool.hpp"
+namespace Sirikata { namespace Network {
+namespace {
+///The number of bytes every Chunk in size class which can hold
+size_t sizeClassBytes(unsigned int which) {
+    return (size_t)1<<(which+ChunkPool::MIN_SIZE_CLASS_SHIFT);
+}
+///The smallest size class holding size bytes, or NUM_SIZE_CLASSES if size is too large to pool
+unsigned int sizeClassFor(size_t size) {
+    unsigned int which=0;
+    while (which<ChunkPool::NUM_SIZE_CLASSES&&sizeClassBytes(which)<size)
+        ++which;
+    return which;
+}
+///The largest size class a Chunk with this capacity can serve, or NUM_SIZE_CLASSES if it is too small or far too large to keep
+unsigned int sizeClassOf(size_t capacity) {
+    if (capacity<sizeClassBytes(0)||capacity>=2*sizeClassBytes(ChunkPool::NUM_SIZE_CLASSES-1))
+        return ChunkPool::NUM_SIZE_CLASSES;
+    unsigned int which=0;
+    while (which+1<ChunkPool::NUM_SIZE_CLASSES&&sizeClassBytes(which+1)<=capacity)
+        ++which;
+    return which;
+}
+unsigned int localLimit(unsigned int which) {
+    size_t limit=ChunkPool::MAX_LOCAL_FREE_BYTES/sizeClassBytes(which);
+    return limit<ChunkPool::MAX_LOCAL_FREE?(limit?(unsigned int)limit:1):ChunkPool::MAX_LOCAL_FREE;
+}
+size_t globalLimit(unsigned int which) {
+    return ChunkPool::MAX_GLOBAL_FREE_BYTES/sizeClassBytes(which);
+}
+
+std::ostream&operator<<(std::ostream&os, const ChunkPool::Statistics&stats) {
+    return os<<"Chunk pool: "<<stats.mLocalHits<<" local hits, "<<stats.mGlobalHits<<" global hits, "
+             <<stats.mMisses<<" misses, "<<stats.mUnpooled<<" unpooled";
+}
+
+///What allocate really hands out: a Chunk along with the number of releases still needed before it may be recycled and who to tell when it is
+class PooledChunk:public Chunk {
+public:
+    AtomicValue<uint32> mReferences;
+    ChunkPool::ReleaseObserver*mObserver;
+    PooledChunk():mReferences(1),mObserver(NULL) {
+    }
+    explicit PooledChunk(size_t size):Chunk(size),mReferences(1),mObserver(NULL) {
+    }
+};
+
+///The overflow lists shared by all threads along with the statistics totals, all guarded by mMutex
+class GlobalFreeLists {
+public:
+    boost::mutex mMutex;
+    std::vector<PooledChunk*> mFree[ChunkPool::NUM_SIZE_CLASSES];
+    ChunkPool::Statistics mTotals;
+    ///the allocation count at which the statistics are next logged
+    uint64 mNextLog;
+    GlobalFreeLists():mNextLog(ChunkPool::LOG_INTERVAL) {
+    }
+    ~GlobalFreeLists() {
+        for (unsigned int which=0;which<ChunkPool::NUM_SIZE_CLASSES;++which) {
+            for (size_t i=0;i<mFree[which].size();++i) {
+                delete mFree[which][i];
+            }
+        }
+    }
+} sGlobalFreeLists;
+
+///A single thread's free lists and the counts it has not yet folded into the global totals
+class LocalFreeLists {
+public:
+    PooledChunk*mFree[ChunkPool::NUM_SIZE_CLASSES][ChunkPool::MAX_LOCAL_FREE];
+    unsigned int mCount[ChunkPool::NUM_SIZE_CLASSES];
+    ChunkPool::Statistics mUnfolded;
+    LocalFreeLists() {
+        std::memset(mCount,0,sizeof(mCount));
+    }
+    /**
+     * Adds mUnfolded to the global totals. Must be called with sGlobalFreeLists.mMutex held
+     * \param snapshot receives a copy of the new totals
+     * \returns true if the totals crossed another LOG_INTERVAL allocations and should be logged
+     */
+    bool fold(ChunkPool::Statistics&snapshot) {
+        ChunkPool::Statistics&totals=sGlobalFreeLists.mTotals;
+        totals.mLocalHits+=mUnfolded.mLocalHits;
+        totals.mGlobalHits+=mUnfolded.mGlobalHits;
+        totals.mMisses+=mUnfolded.mMisses;
+        totals.mUnpooled+=mUnfolded.mUnpooled;
+        mUnfolded=ChunkPool::Statistics();
+        snapshot=totals;
+        uint64 allocations=totals.mLocalHits+totals.mGlobalHits+totals.mMisses+totals.mUnpooled;
+        if (allocations>=sGlobalFreeLists.mNextLog) {
+            sGlobalFreeLists.mNextLog=allocations+ChunkPool::LOG_INTERVAL;
+            return true;
+        }
+        return false;
+    }
+    ///Moves count Chunks of size class which to the global overflow list, freeing any that do not fit
+    void spill(unsigned int which, unsigned int count) {
+        PooledChunk*toDelete[ChunkPool::MAX_LOCAL_FREE];
+        unsigned int numToDelete=0;
+        bool log;
+        ChunkPool::Statistics snapshot;
+        {
+            boost::lock_guard<boost::mutex> lok(sGlobalFreeLists.mMutex);
+            std::vector<PooledChunk*>&global=sGlobalFreeLists.mFree[which];
+            size_t limit=globalLimit(which);
+            while (count--) {
+                PooledChunk*chunk=mFree[which][--mCount[which]];
+                if (global.size()<limit)
+                    global.push_back(chunk);
+                else
+                    toDelete[numToDelete++]=chunk;
+            }
+            log=fold(snapshot);
+        }
+        while (numToDelete)
+            delete toDelete[--numToDelete];
+        if (log)
+            SILOG(tcpsst,debug,snapshot);
+    }
+    ///Takes up to half a list's worth of size class which from the global overflow list, returning how many were taken
+    unsigned int refill(unsigned int which) {
+        unsigned int taken=0;
+        bool log;
+        ChunkPool::Statistics snapshot;
+        {
+            boost::lock_guard<boost::mutex> lok(sGlobalFreeLists.mMutex);
+            std::vector<PooledChunk*>&global=sGlobalFreeLists.mFree[which];
+            unsigned int wanted=(localLimit(which)+1)/2;
+            while (taken<wanted&&!global.empty()) {
+                mFree[which][mCount[which]++]=global.back();
+                global.pop_back();
+                ++taken;
+            }
+            log=fold(snapshot);
+        }
+        if (log)
+            SILOG(tcpsst,debug,snapshot);
+        return taken;
+    }
+    ///Called when the thread exits: every free Chunk goes to the global list so other threads may use it
+    ~LocalFreeLists() {
+        for (unsigned int which=0;which<ChunkPool::NUM_SIZE_CLASSES;++which) {
+            if (mCount[which])
+                spill(which,mCount[which]);
+        }
+        ChunkPool::Statistics snapshot;
+        boost::lock_guard<boost::mutex> lok(sGlobalFreeLists.mMutex);
+        fold(snapshot);
+    }
+};
+boost::thread_specific_ptr<LocalFreeLists> sLocalFreeLists;
+LocalFreeLists&localFreeLists() {
+    LocalFreeLists*retval=sLocalFreeLists.get();
+    if (retval==NULL) {
+        retval=new LocalFreeLists;
+        sLocalFreeLists.reset(retval);
+    }
+    return *retval;
+}
+}
+
+Chunk*ChunkPool::allocate(size_t size) {
+    LocalFreeLists&local=localFreeLists();
+    unsigned int which=sizeClassFor(size);
+    if (which==NUM_SIZE_CLASSES) {
+        ++local.mUnfolded.mUnpooled;
+        return new PooledChunk(size);
+    }
+    if (local.mCount[which]) {
+        ++local.mUnfolded.mLocalHits;
+    }else if (local.refill(which)) {
+        ++local.mUnfolded.mGlobalHits;
+    }else {
+        ++local.mUnfolded.mMisses;
+        Chunk*retval=new PooledChunk;
+        retval->reserve(sizeClassBytes(which));
+        retval->resize(size);
+        return retval;
+    }
+    Chunk*retval=local.mFree[which][--local.mCount[which]];
+    retval->resize(size);
+    return retval;
+}
+Chunk*ChunkPool::allocate(const uint8*begin, const uint8*end) {
+    Chunk*retval=allocate(end-begin);
+    if (begin!=end)
+        std::memcpy(&*retval->begin(),begin,end-begin);
+    return retval;
+}
+std::tr1::shared_ptr<Chunk> ChunkPool::allocateShared(size_t size) {
+    return std::tr1::shared_ptr<Chunk>(allocate(size),&ChunkPool::release);
+}
+void ChunkPool::share(Chunk*chunk, unsigned int extraReferences) {
+    static_cast<PooledChunk*>(chunk)->mReferences+=extraReferences;
+}
+void ChunkPool::release(Chunk*chunk) {
+    if (chunk==NULL)
+        return;
+    PooledChunk*pooled=static_cast<PooledChunk*>(chunk);
+    //a lone owner can skip the atomic decrement: nobody else can be sharing it
+    if (pooled->mReferences.read()!=1&&--pooled->mReferences!=0)
+        return;
+    pooled->mReferences=1;
+    if (pooled->mObserver) {
+        ReleaseObserver*observer=pooled->mObserver;
+        pooled->mObserver=NULL;
+        observer->chunkReleased(pooled->size());
+    }
+    unsigned int which=sizeClassOf(pooled->capacity());
+    if (which==NUM_SIZE_CLASSES) {
+        delete pooled;
+        return;
+    }
+    LocalFreeLists&local=localFreeLists();
+    unsigned int limit=localLimit(which);
+    if (local.mCount[which]>=limit) {
+        local.spill(which,(limit+1)/2);
+    }
+    local.mFree[which][local.mCount[which]++]=pooled;
+}
+void ChunkPool::observeRelease(Chunk*chunk, ReleaseObserver*observer) {
+    assert(static_cast<PooledChunk*>(chunk)->mObserver==NULL);
+    static_cast<PooledChunk*>(chunk)->mObserver=observer;
+}
+ChunkPool::Statistics ChunkPool::getStatistics() {
+    Statistics retval;
+    {
+        boost::lock_guard<boost::mutex> lok(sGlobalFreeLists.mMutex);
+        retval=sGlobalFreeLists.mTotals;
+    }
+    LocalFreeLists*local=sLocalFreeLists.get();
+    if (local) {
+        retval.mLocalHits+=local->mUnfolded.mLocalHits;
+        retval.mGlobalHits+=local->mUnfolded.mGlobalHits;
+        retval.mMisses+=local->mUnfolded.mMisses;
+        retval.mUnpooled+=local->mUnfolded.mUnpooled;
+    }
+    return retval;
+}
+void ChunkPool::logStatistics() {
+    Statistics stats=getStatistics();
+    SILOG(tcpsst,info,stats);
+}
+
+} }
@@ -0,0 +1,104 @@
+/*  Sirikata Network Utilities
+ *  ChunkPool.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_ChunkPool_HPP__
+#define SIRIKATA_ChunkPool_HPP__
+#include "Stream.hpp"
+#include "util/AtomicTypes.hpp"
+namespace Sirikata { namespace Network {
+/**
+ * Recycles the Chunks the TCPSST stack sends and receives so a small message does not cost a malloc/free pair.
+ * Chunks are kept on power of two size classes (by capacity) from 64 bytes to 64 kilobytes.
+ * Each thread has its own free lists, so the common case takes no lock. When a thread frees more than its lists hold
+ * (as the IO thread does when it retires Chunks sent from user threads) half of the list spills to a global overflow list,
+ * from which threads whose lists ran dry refill in batches.
+ * Chunks larger than the biggest size class are simply allocated and deleted.
+ */
+class SIRIKATA_EXPORT ChunkPool {
+public:
+    enum SizeClasses {
+        ///log2 of the smallest size class
+        MIN_SIZE_CLASS_SHIFT=6,
+        ///the number of size classes: 64 bytes through 64 kilobytes
+        NUM_SIZE_CLASSES=11,
+        ///most Chunks a thread keeps in any one size class
+        MAX_LOCAL_FREE=64,
+        ///most bytes a thread keeps in any one size class, so the large classes hold few Chunks
+        MAX_LOCAL_FREE_BYTES=262144,
+        ///most bytes kept on the global overflow list of any one size class
+        MAX_GLOBAL_FREE_BYTES=4194304,
+        ///how many allocations pass between the debug level statistics logs
+        LOG_INTERVAL=1048576
+    };
+    ///Running totals of where Chunks came from. Each thread folds its counts in whenever it touches the global lists and when it exits
+    struct Statistics {
+        ///allocations served from the calling thread's own free list
+        uint64 mLocalHits;
+        ///allocations served by a batch taken from the global overflow list
+        uint64 mGlobalHits;
+        ///allocations that had to go to the heap
+        uint64 mMisses;
+        ///allocations too large to ever be pooled
+        uint64 mUnpooled;
+        Statistics():mLocalHits(0),mGlobalHits(0),mMisses(0),mUnpooled(0) {}
+    };
+    ///Something to be told when a Chunk it was attached to goes back to the pool, such as the send window of the stream that sent it
+    class ReleaseObserver {
+    public:
+        virtual ~ReleaseObserver(){}
+        ///Called from whichever thread drops the last reference to the Chunk, with the Chunk's size
+        virtual void chunkReleased(size_t size)=0;
+    };
+    ///Returns a Chunk of exactly size bytes, recycled if one of a big enough size class is free. Contents are unspecified
+    static Chunk*allocate(size_t size);
+    ///Returns a Chunk holding a copy of the bytes from begin to end
+    static Chunk*allocate(const uint8*begin, const uint8*end);
+    ///Returns a pooled Chunk of exactly size bytes that goes back to the pool when the last reference is dropped
+    static std::tr1::shared_ptr<Chunk> allocateShared(size_t size);
+    /**
+     * Lets one Chunk from allocate be queued on several sockets at once: it then takes extraReferences
+     * more calls to release before the Chunk is recycled. A shared Chunk must be treated as read-only
+     */
+    static void share(Chunk*chunk, unsigned int extraReferences);
+    ///Hands a Chunk from allocate back to the pool (only Chunks from allocate may be released). NULL is ignored
+    static void release(Chunk*chunk);
+    /**
+     * Has observer told once the last reference to chunk is released, however the Chunk ends up being retired.
+     * A Chunk has at most one observer and must not be resized while it is being observed
+     */
+    static void observeRelease(Chunk*chunk, ReleaseObserver*observer);
+    ///The totals so far, including the calling thread's counts that have not been folded in yet
+    static Statistics getStatistics();
+    ///Writes the totals to the tcpsst log. They are also logged at debug level every LOG_INTERVAL allocations
+    static void logStatistics();
+};
+} }
+#endif
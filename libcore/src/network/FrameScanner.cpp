@@ -0,0 +1,98 @@
+/*  Sirikata Network Utilities
+ *  FrameScanner.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "Stream.hpp"
+#include "FrameScanner.hpp"
+namespace Sirikata { namespace Network {
+namespace {
+/**
+ * Decodes the int30 at data, which must have at least 4 readable bytes, returning how many bytes it takes.
+ * All 4 bytes are loaded at once: the second byte counts if the first has its high bit set and the third and fourth if the second does too
+ */
+inline unsigned int decodeUint30(const uint8*data,uint32&value) {
+    uint32 word=(uint32)data[0]|((uint32)data[1]<<8)|((uint32)data[2]<<16)|((uint32)data[3]<<24);
+    uint32 twoBytes=(word>>7)&1;
+    uint32 fourBytes=twoBytes&(word>>15);
+    value=(word&0x7f)
+        |((word>>1)&0x3f80&(0-twoBytes))
+        |((word>>2)&0x3fffc000&(0-fourBytes));
+    return 1+twoBytes+2*fourBytes;
+}
+}
+size_t FrameScanner::scan(const uint8*buffer,size_t length,Frame*frames,size_t maxFrames,size_t&consumed) {
+    size_t pos=0;
+    size_t count=0;
+    while (count<maxFrames) {
+        size_t available=length-pos;
+        uint32 packetLength;
+        unsigned int headerLength;
+        if (available>=Stream::uint30::MAX_SERIALIZED_LENGTH) {
+            headerLength=decodeUint30(buffer+pos,packetLength);
+        }else {
+            Stream::uint30 slowLength;
+            headerLength=(unsigned int)available;
+            if (available==0||!slowLength.unserialize(buffer+pos,headerLength))
+                break;
+            packetLength=slowLength.read();
+        }
+        if (available-headerLength<packetLength)
+            break;
+        const uint8*packet=buffer+pos+headerLength;
+        uint32 id;
+        unsigned int idLength;
+        if (available-headerLength>=Stream::uint30::MAX_SERIALIZED_LENGTH) {
+            //the bytes past a short packet belong to the next one, but they only count if the StreamID says they do
+            idLength=decodeUint30(packet,id);
+            if (idLength>packetLength) {
+                id=0;
+                idLength=packetLength;
+            }
+        }else {
+            Stream::StreamID slowID;
+            idLength=packetLength;
+            if (slowID.unserialize(packet,idLength)) {
+                id=slowID.read();
+            }else {
+                id=0;
+                idLength=packetLength;
+            }
+        }
+        Frame&frame=frames[count++];
+        frame.mID=Stream::StreamID(id);
+        frame.mOffset=(uint32)(pos+headerLength+idLength);
+        frame.mLength=packetLength-idLength;
+        pos+=headerLength+packetLength;
+    }
+    consumed=pos;
+    return count;
+}
+} }
@@ -0,0 +1,62 @@
+/*  Sirikata Network Utilities
+ *  FrameScanner.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_FrameScanner_HPP__
+#define SIRIKATA_FrameScanner_HPP__
+namespace Sirikata { namespace Network {
+/**
+ * Splits received bytes into the packets they hold in a single pass, so the read buffer can hand out a batch of
+ * packets at a time. Wherever 4 bytes can be read the int30 lengths and StreamIDs are decoded with masks instead of a branch
+ * per byte; the last few bytes of a buffer fall back to Stream::uint30::unserialize
+ */
+class SIRIKATA_EXPORT FrameScanner {
+public:
+    ///Where one whole packet's payload lies in the scanned buffer
+    class Frame {
+    public:
+        Stream::StreamID mID;
+        ///offset of the payload, after the length and StreamID, from the start of the buffer
+        uint32 mOffset;
+        uint32 mLength;
+    };
+    enum {
+        ///How many frames the read buffer scans for at a time
+        MAX_FRAMES=64
+    };
+    /**
+     * Fills frames with up to maxFrames of the whole packets at the front of buffer, stopping at the first one that has not
+     * been received completely. Sets consumed to the bytes of the packets returned and returns how many there are.
+     * A packet too short to hold its StreamID is returned as an empty control packet, as the packet format leaves it
+     */
+    static size_t scan(const uint8*buffer,size_t length,Frame*frames,size_t maxFrames,size_t&consumed);
+};
+} }
+#endif
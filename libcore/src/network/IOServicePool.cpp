@@ -0,0 +1,101 @@
+/*  Sirikata Network Utilities
+ *  IOServicePool.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "util/AtomicTypes.hpp"
+#include "TCPDefinitions.hpp"
+#include "IOServiceFactory.hpp"
+#include "IOServicePool.hpp"
+#include <boost/thread.hpp>
+namespace Sirikata { namespace Network {
+
+///An IOService along with the thread running it and the work keeping it from returning while it is idle
+class IOServicePool::ServiceThread {
+public:
+    IOService*mService;
+    boost::asio::io_service::work*mWork;
+    boost::thread*mThread;
+    ServiceThread():mService(IOServiceFactory::makeIOService()),mWork(NULL),mThread(NULL) {
+    }
+    ~ServiceThread() {
+        IOServiceFactory::destroyIOService(mService);
+    }
+};
+
+IOServicePool::IOServicePool(unsigned int numServices):mNextService(0) {
+    if (numServices==0)
+        numServices=boost::thread::hardware_concurrency();
+    if (numServices==0)
+        numServices=1;
+    for (unsigned int i=0;i<numServices;++i) {
+        mServiceThreads.push_back(new ServiceThread);
+    }
+}
+IOServicePool::~IOServicePool() {
+    stop();
+    for (size_t i=0;i<mServiceThreads.size();++i) {
+        delete mServiceThreads[i];
+    }
+}
+IOService&IOServicePool::service(unsigned int which) {
+    return *mServiceThreads[which]->mService;
+}
+IOService&IOServicePool::nextService() {
+    return service((mNextService++)%size());
+}
+void IOServicePool::run() {
+    for (size_t i=0;i<mServiceThreads.size();++i) {
+        ServiceThread*serviceThread=mServiceThreads[i];
+        if (serviceThread->mThread==NULL) {
+            IOServiceFactory::resetService(serviceThread->mService);
+            serviceThread->mWork=new boost::asio::io_service::work(*serviceThread->mService);
+            serviceThread->mThread=new boost::thread(std::tr1::bind(&IOServiceFactory::runService,serviceThread->mService));
+        }
+    }
+}
+void IOServicePool::stop() {
+    for (size_t i=0;i<mServiceThreads.size();++i) {
+        ServiceThread*serviceThread=mServiceThreads[i];
+        delete serviceThread->mWork;
+        serviceThread->mWork=NULL;
+        IOServiceFactory::stopService(serviceThread->mService);
+    }
+    for (size_t i=0;i<mServiceThreads.size();++i) {
+        ServiceThread*serviceThread=mServiceThreads[i];
+        if (serviceThread->mThread) {
+            serviceThread->mThread->join();
+            delete serviceThread->mThread;
+            serviceThread->mThread=NULL;
+        }
+    }
+}
+
+} }
@@ -0,0 +1,69 @@
+/*  Sirikata Network Utilities
+ *  IOServicePool.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SIRIKATA_IOSERVICEPOOL_HPP_
+#define _SIRIKATA_IOSERVICEPOOL_HPP_
+#include "util/AtomicTypes.hpp"
+
+namespace Sirikata { namespace Network {
+class IOService;
+/**
+ * A set of IOServices, each run by a thread of its own, for processes with more connections than one thread can keep up with.
+ * Every connection lives on a single IOService from the pool so that all of its callbacks still come from one thread:
+ * outgoing streams should be constructed with nextService() and a TCPStreamListener built on the pool moves each accepted
+ * connection onto nextService() once its handshake is complete
+ */
+class SIRIKATA_EXPORT IOServicePool {
+    class ServiceThread;
+    std::vector<ServiceThread*> mServiceThreads;
+    AtomicValue<uint32> mNextService;
+    IOServicePool(const IOServicePool&);
+    IOServicePool&operator=(const IOServicePool&);
+public:
+    ///Makes numServices IOServices (one per hardware thread if numServices is 0). They do not run until run() is called
+    explicit IOServicePool(unsigned int numServices=0);
+    ///Stops and joins the threads if they are still going, then destroys the IOServices
+    ~IOServicePool();
+    ///The number of IOServices in the pool
+    unsigned int size()const {
+        return (unsigned int)mServiceThreads.size();
+    }
+    ///The which'th IOService of the pool
+    IOService&service(unsigned int which);
+    ///Deals out the IOServices in turn so that new connections are spread evenly over the threads
+    IOService&nextService();
+    ///Starts a thread for each IOService which runs it until stop() is called, even while it has no work
+    void run();
+    ///Stops every IOService and waits for the threads to finish
+    void stop();
+};
+} }
+#endif
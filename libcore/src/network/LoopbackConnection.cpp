@@ -0,0 +1,305 @@
+/*  Sirikata Network Utilities
+ *  LoopbackConnection.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TCPDefinitions.hpp"
+#include "LoopbackStream.hpp"
+#include "LoopbackConnection.hpp"
+namespace Sirikata { namespace Network {
+
+namespace {
+struct Listener {
+    IOService*mIO;
+    Stream::SubstreamCallback mNewStreamCallback;
+};
+typedef std::map<String,Listener> ListenerMap;
+boost::mutex sListenersMutex;
+///The LoopbackStreamListeners of the process by address
+ListenerMap sListeners;
+String listenerName(const Address&addy) {
+    return addy.getHostName()+':'+addy.getService();
+}
+}
+
+class LoopbackSetCallbacks:public Stream::SetCallbacks {
+public:
+    LoopbackConnection*mConnection;
+    LoopbackStream*mStream;
+    bool mCallbacksSet;
+    LoopbackSetCallbacks(LoopbackConnection*connection,LoopbackStream*strm):mConnection(connection),mStream(strm),mCallbacksSet(false) {
+    }
+    virtual void operator()(const Stream::ConnectionCallback &connectionCallback,
+                            const Stream::BytesReceivedCallback &bytesReceivedCallback){
+        if (mStream) {
+            mConnection->addCallbacks(mStream->mSide,mStream->getID(),new LoopbackStream::Callbacks(connectionCallback,bytesReceivedCallback));
+            mCallbacksSet=true;
+        }
+    }
+    virtual void setViewCallbacks(const Stream::ConnectionCallback &connectionCallback,
+                                  const Stream::BytesReceivedViewCallback &bytesReceivedCallback){
+        if (mStream) {
+            mConnection->addCallbacks(mStream->mSide,mStream->getID(),new LoopbackStream::Callbacks(connectionCallback,bytesReceivedCallback));
+            mCallbacksSet=true;
+        }
+    }
+};
+
+namespace {
+///Tells a substream callback that the last stream of its connection is gone, as a MultiplexedSocket does when it is destroyed
+void lastStreamGone(Stream::SubstreamCallback substreamCallback) {
+    LoopbackSetCallbacks setCallbackFunctor(NULL,NULL);
+    substreamCallback(NULL,setCallbackFunctor);
+}
+}
+
+LoopbackConnection::LoopbackConnection() {
+}
+
+void LoopbackConnection::enqueue(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,const Packet&packet) {
+    Side&receiver=thus->mSides[side];
+    if (receiver.mGone)
+        return;
+    receiver.mIncoming.push_back(packet);
+    if (!receiver.mDeliveryPosted) {
+        receiver.mDeliveryPosted=true;
+        receiver.mIO->post(std::tr1::bind(&LoopbackConnection::deliver,thus,side));
+    }
+}
+
+std::tr1::shared_ptr<LoopbackStream::Callbacks> LoopbackConnection::forget(unsigned int side,const Stream::StreamID&id) {
+    std::tr1::shared_ptr<LoopbackStream::Callbacks> retval;
+    Side&end=mSides[side];
+    end.mOpenStreams.erase(id);
+    CallbackMap::iterator where=end.mCallbacks.find(id);
+    if (where!=end.mCallbacks.end()) {
+        retval=where->second;
+        end.mCallbacks.erase(where);
+    }
+    return retval;
+}
+
+std::tr1::shared_ptr<LoopbackStream::Callbacks> LoopbackConnection::find(unsigned int side,const Stream::StreamID&id) {
+    boost::lock_guard<boost::mutex> lok(mMutex);
+    CallbackMap::iterator where=mSides[side].mCallbacks.find(id);
+    if (where!=mSides[side].mCallbacks.end())
+        return where->second;
+    return std::tr1::shared_ptr<LoopbackStream::Callbacks>();
+}
+
+void LoopbackConnection::openStream(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,const Stream::StreamID&id) {
+    Stream::SubstreamCallback substreamCallback;
+    {
+        boost::lock_guard<boost::mutex> lok(thus->mMutex);
+        substreamCallback=thus->mSides[side].mSubstreamCallback;
+    }
+    LoopbackStream*newStream=new LoopbackStream(thus,side,id);
+    LoopbackSetCallbacks setCallbackFunctor(&*thus,newStream);
+    substreamCallback(newStream,setCallbackFunctor);
+    if (!setCallbackFunctor.mCallbacksSet) {
+        SILOG(tcpsst,error,"Client code for loopback stream "<<id.read()<<" did not set listener on socket");
+        closeStream(thus,side,id);
+    }
+}
+
+void LoopbackConnection::deliver(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side) {
+    std::deque<Packet> packets;
+    {
+        boost::lock_guard<boost::mutex> lok(thus->mMutex);
+        packets.swap(thus->mSides[side].mIncoming);
+        thus->mSides[side].mDeliveryPosted=false;
+    }
+    for (std::deque<Packet>::iterator i=packets.begin(),ie=packets.end();i!=ie;++i) {
+        switch(i->mType) {
+          case OPEN:
+            openStream(thus,side,i->mID);
+            break;
+          case DATA: {
+              std::tr1::shared_ptr<LoopbackStream::Callbacks> callbacks=thus->find(side,i->mID);
+              if (callbacks) {
+                  callbacks->bytesReceived(i->mData);
+              }
+              //otherwise the stream was closed here while the data was on its way
+          }
+            break;
+          case CLOSE: {
+              std::tr1::shared_ptr<LoopbackStream::Callbacks> callbacks;
+              {
+                  boost::lock_guard<boost::mutex> lok(thus->mMutex);
+                  callbacks=thus->forget(side,i->mID);
+              }
+              if (callbacks) {
+                  callbacks->mConnectionCallback(Stream::Disconnected,"Remote Host Disconnected");
+              }
+          }
+            break;
+          case CONNECTED: {
+              std::tr1::shared_ptr<LoopbackStream::Callbacks> callbacks=thus->find(side,i->mID);
+              if (callbacks) {
+                  callbacks->mConnectionCallback(Stream::Connected,"");
+              }
+          }
+            break;
+          case CONNECTION_FAILED:
+          case DISCONNECT: {
+              CallbackMap callbacks;
+              {
+                  boost::lock_guard<boost::mutex> lok(thus->mMutex);
+                  callbacks.swap(thus->mSides[side].mCallbacks);
+                  thus->mSides[side].mOpenStreams.clear();
+              }
+              for (CallbackMap::iterator j=callbacks.begin(),je=callbacks.end();j!=je;++j) {
+                  if (i->mType==CONNECTION_FAILED) {
+                      j->second->mConnectionCallback(Stream::ConnectionFailed,"No loopback listener at that address");
+                  }else {
+                      j->second->mConnectionCallback(Stream::Disconnected,"Remote Host Disconnected");
+                  }
+              }
+          }
+            break;
+        }
+    }
+}
+
+std::tr1::shared_ptr<LoopbackConnection> LoopbackConnection::connect(IOService*io,
+                                                                     const Address&addy,
+                                                                     const Stream::SubstreamCallback&substreamCallback,
+                                                                     LoopbackStream::Callbacks*callbacks) {
+    std::tr1::shared_ptr<LoopbackConnection> thus(new LoopbackConnection);
+    Stream::StreamID firstID(1);
+    boost::lock_guard<boost::mutex> lok(thus->mMutex);
+    Side&connector=thus->mSides[CONNECTOR];
+    Side&listener=thus->mSides[LISTENER];
+    connector.mIO=io;
+    connector.mSubstreamCallback=substreamCallback;
+    connector.mHighestStreamID=firstID.read();
+    connector.mCallbacks[firstID]=std::tr1::shared_ptr<LoopbackStream::Callbacks>(callbacks);
+    bool listening=false;
+    {
+        boost::lock_guard<boost::mutex> listenersLock(sListenersMutex);
+        ListenerMap::iterator where=sListeners.find(listenerName(addy));
+        if (where!=sListeners.end()) {
+            listener.mIO=where->second.mIO;
+            listener.mSubstreamCallback=where->second.mNewStreamCallback;
+            listening=true;
+        }
+    }
+    if (listening) {
+        connector.mOpenStreams.insert(firstID);
+        listener.mOpenStreams.insert(firstID);
+        enqueue(thus,LISTENER,Packet(OPEN,firstID));
+        enqueue(thus,CONNECTOR,Packet(CONNECTED,firstID));
+    }else {
+        listener.mGone=true;
+        enqueue(thus,CONNECTOR,Packet(CONNECTION_FAILED,firstID));
+    }
+    return thus;
+}
+
+Stream::StreamID LoopbackConnection::openNewStream(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,LoopbackStream::Callbacks*callbacks) {
+    boost::lock_guard<boost::mutex> lok(thus->mMutex);
+    Side&opener=thus->mSides[side];
+    Side&other=thus->mSides[1-side];
+    if (opener.mGone||other.mGone) {
+        delete callbacks;
+        return Stream::StreamID();
+    }
+    opener.mHighestStreamID+=2;
+    Stream::StreamID newID(opener.mHighestStreamID);
+    opener.mCallbacks[newID]=std::tr1::shared_ptr<LoopbackStream::Callbacks>(callbacks);
+    opener.mOpenStreams.insert(newID);
+    other.mOpenStreams.insert(newID);
+    enqueue(thus,1-side,Packet(OPEN,newID));
+    return newID;
+}
+
+void LoopbackConnection::addCallbacks(unsigned int side,const Stream::StreamID&id,LoopbackStream::Callbacks*callbacks) {
+    boost::lock_guard<boost::mutex> lok(mMutex);
+    mSides[side].mCallbacks[id]=std::tr1::shared_ptr<LoopbackStream::Callbacks>(callbacks);
+}
+
+bool LoopbackConnection::send(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,const Stream::StreamID&id,const std::tr1::shared_ptr<Chunk>&data) {
+    boost::lock_guard<boost::mutex> lok(thus->mMutex);
+    if (thus->mSides[side].mOpenStreams.find(id)==thus->mSides[side].mOpenStreams.end())
+        return false;
+    Packet packet(DATA,id);
+    packet.mData=data;
+    enqueue(thus,1-side,packet);
+    return true;
+}
+
+void LoopbackConnection::closeStream(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,const Stream::StreamID&id) {
+    std::tr1::shared_ptr<LoopbackStream::Callbacks> callbacks;
+    boost::lock_guard<boost::mutex> lok(thus->mMutex);
+    if (thus->mSides[side].mOpenStreams.find(id)!=thus->mSides[side].mOpenStreams.end()) {
+        enqueue(thus,1-side,Packet(CLOSE,id));
+    }
+    //the callbacks go whether or not the other end closed the stream first
+    callbacks=thus->forget(side,id);
+}
+
+void LoopbackConnection::addStream(unsigned int side) {
+    boost::lock_guard<boost::mutex> lok(mMutex);
+    ++mSides[side].mLiveStreams;
+}
+
+void LoopbackConnection::removeStream(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side) {
+    CallbackMap callbacks;
+    std::deque<Packet> undelivered;
+    boost::lock_guard<boost::mutex> lok(thus->mMutex);
+    Side&end=thus->mSides[side];
+    if (--end.mLiveStreams==0) {
+        //with no stream left nobody could see what is queued here, and the other end must hear that its streams are cut off
+        end.mGone=true;
+        callbacks.swap(end.mCallbacks);
+        undelivered.swap(end.mIncoming);
+        end.mOpenStreams.clear();
+        enqueue(thus,1-side,Packet(DISCONNECT,Stream::StreamID()));
+        end.mIO->post(std::tr1::bind(&lastStreamGone,end.mSubstreamCallback));
+    }
+}
+
+bool LoopbackConnection::listen(const Address&addy,IOService*io,const Stream::SubstreamCallback&newStreamCallback) {
+    boost::lock_guard<boost::mutex> lok(sListenersMutex);
+    String name=listenerName(addy);
+    if (sListeners.find(name)!=sListeners.end())
+        return false;
+    Listener&listener=sListeners[name];
+    listener.mIO=io;
+    listener.mNewStreamCallback=newStreamCallback;
+    return true;
+}
+
+void LoopbackConnection::unlisten(const Address&addy) {
+    boost::lock_guard<boost::mutex> lok(sListenersMutex);
+    sListeners.erase(listenerName(addy));
+}
+
+} }
@@ -0,0 +1,143 @@
+/*  Sirikata Network Utilities
+ *  LoopbackConnection.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_LoopbackConnection_HPP__
+#define SIRIKATA_LoopbackConnection_HPP__
+#include "LoopbackStream.hpp"
+#include <boost/thread/mutex.hpp>
+namespace Sirikata { namespace Network {
+/**
+ * The shared state of a loopback connection: for each end, the callbacks of its streams and the queue of packets waiting
+ * to be delivered to it. Packets are appended under the connection lock and delivered in batches from the receiving end's IOService,
+ * so callbacks are never made with the lock held and never from the sending thread.
+ * Stream IDs are never reused: the connector opens odd IDs and the listener even ones, and the first stream is 1 on both ends
+ */
+class LoopbackConnection {
+public:
+    enum Sides {
+        CONNECTOR=0,
+        LISTENER=1,
+        NUM_SIDES=2
+    };
+private:
+    ///What a queued packet asks the receiving end to do
+    enum PacketType {
+        ///the other end opened a new stream: offer it to the substream callback
+        OPEN,
+        ///bytes for a stream
+        DATA,
+        ///the other end closed a stream
+        CLOSE,
+        ///the connect attempt reached a listener
+        CONNECTED,
+        ///the connect attempt found nobody listening
+        CONNECTION_FAILED,
+        ///the other end has no streams left
+        DISCONNECT
+    };
+    struct Packet {
+        PacketType mType;
+        Stream::StreamID mID;
+        std::tr1::shared_ptr<Chunk> mData;
+        Packet(PacketType type,const Stream::StreamID&id):mType(type),mID(id) {}
+    };
+    typedef std::tr1::unordered_map<Stream::StreamID,std::tr1::shared_ptr<LoopbackStream::Callbacks>,Stream::StreamID::Hasher> CallbackMap;
+    typedef std::tr1::unordered_set<Stream::StreamID,Stream::StreamID::Hasher> StreamIDSet;
+    struct Side {
+        IOService*mIO;
+        Stream::SubstreamCallback mSubstreamCallback;
+        ///callbacks of this end's streams by ID
+        CallbackMap mCallbacks;
+        ///the streams this end may still send on: neither end has closed them
+        StreamIDSet mOpenStreams;
+        ///packets waiting to be delivered to this end
+        std::deque<Packet> mIncoming;
+        ///true while a delivery is posted to mIO that has not yet taken mIncoming
+        bool mDeliveryPosted;
+        ///the LoopbackStream objects attached to this end
+        unsigned int mLiveStreams;
+        ///the highest ID this end has opened so far
+        unsigned int mHighestStreamID;
+        ///set once this end has no streams left, or never had a listener: nothing more is queued for it
+        bool mGone;
+        Side():mIO(NULL),mDeliveryPosted(false),mLiveStreams(0),mHighestStreamID(0),mGone(false) {}
+    };
+    boost::mutex mMutex;
+    Side mSides[NUM_SIDES];
+    ///Queues packet for side and has its IOService deliver it: must be called with mMutex held
+    static void enqueue(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,const Packet&packet);
+    ///Delivers everything queued for side: posted to that side's IOService
+    static void deliver(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side);
+    ///Forgets stream id on side, returning its callbacks if it had any: must be called with mMutex held
+    std::tr1::shared_ptr<LoopbackStream::Callbacks> forget(unsigned int side,const Stream::StreamID&id);
+    ///The callbacks registered for id on side, or NULL
+    std::tr1::shared_ptr<LoopbackStream::Callbacks> find(unsigned int side,const Stream::StreamID&id);
+    ///Offers a stream the other end opened to side's substream callback, closing it again if the callback declines it
+    static void openStream(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,const Stream::StreamID&id);
+    LoopbackConnection();
+public:
+    /**
+     * Connects to whichever LoopbackStreamListener listens on addy, registering callbacks (which it takes ownership of) as stream 1
+     * of the connector end. If there is no such listener the callbacks get ConnectionFailed
+     */
+    static std::tr1::shared_ptr<LoopbackConnection> connect(IOService*io,
+                                                            const Address&addy,
+                                                            const Stream::SubstreamCallback&substreamCallback,
+                                                            LoopbackStream::Callbacks*callbacks);
+    /**
+     * Opens a new stream on side, registering callbacks (which it takes ownership of) for it. Returns the ID of the stream,
+     * or StreamID() if the connection is already gone
+     */
+    static Stream::StreamID openNewStream(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,LoopbackStream::Callbacks*callbacks);
+    ///Registers the callbacks of a stream the other end opened. Takes ownership of callbacks
+    void addCallbacks(unsigned int side,const Stream::StreamID&id,LoopbackStream::Callbacks*callbacks);
+    ///Queues data for the other end of stream id. Returns false if the stream is closed, in which case data is not sent
+    static bool send(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,const Stream::StreamID&id,const std::tr1::shared_ptr<Chunk>&data);
+    ///Closes stream id from side, telling the other end once everything sent before it is delivered
+    static void closeStream(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side,const Stream::StreamID&id);
+    ///Notes a new LoopbackStream object on side
+    void addStream(unsigned int side);
+    ///Notes a LoopbackStream object on side going away: when the last goes the other end is disconnected
+    static void removeStream(const std::tr1::shared_ptr<LoopbackConnection>&thus,unsigned int side);
+    ///The IOService side's callbacks are made from
+    IOService*getIOService(unsigned int side)const {
+        return mSides[side].mIO;
+    }
+    /**
+     * Makes newStreamCallback the substream callback for connections to addy, which they will be delivered to from io.
+     * Returns false if another listener already has the address
+     */
+    static bool listen(const Address&addy,IOService*io,const Stream::SubstreamCallback&newStreamCallback);
+    ///Stops accepting connections to addy: connections already made are not affected
+    static void unlisten(const Address&addy);
+};
+} }
+#endif
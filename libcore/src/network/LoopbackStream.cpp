@@ -0,0 +1,136 @@
+/*  Sirikata Network Utilities
+ *  LoopbackStream.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TCPDefinitions.hpp"
+#include "LoopbackStream.hpp"
+#include "LoopbackConnection.hpp"
+#include "ChunkPool.hpp"
+#include "SendWindow.hpp"
+namespace Sirikata { namespace Network {
+
+LoopbackStream::LoopbackStream(IOService&io):mIO(&io),mSide(LoopbackConnection::CONNECTOR),mPriority(NormalPriority),mSendWindow(new SendWindow) {
+}
+LoopbackStream::LoopbackStream(const std::tr1::shared_ptr<LoopbackConnection>&connection,unsigned int side,const StreamID&id):mIO(connection->getIOService(side)),mSide(side),mPriority(NormalPriority),mSendWindow(new SendWindow) {
+    attach(connection,side,id);
+}
+LoopbackStream::~LoopbackStream() {
+    if (mConnection) {
+        LoopbackConnection::removeStream(mConnection,mSide);
+    }
+    mSendWindow->release();
+}
+void LoopbackStream::attach(const std::tr1::shared_ptr<LoopbackConnection>&connection,unsigned int side,const StreamID&id) {
+    if (mConnection) {
+        LoopbackConnection::removeStream(mConnection,mSide);
+    }
+    mConnection=connection;
+    mSide=side;
+    mID=id;
+    mConnection->addStream(mSide);
+}
+bool LoopbackStream::send(const Chunk&data,StreamReliability reliability) {
+    //the queue loses and reorders nothing, which is all any reliability asks of it
+    Chunk*copy=ChunkPool::allocate(data.size());
+    if (data.size()) {
+        std::memcpy(&*copy->begin(),&*data.begin(),data.size());
+    }
+    bool windowOpen=mSendWindow->attach(copy);
+    std::tr1::shared_ptr<Chunk> toBeSent(copy,&ChunkPool::release);
+    if (!mConnection||!LoopbackConnection::send(mConnection,mSide,getID(),toBeSent)) {
+        SILOG(tcpsst,debug,"printing to closed loopback stream id "<<getID().read());
+    }
+    return windowOpen;
+}
+void LoopbackStream::setSendWindow(size_t windowBytes,const ReadySendCallback&readySendCallback) {
+    mSendWindow->setWindow(windowBytes,readySendCallback);
+}
+size_t LoopbackStream::getQueuedBytes()const {
+    return mSendWindow->getQueuedBytes();
+}
+void LoopbackStream::setPriority(StreamPriority priority) {
+    mPriority=priority;
+}
+StreamPriority LoopbackStream::getPriority()const {
+    return mPriority;
+}
+void LoopbackStream::connect(const Address&addy,
+                             const SubstreamCallback &substreamCallback,
+                             const ConnectionCallback &connectionCallback,
+                             const BytesReceivedCallback&bytesReceivedCallback) {
+    connectCallbacks(addy,substreamCallback,new Callbacks(connectionCallback,bytesReceivedCallback));
+}
+void LoopbackStream::connectViews(const Address&addy,
+                                  const SubstreamCallback &substreamCallback,
+                                  const ConnectionCallback &connectionCallback,
+                                  const BytesReceivedViewCallback&bytesReceivedCallback) {
+    connectCallbacks(addy,substreamCallback,new Callbacks(connectionCallback,bytesReceivedCallback));
+}
+void LoopbackStream::connectCallbacks(const Address&addy,
+                                      const SubstreamCallback &substreamCallback,
+                                      Callbacks*callbacks) {
+    attach(LoopbackConnection::connect(mIO,addy,substreamCallback,callbacks),LoopbackConnection::CONNECTOR,StreamID(1));
+}
+Stream* LoopbackStream::factory() {
+    return new LoopbackStream(*mIO);
+}
+bool LoopbackStream::cloneFrom(Stream*otherStream,
+                               const ConnectionCallback &connectionCallback,
+                               const BytesReceivedCallback&bytesReceivedCallback) {
+    return cloneFromCallbacks(otherStream,new Callbacks(connectionCallback,bytesReceivedCallback));
+}
+bool LoopbackStream::cloneFromViews(Stream*otherStream,
+                                    const ConnectionCallback &connectionCallback,
+                                    const BytesReceivedViewCallback&bytesReceivedCallback) {
+    return cloneFromCallbacks(otherStream,new Callbacks(connectionCallback,bytesReceivedCallback));
+}
+bool LoopbackStream::cloneFromCallbacks(Stream*otherStream,
+                                        Callbacks*callbacks) {
+    LoopbackStream*toBeCloned=dynamic_cast<LoopbackStream*>(otherStream);
+    if (NULL==toBeCloned||!toBeCloned->mConnection) {
+        delete callbacks;
+        return false;
+    }
+    StreamID newID=LoopbackConnection::openNewStream(toBeCloned->mConnection,toBeCloned->mSide,callbacks);
+    if (newID==StreamID()) {
+        return false;
+    }
+    mIO=toBeCloned->mIO;
+    attach(toBeCloned->mConnection,toBeCloned->mSide,newID);
+    return true;
+}
+void LoopbackStream::close() {
+    if (mConnection) {
+        LoopbackConnection::closeStream(mConnection,mSide,getID());
+    }
+}
+
+} }
@@ -0,0 +1,148 @@
+/*  Sirikata Network Utilities
+ *  LoopbackStream.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_LoopbackStream_HPP__
+#define SIRIKATA_LoopbackStream_HPP__
+#include "Stream.hpp"
+namespace Sirikata { namespace Network {
+class LoopbackConnection;
+class LoopbackSetCallbacks;
+class SendWindow;
+class IOService;
+
+/**
+ * A Stream between two endpoints in the same process, for an object host and space sharing a process and for tests.
+ * It keeps the semantics of TCPStream: connect() reaches a LoopbackStreamListener listening on the same Address,
+ * cloneFrom() opens substreams which the other end is offered through its substream callback, close() gives the other end
+ * a Disconnected callback and every callback is made from the IOService of the end it belongs to.
+ * Chunks are handed across through an in-memory queue for each direction rather than framed and written to sockets:
+ * the queue delivers everything in the order it was sent, which satisfies every StreamReliability, and since nothing
+ * is lost or reordered a test driving both ends from one IOService sees the same sequence of callbacks on every run
+ */
+class SIRIKATA_EXPORT LoopbackStream:public Stream {
+public:
+    /**
+     * The callbacks registered for one end of a stream
+     */
+    class Callbacks:public Noncopyable {
+    public:
+        Stream::ConnectionCallback mConnectionCallback;
+        ///set if the user wants received bytes as a Chunk
+        Stream::BytesReceivedCallback mBytesReceivedCallback;
+        ///set instead of mBytesReceivedCallback if the user is happy with views
+        Stream::BytesReceivedViewCallback mBytesReceivedViewCallback;
+        Callbacks(const Stream::ConnectionCallback &connectionCallback,
+                  const Stream::BytesReceivedCallback &bytesReceivedCallback):
+            mConnectionCallback(connectionCallback),
+            mBytesReceivedCallback(bytesReceivedCallback) {
+        }
+        Callbacks(const Stream::ConnectionCallback &connectionCallback,
+                  const Stream::BytesReceivedViewCallback &bytesReceivedViewCallback):
+            mConnectionCallback(connectionCallback),
+            mBytesReceivedViewCallback(bytesReceivedViewCallback) {
+        }
+        ///Hands over a received Chunk, which the sender copied so it may be given to either kind of callback as is
+        void bytesReceived(const std::tr1::shared_ptr<Chunk>&data) {
+            if (mBytesReceivedViewCallback) {
+                mBytesReceivedViewCallback(ChunkView(data));
+            }else {
+                mBytesReceivedCallback(*data);
+            }
+        }
+    };
+private:
+    friend class LoopbackConnection;
+    friend class LoopbackSetCallbacks;
+    ///The IOService this end's callbacks are made from
+    IOService*mIO;
+    ///The pair of queues shared by every stream between the two endpoints
+    std::tr1::shared_ptr<LoopbackConnection> mConnection;
+    ///Which end of mConnection this stream belongs to
+    unsigned int mSide;
+    StreamID mID;
+    StreamPriority mPriority;
+    ///Counts this stream's bytes that the other end has not finished receiving
+    SendWindow*mSendWindow;
+    ///Shared implementation of connect and connectViews: takes ownership of the callbacks
+    void connectCallbacks(const Address&addy,
+                          const SubstreamCallback &substreamCallback,
+                          Callbacks*callbacks);
+    ///Shared implementation of cloneFrom and cloneFromViews: takes ownership of the callbacks
+    bool cloneFromCallbacks(Stream*otherStream,
+                            Callbacks*callbacks);
+    ///Attaches this stream to one end of a connection
+    void attach(const std::tr1::shared_ptr<LoopbackConnection>&connection,unsigned int side,const StreamID&id);
+public:
+    ///Returns the active stream ID
+    StreamID getID()const {return mID;}
+    ///Constructor which leaves the stream unconnected, prepared for a connect() or a clone()
+    LoopbackStream(IOService&);
+    ///Constructor for a stream the other end opened on connection
+    LoopbackStream(const std::tr1::shared_ptr<LoopbackConnection>&connection,unsigned int side,const StreamID&id);
+    ///Lets go of the connection: once neither end has a stream left on it the other end is disconnected
+    ~LoopbackStream();
+    ///Implementation of send interface
+    virtual bool send(const Chunk&data,StreamReliability);
+    ///Implementation of setSendWindow interface
+    virtual void setSendWindow(size_t windowBytes,const ReadySendCallback&readySendCallback);
+    ///Implementation of getQueuedBytes interface
+    virtual size_t getQueuedBytes()const;
+    ///Implementation of setPriority interface: there is no contention to schedule, so it is only remembered
+    virtual void setPriority(StreamPriority priority);
+    ///Implementation of getPriority interface
+    virtual StreamPriority getPriority()const;
+    ///Implementation of connect interface
+    virtual void connect(
+        const Address& addy,
+        const SubstreamCallback &substreamCallback,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedCallback&chunkReceivedCallback);
+    ///Implementation of connect interface delivering views of the received Chunks
+    virtual void connectViews(
+        const Address& addy,
+        const SubstreamCallback &substreamCallback,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedViewCallback&chunkReceivedCallback);
+    ///Creates a stream of the same type as this stream, with the same IOService
+    virtual Stream* factory();
+    ///Creates a new substream on this connection
+    virtual bool cloneFrom(Stream*,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedCallback&chunkReceivedCallback);
+    ///Creates a new substream on this connection delivering views of the received Chunks
+    virtual bool cloneFromViews(Stream*,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedViewCallback&chunkReceivedCallback);
+    ///Closes this stream: the other end gets a Disconnected callback once it has received everything sent before the close
+    virtual void close();
+};
+} }
+#endif
@@ -0,0 +1,66 @@
+/*  Sirikata Network Utilities
+ *  LoopbackStreamListener.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TCPDefinitions.hpp"
+#include "LoopbackStream.hpp"
+#include "LoopbackStreamListener.hpp"
+#include "LoopbackConnection.hpp"
+namespace Sirikata { namespace Network {
+
+LoopbackStreamListener::LoopbackStreamListener(IOService&io):mIOService(&io),mAddress("",""),mListening(false) {
+}
+bool LoopbackStreamListener::listen(const Address&address,
+                                    const Stream::SubstreamCallback&newStreamCallback) {
+    close();
+    mListening=LoopbackConnection::listen(address,mIOService,newStreamCallback);
+    if (mListening) {
+        mAddress=address;
+    }
+    return mListening;
+}
+LoopbackStreamListener::~LoopbackStreamListener() {
+    close();
+}
+String LoopbackStreamListener::listenAddressName() const {
+    return mAddress.getHostName()+':'+mAddress.getService();
+}
+Address LoopbackStreamListener::listenAddress() const {
+    return mAddress;
+}
+void LoopbackStreamListener::close(){
+    if (mListening) {
+        LoopbackConnection::unlisten(mAddress);
+        mListening=false;
+    }
+}
+
+} }
@@ -0,0 +1,59 @@
+/*  Sirikata Network Utilities
+ *  LoopbackStreamListener.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_LoopbackStreamListener_HPP__
+#define SIRIKATA_LoopbackStreamListener_HPP__
+#include "StreamListener.hpp"
+namespace Sirikata { namespace Network {
+class IOService;
+/**
+ * Accepts LoopbackStream connections made from within the process to the address it listens on.
+ * The address is only a name shared by the two ends: no socket is opened.
+ * The substream callback for each connection is made from the IOService the listener was built on
+ */
+class SIRIKATA_EXPORT LoopbackStreamListener:public StreamListener{
+    IOService*mIOService;
+    Address mAddress;
+    bool mListening;
+public:
+    LoopbackStreamListener(IOService&);
+    ///Claims addy for this listener: returns false if another listener in the process already has it
+    virtual bool listen(
+        const Address&addy,
+        const Stream::SubstreamCallback&newStreamCallback);
+    virtual String listenAddressName()const;
+    virtual Address listenAddress()const;
+    ///Stops accepting connections: ones already made carry on
+    virtual void close();
+    virtual ~LoopbackStreamListener();
+};
+} }
+#endif
@@ -30,19 +30,32 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "util/Standard.hh"
+#include "options/Options.hpp"
 #include "TCPDefinitions.hpp"
 #include "Stream.hpp"
 #include "TCPStream.hpp"
+#include "ChunkPool.hpp"
 #include "util/ThreadSafeQueue.hpp"
 #include "ASIOSocketWrapper.hpp"
+#include "ASIODatagramSocket.hpp"
+#include "StreamCompression.hpp"
 #include "MultiplexedSocket.hpp"
+#include "NetworkMetrics.hpp"
 #include "ASIOConnectAndHandshake.hpp"
 #include "TCPSetCallbacks.hpp"
 
 namespace Sirikata { namespace Network {
-
+namespace {
+OptionValue*sKeepaliveInterval;
+OptionValue*sKeepaliveTimeout;
+InitializeGlobalOptions gKeepaliveOptions("tcpsst",
+    sKeepaliveInterval=new OptionValue("keepalive","5",OptionValueType<double>(),"Ping each socket of a connection this many seconds apart to measure its round trip time and notice when the other end has gone (0 never pings)"),
+    sKeepaliveTimeout=new OptionValue("keepalivetimeout","30",OptionValueType<double>(),"Disconnect a connection once a ping has gone this many seconds unanswered by an end that has answered pings before (0 never gives up)"),
+    NULL);
+}
 
 boost::mutex MultiplexedSocket::sConnectingMutex; 
+AtomicValue<uint32> MultiplexedSocket::sNextCaptureID(0);
 
 
 void triggerMultiplexedConnectionError(MultiplexedSocket*socket,ASIOSocketWrapper*wrapper,const boost::system::error_code &error){
@@ -66,8 +79,10 @@ void MultiplexedSocket::ioReactorThreadCommitCallback(StreamIDCallbackPair& newc
 }
 
 bool MultiplexedSocket::CommitCallbacks(std::deque<StreamIDCallbackPair> &registration, SocketConnectionPhase status, bool setConnectedStatus) {
-    static boost::thread::id reactorThread=boost::this_thread::get_id();
-    assert(boost::this_thread::get_id()==reactorThread);//this function must happen from the IO reactor so it can copy over registrations without a lock
+    if (mReactorThread==boost::thread::id()) {
+        mReactorThread=boost::this_thread::get_id();
+    }
+    assert(boost::this_thread::get_id()==mReactorThread);//this function must happen from the IO reactor so it can copy over registrations without a lock
     bool statusChanged=false;
     if (setConnectedStatus||!mCallbackRegistration.empty()) {
         if (status==CONNECTED) {
@@ -106,12 +121,59 @@ bool MultiplexedSocket::CommitCallbacks(std::deque<StreamIDCallbackPair> &regist
     return statusChanged;
 }
 
+uint64 MultiplexedSocket::sendLoad(size_t whichStream) const{
+    const ASIOSocketWrapper&socket=mSockets[whichStream];
+    return (uint64)socket.getQueuedBytes()
+        +(uint64)socket.getInFlightBytes()
+        +((uint64)socket.getAverageSendLatency()+socket.getRoundTripTime())*LATENCY_LOAD_WEIGHT;
+}
+void MultiplexedSocket::snapshot(NetworkMetrics::ConnectionSnapshot&snapshot)const {
+    size_t numSockets=mSockets.size();
+    snapshot.mQueuedBytes.resize(numSockets);
+    snapshot.mInFlightBytes.resize(numSockets);
+    snapshot.mAverageSendLatency.resize(numSockets);
+    snapshot.mRoundTripTime.resize(numSockets);
+    for (size_t i=0;i<numSockets;++i) {
+        snapshot.mQueuedBytes[i]=mSockets[i].getQueuedBytes();
+        snapshot.mInFlightBytes[i]=mSockets[i].getInFlightBytes();
+        snapshot.mAverageSendLatency[i]=mSockets[i].getAverageSendLatency();
+        snapshot.mRoundTripTime[i]=mSockets[i].getRoundTripTime();
+    }
+}
+uint32 MultiplexedSocket::roundTripTime()const {
+    uint32 lowest=0;
+    for (size_t i=0;i<mSockets.size();++i) {
+        uint32 roundTrip=mSockets[i].getRoundTripTime();
+        if (roundTrip&&(lowest==0||roundTrip<lowest)) {
+            lowest=roundTrip;
+        }
+    }
+    return lowest;
+}
 size_t MultiplexedSocket::leastBusyStream() {
-        ///FIXME look at bytes to be sent or recently used, etc
-        return rand()%mSockets.size();
- }
+    size_t numSockets=mSockets.size();
+    //start at a random socket so that equally idle sockets share the unordered traffic
+    size_t start=rand()%numSockets;
+    size_t retval=start;
+    uint64 lowestLoad=sendLoad(start);
+    for (size_t i=1;i<numSockets&&lowestLoad;++i) {
+        size_t which=(start+i)%numSockets;
+        uint64 load=sendLoad(which);
+        if (load<lowestLoad) {
+            lowestLoad=load;
+            retval=which;
+        }
+    }
+    return retval;
+}
 float MultiplexedSocket::dropChance(const Chunk*data,size_t whichStream) {
-    return .25;
+    const float maxDropChance=.95f;
+    uint32 queued=mSockets[whichStream].getQueuedBytes()+(uint32)data->size();
+    if (queued<=UNRELIABLE_DROP_LOW_WATER)
+        return 0;
+    if (queued>=UNRELIABLE_DROP_HIGH_WATER)
+        return maxDropChance;
+    return maxDropChance*(float)(queued-UNRELIABLE_DROP_LOW_WATER)/(float)(UNRELIABLE_DROP_HIGH_WATER-UNRELIABLE_DROP_LOW_WATER);
 }
 
 void MultiplexedSocket::sendBytesNow(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const RawRequest&data) {
@@ -120,24 +182,36 @@ void MultiplexedSocket::sendBytesNow(const std::tr1::shared_ptr<MultiplexedSocke
     static Stream::StreamID::Hasher hasher;
     if (data.originStream==Stream::StreamID()) {
         unsigned int socket_size=(unsigned int)thus->mSockets.size();
-        for(unsigned int i=1;i<socket_size;++i) {                
-            thus->mSockets[i].rawSend(thus,new Chunk(*data.data));
+        //every socket queues the very same serialized packet: the last one to finish sending it releases it
+        ChunkPool::share(data.data,socket_size-1);
+        for(unsigned int i=0;i<socket_size;++i) {
+            thus->mSockets[i].rawSend(thus,data.data,data.priority,data.closedStream);
         }
-        thus->mSockets[0].rawSend(thus,data.data);
     }else {
+        if (data.unreliable&&thus->mDatagramsReady.read()&&data.data->size()<=thus->mDatagramSocket->getMaxDatagramSize()) {
+            ASIODatagramSocket::send(thus->mDatagramSocket,data.data);
+            NetworkMetrics::add(NetworkMetrics::DATAGRAMS_SENT);
+            return;
+        }
         size_t whichStream=data.unordered?thus->leastBusyStream():hasher(data.originStream)%thus->mSockets.size();
         if (data.unreliable==false||rand()/(float)RAND_MAX>thus->dropChance(data.data,whichStream)) {
-            thus->mSockets[whichStream].rawSend(thus,data.data);
-        }        
+            thus->mSockets[whichStream].rawSend(thus,data.data,data.priority,data.originStream);
+        }else {
+            ChunkPool::release(data.data);
+            NetworkMetrics::add(NetworkMetrics::UNRELIABLE_DROPS);
+        }
     }
 }
 
 
-void MultiplexedSocket::closeStream(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const Stream::StreamID&sid,TCPStream::TCPStreamControlCodes code) {
+void MultiplexedSocket::closeStream(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const Stream::StreamID&sid,TCPStream::TCPStreamControlCodes code,StreamPriority priority) {
     RawRequest closeRequest;
     closeRequest.originStream=Stream::StreamID();//control packet
+    closeRequest.closedStream=sid;
     closeRequest.unordered=false;
     closeRequest.unreliable=false;
+    //queued in the stream's own class so that it cannot overtake the stream's last packets on any socket
+    closeRequest.priority=priority;
     closeRequest.data=ASIOSocketWrapper::constructControlPacket(code,sid);
     sendBytes(thus,closeRequest);
 }
@@ -181,22 +255,27 @@ MultiplexedSocket::SocketConnectionPhase MultiplexedSocket::addCallbacks(const S
 
 
 Stream::StreamID MultiplexedSocket::getNewID() {
-    if (!mFreeStreamIDs.probablyEmpty()) {
-        Stream::StreamID retval;
-        if (mFreeStreamIDs.pop(retval))
-            return retval;
-    }
+    Stream::StreamID freeID;
+    if (mFreeStreamIDs.pop(freeID))
+        return freeID;
     unsigned int retval=mHighestStreamID+=2;
     assert(retval>1);
     return Stream::StreamID(retval);
 }
-MultiplexedSocket::MultiplexedSocket(IOService*io, const Stream::SubstreamCallback&substreamCallback):mIO(io),mNewSubstreamCallback(substreamCallback),mHighestStreamID(1) {
+MultiplexedSocket::MultiplexedSocket(IOService*io, const Stream::SubstreamCallback&substreamCallback):mIO(io),mNewSubstreamCallback(substreamCallback),mDatagramsReady(0),mPeerDecompresses(0),mPeerReassembles(0),mCaptureID(sNextCaptureID++),mHighestStreamID(1),mKeepaliveTimer(NULL),mNextPingSequence(0),mPeerAnswersPings(false) {
     mSocketConnectionPhase=PRECONNECTION;
 }
 MultiplexedSocket::MultiplexedSocket(IOService*io,const UUID&uuid,const std::vector<TCPSocket*>&sockets, const Stream::SubstreamCallback &substreamCallback)
     : mIO(io),
      mNewSubstreamCallback(substreamCallback),
-     mHighestStreamID(0) {
+     mDatagramsReady(0),
+     mPeerDecompresses(0),
+     mPeerReassembles(0),
+     mCaptureID(sNextCaptureID++),
+     mHighestStreamID(0),
+     mKeepaliveTimer(NULL),
+     mNextPingSequence(0),
+     mPeerAnswersPings(false) {
     mSocketConnectionPhase=PRECONNECTION;
     for (unsigned int i=0;i<(unsigned int)sockets.size();++i) {
         mSockets.push_back(ASIOSocketWrapper(sockets[i]));
@@ -220,9 +299,14 @@ MultiplexedSocket::~MultiplexedSocket() {
     mNewSubstreamCallback=&Stream::ignoreSubstreamCallback;
     TCPSetCallbacks setCallbackFunctor(this,NULL);        
     callbackToBeDeleted(NULL,setCallbackFunctor);
+    //cancels the wait, whose handler then finds this gone
+    delete mKeepaliveTimer;
     for (unsigned int i=0;i<(unsigned int)mSockets.size();++i){
         mSockets[i].shutdownAndClose();
     }        
+    if (mDatagramSocket) {
+        mDatagramSocket->close();
+    }
     boost::lock_guard<boost::mutex> connecting_mutex(sConnectingMutex);        
     for (unsigned int i=0;i<(unsigned int)mSockets.size();++i){
         mSockets[i].destroySocket();
@@ -234,7 +318,7 @@ MultiplexedSocket::~MultiplexedSocket() {
         mCallbackRegistration.pop_front();
     }
     for (size_t i=0;i<mNewRequests.size();++i) {
-        delete mNewRequests[i].data;
+        ChunkPool::release(mNewRequests[i].data);
     }
     mNewRequests.clear();
     while(!mCallbacks.empty()) {
@@ -244,6 +328,7 @@ MultiplexedSocket::~MultiplexedSocket() {
 }
 
 void MultiplexedSocket::shutDownClosedStream(unsigned int controlCode,const Stream::StreamID &id) {
+    NetworkMetrics::add(NetworkMetrics::STREAMS_CLOSED);
     if (controlCode==TCPStream::TCPStreamCloseStream){
         std::deque<StreamIDCallbackPair> registrations;
         CommitCallbacks(registrations,CONNECTED,false);
@@ -261,6 +346,9 @@ void MultiplexedSocket::shutDownClosedStream(unsigned int controlCode,const Stre
             mCallbacks.erase(where);
         }                                    
     }
+    //a message the remote end was partway through sending will never be completed
+    mPartialMessages.erase(id);
+    mDecompressors.erase(id);
     std::tr1::unordered_set<Stream::StreamID>::iterator where=mOneSidedClosingStreams.find(id);
     if (where!=mOneSidedClosingStreams.end()) {
         mOneSidedClosingStreams.erase(where);
@@ -269,7 +357,14 @@ void MultiplexedSocket::shutDownClosedStream(unsigned int controlCode,const Stre
         mFreeStreamIDs.push(id);
     }
 }
-void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,const Chunk&newChunk){
+StreamPriority MultiplexedSocket::streamPriority(const Stream::StreamID&id)const {
+    CallbackMap::const_iterator where=mCallbacks.find(id);
+    if (where!=mCallbacks.end()) {
+        return where->second->mPriority;
+    }
+    return NormalPriority;
+}
+void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,const ChunkView&newChunk){
     if (id==Stream::StreamID()) {//control packet
         if(newChunk.size()) {
             unsigned int controlCode=*newChunk.begin();
@@ -290,16 +385,18 @@ void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::Strea
                         int how_much=where->second;
                         if (where->second==mSockets.size()) {
                             mAckedClosingStreams.erase(where);        
+                            StreamPriority priority=streamPriority(id);
                             shutDownClosedStream(controlCode,id);
                             if (controlCode==TCPStream::TCPStreamCloseStream) {
-                                closeStream(getSharedPtr(),id,TCPStream::TCPStreamAckCloseStream);
+                                closeStream(getSharedPtr(),id,TCPStream::TCPStreamAckCloseStream,priority);
                             }
                         }
                     }else{
                         if (mSockets.size()==1) {
+                            StreamPriority priority=streamPriority(id);
                             shutDownClosedStream(controlCode,id);
                             if (controlCode==TCPStream::TCPStreamCloseStream) {
-                                closeStream(getSharedPtr(),id,TCPStream::TCPStreamAckCloseStream);
+                                closeStream(getSharedPtr(),id,TCPStream::TCPStreamAckCloseStream,priority);
                             }
                         }else {
                             mAckedClosingStreams[id]=1;
@@ -307,29 +404,259 @@ void MultiplexedSocket::receiveFullChunk(unsigned int whichSocket, Stream::Strea
                     }
                 }
                 break;
+              case TCPStream::TCPStreamFragment:
+              case TCPStream::TCPStreamLastFragment:
+              case TCPStream::TCPStreamLastCompressedFragment:
+              case TCPStream::TCPStreamCompressedMessage:
+                receiveFragment(controlCode,newChunk);
+                break;
+              case TCPStream::TCPStreamCompressionOffer:{
+                  Stream::uint30 version;
+                  unsigned int avail_len=newChunk.size()-1;
+                  if (newChunk.size()>=2&&version.unserialize((const uint8*)&(newChunk[1]),avail_len)&&version.read()==StreamCompressor::VERSION) {
+                      mPeerDecompresses.compareAndSwap(0,1);
+                  }
+              }
+                break;
+              case TCPStream::TCPStreamFragmentationOffer:{
+                  Stream::uint30 version;
+                  unsigned int avail_len=newChunk.size()-1;
+                  if (newChunk.size()>=2&&version.unserialize((const uint8*)&(newChunk[1]),avail_len)&&version.read()>=TCPStream::FRAGMENTATION_VERSION) {
+                      mPeerReassembles.compareAndSwap(0,1);
+                  }
+              }
+                break;
+              case TCPStream::TCPStreamPing:
+              case TCPStream::TCPStreamPong:{
+                  Stream::uint30 sequence;
+                  unsigned int avail_len=newChunk.size()-1;
+                  if (newChunk.size()<2||!sequence.unserialize((const uint8*)&(newChunk[1]),avail_len)) {
+                      SILOG(tcpsst,warning,"Keepalive control chunk malformed");
+                  }else if (controlCode==TCPStream::TCPStreamPing) {
+                      //answered on the socket it came in on so the round trip is that socket's
+                      mSockets[whichSocket].rawSend(getSharedPtr(),ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamPong,sequence),InteractivePriority);
+                  }else if (mSockets[whichSocket].pongReceived(sequence.read())) {
+                      mPeerAnswersPings=true;
+                  }
+              }
+                break;
+              case TCPStream::TCPStreamDatagramOffer:
+              case TCPStream::TCPStreamDatagramAccept:{
+                  //the port travels where a close would carry its StreamID
+                  Stream::uint30 port;
+                  unsigned int avail_len=newChunk.size()-1;
+                  if (newChunk.size()<2||!port.unserialize((const uint8*)&(newChunk[1]),avail_len)||port.read()==0||port.read()>65535) {
+                      SILOG(tcpsst,warning,"Datagram control chunk malformed");
+                  }else if (controlCode==TCPStream::TCPStreamDatagramOffer) {
+                      acceptDatagrams(whichSocket,port.read());
+                  }else {
+                      datagramsAccepted(whichSocket,port.read());
+                  }
+              }
+                break;
               default:
                 break;
             }
         }
     }else {
-        std::deque<StreamIDCallbackPair> registrations;
-        CommitCallbacks(registrations,CONNECTED,false);
-        CallbackMap::iterator where=mCallbacks.find(id);
-        if (where!=mCallbacks.end()) {
-            where->second->mBytesReceivedCallback(newChunk);
-        }else if (mOneSidedClosingStreams.find(id)==mOneSidedClosingStreams.end()) {
-            //new substream
-            TCPStream*newStream=new TCPStream(getSharedPtr(),id);
-            TCPSetCallbacks setCallbackFunctor(this,newStream);
-            mNewSubstreamCallback(newStream,setCallbackFunctor);
-            if (setCallbackFunctor.mCallbacks != NULL) {
-                CommitCallbacks(registrations,CONNECTED,false);//make sure bytes are received
-                setCallbackFunctor.mCallbacks->mBytesReceivedCallback(newChunk);
-            }else {
-                closeStream(getSharedPtr(),id);
+        receiveStreamChunk(id,newChunk);
+    }
+}
+void MultiplexedSocket::receiveStreamChunk(const Stream::StreamID&id,const ChunkView&newChunk){
+    std::deque<StreamIDCallbackPair> registrations;
+    CommitCallbacks(registrations,CONNECTED,false);
+    CallbackMap::iterator where=mCallbacks.find(id);
+    if (where!=mCallbacks.end()) {
+        where->second->bytesReceived(newChunk);
+    }else if (mOneSidedClosingStreams.find(id)==mOneSidedClosingStreams.end()) {
+        //new substream
+        NetworkMetrics::add(NetworkMetrics::STREAMS_OPENED);
+        TCPStream*newStream=new TCPStream(getSharedPtr(),id);
+        TCPSetCallbacks setCallbackFunctor(this,newStream);
+        mNewSubstreamCallback(newStream,setCallbackFunctor);
+        if (setCallbackFunctor.mCallbacks != NULL) {
+            CommitCallbacks(registrations,CONNECTED,false);//make sure bytes are received
+            setCallbackFunctor.mCallbacks->bytesReceived(newChunk);
+        }else {
+            closeStream(getSharedPtr(),id);
+        }
+    }else {
+        //IGNORED MESSAGE
+    }
+}
+void MultiplexedSocket::receiveFragment(unsigned int controlCode,const ChunkView&frame){
+    Stream::StreamID id;
+    unsigned int idLength=frame.size()-1;
+    if (frame.size()<2||!id.unserialize(&frame[1],idLength)||id==Stream::StreamID()) {
+        SILOG(tcpsst,warning,"Fragment control chunk too short");
+        return;
+    }
+    size_t headerLength=1+idLength;
+    if (controlCode==TCPStream::TCPStreamCompressedMessage) {
+        //stands alone, so it leaves any message of the stream being reassembled from another socket's frames as it is
+        receiveCompressed(id,frame.subView(headerLength,frame.size()-headerLength));
+        return;
+    }
+    PartialMessageMap::iterator where=mPartialMessages.find(id);
+    if (controlCode!=TCPStream::TCPStreamFragment&&where==mPartialMessages.end()) {
+        //a message that happened to fit in its final frame needs no reassembly
+        if (controlCode==TCPStream::TCPStreamLastCompressedFragment) {
+            receiveCompressed(id,frame.subView(headerLength,frame.size()-headerLength));
+        }else {
+            receiveStreamChunk(id,frame.subView(headerLength,frame.size()-headerLength));
+        }
+        return;
+    }
+    if (where==mPartialMessages.end()) {
+        where=mPartialMessages.insert(PartialMessageMap::value_type(id,ChunkPool::allocateShared(0))).first;
+    }
+    Chunk&message=*where->second;
+    message.insert(message.end(),frame.begin()+headerLength,frame.end());
+    if (controlCode!=TCPStream::TCPStreamFragment) {
+        ChunkView wholeMessage(where->second);
+        mPartialMessages.erase(where);
+        if (controlCode==TCPStream::TCPStreamLastCompressedFragment) {
+            receiveCompressed(id,wholeMessage);
+        }else {
+            receiveStreamChunk(id,wholeMessage);
+        }
+    }
+}
+void MultiplexedSocket::receiveCompressed(const Stream::StreamID&id,const ChunkView&compressed) {
+    std::tr1::shared_ptr<StreamDecompressor>&decompressor=mDecompressors[id];
+    if (!decompressor) {
+        decompressor.reset(new StreamDecompressor);
+    }
+    std::tr1::shared_ptr<Chunk> message(ChunkPool::allocateShared(0));
+    if (!decompressor->decompress(compressed.begin(),compressed.size(),*message)) {
+        SILOG(tcpsst,warning,"Dropping malformed compressed message for stream "<<id.read());
+        return;
+    }
+    receiveStreamChunk(id,ChunkView(message));
+}
+void MultiplexedSocket::offerCompression(const std::tr1::shared_ptr<MultiplexedSocket>&thus) {
+    thus->mSockets[0].rawSend(thus,ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamCompressionOffer,Stream::StreamID(StreamCompressor::VERSION)));
+}
+void MultiplexedSocket::offerFragmentation(const std::tr1::shared_ptr<MultiplexedSocket>&thus) {
+    thus->mSockets[0].rawSend(thus,ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamFragmentationOffer,Stream::StreamID(TCPStream::FRAGMENTATION_VERSION)));
+}
+void MultiplexedSocket::startKeepalive(const std::tr1::shared_ptr<MultiplexedSocket>&thus) {
+    if (sKeepaliveInterval->as<double>()<=0||thus->mKeepaliveTimer)
+        return;
+    thus->mKeepaliveTimer=new boost::asio::deadline_timer(*thus->mIO);
+    thus->scheduleKeepalive();
+}
+void MultiplexedSocket::scheduleKeepalive() {
+    mKeepaliveTimer->expires_from_now(boost::posix_time::microseconds((int64)(sKeepaliveInterval->as<double>()*1000000.)));
+    mKeepaliveTimer->async_wait(boost::bind(&MultiplexedSocket::keepaliveTick,
+                                            getWeakPtr(),
+                                            boost::asio::placeholders::error));
+}
+void MultiplexedSocket::keepaliveTick(const std::tr1::weak_ptr<MultiplexedSocket>&weak_thus,const boost::system::error_code&error) {
+    std::tr1::shared_ptr<MultiplexedSocket> thus=weak_thus.lock();
+    if (error||!thus||thus->mSocketConnectionPhase==DISCONNECTED)
+        return;
+    double timeout=sKeepaliveTimeout->as<double>();
+    Task::AbsTime now=Task::AbsTime::now();
+    for (unsigned int i=0;i<(unsigned int)thus->mSockets.size();++i) {
+        ASIOSocketWrapper&socket=thus->mSockets[i];
+        if (socket.getPingSentTime()==Task::AbsTime::null()) {
+            socket.sendPing(thus,thus->mNextPingSequence++&((1<<30)-1));
+        }else if (thus->mPeerAnswersPings&&timeout>0&&(double)(now-socket.getPingSentTime())>timeout) {
+            SILOG(tcpsst,warning,"Socket "<<i<<" went "<<timeout<<" seconds without answering a keepalive: disconnecting");
+            NetworkMetrics::add(NetworkMetrics::KEEPALIVE_TIMEOUTS);
+            thus->hostDisconnectedCallback(i,std::string("Remote host stopped answering keepalives"));
+            //shut down rather than closed since other threads may be sending on them: their reads then fail as though the peer had hung up
+            for (std::vector<ASIOSocketWrapper>::iterator j=thus->mSockets.begin(),je=thus->mSockets.end();j!=je;++j) {
+                boost::system::error_code ignored;
+                j->getSocket().shutdown(boost::asio::ip::tcp::socket::shutdown_both,ignored);
+            }
+            return;
+        }
+    }
+    thus->scheduleKeepalive();
+}
+void MultiplexedSocket::offerDatagrams(const std::tr1::shared_ptr<MultiplexedSocket>&thus) {
+    boost::system::error_code error;
+    boost::asio::ip::tcp::endpoint local=thus->mSockets[0].getSocket().local_endpoint(error);
+    if (error)
+        return;
+    std::tr1::shared_ptr<ASIODatagramSocket> datagramSocket(new ASIODatagramSocket(*thus->mIO));
+    unsigned short port=datagramSocket->open(local.address());
+    if (port==0)
+        return;
+    //listen straight away since the other end may start sending as soon as it accepts
+    thus->mDatagramSocket=datagramSocket;
+    ASIODatagramSocket::startReceiving(datagramSocket,thus);
+    thus->mSockets[0].rawSend(thus,ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamDatagramOffer,Stream::StreamID(port)));
+}
+void MultiplexedSocket::acceptDatagrams(unsigned int whichSocket,unsigned int port) {
+    if (mDatagramSocket)
+        return;
+    boost::system::error_code error;
+    TCPSocket&socket=mSockets[whichSocket].getSocket();
+    boost::asio::ip::tcp::endpoint local=socket.local_endpoint(error);
+    boost::asio::ip::tcp::endpoint remote;
+    if (!error)
+        remote=socket.remote_endpoint(error);
+    if (error)
+        return;
+    std::tr1::shared_ptr<ASIODatagramSocket> datagramSocket(new ASIODatagramSocket(*mIO));
+    unsigned short localPort=datagramSocket->open(local.address());
+    if (localPort==0||!datagramSocket->connect(boost::asio::ip::udp::endpoint(remote.address(),(unsigned short)port))) {
+        datagramSocket->close();
+        return;
+    }
+    mDatagramSocket=datagramSocket;
+    ASIODatagramSocket::startReceiving(datagramSocket,getWeakPtr());
+    mDatagramsReady.compareAndSwap(0,1);
+    mSockets[whichSocket].rawSend(getSharedPtr(),ASIOSocketWrapper::constructControlPacket(TCPStream::TCPStreamDatagramAccept,Stream::StreamID(localPort)));
+}
+void MultiplexedSocket::datagramsAccepted(unsigned int whichSocket,unsigned int port) {
+    if (!mDatagramSocket||mDatagramsReady.read())
+        return;
+    boost::system::error_code error;
+    boost::asio::ip::tcp::endpoint remote=mSockets[whichSocket].getSocket().remote_endpoint(error);
+    if (!error&&mDatagramSocket->connect(boost::asio::ip::udp::endpoint(remote.address(),(unsigned short)port))) {
+        mDatagramsReady.compareAndSwap(0,1);
+    }
+}
+void MultiplexedSocket::receiveDatagram(const ChunkView&datagram) {
+    NetworkMetrics::add(NetworkMetrics::DATAGRAMS_RECEIVED);
+    Stream::uint30 packetLength;
+    unsigned int lengthLength=datagram.size();
+    if (!packetLength.unserialize(datagram.begin(),lengthLength)||lengthLength+packetLength.read()!=datagram.size()) {
+        SILOG(tcpsst,warning,"Datagram does not hold exactly one packet");
+        return;
+    }
+    Stream::StreamID id;
+    unsigned int idLength=packetLength.read();
+    if (!id.unserialize(datagram.begin()+lengthLength,idLength)) {
+        return;
+    }
+    size_t headerLength=lengthLength+idLength;
+    ChunkView payload=datagram.subView(headerLength,datagram.size()-headerLength);
+    bool compressed=false;
+    if (id==Stream::StreamID()) {
+        //the only control packet sent as a datagram is an unreliable compressed message, which always stands alone
+        unsigned int streamIdLength=payload.size()-1;
+        if (payload.size()<2||payload[0]!=TCPStream::TCPStreamCompressedMessage||!id.unserialize(payload.begin()+1,streamIdLength)||id==Stream::StreamID()) {
+            return;
+        }
+        payload=payload.subView(1+streamIdLength,payload.size()-1-streamIdLength);
+        compressed=true;
+    }
+    std::deque<StreamIDCallbackPair> registrations;
+    CommitCallbacks(registrations,CONNECTED,false);
+    CallbackMap::iterator where=mCallbacks.find(id);
+    if (where!=mCallbacks.end()) {
+        if (compressed) {
+            std::tr1::shared_ptr<Chunk> message(ChunkPool::allocateShared(0));
+            if (StreamDecompressor::decompressStandalone(payload.begin(),payload.size(),*message)) {
+                where->second->bytesReceived(ChunkView(message));
             }
         }else {
-            //IGNORED MESSAGE
+            where->second->bytesReceived(payload);
         }
     }
 }
@@ -29,18 +29,34 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include "util/LockFreeStack.hpp"
 
 namespace Sirikata { namespace Network {
-
+class ASIODatagramSocket;
+class StreamDecompressor;
+class PacketReplay;
 class MultiplexedSocket:public SelfWeakPtr<MultiplexedSocket> {
+    friend class PacketReplay;
 public:
     class RawRequest {
     public:
         bool unordered;
         bool unreliable;
         Stream::StreamID originStream;
+        ///For a close, the stream it closes: each socket queues the close behind that stream's packets
+        Stream::StreamID closedStream;
+        ///The class of traffic the sockets schedule this packet in
+        StreamPriority priority;
         Chunk * data;
     };
+    enum LoadBalancingConstants{
+        ///How many bytes of queued data a microsecond of average send latency or round trip time is worth when comparing socket load
+        LATENCY_LOAD_WEIGHT=1,
+        ///Unreliable packets are never dropped while fewer than this many bytes are queued on the chosen socket
+        UNRELIABLE_DROP_LOW_WATER=16384,
+        ///Unreliable packets are dropped with the maximum probability once this many bytes are queued on the chosen socket
+        UNRELIABLE_DROP_HIGH_WATER=262144
+    };
     enum SocketConnectionPhase{
         PRECONNECTION,
         WAITCONNECTING,//need to fetch the lock, but about to connect
@@ -81,16 +97,40 @@ private:
     std::deque<StreamIDCallbackPair> mCallbackRegistration;
     ///a map of ID to callback, only to be touched by the io reactor thread
     CallbackMap mCallbacks;
+    ///the thread running this socket's IOService, noted on the first CommitCallbacks so debug builds can check nothing else touches mCallbacks
+    boost::thread::id mReactorThread;
+    typedef std::tr1::unordered_map<Stream::StreamID,std::tr1::shared_ptr<Chunk>,Stream::StreamID::Hasher> PartialMessageMap;
+    ///The frames received so far of messages that are still arriving, by stream: only touched by the IO reactor thread
+    PartialMessageMap mPartialMessages;
     ///a map from StreamID to count of number of acked close requests--to avoid any unordered packets coming in
     std::tr1::unordered_map<Stream::StreamID,unsigned int,Stream::StreamID::Hasher>mAckedClosingStreams;
     ///a set of StreamIDs to hold the streams that were requested closed but have not been acknowledged, to prevent received packets triggering NewStream callbacks as if a new ID were received
     std::tr1::unordered_set<Stream::StreamID,Stream::StreamID::Hasher>mOneSidedClosingStreams;
-#define ThreadSafeStack ThreadSafeQueue //FIXME this can be way more efficient
+    ///The UDP side channel, once one is negotiated: the connecting side holds it here from the moment it offers one
+    std::tr1::shared_ptr<ASIODatagramSocket> mDatagramSocket;
+    ///Set to 1 once both ends have agreed on mDatagramSocket, after which it is never changed and unreliable packets may use it
+    AtomicValue<uint32> mDatagramsReady;
+    ///Set to 1 once the other end has offered to decompress what this end sends
+    AtomicValue<uint32> mPeerDecompresses;
+    ///Set to 1 once the other end has offered to reassemble the frames of fragmented messages
+    AtomicValue<uint32> mPeerReassembles;
+    typedef std::tr1::unordered_map<Stream::StreamID,std::tr1::shared_ptr<StreamDecompressor>,Stream::StreamID::Hasher> DecompressorMap;
+    ///The history of the compressed ordered messages received so far, by stream: only touched by the IO reactor thread
+    DecompressorMap mDecompressors;
+    ///Tells this connection's packets apart from those of the process's other connections in a PacketCapture
+    uint32 mCaptureID;
+    ///The capture ID of the next MultiplexedSocket to be made
+    static AtomicValue<uint32> sNextCaptureID;
     ///The highest streamID that has been used for making new streams on this side
     AtomicValue<uint32> mHighestStreamID;
-    ///actually free stream IDs that will not be sent out until recalimed by this side
-    ThreadSafeStack<Stream::StreamID>mFreeStreamIDs;
-#undef ThreadSafeStack
+    ///actually free stream IDs that will not be sent out until recalimed by this side: taken and returned without a lock, as short lived substreams come and go from many threads
+    LockFreeStack<Stream::StreamID>mFreeStreamIDs;
+    ///Fires every tcpsst.keepalive seconds once the connection is up: NULL before then and when keepalives are off
+    boost::asio::deadline_timer*mKeepaliveTimer;
+    ///The sequence number the next keepalive ping carries: only touched by the IO reactor thread
+    uint32 mNextPingSequence;
+    ///Set once the other end has answered a ping, after which it must keep answering them: only touched by the IO reactor thread
+    bool mPeerAnswersPings;
 
 //Begin helper functions//
 
@@ -98,11 +138,14 @@ private:
     void ioReactorThreadCommitCallback(StreamIDCallbackPair& newcallback);
     ///reads the current list of id-callback pairs to the registration list and if setConectedStatus is set, changes the status of the overall MultiplexedSocket at the same time
     bool CommitCallbacks(std::deque<StreamIDCallbackPair> &registration, SocketConnectionPhase status, bool setConnectedStatus=false);
+    ///Returns an estimate of how backed up a particular socket is: queued and in flight bytes plus a penalty for slow recent sends and slowly answered pings
+    uint64 sendLoad(size_t whichStream) const;
     ///Returns the least busy stream upon which unordered data may be piled
     size_t leastBusyStream();
     /**
      *chance in the current load that an unreliable packet may be dropped 
-     * (due to busy queues, etc). 
+     * (due to busy queues, etc). Scales linearly with the bytes queued on whichStream between
+     * UNRELIABLE_DROP_LOW_WATER and UNRELIABLE_DROP_HIGH_WATER
      * \returns drop chance which must be less than 1.0 and greater or equal to 0.0 
      */
     float dropChance(const Chunk*data,size_t whichStream);
@@ -134,7 +177,7 @@ public:
      * Sends a packet telling the other side that this stream is closed (or alternatively if its a closeAck that the close request was received and no further packets for that
      * stream will be sent with that streamID
      */
-    static void closeStream(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const Stream::StreamID&sid,TCPStream::TCPStreamControlCodes code=TCPStream::TCPStreamCloseStream);
+    static void closeStream(const std::tr1::shared_ptr<MultiplexedSocket>&thus,const Stream::StreamID&sid,TCPStream::TCPStreamControlCodes code=TCPStream::TCPStreamCloseStream,StreamPriority priority=NormalPriority);
 
     /**
      * Either sends or queues bytes in the data request depending on the connection state 
@@ -158,12 +201,56 @@ public:
     ~MultiplexedSocket();
     ///a stream that has been closed and the other side has agreed not to send any more packets using that ID
     void shutDownClosedStream(unsigned int controlCode,const Stream::StreamID &id);
+    ///The priority the local end of stream id registered its callbacks with (NormalPriority if it has none): only valid from the IO reactor thread
+    StreamPriority streamPriority(const Stream::StreamID&id)const;
     /**
      * Process an entire packet when received from the IO reactor thread.
      * Control packets come in on Stream::StreamID() and others should be directed
-     * to the appropriate callback
+     * to the appropriate callback. newChunk views the receive slab, so callbacks that want a Chunk of their own get a copy
+     */
+    void receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,const ChunkView&newChunk);
+    ///Hands a complete message to the callbacks for stream id, offering it to the substream callback if the stream is new
+    void receiveStreamChunk(const Stream::StreamID&id,const ChunkView&newChunk);
+    ///Appends a frame of a fragmented message to the rest of it, delivering the message once its final frame arrives
+    void receiveFragment(unsigned int controlCode,const ChunkView&frame);
+    ///Decompresses a message for stream id in the stream's history and hands it to receiveStreamChunk: drops it with a warning if it is malformed
+    void receiveCompressed(const Stream::StreamID&id,const ChunkView&compressed);
+    ///Tells the other end that this end can decompress what it sends. Called by either side once its handshake completes
+    static void offerCompression(const std::tr1::shared_ptr<MultiplexedSocket>&thus);
+    ///Whether the other end has offered to decompress what this end sends
+    bool peerDecompresses()const {
+        return mPeerDecompresses.read()!=0;
+    }
+    ///Tells the other end that this end can reassemble fragmented messages. Called by either side once its handshake completes
+    static void offerFragmentation(const std::tr1::shared_ptr<MultiplexedSocket>&thus);
+    ///Whether the other end has offered to reassemble the frames of fragmented messages this end sends
+    bool peerReassembles()const {
+        return mPeerReassembles.read()!=0;
+    }
+    /**
+     * Opens a UDP side channel next to the TCP sockets and offers it to the other end, which may accept it by opening one of its own.
+     * Called by the connecting side once its handshake completes
      */
-    void receiveFullChunk(unsigned int whichSocket, Stream::StreamID id,const Chunk&newChunk);
+    static void offerDatagrams(const std::tr1::shared_ptr<MultiplexedSocket>&thus);
+    ///Answers the other end's offer of a side channel on port of the host at the other end of socket whichSocket
+    void acceptDatagrams(unsigned int whichSocket,unsigned int port);
+    ///Starts sending unreliable packets over the side channel now that the other end has opened its own on port
+    void datagramsAccepted(unsigned int whichSocket,unsigned int port);
+    /**
+     * Process a packet received on the UDP side channel from the IO reactor thread. Datagrams only reach streams that
+     * already have callbacks: an unreliable packet that outlived its stream must not open a new one
+     */
+    void receiveDatagram(const ChunkView&datagram);
+    ///Starts pinging every socket each tcpsst.keepalive seconds, if that is nonzero. Called by either side once its handshake completes
+    static void startKeepalive(const std::tr1::shared_ptr<MultiplexedSocket>&thus);
+    /**
+     * Pings each socket whose last ping has been answered. If one has gone unanswered for tcpsst.keepalivetimeout seconds
+     * and the other end is known to answer them, the connection is reported disconnected and its sockets are shut down.
+     * Otherwise waits for the next tick
+     */
+    static void keepaliveTick(const std::tr1::weak_ptr<MultiplexedSocket>&weak_thus,const boost::system::error_code&error);
+    ///Waits tcpsst.keepalive seconds before the next keepaliveTick
+    void scheduleKeepalive();
    /**
     * The a particular socket's connection failed
     * This function will call all substreams disconnected methods
@@ -245,5 +332,13 @@ public:
     const ASIOSocketWrapper&getASIOSocketWrapper(unsigned int whichSocket)const{
         return mSockets[whichSocket];
     }
+    ///The number this connection's packets go by in a PacketCapture
+    uint32 getCaptureID()const{
+        return mCaptureID;
+    }
+    ///Fills in the queued bytes, in flight bytes, send latency and round trip time of each socket
+    void snapshot(NetworkMetrics::ConnectionSnapshot&snapshot)const;
+    ///The lowest smoothed round trip time of any socket that has had a ping answered, in microseconds: 0 if none has
+    uint32 roundTripTime()const;
 };
 } }
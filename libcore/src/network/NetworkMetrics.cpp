@@ -0,0 +1,153 @@
+/*  Sirikata Network Utilities
+ *  NetworkMetrics.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "options/Options.hpp"
+#include "task/Time.hpp"
+#include "TCPDefinitions.hpp"
+#include "NetworkMetrics.hpp"
+namespace Sirikata { namespace Network {
+namespace {
+OptionValue*sMetricsInterval;
+InitializeGlobalOptions gMetricsOptions("tcpsst",
+    sMetricsInterval=new OptionValue("metricsinterval","0",OptionValueType<double>(),"Log the TCPSST traffic counters this many seconds apart while there is traffic (0 never logs them)"),
+    NULL);
+
+class ThreadCounters;
+///The counting blocks of every live thread along with the totals of threads that have exited, all guarded by mMutex
+class MetricsRegistry {
+public:
+    boost::mutex mMutex;
+    std::set<ThreadCounters*> mThreads;
+    NetworkMetrics::Snapshot mRetired;
+    ///when the next snapshot is due to be logged, or null if none has been scheduled
+    Task::AbsTime mNextLog;
+    MetricsRegistry():mNextLog(Task::AbsTime::null()) {
+    }
+} sMetricsRegistry;
+
+///A single thread's counts: only that thread writes them, and other threads only read them with sMetricsRegistry.mMutex held
+class ThreadCounters {
+public:
+    volatile uint64 mCounts[NetworkMetrics::NUM_COUNTERS];
+    ///increments left before this thread next checks whether a snapshot is due to be logged
+    unsigned int mUntilCheck;
+    ThreadCounters():mUntilCheck(NetworkMetrics::CHECK_INTERVAL) {
+        for (unsigned int i=0;i<NetworkMetrics::NUM_COUNTERS;++i) {
+            mCounts[i]=0;
+        }
+        boost::lock_guard<boost::mutex> lok(sMetricsRegistry.mMutex);
+        sMetricsRegistry.mThreads.insert(this);
+    }
+    ~ThreadCounters() {
+        boost::lock_guard<boost::mutex> lok(sMetricsRegistry.mMutex);
+        for (unsigned int i=0;i<NetworkMetrics::NUM_COUNTERS;++i) {
+            sMetricsRegistry.mRetired.mCounts[i]+=mCounts[i];
+        }
+        sMetricsRegistry.mThreads.erase(this);
+    }
+};
+boost::thread_specific_ptr<ThreadCounters> sThreadCounters;
+
+///Returns true, and schedules the next one, if the tcpsst.metricsinterval option says a snapshot is due
+bool logDue() {
+    double interval=sMetricsInterval->as<double>();
+    if (interval<=0)
+        return false;
+    Task::AbsTime now=Task::AbsTime::now();
+    boost::lock_guard<boost::mutex> lok(sMetricsRegistry.mMutex);
+    if (sMetricsRegistry.mNextLog==Task::AbsTime::null()) {
+        //the first check starts the clock rather than logging a partial interval
+        sMetricsRegistry.mNextLog=now+Task::DeltaTime::seconds(interval);
+        return false;
+    }
+    if (now<sMetricsRegistry.mNextLog)
+        return false;
+    sMetricsRegistry.mNextLog=now+Task::DeltaTime::seconds(interval);
+    return true;
+}
+}
+
+void NetworkMetrics::add(Counter which,uint64 amount) {
+    ThreadCounters*counters=sThreadCounters.get();
+    if (counters==NULL) {
+        counters=new ThreadCounters;
+        sThreadCounters.reset(counters);
+    }
+    counters->mCounts[which]+=amount;
+    if (--counters->mUntilCheck==0) {
+        counters->mUntilCheck=CHECK_INTERVAL;
+        if (logDue()) {
+            logSnapshot();
+        }
+    }
+}
+NetworkMetrics::Snapshot NetworkMetrics::snapshot() {
+    boost::lock_guard<boost::mutex> lok(sMetricsRegistry.mMutex);
+    Snapshot retval=sMetricsRegistry.mRetired;
+    for (std::set<ThreadCounters*>::const_iterator i=sMetricsRegistry.mThreads.begin(),ie=sMetricsRegistry.mThreads.end();i!=ie;++i) {
+        for (unsigned int which=0;which<NUM_COUNTERS;++which) {
+            retval.mCounts[which]+=(*i)->mCounts[which];
+        }
+    }
+    return retval;
+}
+const char*NetworkMetrics::name(Counter which) {
+    static const char*names[NUM_COUNTERS]={
+        "packets_queued",
+        "bytes_queued",
+        "packets_sent",
+        "socket_sends",
+        "bytes_sent",
+        "unreliable_drops",
+        "datagrams_sent",
+        "datagrams_received",
+        "socket_reads",
+        "bytes_received",
+        "packets_received",
+        "streams_opened",
+        "streams_closed",
+        "keepalive_timeouts"
+    };
+    return which<NUM_COUNTERS?names[which]:"unknown";
+}
+void NetworkMetrics::logSnapshot() {
+    Snapshot current=snapshot();
+    SILOG(tcpsst,info,current);
+}
+std::ostream&operator<<(std::ostream&os,const NetworkMetrics::Snapshot&snapshot) {
+    os<<"Network metrics:";
+    for (unsigned int which=0;which<NetworkMetrics::NUM_COUNTERS;++which) {
+        os<<' '<<NetworkMetrics::name((NetworkMetrics::Counter)which)<<'='<<snapshot.mCounts[which];
+    }
+    return os;
+}
+} }
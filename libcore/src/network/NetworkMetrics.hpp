@@ -0,0 +1,108 @@
+/*  Sirikata Network Utilities
+ *  NetworkMetrics.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_NetworkMetrics_HPP__
+#define SIRIKATA_NetworkMetrics_HPP__
+namespace Sirikata { namespace Network {
+/**
+ * Process wide counters of the traffic the TCPSST stack carries. Each thread counts into its own block without any
+ * locking or atomic operations; snapshot() adds up every live thread's block along with what threads that have exited counted.
+ * A snapshot taken while other threads are counting may miss their latest increments but never goes backwards.
+ * While the tcpsst.metricsinterval option is nonzero a snapshot is logged at info level that often, checked
+ * every CHECK_INTERVAL increments on each thread, so a process that is not sending or receiving logs nothing
+ */
+class SIRIKATA_EXPORT NetworkMetrics {
+public:
+    enum Counter {
+        ///Packets handed to a TCP socket's send queue, and their bytes
+        PACKETS_QUEUED,
+        BYTES_QUEUED,
+        ///Packets written out in full by a TCP socket
+        PACKETS_SENT,
+        ///async_sends completed by TCP sockets, and the bytes they wrote
+        SOCKET_SENDS,
+        BYTES_SENT,
+        ///Unreliable packets dropped by MultiplexedSocket::sendBytesNow because their socket was backed up
+        UNRELIABLE_DROPS,
+        ///Unreliable packets sent over the UDP side channel instead of a TCP socket, and datagrams received from it
+        DATAGRAMS_SENT,
+        DATAGRAMS_RECEIVED,
+        ///Reads completed by TCP sockets, and the bytes they read
+        SOCKET_READS,
+        BYTES_RECEIVED,
+        ///Packets received whole by TCP sockets, control packets included
+        PACKETS_RECEIVED,
+        ///Streams opened from either end of a connection, and streams closed
+        STREAMS_OPENED,
+        STREAMS_CLOSED,
+        ///Connections given up on because the other end stopped answering keepalive pings
+        KEEPALIVE_TIMEOUTS,
+        NUM_COUNTERS
+    };
+    enum {
+        ///How many increments a thread makes between checks of whether a snapshot is due to be logged
+        CHECK_INTERVAL=4096
+    };
+    ///The totals of every counter at one moment
+    class Snapshot {
+    public:
+        uint64 mCounts[NUM_COUNTERS];
+        Snapshot() {
+            std::memset(mCounts,0,sizeof(mCounts));
+        }
+        uint64 operator[](Counter which)const {
+            return mCounts[which];
+        }
+    };
+    ///The state of one connection's TCP sockets, by socket
+    class ConnectionSnapshot {
+    public:
+        ///Bytes waiting to be written
+        std::vector<uint32> mQueuedBytes;
+        ///Bytes in the async_send currently posted
+        std::vector<uint32> mInFlightBytes;
+        ///Smoothed microseconds recent async_sends took
+        std::vector<uint32> mAverageSendLatency;
+        ///Smoothed microseconds keepalive pings took to be answered: 0 until one has been
+        std::vector<uint32> mRoundTripTime;
+    };
+    ///Adds amount to counter which for the calling thread
+    static void add(Counter which,uint64 amount=1);
+    ///Adds up the counts of every thread
+    static Snapshot snapshot();
+    ///The name counter which is logged under
+    static const char*name(Counter which);
+    ///Writes a snapshot to the tcpsst log
+    static void logSnapshot();
+};
+std::ostream&operator<<(std::ostream&os,const NetworkMetrics::Snapshot&snapshot);
+} }
+#endif
@@ -0,0 +1,137 @@
+/*  Sirikata Network Utilities
+ *  PacketCapture.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "options/Options.hpp"
+#include "TCPDefinitions.hpp"
+#include "PacketCapture.hpp"
+namespace Sirikata { namespace Network {
+namespace {
+OptionValue*sCaptureFile;
+InitializeGlobalOptions gCaptureOptions("tcpsst",
+    sCaptureFile=new OptionValue("capture","",OptionValueType<std::string>(),"Record every packet received by TCPSST connections made from now on to this file, for replay with tcpsstreplay"),
+    NULL);
+boost::mutex sCurrentCaptureMutex;
+std::string sCurrentCaptureFile;
+std::tr1::shared_ptr<PacketCapture> sCurrentCapture;
+
+void writeLittleEndian(uint8*output,uint64 value,unsigned int length) {
+    for (unsigned int i=0;i<length;++i) {
+        output[i]=(uint8)(value>>(8*i));
+    }
+}
+uint64 readLittleEndian(const uint8*input,unsigned int length) {
+    uint64 retval=0;
+    for (unsigned int i=0;i<length;++i) {
+        retval|=((uint64)input[i])<<(8*i);
+    }
+    return retval;
+}
+}
+const char PacketCapture::MAGIC[9]="SSTCAP01";
+
+std::tr1::shared_ptr<PacketCapture> PacketCapture::current() {
+    std::string filename=sCaptureFile->as<std::string>();
+    boost::lock_guard<boost::mutex> lok(sCurrentCaptureMutex);
+    if (filename!=sCurrentCaptureFile) {
+        sCurrentCaptureFile=filename;
+        sCurrentCapture=std::tr1::shared_ptr<PacketCapture>();
+        if (!filename.empty()) {
+            std::tr1::shared_ptr<PacketCapture> capture(new PacketCapture(filename));
+            if (capture->isOpen()) {
+                sCurrentCapture=capture;
+            }else {
+                SILOG(tcpsst,error,"Could not open packet capture "<<filename);
+            }
+        }
+    }
+    return sCurrentCapture;
+}
+PacketCapture::PacketCapture(const std::string&filename):mStartTime(Task::AbsTime::now()) {
+    mFile=fopen(filename.c_str(),"wb");
+    if (mFile&&fwrite(MAGIC,sizeof(MAGIC)-1,1,mFile)!=1) {
+        fclose(mFile);
+        mFile=NULL;
+    }
+}
+PacketCapture::~PacketCapture() {
+    if (mFile) {
+        fclose(mFile);
+    }
+}
+void PacketCapture::record(uint32 connection,unsigned int whichSocket,const Stream::StreamID&id,const ChunkView&packet) {
+    uint8 header[RECORD_HEADER_LENGTH];
+    boost::lock_guard<boost::mutex> lok(mMutex);
+    //timed under the lock so the times in the file never go backwards
+    writeLittleEndian(header,(uint64)(Task::AbsTime::now()-mStartTime).toMicroseconds(),8);
+    writeLittleEndian(header+8,connection,4);
+    writeLittleEndian(header+12,whichSocket,4);
+    writeLittleEndian(header+16,id.read(),4);
+    writeLittleEndian(header+20,packet.size(),4);
+    fwrite(header,RECORD_HEADER_LENGTH,1,mFile);
+    if (packet.size()) {
+        fwrite(packet.data(),packet.size(),1,mFile);
+    }
+}
+void PacketCapture::flush() {
+    boost::lock_guard<boost::mutex> lok(mMutex);
+    fflush(mFile);
+}
+bool PacketCapture::read(const std::string&filename,std::vector<Record>&records) {
+    FILE*fp=fopen(filename.c_str(),"rb");
+    if (fp==NULL)
+        return false;
+    char magic[sizeof(MAGIC)-1];
+    bool retval=fread(magic,sizeof(magic),1,fp)==1&&std::memcmp(magic,MAGIC,sizeof(magic))==0;
+    uint8 header[RECORD_HEADER_LENGTH];
+    while (retval) {
+        size_t headerLength=fread(header,1,RECORD_HEADER_LENGTH,fp);
+        if (headerLength!=RECORD_HEADER_LENGTH) {
+            //a clean end of file falls between records
+            retval=(headerLength==0);
+            break;
+        }
+        records.push_back(Record());
+        Record&record=records.back();
+        record.mTime=readLittleEndian(header,8);
+        record.mConnection=(uint32)readLittleEndian(header+8,4);
+        record.mSocket=(uint32)readLittleEndian(header+12,4);
+        record.mStream=Stream::StreamID((uint32)readLittleEndian(header+16,4));
+        record.mData.resize((size_t)readLittleEndian(header+20,4));
+        if (record.mData.size()&&fread(&record.mData[0],record.mData.size(),1,fp)!=1) {
+            records.pop_back();
+            retval=false;
+        }
+    }
+    fclose(fp);
+    return retval;
+}
+} }
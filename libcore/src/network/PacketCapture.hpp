@@ -0,0 +1,92 @@
+/*  Sirikata Network Utilities
+ *  PacketCapture.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_PacketCapture_HPP__
+#define SIRIKATA_PacketCapture_HPP__
+#include <boost/thread/mutex.hpp>
+#include "task/Time.hpp"
+#include "Stream.hpp"
+namespace Sirikata { namespace Network {
+/**
+ * A binary record of every packet the TCP sockets of this process's TCPSST connections receive, kept while the
+ * tcpsst.capture option names a file. PacketReplay feeds a capture back through the receive path.
+ * The file starts with the 8 byte MAGIC, followed by one record per packet, each made of little endian fields:
+ * microseconds since the capture began (uint64), connection (uint32), socket (uint32), StreamID (uint32), length (uint32)
+ * and then the length bytes of the packet that followed its StreamID on the wire.
+ * Connections are numbered by MultiplexedSocket::getCaptureID and sockets by their index within the connection.
+ * Packets are recorded in the order the IO threads receive them: those of any one socket are never reordered
+ */
+class SIRIKATA_EXPORT PacketCapture {
+    FILE*mFile;
+    boost::mutex mMutex;
+    Task::AbsTime mStartTime;
+    PacketCapture(const PacketCapture&);
+    PacketCapture&operator=(const PacketCapture&);
+public:
+    enum {
+        ///The length of a record before its packet
+        RECORD_HEADER_LENGTH=24
+    };
+    ///The first bytes of every capture
+    static const char MAGIC[9];
+    ///One packet read back from a capture
+    class Record {
+    public:
+        uint64 mTime;
+        uint32 mConnection;
+        uint32 mSocket;
+        Stream::StreamID mStream;
+        Chunk mData;
+    };
+    /**
+     * The capture named by the tcpsst.capture option, opened on first use and shared by every connection, or NULL if the option is empty.
+     * Connections made after the option changes record to the newly named file
+     */
+    static std::tr1::shared_ptr<PacketCapture> current();
+    ///Starts a new capture in filename, replacing anything there: check isOpen for success
+    explicit PacketCapture(const std::string&filename);
+    ///Flushes and closes the file
+    ~PacketCapture();
+    bool isOpen()const {
+        return mFile!=NULL;
+    }
+    ///Appends a packet that arrived on socket whichSocket of connection: may be called from any thread
+    void record(uint32 connection,unsigned int whichSocket,const Stream::StreamID&id,const ChunkView&packet);
+    ///Writes out any records still buffered, so that the capture may be read while it is still being recorded
+    void flush();
+    /**
+     * Reads every record of the capture in filename onto the end of records.
+     * Returns false if the file cannot be opened, is not a capture or ends partway through a record, keeping the records before that point
+     */
+    static bool read(const std::string&filename,std::vector<Record>&records);
+};
+} }
+#endif
@@ -0,0 +1,103 @@
+/*  Sirikata Network Utilities
+ *  PacketReplay.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TCPDefinitions.hpp"
+#include "TCPStream.hpp"
+#include "ChunkPool.hpp"
+#include "util/ThreadSafeQueue.hpp"
+#include "ASIOSocketWrapper.hpp"
+#include "MultiplexedSocket.hpp"
+#include "PacketReplay.hpp"
+#include "ASIOReadBuffer.hpp"
+namespace Sirikata { namespace Network {
+PacketReplay::PacketReplay(const std::vector<PacketCapture::Record>&records):mNumPackets(records.size()),mCapturedDuration(0) {
+    std::map<uint32,uint32> connectionNumbers;
+    for (std::vector<PacketCapture::Record>::const_iterator i=records.begin(),ie=records.end();i!=ie;++i) {
+        std::map<uint32,uint32>::iterator where=connectionNumbers.find(i->mConnection);
+        if (where==connectionNumbers.end()) {
+            where=connectionNumbers.insert(std::pair<uint32,uint32>(i->mConnection,(uint32)mNumSockets.size())).first;
+            mNumSockets.push_back(0);
+        }
+        uint32 connection=where->second;
+        if (mNumSockets[connection]<=i->mSocket) {
+            mNumSockets[connection]=i->mSocket+1;
+        }
+        if (i->mTime>mCapturedDuration) {
+            mCapturedDuration=i->mTime;
+        }
+        if (mReads.empty()||mReads.back().mConnection!=connection||mReads.back().mSocket!=i->mSocket) {
+            Read read;
+            read.mConnection=connection;
+            read.mSocket=i->mSocket;
+            read.mOffset=mBytes.size();
+            read.mLength=0;
+            mReads.push_back(read);
+        }
+        uint8 streamIDSerialized[Stream::StreamID::MAX_SERIALIZED_LENGTH];
+        unsigned int streamIDLength=i->mStream.serialize(streamIDSerialized,Stream::StreamID::MAX_SERIALIZED_LENGTH);
+        uint8 packetLengthSerialized[Stream::uint30::MAX_SERIALIZED_LENGTH];
+        unsigned int packetHeaderLength=Stream::uint30(streamIDLength+i->mData.size()).serialize(packetLengthSerialized,Stream::uint30::MAX_SERIALIZED_LENGTH);
+        mBytes.insert(mBytes.end(),packetLengthSerialized,packetLengthSerialized+packetHeaderLength);
+        mBytes.insert(mBytes.end(),streamIDSerialized,streamIDSerialized+streamIDLength);
+        mBytes.insert(mBytes.end(),i->mData.begin(),i->mData.end());
+        mReads.back().mLength+=packetHeaderLength+streamIDLength+i->mData.size();
+    }
+}
+Task::DeltaTime PacketReplay::run(IOService&io,const Stream::SubstreamCallback&substreamCallback)const {
+    std::vector<std::tr1::shared_ptr<MultiplexedSocket> > connections;
+    std::vector<std::vector<ASIOReadBuffer*> > readBuffers(mNumSockets.size());
+    for (size_t i=0;i<mNumSockets.size();++i) {
+        std::vector<TCPSocket*> sockets;
+        for (unsigned int j=0;j<mNumSockets[i];++j) {
+            sockets.push_back(new TCPSocket(io));
+        }
+        std::tr1::shared_ptr<MultiplexedSocket> connection(
+            MultiplexedSocket::construct<MultiplexedSocket>(&io,UUID::null(),sockets,substreamCallback));
+        connection->mSocketConnectionPhase=MultiplexedSocket::CONNECTED;
+        connections.push_back(connection);
+        for (unsigned int j=0;j<mNumSockets[i];++j) {
+            readBuffers[i].push_back(new ASIOReadBuffer(connection,j,*this));
+        }
+    }
+    Task::AbsTime start=Task::AbsTime::now();
+    for (std::vector<Read>::const_iterator i=mReads.begin(),ie=mReads.end();i!=ie;++i) {
+        readBuffers[i->mConnection][i->mSocket]->replayReceived(connections[i->mConnection],&mBytes[i->mOffset],i->mLength);
+    }
+    Task::DeltaTime elapsed=Task::AbsTime::now()-start;
+    for (size_t i=0;i<readBuffers.size();++i) {
+        for (size_t j=0;j<readBuffers[i].size();++j) {
+            delete readBuffers[i][j];
+        }
+    }
+    return elapsed;
+}
+} }
@@ -0,0 +1,87 @@
+/*  Sirikata Network Utilities
+ *  PacketReplay.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_PacketReplay_HPP__
+#define SIRIKATA_PacketReplay_HPP__
+#include "PacketCapture.hpp"
+namespace Sirikata { namespace Network {
+class IOService;
+/**
+ * Drives the receive path of TCPSST, from ASIOReadBuffer::translateBuffer onward, with the packets of a PacketCapture
+ * as fast as it will go, so that receive side performance can be measured and regressions reproduced without a network.
+ * Each captured connection is played back into a MultiplexedSocket of its own whose sockets are never connected.
+ * The packets are serialized back into the bytes each socket carried when the replay is made. Packets that arrived back to
+ * back on the same socket reach its ASIOReadBuffer together, a slab at a time, as they would from a busy socket. Sockets
+ * take turns in the order of the capture, so every run delivers the same packets to the same streams in the same order.
+ * Anything the receive path sends in reply, such as the acknowledgement of a closed stream, is left queued on the unconnected sockets
+ */
+class SIRIKATA_EXPORT PacketReplay {
+    ///A run of packets that arrived back to back on one socket
+    class Read {
+    public:
+        uint32 mConnection;
+        uint32 mSocket;
+        size_t mOffset;
+        size_t mLength;
+    };
+    ///The captured packets serialized as they were on the wire
+    std::vector<uint8> mBytes;
+    ///The runs of mBytes to hand to each socket, in order
+    std::vector<Read> mReads;
+    ///The number of sockets of each connection, connections being numbered in the order they first appear in the capture
+    std::vector<unsigned int> mNumSockets;
+    size_t mNumPackets;
+    uint64 mCapturedDuration;
+public:
+    ///Prepares to replay records, which must be in the order PacketCapture::read returned them
+    explicit PacketReplay(const std::vector<PacketCapture::Record>&records);
+    /**
+     * Replays every packet into fresh MultiplexedSockets on io, which is not run. Streams the capture opens are offered to substreamCallback.
+     * Returns how long the receive path took, excluding the setup and teardown of the connections
+     */
+    Task::DeltaTime run(IOService&io,const Stream::SubstreamCallback&substreamCallback)const;
+    size_t getNumPackets()const {
+        return mNumPackets;
+    }
+    ///The number of bytes the replayed sockets receive, headers included
+    size_t getNumBytes()const {
+        return mBytes.size();
+    }
+    size_t getNumConnections()const {
+        return mNumSockets.size();
+    }
+    ///How long the capture took to record
+    Task::DeltaTime getCapturedDuration()const {
+        return Task::DeltaTime::microseconds((int64)mCapturedDuration);
+    }
+};
+} }
+#endif
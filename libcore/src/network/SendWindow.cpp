@@ -0,0 +1,85 @@
+/*  Sirikata Network Utilities
+ *  SendWindow.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TCPDefinitions.hpp"
+#include "ChunkPool.hpp"
+#include "SendWindow.hpp"
+namespace Sirikata { namespace Network {
+
+SendWindow::SendWindow():mReferences(1),mQueuedBytes(0),mWindowBytes(DEFAULT_WINDOW_BYTES),mBlocked(0) {
+}
+void SendWindow::release() {
+    if (--mReferences==0)
+        delete this;
+}
+void SendWindow::setWindow(size_t windowBytes, const Stream::ReadySendCallback&readySendCallback) {
+    {
+        boost::lock_guard<boost::mutex> lok(mCallbackMutex);
+        mReadySendCallback=readySendCallback;
+    }
+    mWindowBytes=(uint32)windowBytes;
+    //a larger window may already have room for a blocked producer
+    if (claimReady())
+        fireReady();
+}
+bool SendWindow::claimReady() {
+    return mBlocked.read()&&mQueuedBytes.read()<=mWindowBytes.read()/2&&mBlocked.compareAndSwap(1,0);
+}
+void SendWindow::fireReady() {
+    Stream::ReadySendCallback readySendCallback;
+    {
+        boost::lock_guard<boost::mutex> lok(mCallbackMutex);
+        readySendCallback=mReadySendCallback;
+    }
+    if (readySendCallback)
+        readySendCallback();
+}
+bool SendWindow::attach(Chunk*chunk) {
+    ++mReferences;
+    uint32 queued=(mQueuedBytes+=(uint32)chunk->size());
+    ChunkPool::observeRelease(chunk,this);
+    if (queued<mWindowBytes.read())
+        return true;
+    mBlocked=1;
+    //the IO thread may have drained the queue before it could see the flag: if so the producer need not wait after all
+    if (claimReady())
+        return true;
+    return false;
+}
+void SendWindow::chunkReleased(size_t size) {
+    mQueuedBytes-=(uint32)size;
+    if (claimReady())
+        fireReady();
+    release();
+}
+
+} }
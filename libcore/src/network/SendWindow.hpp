@@ -0,0 +1,80 @@
+/*  Sirikata Network Utilities
+ *  SendWindow.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_SendWindow_HPP__
+#define SIRIKATA_SendWindow_HPP__
+#include "ChunkPool.hpp"
+#include <boost/thread/mutex.hpp>
+namespace Sirikata { namespace Network {
+/**
+ * Counts the bytes a stream has sent that are still waiting to be written to the network so that producers can be throttled.
+ * Every Chunk the stream sends is attached to the window, which is credited back when ChunkPool retires the Chunk: after it was
+ * written out, dropped as an unreliable packet or thrown away with its connection. Once the queued bytes reach the window size
+ * the stream reports itself full, and when they drain back to half the window the ready send callback fires.
+ * The window is refcounted by its stream and by every attached Chunk so that it outlives a stream closed with data still queued.
+ */
+class SendWindow:public ChunkPool::ReleaseObserver {
+    ///One reference for the owning stream and one for each Chunk still attached
+    AtomicValue<uint32> mReferences;
+    AtomicValue<uint32> mQueuedBytes;
+    AtomicValue<uint32> mWindowBytes;
+    ///1 when a producer has seen the window full and is owed a ready send callback
+    AtomicValue<uint32> mBlocked;
+    boost::mutex mCallbackMutex;
+    Stream::ReadySendCallback mReadySendCallback;
+    ///Claims the owed ready send callback if the queue has drained to half the window: returns true if the caller must fire it
+    bool claimReady();
+    void fireReady();
+    virtual ~SendWindow(){}
+public:
+    enum {
+        ///The window of a stream that was never given one
+        DEFAULT_WINDOW_BYTES=1048576
+    };
+    ///Makes a window holding the single reference of the stream that owns it
+    SendWindow();
+    ///Drops a reference, destroying the window once no stream or Chunk refers to it
+    void release();
+    ///Sets the window size and the callback made (from whichever thread retires the data) when a full window drains to half
+    void setWindow(size_t windowBytes, const Stream::ReadySendCallback&readySendCallback);
+    /**
+     * Counts chunk against the window until ChunkPool retires it. Returns false if the window is now full,
+     * in which case the ready send callback is owed once it drains
+     */
+    bool attach(Chunk*chunk);
+    ///The bytes attached that have not been retired yet
+    size_t getQueuedBytes()const {
+        return mQueuedBytes.read();
+    }
+    virtual void chunkReleased(size_t size);
+};
+} }
+#endif
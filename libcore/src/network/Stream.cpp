@@ -33,6 +33,27 @@
 #include "util/Standard.hh"
 #include "Stream.hpp"
 namespace Sirikata { namespace Network {
+namespace {
+///adapts a view callback to a Stream that can only deliver whole Chunks
+void deliverBorrowedView(const Stream::BytesReceivedViewCallback&viewCallback, const Chunk&chunk) {
+    viewCallback(ChunkView(chunk));
+}
+}
+void Stream::SetCallbacks::setViewCallbacks(const Stream::ConnectionCallback &connectionCallback,
+                                            const Stream::BytesReceivedViewCallback &bytesReceivedCallback) {
+    (*this)(connectionCallback,std::tr1::bind(&deliverBorrowedView,bytesReceivedCallback,_1));
+}
+void Stream::connectViews(const Address& addy,
+                          const SubstreamCallback &substreamCallback,
+                          const ConnectionCallback &connectionCallback,
+                          const BytesReceivedViewCallback&chunkReceivedCallback) {
+    connect(addy,substreamCallback,connectionCallback,std::tr1::bind(&deliverBorrowedView,chunkReceivedCallback,_1));
+}
+bool Stream::cloneFromViews(Stream*s,
+                            const ConnectionCallback &connectionCallback,
+                            const BytesReceivedViewCallback&chunkReceivedCallback) {
+    return cloneFrom(s,connectionCallback,std::tr1::bind(&deliverBorrowedView,chunkReceivedCallback,_1));
+}
 void Stream::ignoreSubstreamCallback(Stream * stream, SetCallbacks&) {
     delete stream;
 }
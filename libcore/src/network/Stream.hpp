@@ -38,6 +38,72 @@ namespace Sirikata {
 namespace Network {
 typedef std::vector<uint8> Chunk;
 
+/**
+ * A read-only window onto bytes that were received from the network.
+ * The window holds a reference to the refcounted slab the bytes were read into, so a receiver
+ * may keep the view (or the slab) around without copying; the slab is only recycled once every
+ * view of it is gone. Call copy() to get a Chunk that is owned outright.
+ */
+class ChunkView {
+    std::tr1::shared_ptr<Chunk> mSlab;
+    const uint8* mData;
+    size_t mSize;
+public:
+    typedef const uint8* const_iterator;
+    ///An empty view
+    ChunkView():mData(NULL),mSize(0) {
+    }
+    ///A view of length bytes starting offset bytes into slab
+    ChunkView(const std::tr1::shared_ptr<Chunk>&slab, size_t offset, size_t length)
+        : mSlab(slab),mData(length?&(*slab)[offset]:NULL),mSize(length) {
+    }
+    ///A view of the whole of slab
+    explicit ChunkView(const std::tr1::shared_ptr<Chunk>&slab)
+        : mSlab(slab),mData(slab->empty()?NULL:&(*slab)[0]),mSize(slab->size()) {
+    }
+    ///A view borrowing a Chunk that the caller keeps alive at least as long as the view
+    explicit ChunkView(const Chunk&borrowed)
+        : mData(borrowed.empty()?NULL:&borrowed[0]),mSize(borrowed.size()) {
+    }
+    const uint8*data()const {
+        return mData;
+    }
+    size_t size()const {
+        return mSize;
+    }
+    bool empty()const {
+        return mSize==0;
+    }
+    const_iterator begin()const {
+        return mData;
+    }
+    const_iterator end()const {
+        return mData+mSize;
+    }
+    const uint8&operator[](size_t i)const {
+        return mData[i];
+    }
+    ///A view of length bytes starting offset bytes into this view, keeping the same slab (or borrowed Chunk) alive
+    ChunkView subView(size_t offset, size_t length)const {
+        ChunkView retval(*this);
+        retval.mData=length?mData+offset:NULL;
+        retval.mSize=length;
+        return retval;
+    }
+    ///Copies the viewed bytes into a Chunk owned by the caller
+    Chunk copy()const {
+        return Chunk(begin(),end());
+    }
+    ///The slab keeping these bytes alive: NULL for views of borrowed Chunks
+    const std::tr1::shared_ptr<Chunk>&slab()const {
+        return mSlab;
+    }
+    ///True if the view covers all of its slab, in which case the slab may stand in for a Chunk copy of the view
+    bool spansSlab()const {
+        return mSlab&&mSize==mSlab->size();
+    }
+};
+
 
 ///Codes indicating if packet sending should be reliable or not,and in order or not
 enum StreamReliability {
@@ -46,6 +112,18 @@ enum StreamReliability {
     ReliableOrdered
 };
 
+/**
+ * Classes of traffic that may share a connection. When packets from several streams are waiting on the same socket
+ * each class gets a share of the bandwidth that grows with its priority, so bulk transfers cannot starve latency critical streams.
+ * Packets within one class keep the order they were sent in
+ */
+enum StreamPriority {
+    BulkPriority,
+    NormalPriority,
+    InteractivePriority,
+    NUM_STREAM_PRIORITIES
+};
+
 
 /**
  * This is the stream interface by which applications will send packets to the world
@@ -135,6 +213,10 @@ public:
     typedef std::tr1::function<void(ConnectionStatus,const std::string&reason)> ConnectionCallback;
     ///Callback type for when a full chunk of bytes are waiting on the stream
     typedef std::tr1::function<void(const Chunk&)> BytesReceivedCallback;
+    ///Callback type for when a full chunk of bytes are waiting on the stream, handed over as a view into the buffer they were received into rather than as a copy
+    typedef std::tr1::function<void(const ChunkView&)> BytesReceivedViewCallback;
+    ///Callback type for when a stream that reported its send window full has drained enough to take more data
+    typedef std::tr1::function<void()> ReadySendCallback;
     /**
      *  This class is passed into any newSubstreamCallback functions so they may 
      *  immediately setup callbacks for connetion events and possibly start sending immediate responses.     
@@ -148,6 +230,12 @@ public:
          */
         virtual void operator()(const Stream::ConnectionCallback &connectionCallback,
                                 const Stream::BytesReceivedCallback &bytesReceivedCallback)=0;
+        /**
+         * Like operator() but received bytes are delivered as views into the receive buffers.
+         * Streams that cannot avoid the copy wrap the callback so it sees a view of a temporary Chunk
+         */
+        virtual void setViewCallbacks(const Stream::ConnectionCallback &connectionCallback,
+                                      const Stream::BytesReceivedViewCallback &bytesReceivedCallback);
     };
     /**
      * The substreamCallback must call SetCallbacks' operator() to activate the stream
@@ -171,16 +259,46 @@ public:
         const SubstreamCallback &substreamCallback,
         const ConnectionCallback &connectionCallback,
         const BytesReceivedCallback&chunkReceivedCallback)=0;
+    /**
+     * Identical to connect() except that received bytes are delivered as views into the receive buffers
+     * rather than copied into a fresh Chunk. Streams that cannot avoid the copy wrap the callback so it sees a view of a temporary Chunk
+     */
+    virtual void connectViews(
+        const Address& addy,
+        const SubstreamCallback &substreamCallback,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedViewCallback&chunkReceivedCallback);
     ///Creates a stream of the same type as this stream
     virtual Stream*factory()=0;
     ///Makes this stream a clone of stream "s" if they are of the same type
     virtual bool cloneFrom(Stream*s,
         const ConnectionCallback &connectionCallback,
         const BytesReceivedCallback&chunkReceivedCallback)=0;
+    ///Identical to cloneFrom() except that received bytes are delivered as views into the receive buffers
+    virtual bool cloneFromViews(Stream*s,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedViewCallback&chunkReceivedCallback);
     
     
-    ///Send a chunk of data to the receiver
-    virtual void send(const Chunk&data,StreamReliability)=0;
+    /**
+     * Send a chunk of data to the receiver. Returns false once the stream's send window is full: the data is sent regardless,
+     * but a producer that can slow down should hold further data back until the ready send callback is made
+     */
+    virtual bool send(const Chunk&data,StreamReliability)=0;
+    /**
+     * Sets how many bytes may be waiting to go out on this stream before send reports it full, and the callback made
+     * (from whichever thread retires the data) once a full window has drained to half. Streams without flow control ignore it
+     */
+    virtual void setSendWindow(size_t windowBytes,const ReadySendCallback&readySendCallback){}
+    ///The number of bytes sent on this stream that have not yet been written to the network
+    virtual size_t getQueuedBytes()const{return 0;}
+    /**
+     * Sets the class of traffic packets subsequently sent on this stream are scheduled in. Best called before the first send:
+     * packets already queued keep their old class, so packets sent after a change may overtake them
+     */
+    virtual void setPriority(StreamPriority priority){}
+    ///The class of traffic packets sent on this stream are scheduled in
+    virtual StreamPriority getPriority()const{return NormalPriority;}
     ///close this stream: if it is the last stream, close the connection as well
     virtual void close()=0;
     virtual ~Stream(){};
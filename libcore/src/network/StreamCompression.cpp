@@ -0,0 +1,264 @@
+/*  Sirikata Network Utilities
+ *  StreamCompression.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "options/Options.hpp"
+#include "TCPDefinitions.hpp"
+#include "TCPStream.hpp"
+#include "StreamCompression.hpp"
+namespace Sirikata { namespace Network {
+namespace {
+OptionValue*sOfferCompression;
+InitializeGlobalOptions gCompressionOptions("tcpsst",
+    sOfferCompression=new OptionValue("compression","false",OptionValueType<bool>(),"Offer to decompress what the other end of each connection sends, which it then compresses in messages of at least its tcpsst.compressthreshold bytes"),
+    NULL);
+
+inline uint32 read32(const uint8*data) {
+    return (uint32)data[0]|((uint32)data[1]<<8)|((uint32)data[2]<<16)|((uint32)data[3]<<24);
+}
+inline uint32 hashPosition(const uint8*data) {
+    return (read32(data)*2654435761U)>>(32-StreamCompressor::HASH_BITS);
+}
+uint8*writeLength(uint8*output,size_t length) {
+    while (length>=255) {
+        *output++=255;
+        length-=255;
+    }
+    *output++=(uint8)length;
+    return output;
+}
+///Writes a sequence of numLiterals literals then a match of matchLength bytes offset back, or no match at all if matchLength is 0
+uint8*writeSequence(uint8*output,const uint8*literals,size_t numLiterals,size_t offset,size_t matchLength) {
+    uint8*token=output++;
+    *token=(uint8)((numLiterals<15?numLiterals:15)<<4);
+    if (numLiterals>=15)
+        output=writeLength(output,numLiterals-15);
+    if (numLiterals)
+        std::memcpy(output,literals,numLiterals);
+    output+=numLiterals;
+    if (matchLength) {
+        *output++=(uint8)(offset&255);
+        *output++=(uint8)(offset>>8);
+        size_t extra=matchLength-StreamCompressor::MIN_MATCH;
+        *token|=(uint8)(extra<15?extra:15);
+        if (extra>=15)
+            output=writeLength(output,extra-15);
+    }
+    return output;
+}
+bool readLength(const uint8*&input,const uint8*inputEnd,size_t&length) {
+    uint8 more;
+    do {
+        if (input==inputEnd)
+            return false;
+        more=*input++;
+        length+=more;
+    }while (more==255);
+    return true;
+}
+/**
+ * Compresses window[begin,end) onto the end of output behind a header carrying mode, matching against whatever hashTable
+ * remembers of the window before begin. Returns false, leaving output as it was, if that comes out no shorter than the message
+ */
+bool compressWindow(const uint8*window,size_t begin,size_t end,uint32*hashTable,StreamCompressor::Mode mode,Chunk&output) {
+    size_t length=end-begin;
+    if (length<=StreamCompressor::MIN_MATCH||length>=(1<<30))
+        return false;
+    uint8 header[1+Stream::uint30::MAX_SERIALIZED_LENGTH];
+    header[0]=(uint8)mode;
+    unsigned int headerLength=1+Stream::uint30((uint32)length).serialize(header+1,Stream::uint30::MAX_SERIALIZED_LENGTH);
+    size_t outputStart=output.size();
+    //a match never takes more bytes than it covers, so the worst case is one long run of literals
+    output.resize(outputStart+headerLength+length+length/255+16);
+    uint8*outputBegin=&output[outputStart];
+    uint8*out=outputBegin;
+    std::memcpy(out,header,headerLength);
+    out+=headerLength;
+    size_t anchor=begin;
+    size_t pos=begin;
+    while (pos+StreamCompressor::MIN_MATCH<=end) {
+        uint32 hash=hashPosition(window+pos);
+        size_t candidate=hashTable[hash];
+        hashTable[hash]=(uint32)(pos+1);
+        //the table may remember positions of a message that was rolled back, so a candidate only counts if its bytes still match
+        if (candidate&&candidate-1<pos&&pos-(candidate-1)<=StreamCompressor::MAX_OFFSET&&read32(window+candidate-1)==read32(window+pos)) {
+            size_t matchStart=candidate-1;
+            size_t matchLength=StreamCompressor::MIN_MATCH;
+            while (pos+matchLength<end&&window[matchStart+matchLength]==window[pos+matchLength])
+                ++matchLength;
+            out=writeSequence(out,window+anchor,pos-anchor,pos-matchStart,matchLength);
+            pos+=matchLength;
+            anchor=pos;
+        }else {
+            ++pos;
+        }
+    }
+    out=writeSequence(out,window+anchor,end-anchor,0,0);
+    size_t compressedLength=out-outputBegin;
+    if (compressedLength>=length) {
+        output.resize(outputStart);
+        return false;
+    }
+    output.resize(outputStart+compressedLength);
+    return true;
+}
+///Reads the mode and uncompressed length at the front of a compressed message
+bool readHeader(const uint8*data,size_t length,StreamCompressor::Mode&mode,size_t&messageLength,size_t&headerLength) {
+    if (length<2||data[0]>StreamCompressor::CONTINUE_HISTORY)
+        return false;
+    Stream::uint30 decodedLength;
+    unsigned int lengthLength=(unsigned int)(length-1);
+    if (!decodedLength.unserialize(data+1,lengthLength))
+        return false;
+    mode=(StreamCompressor::Mode)data[0];
+    messageLength=decodedLength.read();
+    headerLength=1+lengthLength;
+    //no sequence byte can stand for more than 255 bytes of output, so anything claiming more is malformed
+    return messageLength>0&&messageLength/256<=length;
+}
+///Decodes the sequences between input and inputEnd onto the end of window, whose earlier contents they may refer back to
+bool decodeSequences(const uint8*input,const uint8*inputEnd,size_t messageLength,std::vector<uint8>&window) {
+    size_t pos=window.size();
+    size_t end=pos+messageLength;
+    window.resize(end);
+    uint8*data=&window[0];
+    while (input<inputEnd) {
+        unsigned int token=*input++;
+        size_t numLiterals=token>>4;
+        if (numLiterals==15&&!readLength(input,inputEnd,numLiterals))
+            return false;
+        if (numLiterals>(size_t)(inputEnd-input)||numLiterals>end-pos)
+            return false;
+        if (numLiterals)
+            std::memcpy(data+pos,input,numLiterals);
+        input+=numLiterals;
+        pos+=numLiterals;
+        if (pos==end)
+            return input==inputEnd;
+        if (inputEnd-input<2)
+            return false;
+        size_t offset=(size_t)input[0]|((size_t)input[1]<<8);
+        input+=2;
+        size_t matchLength=token&15;
+        if (matchLength==15&&!readLength(input,inputEnd,matchLength))
+            return false;
+        matchLength+=StreamCompressor::MIN_MATCH;
+        if (offset==0||offset>pos||matchLength>end-pos)
+            return false;
+        //byte by byte, as a match may overlap the bytes it produces
+        for (size_t i=0;i<matchLength;++i,++pos) {
+            data[pos]=data[pos-offset];
+        }
+    }
+    return false;
+}
+///Drops the front of window once it holds more than twice HISTORY_LENGTH bytes, returning how many bytes went
+size_t trimHistory(std::vector<uint8>&window) {
+    if (window.size()<=2*StreamCompressor::HISTORY_LENGTH)
+        return 0;
+    size_t drop=window.size()-StreamCompressor::HISTORY_LENGTH;
+    window.erase(window.begin(),window.begin()+drop);
+    return drop;
+}
+}
+
+StreamCompressor::StreamCompressor():mStarted(false) {
+}
+bool StreamCompressor::compress(const uint8*data,size_t length,Chunk&output) {
+    if (length<=MIN_MATCH)
+        return false;
+    if (mHashTable.empty())
+        mHashTable.resize(1<<HASH_BITS,0);
+    size_t begin=mWindow.size();
+    mWindow.insert(mWindow.end(),data,data+length);
+    if (!compressWindow(&mWindow[0],begin,mWindow.size(),&mHashTable[0],mStarted?CONTINUE_HISTORY:NEW_HISTORY,output)) {
+        //the other end never sees this message compressed, so it must not become part of the history
+        mWindow.resize(begin);
+        return false;
+    }
+    mStarted=true;
+    size_t drop=trimHistory(mWindow);
+    if (drop) {
+        for (std::vector<uint32>::iterator i=mHashTable.begin(),ie=mHashTable.end();i!=ie;++i) {
+            *i=*i>drop?*i-(uint32)drop:0;
+        }
+    }
+    return true;
+}
+bool StreamCompressor::compressStandalone(const uint8*data,size_t length,Chunk&output) {
+    std::vector<uint32> hashTable(1<<HASH_BITS,0);
+    return compressWindow(data,0,length,&hashTable[0],STANDALONE,output);
+}
+bool StreamCompressor::offerCompression() {
+    return sOfferCompression->as<bool>();
+}
+
+StreamDecompressor::StreamDecompressor():mStarted(false) {
+}
+bool StreamDecompressor::decompress(const uint8*data,size_t length,Chunk&output) {
+    StreamCompressor::Mode mode;
+    size_t messageLength;
+    size_t headerLength;
+    if (!readHeader(data,length,mode,messageLength,headerLength))
+        return false;
+    if (mode==StreamCompressor::STANDALONE)
+        return decompressStandalone(data,length,output);
+    if (mode==StreamCompressor::NEW_HISTORY) {
+        mWindow.clear();
+    }else if (!mStarted) {
+        return false;
+    }
+    size_t begin=mWindow.size();
+    if (!decodeSequences(data+headerLength,data+length,messageLength,mWindow)) {
+        //the history no longer matches the sender's, so nothing more may be decompressed in it
+        mWindow.clear();
+        mStarted=false;
+        return false;
+    }
+    mStarted=true;
+    output.assign(mWindow.begin()+begin,mWindow.end());
+    trimHistory(mWindow);
+    return true;
+}
+bool StreamDecompressor::decompressStandalone(const uint8*data,size_t length,Chunk&output) {
+    StreamCompressor::Mode mode;
+    size_t messageLength;
+    size_t headerLength;
+    if (!readHeader(data,length,mode,messageLength,headerLength)||mode!=StreamCompressor::STANDALONE)
+        return false;
+    Chunk window;
+    if (!decodeSequences(data+headerLength,data+length,messageLength,window))
+        return false;
+    output.swap(window);
+    return true;
+}
+
+} }
@@ -0,0 +1,100 @@
+/*  Sirikata Network Utilities
+ *  StreamCompression.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SIRIKATA_StreamCompression_HPP__
+#define SIRIKATA_StreamCompression_HPP__
+namespace Sirikata { namespace Network {
+/**
+ * The LZ77 codec TCPStream compresses messages with. A compressed message is a mode byte, its uncompressed length as a
+ * variable length int30 and then a series of sequences, each a token byte whose high nibble counts the literals that follow
+ * and whose low nibble is the length of the match after them less MIN_MATCH, then the literals, then the match as a
+ * 2 byte little endian offset back from the current position. A nibble of 15 is continued by bytes added on until one is below 255.
+ * The final sequence has no match and ends the message.
+ * Messages compressed in a history may refer back to the last HISTORY_LENGTH bytes of the messages compressed before them in
+ * the same history, so messages repeating what went before compress far better than they would alone.
+ * The receiver has to decompress them in the order they were compressed
+ */
+class SIRIKATA_EXPORT StreamCompressor {
+public:
+    enum {
+        ///The version of the codec the compression offer carries
+        VERSION=1,
+        ///The shortest match a sequence encodes
+        MIN_MATCH=4,
+        ///The furthest back a match may be
+        MAX_OFFSET=65535,
+        ///The hash table of earlier positions has 1<<HASH_BITS entries
+        HASH_BITS=13,
+        ///How many bytes of earlier messages both ends keep at least
+        HISTORY_LENGTH=65536
+    };
+    enum Mode {
+        ///The message refers to no other
+        STANDALONE=0,
+        ///The message begins a history, replacing whatever the decompressor held
+        NEW_HISTORY=1,
+        ///The message continues the history of the messages before it
+        CONTINUE_HISTORY=2
+    };
+private:
+    ///The history followed, while compress runs, by the message being compressed
+    std::vector<uint8> mWindow;
+    ///One more than the index into mWindow of the last position seen with each hash, or 0 if none has been
+    std::vector<uint32> mHashTable;
+    ///Set once a message has begun the history
+    bool mStarted;
+public:
+    StreamCompressor();
+    /**
+     * Compresses length bytes at data into output as the next message of this compressor's history.
+     * Returns false, leaving output and the history as they were, if the message would not come out any shorter
+     */
+    bool compress(const uint8*data,size_t length,Chunk&output);
+    ///Compresses a message on its own, for messages that may arrive out of order: returns false as compress does
+    static bool compressStandalone(const uint8*data,size_t length,Chunk&output);
+    ///Whether connections offer to decompress what the other end sends them: the tcpsst.compression option
+    static bool offerCompression();
+};
+///Undoes a StreamCompressor, holding the history of the messages of one stream
+class SIRIKATA_EXPORT StreamDecompressor {
+    ///The last of the decompressed history: at least HISTORY_LENGTH bytes of it once there is that much
+    std::vector<uint8> mWindow;
+    ///Set once a message has begun the history
+    bool mStarted;
+public:
+    StreamDecompressor();
+    ///Decompresses the compressed message of length bytes at data into output: returns false if it is malformed or continues a history this decompressor does not have
+    bool decompress(const uint8*data,size_t length,Chunk&output);
+    ///Decompresses a message that must stand alone
+    static bool decompressStandalone(const uint8*data,size_t length,Chunk&output);
+};
+} }
+#endif
@@ -42,7 +42,16 @@ public:
                             const Stream::BytesReceivedCallback &bytesReceivedCallback){
         mCallbacks=new TCPStream::Callbacks(connectionCallback,
                                             bytesReceivedCallback,
-                                            mStream->mSendStatus);
+                                            mStream->mSendStatus,
+                                            mStream->mPriority);
+        mMultiSocket->addCallbacks(mStream->getID(),mCallbacks);
+    }
+    virtual void setViewCallbacks(const Stream::ConnectionCallback &connectionCallback,
+                                  const Stream::BytesReceivedViewCallback &bytesReceivedCallback){
+        mCallbacks=new TCPStream::Callbacks(connectionCallback,
+                                            bytesReceivedCallback,
+                                            mStream->mSendStatus,
+                                            mStream->mPriority);
         mMultiSocket->addCallbacks(mStream->getID(),mCallbacks);
     }
 };
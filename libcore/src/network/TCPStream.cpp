@@ -32,39 +32,79 @@
 
 #include "util/Standard.hh"
 #include "util/AtomicTypes.hpp"
+#include "options/Options.hpp"
 
 #include "TCPDefinitions.hpp"
 #include "TCPStream.hpp"
+#include "ChunkPool.hpp"
+#include "SendWindow.hpp"
 #include "util/ThreadSafeQueue.hpp"
 #include "ASIOSocketWrapper.hpp"
 #include "MultiplexedSocket.hpp"
 #include "TCPSetCallbacks.hpp"
+#include "StreamCompression.hpp"
 #include <boost/thread.hpp>
 namespace Sirikata { namespace Network {
 
 using namespace boost::asio::ip;
-TCPStream::TCPStream(const std::tr1::shared_ptr<MultiplexedSocket>&shared_socket,const Stream::StreamID&sid):mSocket(shared_socket),mID(sid),mSendStatus(new AtomicValue<int>(0)) {
-
-}
-
-void TCPStream::send(const Chunk&data, StreamReliability reliability) {
-    MultiplexedSocket::RawRequest toBeSent;
+namespace {
+OptionValue*sMaxFrameSize;
+OptionValue*sNumSockets;
+OptionValue*sCompressThreshold;
+InitializeGlobalOptions gTCPStreamOptions("tcpsst",
+    sMaxFrameSize=new OptionValue("maxframesize","16000",OptionValueType<size_t>(),"Messages longer than this many bytes are sent as frames of at most this size so they interleave with other streams (0 never splits a message); the default lets frames land in a single receive buffer"),
+    sNumSockets=new OptionValue("sockets","3",OptionValueType<unsigned int>(),"How many TCP sockets each connecting stream opens to carry its connection"),
+    sCompressThreshold=new OptionValue("compressthreshold","512",OptionValueType<size_t>(),"Messages at least this many bytes long are compressed when the other end of the connection has offered to decompress them (0 never compresses)"),
+    NULL);
+///Sets the flags of request that carry reliability
+void setReliability(MultiplexedSocket::RawRequest&request,StreamReliability reliability) {
     // only allow 3 of the four possibilities because unreliable ordered is tricky and usually useless
     switch(reliability) {
       case Unreliable:
-        toBeSent.unordered=true;
-        toBeSent.unreliable=true;
+        request.unordered=true;
+        request.unreliable=true;
         break;
       case ReliableOrdered:
-        toBeSent.unordered=false;
-        toBeSent.unreliable=false;
+        request.unordered=false;
+        request.unreliable=false;
         break;
       case ReliableUnordered:
-        toBeSent.unordered=true;
-        toBeSent.unreliable=false;
+        request.unordered=true;
+        request.unreliable=false;
         break;
     }
+}
+}
+TCPStream::TCPStream(const std::tr1::shared_ptr<MultiplexedSocket>&shared_socket,const Stream::StreamID&sid):mSocket(shared_socket),mID(sid),mSendStatus(new AtomicValue<int>(0)),mPriority(NormalPriority),mSendWindow(new SendWindow),mMaxFrameSize(sMaxFrameSize->as<size_t>()),mNumSockets(sNumSockets->as<unsigned int>()),mCompressionThreshold(sCompressThreshold->as<size_t>()),mCompressor(NULL) {
+
+}
+
+TCPStream::~TCPStream() {
+    mSendWindow->release();
+    delete mCompressor;
+}
+bool TCPStream::send(const Chunk&data, StreamReliability reliability) {
+    if (mCompressionThreshold&&data.size()>=mCompressionThreshold&&mSocket&&mSocket->peerDecompresses()) {
+        Chunk compressed;
+        if (reliability==ReliableOrdered) {
+            //ordered messages are decompressed in the order they are queued, so they may refer back to the ones before them
+            boost::lock_guard<boost::mutex> lok(mCompressorMutex);
+            if (mCompressor==NULL)
+                mCompressor=new StreamCompressor;
+            if (mCompressor->compress(&data[0],data.size(),compressed))
+                return sendFrames(compressed,TCPStreamLastCompressedFragment,reliability);
+        }else if (StreamCompressor::compressStandalone(&data[0],data.size(),compressed)) {
+            return sendFrames(compressed,TCPStreamLastCompressedFragment,reliability);
+        }
+    }
+    size_t maxFrameSize=frameSize();
+    if (maxFrameSize&&data.size()>maxFrameSize) {
+        return sendFrames(data,TCPStreamLastFragment,ReliableOrdered);
+    }
+    MultiplexedSocket::RawRequest toBeSent;
+    setReliability(toBeSent,reliability);
     toBeSent.originStream=getID();
+    toBeSent.priority=mPriority;
     uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
     unsigned int streamIdLength=StreamID::MAX_SERIALIZED_LENGTH;
     unsigned int successLengthNeeded=toBeSent.originStream.serialize(serializedStreamId,streamIdLength);
@@ -78,7 +118,9 @@ void TCPStream::send(const Chunk&data, StreamReliability reliability) {
     unsigned int packetHeaderLength=packetLength.serialize(packetLengthSerialized,uint30::MAX_SERIALIZED_LENGTH);
     //allocate a packet long enough to take both the length of the packet and the stream id as well as the packet data. totalSize = size of streamID + size of data and
     //packetHeaderLength = the length of the length component of the packet
-    toBeSent.data=new Chunk(totalSize+packetHeaderLength);
+    toBeSent.data=ChunkPool::allocate(totalSize+packetHeaderLength);
+    //counted against the window from here until the packet is written, dropped or discarded
+    bool windowOpen=mSendWindow->attach(toBeSent.data);
 
     uint8 *outputBuffer=&(*toBeSent.data)[0];
     std::memcpy(outputBuffer,packetLengthSerialized,packetHeaderLength);
@@ -98,9 +140,99 @@ void TCPStream::send(const Chunk&data, StreamReliability reliability) {
     --(*mSendStatus);
     if (!didsend) {
         //if the data was not sent, its our job to clean it up
-        delete toBeSent.data;
+        ChunkPool::release(toBeSent.data);
         SILOG(tcpsst,debug,"printing to closed stream id "<<getID().read());
     }
+    return windowOpen;
+}
+bool TCPStream::sendFrames(const Chunk&data,uint8 lastFrameCode,StreamReliability reliability) {
+    uint8 serializedControlId[StreamID::MAX_SERIALIZED_LENGTH];
+    unsigned int controlIdLength=StreamID().serialize(serializedControlId,StreamID::MAX_SERIALIZED_LENGTH);
+    uint8 serializedStreamId[StreamID::MAX_SERIALIZED_LENGTH];
+    unsigned int streamIdLength=getID().serialize(serializedStreamId,StreamID::MAX_SERIALIZED_LENGTH);
+    assert(controlIdLength<=StreamID::MAX_SERIALIZED_LENGTH&&streamIdLength<=StreamID::MAX_SERIALIZED_LENGTH);
+    bool windowOpen=true;
+    size_t maxFrameSize=frameSize();
+    if (maxFrameSize==0) {
+        maxFrameSize=data.size();
+    }
+    if (data.size()>maxFrameSize) {
+        //the frames must stay together on one socket for reassembly, so messages of several frames are always sent reliably and in order
+        reliability=ReliableOrdered;
+    }else if (lastFrameCode==TCPStreamLastCompressedFragment) {
+        //a message in one frame may go on any socket, so it must not be taken for the end of a message being reassembled
+        lastFrameCode=TCPStreamCompressedMessage;
+    }
+    std::vector<MultiplexedSocket::RawRequest> frames;
+    frames.reserve((data.size()+maxFrameSize-1)/maxFrameSize);
+    for (size_t offset=0;offset<data.size();offset+=maxFrameSize) {
+        size_t frameSize=data.size()-offset<maxFrameSize?data.size()-offset:maxFrameSize;
+        uint8 controlCode=(offset+frameSize==data.size())?lastFrameCode:TCPStreamFragment;
+        size_t totalSize=controlIdLength+1+streamIdLength+frameSize;
+        uint8 packetLengthSerialized[uint30::MAX_SERIALIZED_LENGTH];
+        unsigned int packetHeaderLength=uint30(totalSize).serialize(packetLengthSerialized,uint30::MAX_SERIALIZED_LENGTH);
+        MultiplexedSocket::RawRequest frame;
+        setReliability(frame,reliability);
+        //routed by the stream's ID even though the frame itself is a control packet
+        frame.originStream=getID();
+        frame.priority=mPriority;
+        frame.data=ChunkPool::allocate(packetHeaderLength+totalSize);
+        uint8 *outputBuffer=&(*frame.data)[0];
+        std::memcpy(outputBuffer,packetLengthSerialized,packetHeaderLength);
+        outputBuffer+=packetHeaderLength;
+        std::memcpy(outputBuffer,serializedControlId,controlIdLength);
+        outputBuffer+=controlIdLength;
+        *outputBuffer++=controlCode;
+        std::memcpy(outputBuffer,serializedStreamId,streamIdLength);
+        outputBuffer+=streamIdLength;
+        std::memcpy(outputBuffer,&data[offset],frameSize);
+        windowOpen=mSendWindow->attach(frame.data);
+        frames.push_back(frame);
+    }
+    bool didsend=false;
+    //the whole message goes out under one send status so a close cannot cut it off partway
+    unsigned int sendStatus=++(*mSendStatus);
+    if ((sendStatus&(3*SendStatusClosing))==0) {
+        for (size_t i=0;i<frames.size();++i) {
+            MultiplexedSocket::sendBytes(mSocket,frames[i]);
+        }
+        didsend=true;
+    }
+    --(*mSendStatus);
+    if (!didsend) {
+        for (size_t i=0;i<frames.size();++i) {
+            ChunkPool::release(frames[i].data);
+        }
+        SILOG(tcpsst,debug,"printing to closed stream id "<<getID().read());
+    }
+    return windowOpen;
+}
+void TCPStream::setSendWindow(size_t windowBytes,const ReadySendCallback&readySendCallback) {
+    mSendWindow->setWindow(windowBytes,readySendCallback);
+}
+size_t TCPStream::getQueuedBytes()const {
+    return mSendWindow->getQueuedBytes();
+}
+void TCPStream::getConnectionSnapshot(NetworkMetrics::ConnectionSnapshot&snapshot)const {
+    if (mSocket) {
+        mSocket->snapshot(snapshot);
+    }
+}
+uint32 TCPStream::getRoundTripTime()const {
+    return mSocket?mSocket->roundTripTime():0;
+}
+size_t TCPStream::frameSize()const {
+    //a peer that has not offered to reassemble frames would drop them as unknown control packets
+    return mSocket&&mSocket->peerReassembles()?mMaxFrameSize:0;
+}
+void TCPStream::setMaxFrameSize(size_t maxFrameSize) {
+    mMaxFrameSize=maxFrameSize;
+}
+void TCPStream::setNumSockets(unsigned int numSockets) {
+    mNumSockets=numSockets;
+}
+void TCPStream::setCompressionThreshold(size_t compressionThreshold) {
+    mCompressionThreshold=compressionThreshold;
 }
 ///This function waits on the sendStatus clearing up so no outstanding sends are being made (and no further ones WILL be made cus of the SendStatusClosing flag that is on
 void TCPStream::closeSendStatus(AtomicValue<int>&vSendStatus) {
@@ -124,21 +256,48 @@ void TCPStream::close() {
     //obliterate all incoming callback to this stream
     mSocket->addCallbacks(getID(),NULL);
     //send out that the stream is now closed on all sockets
-    MultiplexedSocket::closeStream(mSocket,getID());
+    MultiplexedSocket::closeStream(mSocket,getID(),TCPStream::TCPStreamCloseStream,mPriority);
+}
+void TCPStream::setPriority(StreamPriority priority) {
+    mPriority=priority;
+}
+StreamPriority TCPStream::getPriority()const {
+    return mPriority;
 }
-TCPStream::TCPStream(IOService&io):mIO(&io),mSendStatus(new AtomicValue<int>(0)) {
+TCPStream::TCPStream(IOService&io):mIO(&io),mSendStatus(new AtomicValue<int>(0)),mPriority(NormalPriority),mSendWindow(new SendWindow),mMaxFrameSize(sMaxFrameSize->as<size_t>()),mNumSockets(sNumSockets->as<unsigned int>()),mCompressionThreshold(sCompressThreshold->as<size_t>()),mCompressor(NULL) {
 }
 void TCPStream::connect(const Address&addy,
                         const SubstreamCallback &substreamCallback,
                         const ConnectionCallback &connectionCallback,
                         const BytesReceivedCallback&bytesReceivedCallback) {
+    connectCallbacks(addy,substreamCallback,new Callbacks(connectionCallback,
+                                                          bytesReceivedCallback,
+                                                          mSendStatus,
+                                                          mPriority));
+}
+void TCPStream::connectViews(const Address&addy,
+                             const SubstreamCallback &substreamCallback,
+                             const ConnectionCallback &connectionCallback,
+                             const BytesReceivedViewCallback&bytesReceivedCallback) {
+    connectCallbacks(addy,substreamCallback,new Callbacks(connectionCallback,
+                                                          bytesReceivedCallback,
+                                                          mSendStatus,
+                                                          mPriority));
+}
+void TCPStream::connectCallbacks(const Address&addy,
+                                 const SubstreamCallback &substreamCallback,
+                                 Callbacks*callbacks) {
     mSocket=MultiplexedSocket::construct<MultiplexedSocket>(mIO,substreamCallback);
     *mSendStatus=0;
     mID=StreamID(1);
-    mSocket->addCallbacks(getID(),new Callbacks(connectionCallback,
-                                                bytesReceivedCallback,
-                                                mSendStatus));
-    mSocket->connect(addy,3);
+    NetworkMetrics::add(NetworkMetrics::STREAMS_OPENED);
+    mSocket->addCallbacks(getID(),callbacks);
+    unsigned int numSockets=mNumSockets;
+    if (numSockets<1||numSockets>MAX_SOCKETS) {
+        SILOG(tcpsst,warning,"Cannot connect with "<<numSockets<<" sockets: using 3");
+        numSockets=3;
+    }
+    mSocket->connect(addy,numSockets);
 }
 Stream* TCPStream::factory() {
     return new TCPStream(*mIO);
@@ -146,19 +305,32 @@ Stream* TCPStream::factory() {
 bool TCPStream::cloneFrom(Stream*otherStream,
                           const ConnectionCallback &connectionCallback,
                           const BytesReceivedCallback&bytesReceivedCallback) {
+    return cloneFromCallbacks(otherStream,new Callbacks(connectionCallback,
+                                                        bytesReceivedCallback,
+                                                        mSendStatus,
+                                                        mPriority));
+}
+bool TCPStream::cloneFromViews(Stream*otherStream,
+                               const ConnectionCallback &connectionCallback,
+                               const BytesReceivedViewCallback&bytesReceivedCallback) {
+    return cloneFromCallbacks(otherStream,new Callbacks(connectionCallback,
+                                                        bytesReceivedCallback,
+                                                        mSendStatus,
+                                                        mPriority));
+}
+bool TCPStream::cloneFromCallbacks(Stream*otherStream,
+                                   Callbacks*callbacks) {
     TCPStream * toBeCloned=dynamic_cast<TCPStream*>(otherStream);
-    if (NULL==toBeCloned)
-        return false;
-    mSocket=toBeCloned->mSocket;
-    if (!mSocket) {
+    if (NULL==toBeCloned||!toBeCloned->mSocket) {
+        delete callbacks;
         return false;
     }
+    mSocket=toBeCloned->mSocket;
     StreamID newID=mSocket->getNewID();
     mID=newID;
+    NetworkMetrics::add(NetworkMetrics::STREAMS_OPENED);
     //check from addCallbacks if the socket is already disconnected--if so let the user know
-    return mSocket->addCallbacks(newID,new Callbacks(connectionCallback,
-                                                     bytesReceivedCallback,
-                                                     mSendStatus))!=MultiplexedSocket::DISCONNECTED;
+    return mSocket->addCallbacks(newID,callbacks)!=MultiplexedSocket::DISCONNECTED;
 }
 
 
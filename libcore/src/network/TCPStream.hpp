@@ -33,10 +33,14 @@
 #define SIRIKATA_TCPStream_HPP__
 #include "Stream.hpp"
 #include "util/AtomicTypes.hpp"
+#include "NetworkMetrics.hpp"
+#include <boost/thread/mutex.hpp>
 namespace Sirikata { namespace Network {
 class MultiplexedSocket;
 class TCPSetCallbacks;
+class SendWindow;
 class IOService;
+class StreamCompressor;
 
 /**
  * This is a particular example implementation of the Stream interface sitting atop TCP.
@@ -82,6 +86,40 @@ class IOService;
  * 
  * If all streams are shut down, the sockets may be deactivated
  * If the socket disconnects due to error, then Disconnect callbacks must be called
+ *
+ * --Fragmentation--
+ * Once its handshake is complete each side sends a control packet with control code 12 followed by the version of the framing
+ * it can reassemble, written as a variable length int30; a side that does not understand it ignores it.
+ * The other side may from then on split a message longer than the sending stream's maximum frame size into frames so that it
+ * does not hold a socket to itself while it is written and the receiver need not allocate all of it up front; until then every
+ * message goes out whole. Each frame is a control packet with control code 3 (or 4 for the final frame) followed by the variable
+ * length StreamID the message belongs to and then the next piece of the message. All frames of a message go out on the same socket,
+ * in order. A socket takes the packets waiting in each priority class from the streams that have any in turn, one packet at a time,
+ * so other streams' packets are interleaved between the frames; the receiver appends them until the final frame arrives and
+ * then delivers the whole message as though it had been sent in one packet
+ *
+ * --Datagrams--
+ * Once its handshake is complete a connecting side may offer a UDP side channel for unreliable packets: it opens a UDP socket on
+ * the address of its TCP sockets and sends a control packet with control code 5 followed by the port, written as a variable length int30.
+ * A listener that supports it opens a UDP socket of its own and answers on the same TCP socket with control code 6 and its port;
+ * one that does not ignores the unknown control code and the connection carries on over TCP alone.
+ * Each datagram holds exactly one packet in the live phase format above. Only unreliable packets short enough to fit a datagram are sent this way,
+ * and a datagram is ignored unless its stream is already open, so streams are only ever opened and closed over TCP
+ *
+ * --Compression--
+ * Once its handshake is complete either side may send a control packet with control code 8 followed by the version of the
+ * StreamCompressor codec it can decompress, written as a variable length int30; a side that does not understand it ignores it.
+ * The other side may from then on send a message compressed: it is sent as fragmented messages are, except that the final frame
+ * has control code 7 and the reassembled message is decompressed before it is delivered. A compressed message that fits in a single
+ * frame is instead sent as one control packet with control code 11, with the reliability the message was sent with; it is decompressed
+ * as it arrives, even between the frames of another message of the same stream arriving on a different socket.
+ * Only ordered messages refer back to the earlier messages of their stream, which the receiver forgets when the stream closes
+ *
+ * --Keepalive--
+ * Either side may send a control packet with control code 9 followed by a sequence number, written as a variable length int30, on any socket.
+ * The other side answers on the same socket with control code 10 and the same sequence number; a side that does not understand it ignores it.
+ * The time an answer takes is the socket's round trip time. A side only gives up on the connection when a ping goes unanswered
+ * if the other side has answered one before
  */
 class SIRIKATA_EXPORT TCPStream:public Stream {
 public:
@@ -95,7 +133,21 @@ public:
     };
     enum TCPStreamControlCodes {
         TCPStreamCloseStream=1,
-        TCPStreamAckCloseStream=2
+        TCPStreamAckCloseStream=2,
+        TCPStreamFragment=3,
+        TCPStreamLastFragment=4,
+        TCPStreamDatagramOffer=5,
+        TCPStreamDatagramAccept=6,
+        TCPStreamLastCompressedFragment=7,
+        TCPStreamCompressionOffer=8,
+        TCPStreamPing=9,
+        TCPStreamPong=10,
+        TCPStreamCompressedMessage=11,
+        TCPStreamFragmentationOffer=12
+    };
+    ///The version of the framing of fragmented messages the fragmentation offer carries
+    enum {
+        FRAGMENTATION_VERSION=1
     };
 private:
     friend class MultiplexedSocket;
@@ -106,6 +158,13 @@ private:
     std::tr1::shared_ptr<MultiplexedSocket> mSocket;
     ///A function to add callbacks to this particular stream, called by the relevant TCPSetCallbacks function inheriting from SetCallbacks
     void addCallbacks(Callbacks*);
+    ///Shared implementation of connect and connectViews: takes ownership of the callbacks
+    void connectCallbacks(const Address& addy,
+                          const SubstreamCallback &substreamCallback,
+                          Callbacks*callbacks);
+    ///Shared implementation of cloneFrom and cloneFromViews: takes ownership of the callbacks
+    bool cloneFromCallbacks(Stream*otherStream,
+                            Callbacks*callbacks);
     ///The streamID that must be prepended to the data within any packet sent and all received packets for this Stream
     StreamID mID;
     enum {
@@ -114,6 +173,27 @@ private:
     };
     ///incremented while sending: or'd in SendStatusClosing when close function triggered so no further packets will be sent using old ID.
     std::tr1::shared_ptr<AtomicValue<int> >mSendStatus;
+    ///The class of traffic this stream's packets (and the close of the stream) are queued in on the sockets
+    StreamPriority mPriority;
+    ///Counts this stream's bytes that are queued but not yet written: shared with the Chunks still waiting to go out
+    SendWindow*mSendWindow;
+    ///Messages longer than this are sent as a series of frames no longer than this: 0 sends every message as a single packet
+    size_t mMaxFrameSize;
+    ///How many TCP sockets connect() opens to carry the connection
+    unsigned int mNumSockets;
+    ///Messages at least this long are compressed if the other end can decompress them: 0 never compresses
+    size_t mCompressionThreshold;
+    ///The history of the ordered messages this stream has compressed, made when the first one is
+    StreamCompressor*mCompressor;
+    ///Held while an ordered message is compressed and queued, so messages are queued in the order they were compressed
+    boost::mutex mCompressorMutex;
+    ///The longest frame a message may be split into on this stream's connection: 0 until the other end has offered to reassemble frames
+    size_t frameSize()const;
+    /**
+     * Splits a message into frames no longer than frameSize(), the last with control code lastFrameCode, and queues them.
+     * A message of several frames goes on the socket the stream's ordered packets use whatever reliability asks for: returns as send does
+     */
+    bool sendFrames(const Chunk&data,uint8 lastFrameCode,StreamReliability reliability);
 public:
     ///Atomically sets the sendStatus for this socket to closed. FIXME: should use atomic compare and swap for |= instead of += right now only supports 2 non-io threads closing at once
     static void closeSendStatus(AtomicValue<int>&vSendStatus);
@@ -126,34 +206,110 @@ public:
     class Callbacks:public Noncopyable {        
     public:
         Stream::ConnectionCallback mConnectionCallback;
+        ///set if the user wants received bytes copied into a Chunk of their own
         Stream::BytesReceivedCallback mBytesReceivedCallback;
+        ///set instead of mBytesReceivedCallback if the user is happy with views into the receive slabs
+        Stream::BytesReceivedViewCallback mBytesReceivedViewCallback;
         std::tr1::weak_ptr<AtomicValue<int> > mSendStatus;
+        ///The priority of the stream when it registered these callbacks: the ack of a remote close is queued in this class
+        StreamPriority mPriority;
         Callbacks(const Stream::ConnectionCallback &connectionCallback,
                   const Stream::BytesReceivedCallback &bytesReceivedCallback,
-                  const std::tr1::weak_ptr<AtomicValue<int> >&sendStatus):
+                  const std::tr1::weak_ptr<AtomicValue<int> >&sendStatus,
+                  StreamPriority priority):
             mConnectionCallback(connectionCallback),
             mBytesReceivedCallback(bytesReceivedCallback),
-            mSendStatus(sendStatus){
+            mSendStatus(sendStatus),
+            mPriority(priority){
+        }
+        Callbacks(const Stream::ConnectionCallback &connectionCallback,
+                  const Stream::BytesReceivedViewCallback &bytesReceivedViewCallback,
+                  const std::tr1::weak_ptr<AtomicValue<int> >&sendStatus,
+                  StreamPriority priority):
+            mConnectionCallback(connectionCallback),
+            mBytesReceivedViewCallback(bytesReceivedViewCallback),
+            mSendStatus(sendStatus),
+            mPriority(priority){
+        }
+        ///Hands a received packet to whichever callback was registered, only copying the bytes out of the slab for old-style callbacks
+        void bytesReceived(const ChunkView&data) {
+            if (mBytesReceivedViewCallback) {
+                mBytesReceivedViewCallback(data);
+            }else if (data.spansSlab()) {
+                mBytesReceivedCallback(*data.slab());
+            }else {
+                mBytesReceivedCallback(data.copy());
+            }
         }
     };
     ///Constructor which leaves socket in a disconnection state, prepared for a connect() or a clone()
     TCPStream(IOService&);
     ///Constructor which brings the socket up to speed in a completely connected state, prepped with a StreamID and communal link pointer
     TCPStream(const std::tr1::shared_ptr<MultiplexedSocket> &shared_socket, const Stream::StreamID&);
+    ///Lets go of the send window, which lives on until the last of this stream's queued Chunks is retired
+    ~TCPStream();
     ///Implementation of send interface
-    virtual void send(const Chunk&data,StreamReliability);
+    virtual bool send(const Chunk&data,StreamReliability);
+    ///Implementation of setSendWindow interface
+    virtual void setSendWindow(size_t windowBytes,const ReadySendCallback&readySendCallback);
+    ///Implementation of getQueuedBytes interface
+    virtual size_t getQueuedBytes()const;
+    ///Fills in the state of each TCP socket of the connection this stream is on: left empty if the stream is not connected
+    void getConnectionSnapshot(NetworkMetrics::ConnectionSnapshot&snapshot)const;
+    /**
+     * Smoothed microseconds the keepalive pings of this stream's connection take to be answered, taken from the socket answering fastest
+     * as the others may be held up behind their queues. 0 until a ping has been answered, or if the stream is not connected
+     */
+    uint32 getRoundTripTime()const;
+    ///Implementation of setPriority interface
+    virtual void setPriority(StreamPriority priority);
+    ///Implementation of getPriority interface
+    virtual StreamPriority getPriority()const;
+    /**
+     * Sets the longest piece of a message sent as a single packet: longer messages are split into frames of this size
+     * once the other end has offered to reassemble them. Defaults to the tcpsst.maxframesize option; 0 turns fragmentation off
+     */
+    void setMaxFrameSize(size_t maxFrameSize);
+    ///The longest piece of a message this stream sends as a single packet
+    size_t getMaxFrameSize()const {return mMaxFrameSize;}
+    /**
+     * Sets how many TCP sockets a later connect() opens, between 1 and MAX_SOCKETS.
+     * Defaults to the tcpsst.sockets option; the listener takes however many the connecting side opens
+     */
+    void setNumSockets(unsigned int numSockets);
+    /**
+     * Sets how long a message must be for it to be compressed, which only happens once the other end has offered to decompress.
+     * Defaults to the tcpsst.compressthreshold option; 0 never compresses
+     */
+    void setCompressionThreshold(size_t compressionThreshold);
+    ///How long a message must be for this stream to compress it
+    size_t getCompressionThreshold()const {return mCompressionThreshold;}
+    enum {
+        ///The most sockets one connection may use, as the protocol header carries the count in two decimal digits
+        MAX_SOCKETS=99
+    };
     ///Implementation of connect interface
     virtual void connect(
         const Address& addy,
         const SubstreamCallback &substreamCallback,
         const ConnectionCallback &connectionCallback,
         const BytesReceivedCallback&chunkReceivedCallback);
+    ///Implementation of connect interface delivering views into the receive slabs
+    virtual void connectViews(
+        const Address& addy,
+        const SubstreamCallback &substreamCallback,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedViewCallback&chunkReceivedCallback);
     ///Creates a stream of the same type as this stream, with the same IO factory
     virtual Stream* factory();
     ///Creates a new substream on this connection
     virtual bool cloneFrom(Stream*,
         const ConnectionCallback &connectionCallback,
         const BytesReceivedCallback&chunkReceivedCallback);
+    ///Creates a new substream on this connection delivering views into the receive slabs
+    virtual bool cloneFromViews(Stream*,
+        const ConnectionCallback &connectionCallback,
+        const BytesReceivedViewCallback&chunkReceivedCallback);
     //Shuts down the socket, allowing StreamID to be reused and opposing stream to get disconnection callback
     virtual void close();
 };
@@ -35,38 +35,46 @@
 #include "TCPStream.hpp"
 #include "TCPStreamListener.hpp"
 #include "ASIOStreamBuilder.hpp"
+#include "IOServicePool.hpp"
 #include "options/Options.hpp"
 namespace Sirikata { namespace Network {
 using namespace boost::asio::ip;
 
 TCPStreamListener::TCPStreamListener(IOService&io) {
     mIOService=&io;
+    mIOServicePool=NULL;
     mTCPAcceptor=NULL;
 }
-bool newAcceptPhase(TCPListener*listen, IOService* io,const Stream::SubstreamCallback &cb);
-void handleAccept(TCPSocket*socket,TCPListener*listen, IOService* io,const Stream::SubstreamCallback &cb,const boost::system::error_code& error){
+TCPStreamListener::TCPStreamListener(IOServicePool&pool) {
+    mIOService=&pool.service(0);
+    mIOServicePool=&pool;
+    mTCPAcceptor=NULL;
+}
+bool newAcceptPhase(TCPListener*listen, IOService* io, IOServicePool*pool, const Stream::SubstreamCallback &cb);
+void handleAccept(TCPSocket*socket,TCPListener*listen, IOService* io, IOServicePool*pool, const Stream::SubstreamCallback &cb,const boost::system::error_code& error){
     if(error) {
 		boost::system::system_error se(error);
 		SILOG(tcpsst,error, "ERROR IN THE TCP STREAM ACCEPTING PROCESS"<<se.what() << std::endl);
         //FIXME: attempt more?
     }else {
-        ASIOStreamBuilder::beginNewStream(socket,io,cb);
-        newAcceptPhase(listen,io,cb);
+        ASIOStreamBuilder::beginNewStream(socket,io,pool,cb);
+        newAcceptPhase(listen,io,pool,cb);
     }
 }
-bool newAcceptPhase(TCPListener*listen, IOService* io, const Stream::SubstreamCallback &cb) {
+bool newAcceptPhase(TCPListener*listen, IOService* io, IOServicePool*pool, const Stream::SubstreamCallback &cb) {
+    //accepted sockets stay on the listening IOService until the handshake says which connection they belong to
     TCPSocket*socket=new TCPSocket(*io);
     //need to use boost bind to avoid TR1 errors about compatibility with boost::asio::placeholders
      
     listen->async_accept(*socket,
-                         std::tr1::bind(&handleAccept,socket,listen,io,cb,_1));
+                         std::tr1::bind(&handleAccept,socket,listen,io,pool,cb,_1));
     return true;
 }
 bool TCPStreamListener::listen (const Address&address,
                                 const Stream::SubstreamCallback&newStreamCallback) {
 
     mTCPAcceptor = new TCPListener(*mIOService,tcp::endpoint(tcp::v4(), atoi(address.getService().c_str())));
-    return newAcceptPhase(mTCPAcceptor,mIOService,newStreamCallback);
+    return newAcceptPhase(mTCPAcceptor,mIOService,mIOServicePool,newStreamCallback);
 }
 TCPStreamListener::~TCPStreamListener() {
     delete mTCPAcceptor;
@@ -35,6 +35,7 @@
 #include "StreamListener.hpp"
 namespace Sirikata { namespace Network {
 class IOService;
+class IOServicePool;
 class TCPListener;
 /**
  * This class waits on a service and listens for incoming connections
@@ -44,6 +45,11 @@ class SIRIKATA_EXPORT TCPStreamListener:public StreamListener{
 
 public:
     TCPStreamListener(IOService&);
+    /**
+     * Listens on one of the pool's IOServices and hands each connection to the next IOService in the pool once its handshake is in,
+     * so the substream callback for a connection, and every callback after it, comes from that IOService's thread
+     */
+    TCPStreamListener(IOServicePool&);
     ///subclasses will expose these methods with similar arguments + protocol specific args
     virtual bool listen(
         const Address&addy,
@@ -56,6 +62,8 @@ public:
     virtual void close();
     virtual ~TCPStreamListener();
     IOService * mIOService;
+    ///The pool accepted connections are spread over, or NULL to keep them all on mIOService
+    IOServicePool * mIOServicePool;
     TCPListener *mTCPAcceptor;
 };
 } }
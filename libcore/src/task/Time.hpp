@@ -103,11 +103,11 @@ public:
     }
 	/// Convert to an integer in milliseconds.
 	int64 toMilliseconds() const {
-		return (int64)(mDeltaTime*1000);
+		return mDeltaTime/1000;
 	}
 	/// Convert to an integer in microseconds.
 	int64 toMicroseconds() const {
-		return (int64)(mDeltaTime*1000000);
+		return mDeltaTime;
 	}
 	/// Convert to an integer in microseconds.
 	int64 toMicro() const {
@@ -0,0 +1,243 @@
+/*  Sirikata Kernel -- Task scheduling system
+ *  TimerQueue.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "TimerQueue.hpp"
+
+namespace Sirikata {
+
+/**
+ * TimerQueue.cpp -- Definition for TimerQueue functions
+ */
+
+namespace Task {
+
+TimerQueue timer_queue;
+
+TimerQueue::TimerQueue()
+		: mFreeTimers(NO_TIMER), mNextTick(0), mEarliestTick(0), mNumScheduled(0) {
+	for (uint32 i = 0; i <= NUM_SLOTS; ++i) {
+		mSlots[i] = NO_TIMER;
+	}
+	for (uint32 i = 0; i < NUM_WHEELS; ++i) {
+		mWheelCounts[i] = 0;
+	}
+}
+
+void TimerQueue::start(AbsTime now) {
+	if (mNextTick == 0) {
+		mNextTick = (uint64)(now - AbsTime::null()).toMicroseconds() / TICK_MICROSECONDS;
+		mEarliestTick = mNextTick;
+	}
+}
+
+uint64 TimerQueue::tickAfter(AbsTime time) {
+	int64 us = (time - AbsTime::null()).toMicroseconds();
+	return us > 0 ? ((uint64)us + TICK_MICROSECONDS - 1) / TICK_MICROSECONDS : 0;
+}
+
+uint32 TimerQueue::add(AbsTime time, const TimedEvent &ev) {
+	start(AbsTime::now());
+	uint32 timer = mFreeTimers;
+	if (timer == NO_TIMER) {
+		timer = (uint32)mTimers.size();
+		mTimers.push_back(Timer());
+	} else {
+		mFreeTimers = mTimers[timer].mNext;
+	}
+	Timer &entry = mTimers[timer];
+	entry.mEvent = ev;
+	entry.mTick = std::max(tickAfter(time), mEarliestTick);
+	entry.mCancelled = false;
+	++mNumScheduled;
+	link(timer);
+	return timer;
+}
+
+void TimerQueue::link(uint32 timer) {
+	Timer &entry = mTimers[timer];
+	// Which wheel is decided by how far ahead of the wheels' position the
+	// event is; which slot by the event's own tick, so that a slot comes up
+	// for cascading just as its events come within reach of the wheel below.
+	uint64 ahead = entry.mTick - mNextTick;
+	uint64 tick = entry.mTick;
+	uint32 wheel = 0;
+	while (wheel < NUM_WHEELS - 1 && ahead >= ((uint64)1 << (WHEEL_BITS * (wheel + 1)))) {
+		++wheel;
+	}
+	if (ahead >= ((uint64)1 << (WHEEL_BITS * NUM_WHEELS))) {
+		tick = mNextTick + ((uint64)1 << (WHEEL_BITS * NUM_WHEELS)) - 1;
+	}
+	uint32 slot = wheel * WHEEL_SIZE + (uint32)((tick >> (WHEEL_BITS * wheel)) & WHEEL_MASK);
+	entry.mSlot = slot;
+	++mWheelCounts[wheel];
+	entry.mPrev = NO_TIMER;
+	entry.mNext = mSlots[slot];
+	if (entry.mNext != NO_TIMER) {
+		mTimers[entry.mNext].mPrev = timer;
+	}
+	mSlots[slot] = timer;
+}
+
+void TimerQueue::unlink(uint32 timer) {
+	Timer &entry = mTimers[timer];
+	if (entry.mSlot < NUM_SLOTS) {
+		--mWheelCounts[entry.mSlot / WHEEL_SIZE];
+	}
+	if (entry.mPrev != NO_TIMER) {
+		mTimers[entry.mPrev].mNext = entry.mNext;
+	} else {
+		mSlots[entry.mSlot] = entry.mNext;
+	}
+	if (entry.mNext != NO_TIMER) {
+		mTimers[entry.mNext].mPrev = entry.mPrev;
+	}
+	entry.mPrev = NO_TIMER;
+	entry.mNext = NO_TIMER;
+}
+
+void TimerQueue::release(uint32 timer) {
+	Timer &entry = mTimers[timer];
+	entry.mEvent = TimedEvent();
+	entry.mSlot = FREE;
+	++entry.mGeneration;
+	entry.mNext = mFreeTimers;
+	mFreeTimers = timer;
+	--mNumScheduled;
+}
+
+void TimerQueue::cascade(uint32 slot) {
+	uint32 timer = mSlots[slot];
+	mSlots[slot] = NO_TIMER;
+	while (timer != NO_TIMER) {
+		uint32 next = mTimers[timer].mNext;
+		--mWheelCounts[slot / WHEEL_SIZE];
+		link(timer);
+		timer = next;
+	}
+}
+
+void TimerQueue::runExpiring(AbsTime now) {
+	while (mSlots[EXPIRING] != NO_TIMER) {
+		uint32 timer = mSlots[EXPIRING];
+		unlink(timer);
+		mTimers[timer].mSlot = RUNNING;
+		// The handler may schedule more events, moving mTimers, so it runs
+		// from a copy of its own and is put back only if it is rescheduled.
+		TimedEvent ev;
+		ev.swap(mTimers[timer].mEvent);
+		DeltaTime again = ev();
+		Timer &entry = mTimers[timer];
+		if (entry.mCancelled || again.toMicroseconds() < 0) {
+			release(timer);
+		} else {
+			entry.mEvent.swap(ev);
+			entry.mTick = std::max(tickAfter(now + again), mEarliestTick);
+			link(timer);
+		}
+	}
+}
+
+void TimerQueue::schedule(AbsTime nextTime,
+			const TimedEvent &ev) {
+	add(nextTime, ev);
+}
+
+SubscriptionId TimerQueue::scheduleId(AbsTime nextTime,
+			const TimedEvent &ev) {
+	uint32 timer = add(nextTime, ev);
+	return ((SubscriptionId)(mTimers[timer].mGeneration & 0x7fffffff) << 32) | timer;
+}
+
+void TimerQueue::unschedule(const SubscriptionId &removeId) {
+	if (removeId < 0) {
+		return;
+	}
+	uint32 timer = (uint32)(removeId & 0xffffffff);
+	if (timer >= mTimers.size()) {
+		return;
+	}
+	Timer &entry = mTimers[timer];
+	if (entry.mSlot == FREE || (entry.mGeneration & 0x7fffffff) != (uint32)(removeId >> 32)) {
+		return;
+	}
+	if (entry.mSlot == RUNNING) {
+		entry.mCancelled = true;
+	} else {
+		unlink(timer);
+		release(timer);
+	}
+}
+
+void TimerQueue::processTimerQueue(AbsTime now) {
+	start(now);
+	uint64 lastTick = (uint64)(now - AbsTime::null()).toMicroseconds() / TICK_MICROSECONDS;
+	// Whatever the handlers schedule waits for the next call.
+	mEarliestTick = lastTick + 1;
+	while (mNextTick <= lastTick) {
+		// Skip straight to the next time the first wheel holding anything
+		// cascades, when the wheels below it are empty.
+		uint32 lowest = 0;
+		while (lowest < NUM_WHEELS && mWheelCounts[lowest] == 0) {
+			++lowest;
+		}
+		if (lowest > 0) {
+			uint64 turn = lowest < NUM_WHEELS ? (uint64)1 << (WHEEL_BITS * lowest) : 0;
+			uint64 cascadeTick = turn ? (mNextTick + turn - 1) & ~(turn - 1) : lastTick + 1;
+			if (cascadeTick > lastTick) {
+				mNextTick = lastTick + 1;
+				break;
+			}
+			mNextTick = cascadeTick;
+		}
+		uint32 index = (uint32)(mNextTick & WHEEL_MASK);
+		// Coming round to the start of a wheel brings the next slot of the
+		// wheel after it within reach, and so on up while those wrap too.
+		for (uint32 wheel = 1; index == 0 && wheel < NUM_WHEELS; ++wheel) {
+			index = (uint32)((mNextTick >> (WHEEL_BITS * wheel)) & WHEEL_MASK);
+			cascade(wheel * WHEEL_SIZE + index);
+		}
+		index = (uint32)(mNextTick & WHEEL_MASK);
+		++mNextTick;
+		// The whole slot expires at once: handing its list over is all it takes.
+		mSlots[EXPIRING] = mSlots[index];
+		mSlots[index] = NO_TIMER;
+		for (uint32 timer = mSlots[EXPIRING]; timer != NO_TIMER; timer = mTimers[timer].mNext) {
+			mTimers[timer].mSlot = EXPIRING;
+			--mWheelCounts[0];
+		}
+		runExpiring(now);
+	}
+	mEarliestTick = mNextTick;
+}
+
+}
+}
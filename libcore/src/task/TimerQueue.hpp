@@ -53,10 +53,96 @@ typedef std::tr1::function<DeltaTime()> TimedEvent;
 
 
 
-/** A work queue that runs on each frame. */
-class TimerQueue {
-	std::map<AbsTime, std::list<TimedEvent> > mQueue;
+/**
+ * A work queue that runs on each frame.
+ *
+ * Events are kept in a hierarchical timing wheel: NUM_WHEELS wheels of
+ * WHEEL_SIZE slots, where a slot of the first wheel holds the events due in
+ * one tick of TICK_MICROSECONDS and a slot of each later wheel spans a whole
+ * turn of the wheel before it.  An event goes straight into the slot for its
+ * time and is cancelled by unlinking it, so both take constant time, and
+ * processTimerQueue empties a whole slot of the first wheel per tick.  Each
+ * time the first wheel comes round, the next slot of the second wheel is
+ * spread out over it (and so on up), so an event is moved at most
+ * NUM_WHEELS-1 times however far ahead it was scheduled.
+ *
+ * Events are held in a vector whose entries are reused, so scheduling
+ * allocates nothing once the queue has reached its working size besides
+ * what copying the TimedEvent needs.  An event never runs before its time and
+ * runs at most a tick late, depending on how often processTimerQueue is called.
+ * Not thread safe: schedule and process from the thread running the frame.
+ */
+class SIRIKATA_EXPORT TimerQueue {
+public:
+	enum {
+		/// The length of a tick: events due within the same tick run in the same batch
+		TICK_MICROSECONDS=1000,
+		WHEEL_BITS=8,
+		WHEEL_SIZE=1<<WHEEL_BITS,
+		WHEEL_MASK=WHEEL_SIZE-1,
+		/// Enough wheels to reach 2^32 ticks ahead (about 49 days); later events wait in the last slot they can reach
+		NUM_WHEELS=4
+	};
+private:
+	enum {
+		NUM_SLOTS=NUM_WHEELS*WHEEL_SIZE,
+		/// The list of events taken off the first wheel that have yet to run in the current tick
+		EXPIRING=NUM_SLOTS,
+		/// mSlot of an event whose handler is running
+		RUNNING=NUM_SLOTS+1,
+		/// mSlot of an entry that holds no event
+		FREE=NUM_SLOTS+2,
+		NO_TIMER=0xffffffff
+	};
+	/** An entry of mTimers: an event, or a spare entry on the free list. */
+	class Timer {
+	public:
+		TimedEvent mEvent;
+		/// The tick the event is due in
+		uint64 mTick;
+		/// Neighbours in the slot's list, or the next spare entry for a FREE one
+		uint32 mPrev;
+		uint32 mNext;
+		/// The slot whose list holds the event, or EXPIRING, RUNNING or FREE
+		uint32 mSlot;
+		/// Changed whenever the entry is freed so that the ids of its old events no longer match
+		uint32 mGeneration;
+		/// Set when a RUNNING event is unscheduled so that it is not rescheduled
+		bool mCancelled;
+		Timer():mTick(0),mPrev(NO_TIMER),mNext(NO_TIMER),mSlot(FREE),mGeneration(0),mCancelled(false) {
+		}
+	};
+	std::vector<Timer> mTimers;
+	/// The first event in each slot, and in the EXPIRING list
+	uint32 mSlots[NUM_SLOTS+1];
+	/// The number of events in each wheel, so that ticks with nothing to run or cascade can be skipped
+	uint32 mWheelCounts[NUM_WHEELS];
+	/// The first spare entry of mTimers
+	uint32 mFreeTimers;
+	/// The next tick processTimerQueue will run: set from the clock by the first schedule or process
+	uint64 mNextTick;
+	/// No event scheduled or rescheduled runs in an earlier tick: mNextTick, or while processing, the tick after the last one being run
+	uint64 mEarliestTick;
+	size_t mNumScheduled;
+
+	/// Sets mNextTick from the clock if nothing has yet
+	void start(AbsTime now);
+	/// The first tick that starts at or after time
+	static uint64 tickAfter(AbsTime time);
+	/// Takes a spare entry for ev due at time and links it into its slot, returning its index
+	uint32 add(AbsTime time, const TimedEvent &ev);
+	/// Links timer into the slot for its mTick
+	void link(uint32 timer);
+	/// Takes timer out of the list holding it
+	void unlink(uint32 timer);
+	/// Releases the event timer holds and puts it on the free list
+	void release(uint32 timer);
+	/// Moves every event of the list headed by mSlots[slot] to the slots it is now close enough for
+	void cascade(uint32 slot);
+	/// Runs the EXPIRING list, rescheduling or releasing each event as its handler asks
+	void runExpiring(AbsTime now);
 public:
+	TimerQueue();
 
 	/**
 	 * Schedules this event to occur at nextTime.  The only way to remove
@@ -88,15 +174,31 @@ public:
 
 	/**
 	 * Unsubscribes from the event matching removeId. The removeId should be
-	 * the value returned when creating the subscription.
+	 * the value returned when creating the subscription.  Unscheduling an
+	 * event that has already been removed does nothing, and an event may
+	 * unschedule itself from its own handler.
 	 *
 	 * @param removeId  the exact SubscriptionID to search for.
 	 */
 	void unschedule(const SubscriptionId &removeId);
+
+	/**
+	 * Runs every event due by now, a tick's worth at a time, in the order of
+	 * the ticks they are due in.  Events scheduled or rescheduled by the
+	 * handlers, even for a time already past, wait for the next call.
+	 *
+	 * @param now  The current time, usually that of the frame.
+	 */
+	void processTimerQueue(AbsTime now);
+
+	/// The number of events waiting to run
+	size_t numScheduled() const {
+		return mNumScheduled;
+	}
 };
 
 /// Global TimerQueue singleton.
-extern TimerQueue timer_queue;
+extern SIRIKATA_EXPORT TimerQueue timer_queue;
 
 }
 }
@@ -0,0 +1,221 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  ARCPolicy.hpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_ARCPolicy_HPP__
+#define SIRIKATA_ARCPolicy_HPP__
+
+#include "CachePolicy.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * Adaptive Replacement Cache (Megiddo and Modha), counted in bytes rather than entries.
+ *
+ * Entries seen once since they were cached live in a recency list, and move to
+ * a frequency list when used again, so a single sweep through many new files
+ * only ever pushes out other files seen once.  The fingerprints of recently
+ * evicted entries are remembered in a ghost list for each: creating an entry
+ * that was just evicted from one list grows the target share of the cache
+ * given to that list, so the split between the two follows the workload.
+ */
+class ARCPolicy : public CachePolicy {
+
+	enum ListId {RECENT, FREQUENT, NUM_LISTS};
+
+	typedef std::list<Fingerprint> ARCList;
+
+	struct ARCData : public Data {
+		ListId mList;
+		ARCList::iterator mIter;
+		cache_usize_type mSize;
+
+		ARCData(ListId list, const ARCList::iterator &iter, cache_usize_type size)
+			: mList(list), mIter(iter), mSize(size) {
+		}
+	};
+
+	/// An evicted entry: which list it was evicted from, and how large it was.
+	struct Ghost {
+		ListId mList;
+		ARCList::iterator mIter;
+		cache_usize_type mSize;
+	};
+	typedef std::tr1::unordered_map<Fingerprint, Ghost, Fingerprint::Hasher> GhostMap;
+
+	/// Cached entries, least recently used at the front.
+	ARCList mLists[NUM_LISTS];
+	cache_usize_type mListBytes[NUM_LISTS];
+	/// Evicted entries, least recently evicted at the front.
+	ARCList mGhostLists[NUM_LISTS];
+	cache_usize_type mGhostBytes[NUM_LISTS];
+	GhostMap mGhosts;
+
+	/// The number of bytes the recent list should get (p in the paper).
+	double mRecentTarget;
+
+	/// The entry last returned from nextItem(): if it is destroyed, it is remembered as a ghost.
+	Fingerprint mVictim;
+	bool mHaveVictim;
+
+	void forgetGhost(GhostMap::iterator ghost) {
+		Ghost &gh = (*ghost).second;
+		mGhostBytes[gh.mList] -= gh.mSize;
+		mGhostLists[gh.mList].erase(gh.mIter);
+		mGhosts.erase(ghost);
+	}
+
+	/// Keeps the recent list and its ghosts within the cache size, and all four lists within twice it.
+	void trimGhosts() {
+		while (!mGhostLists[RECENT].empty() &&
+				mListBytes[RECENT] + mGhostBytes[RECENT] > mTotalSize) {
+			forgetGhost(mGhosts.find(mGhostLists[RECENT].front()));
+		}
+		while (!mGhostLists[FREQUENT].empty() &&
+				mListBytes[RECENT] + mListBytes[FREQUENT] + mGhostBytes[RECENT] + mGhostBytes[FREQUENT] > 2 * mTotalSize) {
+			forgetGhost(mGhosts.find(mGhostLists[FREQUENT].front()));
+		}
+	}
+
+	ARCData *moveTo(ListId list, const Fingerprint &id, ARCData *arcdata) {
+		mListBytes[arcdata->mList] -= arcdata->mSize;
+		mLists[list].splice(mLists[list].end(), mLists[arcdata->mList], arcdata->mIter);
+		arcdata->mList = list;
+		mListBytes[list] += arcdata->mSize;
+		return arcdata;
+	}
+
+public:
+	ARCPolicy(cache_usize_type allocatedSpace, float maxSizePct=0.5)
+		: CachePolicy(allocatedSpace, maxSizePct), mRecentTarget(0), mHaveVictim(false) {
+		for (int i = 0; i < NUM_LISTS; ++i) {
+			mListBytes[i] = 0;
+			mGhostBytes[i] = 0;
+		}
+	}
+
+	virtual void use(const Fingerprint &id, Data* data, cache_usize_type size) {
+		moveTo(FREQUENT, id, static_cast<ARCData*>(data));
+	}
+
+	virtual void useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize) {
+		ARCData *arcdata = static_cast<ARCData*>(data);
+		mListBytes[arcdata->mList] += newsize;
+		mListBytes[arcdata->mList] -= arcdata->mSize;
+		arcdata->mSize = newsize;
+		use(id, data, newsize);
+		CachePolicy::updateSpace(oldsize, newsize);
+	}
+
+	virtual void destroy(const Fingerprint &id, Data* data, cache_usize_type size) {
+		ARCData *arcdata = static_cast<ARCData*>(data);
+
+		CachePolicy::updateSpace(size, 0);
+
+		SILOG(transfer,debug,"[ARCPolicy] Freeing " << id << " (" << size << " bytes); " << mFreeSpace << " free");
+		mListBytes[arcdata->mList] -= arcdata->mSize;
+		mLists[arcdata->mList].erase(arcdata->mIter);
+		if (mHaveVictim && mVictim == id) {
+			// Evicted rather than purged: remember it in case it comes back.
+			mHaveVictim = false;
+			Ghost &ghost = mGhosts[id];
+			ghost.mList = arcdata->mList;
+			ghost.mSize = arcdata->mSize;
+			mGhostLists[ghost.mList].push_back(id);
+			ghost.mIter = mGhostLists[ghost.mList].end();
+			--ghost.mIter;
+			mGhostBytes[ghost.mList] += ghost.mSize;
+			trimGhosts();
+		}
+		delete arcdata;
+	}
+
+	virtual Data* create(const Fingerprint &id, cache_usize_type size) {
+		CachePolicy::updateSpace(0, size);
+
+		ListId list = RECENT;
+		GhostMap::iterator ghost = mGhosts.find(id);
+		if (ghost != mGhosts.end()) {
+			// Evicted too soon: give more room to the list it was evicted from.
+			double recentGhosts = (double)mGhostBytes[RECENT];
+			double frequentGhosts = (double)mGhostBytes[FREQUENT];
+			double step = (double)(size ? size : 1);
+			if ((*ghost).second.mList == RECENT) {
+				if (recentGhosts > 0 && frequentGhosts > recentGhosts) {
+					step *= frequentGhosts / recentGhosts;
+				}
+				mRecentTarget = std::min((double)mTotalSize, mRecentTarget + step);
+			} else {
+				if (frequentGhosts > 0 && recentGhosts > frequentGhosts) {
+					step *= recentGhosts / frequentGhosts;
+				}
+				mRecentTarget = std::max(0., mRecentTarget - step);
+			}
+			forgetGhost(ghost);
+			list = FREQUENT;
+		}
+		mLists[list].push_back(id);
+		ARCList::iterator newIter = mLists[list].end();
+		--newIter;
+		mListBytes[list] += size;
+		trimGhosts();
+
+		return new ARCData(list, newIter, size);
+	}
+
+	virtual bool nextItem(
+			cache_usize_type requiredSpace,
+			Fingerprint &myprint)
+	{
+		if (mFreeSpace >= (cache_ssize_type)requiredSpace) {
+			return false;
+		}
+		ListId list;
+		if (!mLists[RECENT].empty() &&
+				((double)mListBytes[RECENT] > mRecentTarget || mLists[FREQUENT].empty())) {
+			list = RECENT;
+		} else if (!mLists[FREQUENT].empty()) {
+			list = FREQUENT;
+		} else {
+			return false;
+		}
+		myprint = mLists[list].front();
+		mVictim = myprint;
+		mHaveVictim = true;
+		return true;
+	}
+};
+
+}
+}
+
+#endif /* SIRIKATA_ARCPolicy_HPP__ */
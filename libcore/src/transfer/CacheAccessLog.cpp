@@ -0,0 +1,125 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  CacheAccessLog.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "options/Options.hpp"
+#include <boost/thread/locks.hpp>
+#include "CacheAccessLog.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+namespace {
+OptionValue *sAccessLogFile;
+InitializeGlobalOptions gAccessLogOptions("transfer",
+	sAccessLogFile = new OptionValue("accesslog", "", OptionValueType<std::string>(), "Record every request answered by a memory cache to this file, to compare cache policies with cachesim"),
+	NULL);
+boost::mutex sCurrentLogMutex;
+std::string sCurrentLogFile;
+std::tr1::shared_ptr<CacheAccessLog> sCurrentLog;
+}
+
+std::tr1::shared_ptr<CacheAccessLog> CacheAccessLog::current() {
+	std::string filename = sAccessLogFile->as<std::string>();
+	boost::lock_guard<boost::mutex> lok(sCurrentLogMutex);
+	if (filename != sCurrentLogFile) {
+		sCurrentLogFile = filename;
+		sCurrentLog = std::tr1::shared_ptr<CacheAccessLog>();
+		if (!filename.empty()) {
+			std::tr1::shared_ptr<CacheAccessLog> log(new CacheAccessLog(filename));
+			if (log->isOpen()) {
+				sCurrentLog = log;
+			} else {
+				SILOG(transfer,error,"[CacheAccessLog] Could not open access log " << filename);
+			}
+		}
+	}
+	return sCurrentLog;
+}
+
+CacheAccessLog::CacheAccessLog(const std::string &filename)
+		: mStartTime(Task::AbsTime::now()) {
+	mFile = fopen(filename.c_str(), "w");
+	if (mFile && fputs("# microseconds fingerprint bytes\n", mFile) < 0) {
+		fclose(mFile);
+		mFile = NULL;
+	}
+}
+
+CacheAccessLog::~CacheAccessLog() {
+	if (mFile) {
+		fclose(mFile);
+	}
+}
+
+void CacheAccessLog::record(const Fingerprint &fileId, cache_usize_type size) {
+	Array<char, Fingerprint::hex_size> hex = fileId.convertToHex();
+	boost::lock_guard<boost::mutex> lok(mMutex);
+	// timed under the lock so the times in the file never go backwards
+	uint64 time = (uint64)(Task::AbsTime::now() - mStartTime).toMicroseconds();
+	fprintf(mFile, "%llu %.*s %llu\n", (unsigned long long)time,
+		(int)Fingerprint::hex_size, hex.data(), (unsigned long long)size);
+}
+
+void CacheAccessLog::flush() {
+	boost::lock_guard<boost::mutex> lok(mMutex);
+	fflush(mFile);
+}
+
+bool CacheAccessLog::read(const std::string &filename, std::vector<Access> &accesses) {
+	std::ifstream log(filename.c_str());
+	if (!log) {
+		return false;
+	}
+	std::string line;
+	while (std::getline(log, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::istringstream fields(line);
+		Access access;
+		std::string hex;
+		if (!(fields >> access.mTime >> hex >> access.mSize) || hex.length() != Fingerprint::hex_size) {
+			return false;
+		}
+		try {
+			access.mFileId = Fingerprint::convertFromHex(hex);
+		} catch (std::invalid_argument &) {
+			return false;
+		}
+		accesses.push_back(access);
+	}
+	return true;
+}
+
+}
+}
@@ -0,0 +1,99 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  CacheAccessLog.hpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SIRIKATA_CacheAccessLog_HPP__
+#define SIRIKATA_CacheAccessLog_HPP__
+
+#include <boost/thread/mutex.hpp>
+#include "task/Time.hpp"
+#include "URI.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * A log of every getData request answered by a MemoryCacheLayer made while
+ * the transfer.accesslog option names a file, for replay through a CacheSimulator.
+ *
+ * The log is text, one answered request per line: microseconds since the log
+ * was started, the hex Fingerprint of the file, and the number of bytes of the
+ * file the answer held.  Lines starting with '#' are ignored.
+ */
+class SIRIKATA_EXPORT CacheAccessLog : Noncopyable {
+	FILE *mFile;
+	boost::mutex mMutex;
+	Task::AbsTime mStartTime;
+
+public:
+	/// One request read back from a log.
+	struct Access {
+		uint64 mTime;
+		Fingerprint mFileId;
+		cache_usize_type mSize;
+	};
+
+	/**
+	 * The log named by the transfer.accesslog option, opened on first use and
+	 * shared by every cache layer, or NULL if the option is empty.  Layers made
+	 * after the option changes record to the newly named file.
+	 */
+	static std::tr1::shared_ptr<CacheAccessLog> current();
+
+	/// Starts a new log in filename, replacing anything there: check isOpen() for success.
+	explicit CacheAccessLog(const std::string &filename);
+
+	/// Flushes and closes the file.
+	~CacheAccessLog();
+
+	bool isOpen() const {
+		return mFile != NULL;
+	}
+
+	/// Appends a request for fileId answered with size bytes: may be called from any thread.
+	void record(const Fingerprint &fileId, cache_usize_type size);
+
+	/// Writes out any requests still buffered.
+	void flush();
+
+	/**
+	 * Reads every request in the log in filename onto the end of accesses.
+	 * @returns false if the file cannot be opened or has a line that is not a request,
+	 *          keeping the requests before that line.
+	 */
+	static bool read(const std::string &filename, std::vector<Access> &accesses);
+};
+
+}
+}
+
+#endif /* SIRIKATA_CacheAccessLog_HPP__ */
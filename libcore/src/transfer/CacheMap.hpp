@@ -36,6 +36,7 @@
 
 #include "CachePolicy.hpp"
 #include "CacheLayer.hpp"
+#include "util/MPSCRingQueue.hpp"
 #include <boost/thread.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
@@ -45,6 +46,19 @@ namespace Transfer {
 /**
  * Handles locking, and also stores a map that can be used
  * both by the CachePolicy, and by the CacheLayer.
+ *
+ * The map is split into NUM_SHARDS shards by the hash of the Fingerprint,
+ * each with its own lock, so that lookups from different threads rarely
+ * touch the same lock.  An iterator only holds the lock of the shard it is
+ * currently in, moving it when find() or insert() takes it to another shard.
+ *
+ * The CachePolicy is shared by every shard, and CacheMap makes sure only one
+ * thread calls into it at a time.  A read_iterator only holds its shard's
+ * lock shared, so use() does not call the policy: it records the access in
+ * the shard's lock-free buffer of uses, which is replayed into the policy
+ * by the next write_iterator to lock that shard (or by a reader once enough
+ * uses have built up and the policy is free).  A shard's lock is always
+ * taken before the policy's, never the other way around.
  */
 class CacheMap : Noncopyable {
 public:
@@ -58,8 +72,48 @@ private:
 	typedef std::pair<CacheData, std::pair<PolicyData, cache_usize_type> > MapEntry;
 	typedef std::map<Fingerprint, MapEntry> MapClass;
 
-	MapClass mMap;
-	boost::shared_mutex mMapLock;
+	enum {
+		NUM_SHARDS=16,
+		/// Capacity of each shard's ring of uses (more spill into its overflow)
+		USE_BUFFER_SIZE=64,
+		/// A reader replays its shard's uses once this many are waiting
+		REPLAY_THRESHOLD=USE_BUFFER_SIZE/2
+	};
+
+	/// An access recorded by read_iterator::use() for CachePolicy::use()
+	struct PendingUse {
+		Fingerprint mId;
+		PolicyData mData;
+		cache_usize_type mSize;
+
+		PendingUse() : mData(NULL), mSize(0) {
+		}
+		PendingUse(const Fingerprint &id, PolicyData data, cache_usize_type size)
+			: mId(id), mData(data), mSize(size) {
+		}
+	};
+
+	/**
+	 * One shard of the map.  Every PolicyData in mPendingUses belongs to
+	 * an entry of mMap: they are pushed under the shared lock and replayed
+	 * before any write_iterator holding the lock exclusively can erase one.
+	 */
+	struct Shard {
+		MapClass mMap;
+		boost::shared_mutex mLock;
+		MPSCRingQueue<PendingUse> mPendingUses;
+		AtomicValue<uint32> mNumPendingUses;
+
+		Shard() : mPendingUses(USE_BUFFER_SIZE), mNumPendingUses(0) {
+		}
+	};
+
+	Shard mShards[NUM_SHARDS];
+
+	/// Held around every call into mPolicy, and by whoever replays a shard's uses
+	boost::mutex mPolicyLock;
+	/// Scratch space for replayUses(); only touched under mPolicyLock
+	std::deque<PendingUse> mReplaying;
 
 	CacheLayer *mOwner;
 	CachePolicy *mPolicy;
@@ -68,6 +122,25 @@ private:
 		mOwner->destroyCacheEntry(id, data, size);
 	}
 
+	inline Shard *shardFor(const Fingerprint &id) {
+		return &mShards[SHA256::Hasher()(id) & (NUM_SHARDS - 1)];
+	}
+
+	/// Passes every use recorded in shard on to the CachePolicy.  Requires mPolicyLock.
+	void replayUses(Shard &shard) {
+		if (shard.mNumPendingUses.read() == 0) {
+			return;
+		}
+		shard.mPendingUses.popAll(mReplaying);
+		shard.mNumPendingUses -= (uint32)mReplaying.size();
+		for (std::deque<PendingUse>::const_iterator iter = mReplaying.begin();
+				iter != mReplaying.end();
+				++iter) {
+			mPolicy->use((*iter).mId, (*iter).mData, (*iter).mSize);
+		}
+		mReplaying.clear();
+	}
+
 public:
 
 	CacheMap(CacheLayer *owner, CachePolicy *policy) :
@@ -82,58 +155,111 @@ public:
 	/**
 	 * Allocates the requested number of bytes, and erases the
 	 * appropriate set of entries using CachePolicy::allocateSpace().
+	 * The writer is moved to each entry it erases (and may be left
+	 * unlocked), so find() or insert() the entry it is meant for afterwards.
 	 *
 	 * @param required  The space required for the new entry.
 	 * @returns         if the allocation was successful,
 	 *                  or false if the entry is not to be cached.
 	 */
 	inline bool alloc(cache_usize_type required, write_iterator &writer) {
-		bool cachable = mPolicy->cachable(required);
-		if (!cachable) {
-			return false;
+		{
+			boost::lock_guard<boost::mutex> policyLock(mPolicyLock);
+			if (!mPolicy->cachable(required)) {
+				return false;
+			}
 		}
 		Fingerprint toDelete;
-		while (mPolicy->nextItem(required, toDelete)) {
-			writer.find(toDelete);
-			writer.erase();
+		bool replayed = false;
+		while (true) {
+			{
+				boost::lock_guard<boost::mutex> policyLock(mPolicyLock);
+				if (!mPolicy->nextItem(required, toDelete)) {
+					break;
+				}
+			}
+			if (!replayed) {
+				// The policy must hear of every use before it picks what to throw out.
+				writer.release();
+				replayAllUses();
+				replayed = true;
+				continue;
+			}
+			// Another thread may have erased it in the meantime.
+			if (writer.find(toDelete)) {
+				writer.erase();
+			}
 		}
 		return true;
 	}
 
+	/// Passes the uses recorded in every shard on to the CachePolicy.  Requires no locks held.
+	void replayAllUses() {
+		for (int i = 0; i < NUM_SHARDS; ++i) {
+			Shard &shard = mShards[i];
+			if (shard.mNumPendingUses.read()) {
+				boost::shared_lock<boost::shared_mutex> shardLock(shard.mLock);
+				boost::lock_guard<boost::mutex> policyLock(mPolicyLock);
+				replayUses(shard);
+			}
+		}
+	}
+
 	/**
 	 * A read-only iterator.  Not const because the LRU use-count
 	 * is allowed to be updated, even though the CacheLayer cannot
-	 * be changed.  A read_iterator locks the map using a
-	 * boost::shared_lock.  This means that any number of read_iterator
+	 * be changed.  A read_iterator locks the shard it is in using a
+	 * shared lock.  This means that any number of read_iterator
 	 * objects are allowed access at the same time, except when
-	 * a write_iterator is in use.
+	 * a write_iterator is in the same shard.
 	 */
-	class read_iterator {
+	class read_iterator : Noncopyable {
 		CacheMap *mCachemap;
-		boost::shared_lock<boost::shared_mutex> mLock;
-
-		MapClass *mMap;
+		/// The shard whose lock is held, or NULL before the first find()
+		Shard *mShard;
 		MapClass::iterator mIter;
 
+		inline void lockShard(Shard *shard) {
+			if (shard != mShard) {
+				if (mShard) {
+					mShard->mLock.unlock_shared();
+				}
+				shard->mLock.lock_shared();
+				mShard = shard;
+			}
+		}
+
 	public:
-		/// Construct from a CacheMap (contains a scoped read lock)
+		/// Construct from a CacheMap (locks a shard on the first find or iterate)
 		read_iterator(CacheMap &m)
-			: mCachemap(&m), mLock(m.mMapLock),
-			mMap(&m.mMap), mIter(m.mMap.end()) {
+			: mCachemap(&m), mShard(NULL) {
+		}
+
+		~read_iterator() {
+			if (mShard) {
+				mShard->mLock.unlock_shared();
+			}
 		}
 
 		/// @returns   if this iterator can be dereferenced.
 		inline operator bool () const{
-			return (mIter != mMap->end());
+			return mShard && (mIter != mShard->mMap.end());
 		}
 
+		/// Visits every entry, one shard at a time.
 		inline bool iterate () {
-			if (mIter == mMap->end()) {
-				mIter = mMap->begin();
-			} else {
+			if (!mShard) {
+				lockShard(&mCachemap->mShards[0]);
+				mIter = mShard->mMap.begin();
+			} else if (mIter != mShard->mMap.end()) {
 				++mIter;
 			}
-			return (mIter != mMap->end());
+			while (mIter == mShard->mMap.end() &&
+					mShard != &mCachemap->mShards[NUM_SHARDS - 1]) {
+				lockShard(mShard + 1);
+				mIter = mShard->mMap.begin();
+			}
+			return (bool)*this;
 		}
 
 		/** Moves this iterator to id.
@@ -141,7 +267,8 @@ public:
 		 * @returns   if the find was successful.
 		 */
 		inline bool find(const Fingerprint &id) {
-			mIter = mMap->find(id);
+			lockShard(mCachemap->shardFor(id));
+			mIter = mShard->mMap.find(id);
 			return (bool)*this;
 		}
 
@@ -165,37 +292,69 @@ public:
 			return (*mIter).second.second.first;
 		}
 
-		/// Sets the use bit in the corresponding cache policy.
+		/**
+		 * Sets the use bit in the corresponding cache policy.  The use is
+		 * only recorded here, and reaches the policy when the shard's uses
+		 * are next replayed.
+		 */
 		inline void use() {
-			mCachemap->mPolicy->use(getId(), getPolicyInfo(), getSize());
+			mShard->mPendingUses.push(PendingUse(getId(), getPolicyInfo(), getSize()));
+			if (++mShard->mNumPendingUses >= (uint32)REPLAY_THRESHOLD &&
+					mCachemap->mPolicyLock.try_lock()) {
+				mCachemap->replayUses(*mShard);
+				mCachemap->mPolicyLock.unlock();
+			}
 		}
 	};
 
 	/**
 	 * A read-write iterator.  Also contains insert() and erase()
 	 * functions which also interact with the appropriate CachePolicy.
-	 * The write_iterator aassumes exclusive ownership of the map.
-	 * Since creating two write_iterators at once causes deadlock,
+	 * The write_iterator assumes exclusive ownership of the shard it is in.
+	 * Since creating two write_iterators at once can cause deadlock,
 	 * make sure to call the alloc() function that takes a write_iterator
 	 * argument if you already own one.
 	 */
 	class write_iterator : Noncopyable {
 		CacheMap *mCachemap;
-		boost::unique_lock<boost::shared_mutex> mLock;
-
-		MapClass *mMap;
+		/// The shard whose lock is held, or NULL before the first find or insert
+		Shard *mShard;
 		MapClass::iterator mIter;
 
+		/// Locks shard in place of the current one, bringing its policy up to date
+		void lockShard(Shard *shard) {
+			if (shard != mShard) {
+				if (mShard) {
+					mShard->mLock.unlock();
+				}
+				shard->mLock.lock();
+				mShard = shard;
+				boost::lock_guard<boost::mutex> policyLock(mCachemap->mPolicyLock);
+				mCachemap->replayUses(*mShard);
+			}
+		}
+
 	public:
-		/// Construct from a CacheMap (contains a scoped write lock)
+		/// Construct from a CacheMap (locks a shard on the first find or insert)
 		write_iterator(CacheMap &m)
-			: mCachemap(&m), mLock(m.mMapLock),
-			mMap(&m.mMap), mIter(m.mMap.end()) {
+			: mCachemap(&m), mShard(NULL) {
+		}
+
+		~write_iterator() {
+			release();
+		}
+
+		/// Unlocks the shard this iterator is in, leaving it pointing nowhere.
+		void release() {
+			if (mShard) {
+				mShard->mLock.unlock();
+				mShard = NULL;
+			}
 		}
 
 		/// @returns   if this iterator can be dereferenced.
 		inline operator bool () const{
-			return (mIter != mMap->end());
+			return mShard && (mIter != mShard->mMap.end());
 		}
 
 		/** Moves this iterator to id.
@@ -203,7 +362,8 @@ public:
 		 * @returns   if the find was successful.
 		 */
 		bool find(const Fingerprint &id) {
-			mIter = mMap->find(id);
+			lockShard(mCachemap->shardFor(id));
+			mIter = mShard->mMap.find(id);
 			return (bool)*this;
 		}
 
@@ -229,6 +389,7 @@ public:
 
 		/// Sets the use bit in the corresponding cache policy.
 		inline void use() {
+			boost::lock_guard<boost::mutex> policyLock(mCachemap->mPolicyLock);
 			mCachemap->mPolicy->use(getId(), getPolicyInfo(), getSize());
 		}
 
@@ -241,6 +402,7 @@ public:
 		inline void update(cache_usize_type newSize) {
 			cache_usize_type oldSize = getSize();
 			(*mIter).second.second.second = newSize;
+			boost::lock_guard<boost::mutex> policyLock(mCachemap->mPolicyLock);
 			mCachemap->mPolicy->useAndUpdate(getId(),
 					getPolicyInfo(), oldSize, newSize);
 		}
@@ -249,25 +411,35 @@ public:
 		 * Erases the current iterator.  Note that this iterator is
 		 * invalidated at the point you erase it.
 		 *
-s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
+		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 */
 		void erase() {
-			mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+			{
+				boost::lock_guard<boost::mutex> policyLock(mCachemap->mPolicyLock);
+				mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+			}
 			mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
-			mMap->erase(mIter);
-			mIter = mMap->end();
+			mShard->mMap.erase(mIter);
+			mIter = mShard->mMap.end();
 		}
 
 		/** Iterates through the whole map, destroy()ing everything.  Note that the
 		 * write_iterator contains no iterate() method because it is generally not safe.
 		 */
 		void eraseAll() {
-			for (mIter = mMap->begin(); mIter != mMap->end(); ++mIter) {
-				mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
-				mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
+			for (int i = 0; i < NUM_SHARDS; ++i) {
+				lockShard(&mCachemap->mShards[i]);
+				MapClass *map = &mShard->mMap;
+				for (mIter = map->begin(); mIter != map->end(); ++mIter) {
+					{
+						boost::lock_guard<boost::mutex> policyLock(mCachemap->mPolicyLock);
+						mCachemap->mPolicy->destroy(getId(), getPolicyInfo(), getSize());
+					}
+					mCachemap->destroyCacheLayerEntry(getId(), (**this), getSize());
+				}
+				map->clear();
+				mIter = map->end();
 			}
-			mMap->clear();
-			mIter = mMap->end();
 		}
 
 		/**
@@ -284,12 +456,14 @@ s		 * Also, calls CachePolicy::destroy() and CacheInfo::destroy()
 		 * @returns       If this element was actually inserted.
 		 */
 		bool insert(const Fingerprint &id, cache_usize_type size) {
+			lockShard(mCachemap->shardFor(id));
 			std::pair<MapClass::iterator, bool> ins=
-				mMap->insert(MapClass::value_type(id,
+				mShard->mMap.insert(MapClass::value_type(id,
 						MapEntry(CacheData(), std::pair<PolicyData, cache_usize_type>(PolicyData(), size))));
 			mIter = ins.first;
 
 			if (ins.second) {
+				boost::lock_guard<boost::mutex> policyLock(mCachemap->mPolicyLock);
 				(*mIter).second.second.first = mCachemap->mPolicy->create(id, size);
 			}
 			return ins.second;
@@ -0,0 +1,71 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  CachePolicy.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "options/Options.hpp"
+#include "LRUPolicy.hpp"
+#include "ARCPolicy.hpp"
+#include "GDSFPolicy.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+namespace {
+OptionValue *sCachePolicy;
+InitializeGlobalOptions gCachePolicyOptions("transfer",
+	sCachePolicy = new OptionValue("cachepolicy", "lru", OptionValueType<std::string>(), "Which entries a cache throws out first: lru (least recently used), arc (adaptive replacement, resists one-off scans) or gdsf (GreedyDual-Size-Frequency, keeps small often used entries over large ones)"),
+	NULL);
+}
+
+CachePolicy *CachePolicy::makePolicy(const std::string &name, cache_usize_type allocatedSpace, float maxSizePct) {
+	if (name == "lru") {
+		return new LRUPolicy(allocatedSpace, maxSizePct);
+	} else if (name == "arc") {
+		return new ARCPolicy(allocatedSpace, maxSizePct);
+	} else if (name == "gdsf") {
+		return new GDSFPolicy(allocatedSpace, maxSizePct);
+	}
+	return NULL;
+}
+
+CachePolicy *CachePolicy::makePolicy(cache_usize_type allocatedSpace, float maxSizePct) {
+	std::string name = sCachePolicy->as<std::string>();
+	CachePolicy *policy = makePolicy(name, allocatedSpace, maxSizePct);
+	if (!policy) {
+		SILOG(transfer,error,"[CachePolicy] Unknown cache policy \"" << name << "\"; using lru");
+		policy = new LRUPolicy(allocatedSpace, maxSizePct);
+	}
+	return policy;
+}
+
+}
+}
@@ -39,8 +39,15 @@
 namespace Sirikata {
 namespace Transfer {
 
-/// Critical to the functioning of CacheLayer--makes decisions which pieces of data to keep and which to throw out.
-class CachePolicy {
+/**
+ * Critical to the functioning of CacheLayer--makes decisions which pieces of data to keep and which to throw out.
+ *
+ * A policy needs no locking of its own: the CacheMap using it never makes
+ * two calls into it at once.  Uses seen by a CacheMap::read_iterator are
+ * buffered and passed to use() in a batch a little later, but always before
+ * the entry can be destroyed.
+ */
+class SIRIKATA_EXPORT CachePolicy {
 
 protected:
 	cache_usize_type mTotalSize;
@@ -107,6 +114,8 @@ public:
 	 *  Allocates opaque data (and anything other corresponding info)
 	 *  At this point, the allocation must not fail.  It is up to the
 	 *  CacheLayer to respect the decision from allocateSpace().
+	 *  Creating an entry counts as its first access, so the CacheLayer
+	 *  must not also call use() for it: ARC would take that for a second.
 	 *
 	 *  @param id    The FileId corresponding to the data.
 	 *  @param size  The amount of space allocated (should be the same
@@ -137,6 +146,19 @@ public:
 	}
 
 	virtual bool nextItem(cache_usize_type requiredSpace, Fingerprint &myprint) = 0;
+
+	/**
+	 *  Makes a new policy by name.
+	 *
+	 *  @param name            "lru" (LRUPolicy), "arc" (ARCPolicy) or "gdsf" (GDSFPolicy).
+	 *  @param allocatedSpace  The number of bytes the cache may hold.
+	 *  @param maxSizePct      The largest fraction of the cache one entry may take.
+	 *  @returns               The new policy, or NULL if there is none by that name.
+	 */
+	static CachePolicy *makePolicy(const std::string &name, cache_usize_type allocatedSpace, float maxSizePct=0.5);
+
+	/// Makes the policy named by the transfer.cachepolicy option, or an LRUPolicy if it names none.
+	static CachePolicy *makePolicy(cache_usize_type allocatedSpace, float maxSizePct=0.5);
 };
 
 
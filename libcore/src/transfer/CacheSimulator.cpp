@@ -0,0 +1,100 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  CacheSimulator.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include "CacheSimulator.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+CacheSimulator::CacheSimulator(CachePolicy *policy)
+		: mPolicy(policy) {
+}
+
+CacheSimulator::~CacheSimulator() {
+	for (EntryMap::iterator iter = mEntries.begin(); iter != mEntries.end(); ++iter) {
+		mPolicy->destroy((*iter).first, (*iter).second.mData, (*iter).second.mSize);
+	}
+	delete mPolicy;
+}
+
+void CacheSimulator::makeRoom(cache_usize_type required) {
+	Fingerprint toDelete;
+	while (mPolicy->nextItem(required, toDelete)) {
+		EntryMap::iterator victim = mEntries.find(toDelete);
+		if (victim == mEntries.end()) {
+			// A policy that picks what is not there would never stop.
+			SILOG(transfer,error,"[CacheSimulator] Policy picked " << toDelete << ", which is not cached");
+			break;
+		}
+		mPolicy->destroy(toDelete, (*victim).second.mData, (*victim).second.mSize);
+		mEntries.erase(victim);
+	}
+}
+
+void CacheSimulator::access(const Fingerprint &fileId, cache_usize_type size) {
+	++mResult.mRequests;
+	mResult.mBytes += size;
+	EntryMap::iterator iter = mEntries.find(fileId);
+	if (iter != mEntries.end() && (*iter).second.mSize >= size) {
+		++mResult.mHits;
+		mResult.mHitBytes += size;
+		mPolicy->use(fileId, (*iter).second.mData, size);
+		return;
+	}
+	if (!mPolicy->cachable(size)) {
+		return;
+	}
+	if (iter != mEntries.end()) {
+		// The entry only held part of the file: give it the rest.
+		cache_usize_type oldsize = (*iter).second.mSize;
+		mPolicy->useAndUpdate(fileId, (*iter).second.mData, oldsize, size);
+		(*iter).second.mSize = size;
+		makeRoom(0);
+		return;
+	}
+	makeRoom(size);
+	Entry &entry = mEntries[fileId];
+	entry.mData = mPolicy->create(fileId, size);
+	entry.mSize = size;
+}
+
+void CacheSimulator::run(const std::vector<CacheAccessLog::Access> &accesses) {
+	for (std::vector<CacheAccessLog::Access>::const_iterator iter = accesses.begin();
+			iter != accesses.end();
+			++iter) {
+		access((*iter).mFileId, (*iter).mSize);
+	}
+}
+
+}
+}
@@ -0,0 +1,108 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  CacheSimulator.hpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SIRIKATA_CacheSimulator_HPP__
+#define SIRIKATA_CacheSimulator_HPP__
+
+#include "CacheAccessLog.hpp"
+#include "CachePolicy.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * Replays requests, as recorded by a CacheAccessLog, through a CachePolicy
+ * without storing any data, to see how many a cache of that size would answer.
+ *
+ * Every request is for the whole of what was recorded: an entry answers it if
+ * it holds at least that many bytes.  Otherwise the request misses and the
+ * entry is made, or grown, the way MemoryCacheLayer::populateCache would.
+ */
+class SIRIKATA_EXPORT CacheSimulator : Noncopyable {
+public:
+	struct Result {
+		uint64 mRequests;
+		uint64 mHits;
+		uint64 mBytes;
+		uint64 mHitBytes;
+
+		Result() : mRequests(0), mHits(0), mBytes(0), mHitBytes(0) {
+		}
+
+		/// The fraction of requests answered from the cache.
+		double hitRatio() const {
+			return mRequests ? (double)mHits / (double)mRequests : 0;
+		}
+
+		/// The fraction of requested bytes answered from the cache.
+		double byteHitRatio() const {
+			return mBytes ? (double)mHitBytes / (double)mBytes : 0;
+		}
+	};
+
+private:
+	struct Entry {
+		CachePolicy::Data *mData;
+		cache_usize_type mSize;
+	};
+	typedef std::tr1::unordered_map<Fingerprint, Entry, Fingerprint::Hasher> EntryMap;
+
+	CachePolicy *mPolicy;
+	EntryMap mEntries;
+	Result mResult;
+
+	/// Evicts until the policy has room for required more bytes.
+	void makeRoom(cache_usize_type required);
+
+public:
+	/// Simulates a cache, initially empty, run by policy.  Takes ownership of policy.
+	explicit CacheSimulator(CachePolicy *policy);
+
+	~CacheSimulator();
+
+	/// Replays one request for size bytes of fileId.
+	void access(const Fingerprint &fileId, cache_usize_type size);
+
+	/// Replays every request in accesses in order.
+	void run(const std::vector<CacheAccessLog::Access> &accesses);
+
+	/// The requests replayed so far.
+	const Result &getResult() const {
+		return mResult;
+	}
+};
+
+}
+}
+
+#endif /* SIRIKATA_CacheSimulator_HPP__ */
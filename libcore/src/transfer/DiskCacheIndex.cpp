@@ -0,0 +1,431 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  DiskCacheIndex.cpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "util/Standard.hh"
+#include <boost/thread/locks.hpp>
+#include "task/Time.hpp"
+#include "DiskCacheIndex.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#else
+#include <io.h>
+#include <fcntl.h>
+#define fstat _fstat
+#define stat _stat
+#define open _open
+#define close _close
+#define read _read
+#define write _write
+#define unlink _unlink
+#define O_RDONLY _O_RDONLY
+#define O_WRONLY _O_WRONLY
+#define O_CREAT _O_CREAT
+#define O_TRUNC _O_TRUNC
+#define O_APPEND _O_APPEND
+#define O_BINARY _O_BINARY
+#endif
+
+namespace Sirikata {
+namespace Transfer {
+
+namespace {
+
+const char MAGIC[4] = {'S','D','C','I'};
+const uint32 VERSION = 1;
+const uint32 BYTE_ORDER_MARK = 0x01020304;
+const size_t HEADER_SIZE = sizeof(MAGIC) + 2 * sizeof(uint32);
+
+enum RecordType {
+	RECORD_PUT = 1, // size, last access, ranges.
+	RECORD_TOUCH = 2, // last access.
+	RECORD_REMOVE = 3
+};
+
+/// 32-bit FNV-1a, enough to notice a record that was only partly written.
+uint32 checksum(const unsigned char *data, size_t length) {
+	uint32 hash = 2166136261U;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+template <class T>
+void appendValue(std::string &out, const T &value) {
+	out.append((const char *)&value, sizeof(value));
+}
+
+/// Reads values out of a record, failing instead of reading past its end.
+class RecordReader {
+	const unsigned char *mPos;
+	const unsigned char *mEnd;
+public:
+	RecordReader(const unsigned char *data, size_t length)
+		: mPos(data), mEnd(data + length) {
+	}
+	template <class T>
+	bool get(T &value) {
+		if ((size_t)(mEnd - mPos) < sizeof(value)) {
+			return false;
+		}
+		memcpy(&value, mPos, sizeof(value));
+		mPos += sizeof(value);
+		return true;
+	}
+	bool get(Fingerprint &value) {
+		if ((size_t)(mEnd - mPos) < (size_t)Fingerprint::static_size) {
+			return false;
+		}
+		value = Fingerprint::convertFromBinary(mPos);
+		mPos += Fingerprint::static_size;
+		return true;
+	}
+	bool atEnd() const {
+		return mPos == mEnd;
+	}
+};
+
+int64 nowMicro() {
+	return (Task::AbsTime::now() - Task::AbsTime::null()).toMicro();
+}
+
+/// Starts a record body: the type and the fingerprint.
+std::string beginRecord(RecordType type, const Fingerprint &fileId) {
+	std::string body;
+	appendValue(body, (uint8)type);
+	body.append((const char *)fileId.rawData().data(), Fingerprint::static_size);
+	return body;
+}
+
+std::string putRecord(const Fingerprint &fileId, const DiskCacheIndex::Entry &entry) {
+	std::string body = beginRecord(RECORD_PUT, fileId);
+	appendValue(body, (uint64)entry.mSize);
+	appendValue(body, (int64)entry.mLastAccess);
+	appendValue(body, (uint32)entry.mRanges.size());
+	for (RangeList::const_iterator iter = entry.mRanges.begin(); iter != entry.mRanges.end(); ++iter) {
+		appendValue(body, (uint64)(*iter).startbyte());
+		appendValue(body, (uint64)(*iter).length());
+		appendValue(body, (uint8)((*iter).goesToEndOfFile() ? 1 : 0));
+	}
+	return body;
+}
+
+/// Adds the length and checksum around a record body.
+void finishRecord(std::string &out, const std::string &body) {
+	appendValue(out, (uint32)body.length());
+	out += body;
+	appendValue(out, checksum((const unsigned char *)body.data(), body.length()));
+}
+
+bool writeAll(int fd, const std::string &data) {
+	const char *pos = data.data();
+	size_t left = data.length();
+	while (left) {
+		int put = (int)write(fd, pos, (unsigned int)left);
+		if (put < 0 && errno == EINTR) {
+			continue;
+		}
+		if (put <= 0) {
+			return false;
+		}
+		pos += put;
+		left -= (size_t)put;
+	}
+	return true;
+}
+
+bool lessRecentlyAccessed(const DiskCacheIndex::EntryPair &a, const DiskCacheIndex::EntryPair &b) {
+	return a.second.mLastAccess < b.second.mLastAccess;
+}
+
+} // anon namespace.
+
+DiskCacheIndex::DiskCacheIndex(const std::string &path)
+		: mPath(path), mFd(-1), mRecords(0) {
+}
+
+DiskCacheIndex::~DiskCacheIndex() {
+	if (mFd >= 0) {
+		close(mFd);
+	}
+}
+
+bool DiskCacheIndex::parse(const unsigned char *data, size_t length) {
+	if (length < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+		return false;
+	}
+	uint32 version, byteOrder;
+	memcpy(&version, data + sizeof(MAGIC), sizeof(uint32));
+	memcpy(&byteOrder, data + sizeof(MAGIC) + sizeof(uint32), sizeof(uint32));
+	if (version != VERSION || byteOrder != BYTE_ORDER_MARK) {
+		return false;
+	}
+	size_t pos = HEADER_SIZE;
+	while (pos < length) {
+		uint32 bodyLength, sum;
+		if (length - pos < 2 * sizeof(uint32)) {
+			return false;
+		}
+		memcpy(&bodyLength, data + pos, sizeof(uint32));
+		if (length - pos - 2 * sizeof(uint32) < bodyLength) {
+			return false;
+		}
+		const unsigned char *body = data + pos + sizeof(uint32);
+		memcpy(&sum, body + bodyLength, sizeof(uint32));
+		if (sum != checksum(body, bodyLength)) {
+			return false;
+		}
+		pos += bodyLength + 2 * sizeof(uint32);
+
+		RecordReader reader(body, bodyLength);
+		uint8 type;
+		Fingerprint fileId;
+		if (!reader.get(type) || !reader.get(fileId)) {
+			return false;
+		}
+		if (type == RECORD_PUT) {
+			Entry entry;
+			uint64 size;
+			uint32 numRanges;
+			if (!reader.get(size) || !reader.get(entry.mLastAccess) || !reader.get(numRanges)) {
+				return false;
+			}
+			entry.mSize = size;
+			for (uint32 i = 0; i < numRanges; ++i) {
+				uint64 start, rangeLength;
+				uint8 toEndOfFile;
+				if (!reader.get(start) || !reader.get(rangeLength) || !reader.get(toEndOfFile)) {
+					return false;
+				}
+				Range toAdd(start, rangeLength, LENGTH, toEndOfFile != 0);
+				toAdd.addToList(toAdd, entry.mRanges);
+			}
+			mEntries[fileId] = entry;
+		} else if (type == RECORD_TOUCH) {
+			int64 lastAccess;
+			if (!reader.get(lastAccess)) {
+				return false;
+			}
+			EntryMap::iterator iter = mEntries.find(fileId);
+			if (iter != mEntries.end()) {
+				(*iter).second.mLastAccess = lastAccess;
+			}
+		} else if (type == RECORD_REMOVE) {
+			mEntries.erase(fileId);
+		} else {
+			return false;
+		}
+		if (!reader.atEnd()) {
+			return false;
+		}
+		++mRecords;
+	}
+	return true;
+}
+
+bool DiskCacheIndex::load(EntryList &entries) {
+	boost::lock_guard<boost::mutex> lock(mLock);
+	mEntries.clear();
+	mRecords = 0;
+
+	int fd = open(mPath.c_str(), O_RDONLY|O_BINARY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < HEADER_SIZE) {
+		close(fd);
+		return false;
+	}
+	size_t length = (size_t)st.st_size;
+	bool complete;
+#ifndef _WIN32
+	void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapped == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	complete = parse((const unsigned char *)mapped, length);
+	munmap(mapped, length);
+#else
+	std::vector<unsigned char> buffer(length);
+	complete = ((size_t)read(fd, &buffer[0], (unsigned int)length) == length) &&
+		parse(&buffer[0], length);
+#endif
+	close(fd);
+
+	if (mRecords == 0 && !complete) {
+		// not a journal we can read at all.
+		mEntries.clear();
+		return false;
+	}
+	if (complete) {
+		mFd = open(mPath.c_str(), O_WRONLY|O_APPEND|O_BINARY);
+	}
+	if (!complete || mFd < 0) {
+		SILOG(transfer,warning,"[DiskCacheIndex] Rewriting damaged index " << mPath);
+		rewrite();
+	}
+
+	entries.reserve(mEntries.size());
+	for (EntryMap::const_iterator iter = mEntries.begin(); iter != mEntries.end(); ++iter) {
+		entries.push_back(*iter);
+	}
+	std::stable_sort(entries.begin(), entries.end(), &lessRecentlyAccessed);
+	return true;
+}
+
+bool DiskCacheIndex::reset(const EntryList &entries) {
+	boost::lock_guard<boost::mutex> lock(mLock);
+	mEntries.clear();
+	for (EntryList::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+		mEntries[(*iter).first] = (*iter).second;
+	}
+	return rewrite();
+}
+
+bool DiskCacheIndex::rewrite() {
+	std::string contents(MAGIC, sizeof(MAGIC));
+	appendValue(contents, VERSION);
+	appendValue(contents, BYTE_ORDER_MARK);
+	for (EntryMap::const_iterator iter = mEntries.begin(); iter != mEntries.end(); ++iter) {
+		finishRecord(contents, putRecord((*iter).first, (*iter).second));
+	}
+
+	if (mFd >= 0) {
+		close(mFd);
+		mFd = -1;
+	}
+	std::string tempPath = mPath + ".temp";
+	int fd = open(tempPath.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0666);
+	bool success = (fd >= 0 && writeAll(fd, contents));
+#ifndef _WIN32
+	// the new journal must be on disk before it replaces the old one.
+	success = success && (fsync(fd) == 0);
+#endif
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (success) {
+#ifdef _WIN32
+		unlink(mPath.c_str()); // rename does not replace files on Windows.
+#endif
+		success = (rename(tempPath.c_str(), mPath.c_str()) == 0);
+	}
+	if (!success) {
+		SILOG(transfer,error,"[DiskCacheIndex] Failed to write index " << mPath << "; reason: " << errno);
+		unlink(tempPath.c_str());
+		return false;
+	}
+	mRecords = mEntries.size();
+	mFd = open(mPath.c_str(), O_WRONLY|O_APPEND|O_BINARY);
+	return mFd >= 0;
+}
+
+void DiskCacheIndex::append(const std::string &body, bool mayCompact) {
+	if (mayCompact && mRecords >= (size_t)MIN_COMPACT_RECORDS &&
+			mRecords >= (size_t)COMPACT_RATIO * mEntries.size()) {
+		// the journal is mostly out of date; the new record is already in mEntries.
+		rewrite();
+		return;
+	}
+	if (mFd < 0) {
+		return;
+	}
+	std::string record;
+	finishRecord(record, body);
+	if (writeAll(mFd, record)) {
+		++mRecords;
+	} else {
+		SILOG(transfer,error,"[DiskCacheIndex] Failed to append to index " << mPath << "; reason: " << errno);
+	}
+}
+
+void DiskCacheIndex::put(const Fingerprint &fileId, cache_usize_type size, const RangeList &ranges) {
+	boost::lock_guard<boost::mutex> lock(mLock);
+	Entry &entry = mEntries[fileId];
+	entry.mSize = size;
+	entry.mRanges = ranges;
+	entry.mLastAccess = nowMicro();
+	append(putRecord(fileId, entry), true);
+}
+
+void DiskCacheIndex::touch(const Fingerprint &fileId) {
+	boost::lock_guard<boost::mutex> lock(mLock);
+	EntryMap::iterator iter = mEntries.find(fileId);
+	if (iter == mEntries.end()) {
+		return;
+	}
+	int64 now = nowMicro();
+	if (now - (*iter).second.mLastAccess < (int64)TOUCH_INTERVAL_USEC) {
+		return;
+	}
+	(*iter).second.mLastAccess = now;
+	std::string body = beginRecord(RECORD_TOUCH, fileId);
+	appendValue(body, now);
+	append(body, false);
+}
+
+void DiskCacheIndex::remove(const Fingerprint &fileId) {
+	boost::lock_guard<boost::mutex> lock(mLock);
+	if (mEntries.erase(fileId)) {
+		append(beginRecord(RECORD_REMOVE, fileId), true);
+	}
+}
+
+void DiskCacheIndex::compact() {
+	boost::lock_guard<boost::mutex> lock(mLock);
+	rewrite();
+}
+
+size_t DiskCacheIndex::size() {
+	boost::lock_guard<boost::mutex> lock(mLock);
+	return mEntries.size();
+}
+
+size_t DiskCacheIndex::records() {
+	boost::lock_guard<boost::mutex> lock(mLock);
+	return mRecords;
+}
+
+}
+}
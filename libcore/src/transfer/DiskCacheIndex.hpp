@@ -0,0 +1,138 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  DiskCacheIndex.hpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SIRIKATA_DiskCacheIndex_HPP__
+#define SIRIKATA_DiskCacheIndex_HPP__
+
+#include <boost/thread/mutex.hpp>
+#include "URI.hpp"
+#include "Range.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * The list of files in a DiskCacheLayer, kept in one binary journal so that
+ * starting up does not need to visit every file in the cache directory.
+ *
+ * The journal is a header followed by records, each one a length, a body and
+ * a checksum of the body.  A record stores a whole entry (its disk usage,
+ * ranges and last access), a newer last access, or a removal; the latest
+ * record for a fingerprint wins.  Records are only ever appended, so an
+ * update costs one small write.  Once most records are out of date the
+ * next put() or remove() rewrites the journal with one record per entry and
+ * renames it over the old one; touch() never does, since it is called from
+ * reads, which should not wait for a rewrite.
+ *
+ * Numbers are stored in host byte order: a journal from a machine of the
+ * other endianness fails the header check and is treated as missing.
+ * Every function may be called from any thread.
+ */
+class SIRIKATA_EXPORT DiskCacheIndex : Noncopyable {
+public:
+	struct Entry {
+		cache_usize_type mSize; ///< disk usage in bytes.
+		RangeList mRanges; ///< empty if the whole file is on disk.
+		int64 mLastAccess; ///< microseconds since AbsTime::null().
+	};
+	typedef std::pair<Fingerprint, Entry> EntryPair;
+	typedef std::vector<EntryPair> EntryList;
+
+	enum {
+		/// Last accesses closer together than this are not written to the journal.
+		TOUCH_INTERVAL_USEC = 60 * 1000000,
+		/// The journal is not compacted until it holds this many records.
+		MIN_COMPACT_RECORDS = 1024,
+		/// ...and more than this many records for each entry.
+		COMPACT_RATIO = 2
+	};
+
+private:
+	typedef std::tr1::unordered_map<Fingerprint, Entry, Fingerprint::Hasher> EntryMap;
+
+	boost::mutex mLock;
+	std::string mPath;
+	int mFd; // open for appending, or -1.
+	EntryMap mEntries;
+	size_t mRecords; // in the journal, including out of date ones.
+
+	/// Appends a record, or compacts the journal instead if mayCompact and it has grown too large.
+	void append(const std::string &record, bool mayCompact);
+
+	/// Rewrites the journal from mEntries (mLock must be held).
+	bool rewrite();
+
+	/// Reads the records in [data, data+length) into mEntries.
+	/// @returns false if the header is wrong or a record is cut short or corrupt.
+	bool parse(const unsigned char *data, size_t length);
+
+public:
+	/// Uses the journal in path: call load() or reset() before anything else.
+	explicit DiskCacheIndex(const std::string &path);
+
+	~DiskCacheIndex();
+
+	/**
+	 * Reads the journal and opens it for appending.  A damaged tail (from a
+	 * crash while appending) is dropped.
+	 *
+	 * @param entries  Filled with every entry, least recently accessed first.
+	 * @returns false if there is no readable journal, leaving entries empty.
+	 */
+	bool load(EntryList &entries);
+
+	/// Replaces the journal with one holding only entries, such as those found by a directory scan.
+	bool reset(const EntryList &entries);
+
+	/// Adds or replaces the entry for fileId, accessed now.
+	void put(const Fingerprint &fileId, cache_usize_type size, const RangeList &ranges);
+
+	/// Records an access to fileId, if the last one recorded is old enough.
+	void touch(const Fingerprint &fileId);
+
+	/// Forgets fileId.
+	void remove(const Fingerprint &fileId);
+
+	/// Rewrites the journal with one record per entry.
+	void compact();
+
+	/// @returns how many entries the index holds.
+	size_t size();
+
+	/// @returns how many records are in the journal, including out of date ones.
+	size_t records();
+};
+
+}
+}
+
+#endif /* SIRIKATA_DiskCacheIndex_HPP__ */
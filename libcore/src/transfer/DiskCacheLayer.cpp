@@ -42,12 +42,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/mman.h>
 #define fstat64 fstat
 #define stat64 stat
 #else
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/mman.h>
 #endif
 #else
 #include <io.h>
@@ -76,7 +78,8 @@ namespace Sirikata {
 namespace Transfer {
 
 static const char *PARTIAL_SUFFIX = ".part";
-static const char *RANGES_SUFFIX = ".ranges";
+static const char *RANGES_SUFFIX = ".ranges"; // from before the index; only read when scanning.
+static const char *INDEX_NAME = "index";
 
 namespace {
 
@@ -155,142 +158,475 @@ cache_usize_type sizeFromDirentry(const std::string &name, dirent *ent, bool &is
 
 #endif
 
-} // anon namespace.
-
-void DiskCacheLayer::workerThread() {
-	while (true) {
-		std::tr1::shared_ptr<DiskRequest> req;
-
-		mRequestQueue.blockingPop(req);
-		if (req->op == DiskRequest::OPEXIT) {
-			break;
-		} else if (req->op == DiskRequest::OPWRITE) {
-			// Note: TransferLayer::populatePreviousCaches has already been called.
-			std::string fileId = req->fileId.fingerprint().convertToHexString();
-			bool newFile = true;
-			{
-				CacheMap::write_iterator writer(mFiles);
-				if (writer.find(req->fileId.fingerprint())) {
-					CacheData *rlist = static_cast<CacheData*>(*writer);
-					if (rlist->wholeFile() || rlist->contains(*(req->data))) {
-						// this range is already written to disk.
-						continue;
-					}
-					newFile = false;
-				}
-				if (!mFiles.alloc(req->data->length(), writer)) {
-					continue;
-				}
+/// Reads len bytes at offset: with pread if the file is shared (so no lseek is needed), otherwise after an lseek.
+void readAt(int fd, unsigned char *buf, size_t len, cache_usize_type offset, bool positional) {
+#ifndef _WIN32
+	if (positional) {
+		while (len) {
+			ssize_t got = pread(fd, buf, len, (off_t)offset);
+			if (got < 0 && errno == EINTR) {
+				continue;
 			}
-
-			std::string rangesPath = mPrefix + fileId + RANGES_SUFFIX;
-			std::string filePath = mPrefix + fileId + PARTIAL_SUFFIX;
-			if (newFile) {
-				unlink(rangesPath.c_str()); // in case of a leftover old file.
+			if (got <= 0) {
+				break;
 			}
-			int fd = open(filePath.c_str(), O_CREAT|O_WRONLY, 0666);
-			if (fd < 0) {
-				SILOG(transfer,error, "Failed to open " << fileId <<
-					"for writing; reason: " << errno);
+			buf += got;
+			len -= (size_t)got;
+			offset += (cache_usize_type)got;
+		}
+		return;
+	}
+#endif
+	// FIXME: may not work with 64-bit files?
+	lseek(fd, offset, SEEK_SET);
+	read(fd, buf, len);
+}
+
+/// Writes len bytes at offset: with pwrite if the file is shared, otherwise after an lseek.
+void writeAt(int fd, const unsigned char *buf, size_t len, cache_usize_type offset, bool positional) {
+#ifndef _WIN32
+	if (positional) {
+		while (len) {
+			ssize_t put = pwrite(fd, buf, len, (off_t)offset);
+			if (put < 0 && errno == EINTR) {
 				continue;
 			}
-			lseek(fd, req->data->startbyte(), SEEK_SET);
-			write(fd, req->data->data(), (size_t)req->data->length());
-			cache_usize_type diskUsage;
-			{
-				struct stat64 st;
-				fstat64(fd, &st);
-				diskUsage = getDiskUsage(&st);
+			if (put <= 0) {
+				break;
 			}
+			buf += put;
+			len -= (size_t)put;
+			offset += (cache_usize_type)put;
+		}
+		return;
+	}
+#endif
+	lseek(fd, offset, SEEK_SET);
+	write(fd, buf, len);
+}
+
+#ifndef _WIN32
+
+/// A read-only mapping of a whole file, unmapped once no DenseData refers to it.
+class MappedFile : Noncopyable {
+	void *mData;
+	size_t mLength;
+
+public:
+	MappedFile(int fd, size_t length)
+			: mLength(length) {
+		mData = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+		if (mData == MAP_FAILED) {
+			mData = NULL;
+		}
+	}
+
+	~MappedFile() {
+		if (mData) {
+			munmap(mData, mLength);
+		}
+	}
+
+	/// NULL if the file could not be mapped.
+	const unsigned char *data() const {
+		return (const unsigned char *)mData;
+	}
+};
+
+#endif
+
+OptionValue *sNumWorkers;
+OptionValue *sPositionalIO;
+OptionValue *sMaxOpenFiles;
+OptionValue *sMapMinSize;
+InitializeGlobalOptions gDiskCacheOptions("transfer",
+	sNumWorkers = new OptionValue("diskworkers", "4", OptionValueType<unsigned int>(), "How many threads each disk cache uses to read and write files"),
+	sPositionalIO = new OptionValue("diskpositionalio", "true", OptionValueType<bool>(), "Keep recently used disk cache files open and read and write them with pread and pwrite, which lets threads share them (ignored on Windows)"),
+	sMaxOpenFiles = new OptionValue("diskopenfiles", "64", OptionValueType<size_t>(), "The most files each disk cache keeps open when diskpositionalio is set"),
+	sMapMinSize = new OptionValue("diskmapsize", "65536", OptionValueType<size_t>(), "Whole files in a disk cache of at least this many bytes are memory mapped instead of read into memory (0 never maps them; ignored on Windows)"),
+	NULL);
+
+} // anon namespace.
+
+struct DiskCacheLayer::OpenFiles {
+	/// Closes the file once the last thread using it lets go.
+	struct Handle : Sirikata::Noncopyable {
+		int fd;
+		explicit Handle(int fd) : fd(fd) {
+		}
+		~Handle() {
 			close(fd);
+		}
+	};
+	typedef std::tr1::shared_ptr<Handle> HandlePtr;
+
+	typedef std::list<std::string> PathList;
+	struct Entry {
+		HandlePtr handle;
+		PathList::iterator iter;
+	};
+	typedef std::map<std::string, Entry> EntryMap;
+
+	boost::mutex mLock;
+	EntryMap mEntries;
+	PathList mLeastUsed;
+	size_t mCapacity;
+
+	explicit OpenFiles(size_t capacity)
+		: mCapacity(capacity ? capacity : 1) {
+	}
 
-			std::string rangesStr;
-			{
-				CacheMap::write_iterator writer(mFiles);
+	/// Opens path for reading and writing, or returns a NULL handle if it cannot be opened.
+	HandlePtr get(const std::string &path, bool create) {
+		boost::lock_guard<boost::mutex> lock(mLock);
+		EntryMap::iterator iter = mEntries.find(path);
+		if (iter != mEntries.end()) {
+			mLeastUsed.splice(mLeastUsed.end(), mLeastUsed, (*iter).second.iter);
+			return (*iter).second.handle;
+		}
+		int fd = ::open(path.c_str(), create ? O_CREAT|O_RDWR : O_RDWR, 0666);
+		if (fd < 0) {
+			return HandlePtr();
+		}
+		if (mEntries.size() >= mCapacity) {
+			mEntries.erase(mLeastUsed.front());
+			mLeastUsed.pop_front();
+		}
+		Entry &entry = mEntries[path];
+		entry.handle = HandlePtr(new Handle(fd));
+		mLeastUsed.push_back(path);
+		entry.iter = mLeastUsed.end();
+		--entry.iter;
+		return entry.handle;
+	}
 
-				if (writer.insert(req->fileId.fingerprint(), diskUsage)) {
-					*writer = new CacheData;
-					writer.use();
-				} else {
-					writer.update(diskUsage);
-				}
-				RangeList &data = static_cast<CacheData*>(*writer)->mRanges;
-				req->data->addToList(*(req->data), data);
-				if (Range(true).isContainedBy(data)) {
-					data.clear();
-				} else {
-					serializeRanges(data, rangesStr);
-				}
-			}
+	/// Stops handing out path, which is about to be renamed or deleted.
+	void forget(const std::string &path) {
+		boost::lock_guard<boost::mutex> lock(mLock);
+		EntryMap::iterator iter = mEntries.find(path);
+		if (iter != mEntries.end()) {
+			mLeastUsed.erase((*iter).second.iter);
+			mEntries.erase(iter);
+		}
+	}
+};
+
+DiskCacheLayer::DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext)
+		: CacheLayer(tryNext),
+		mReadsInARow(0),
+		mExiting(false),
+		mFiles(this, policy),
+		mPrefix(prefix+"/"),
+		mIndex(mPrefix+INDEX_NAME),
+		mOpenFiles(NULL),
+		mMapMinSize(0),
+		mCleaningUp(false) {
+
+	try {
+		unserialize();
+	} catch (...) {
+		SILOG(transfer,fatal,"ERROR loading file list!");
+		/// do nothing
+	}
+
+#ifndef _WIN32
+	if (sPositionalIO->as<bool>()) {
+		mOpenFiles = new OpenFiles(sMaxOpenFiles->as<size_t>());
+	}
+	mMapMinSize = sMapMinSize->as<size_t>();
+#endif
+	unsigned int numWorkers = sNumWorkers->as<unsigned int>();
+	if (numWorkers < 1) {
+		numWorkers = 1;
+	}
+	for (unsigned int i = 0; i < numWorkers; ++i) {
+		mWorkers.create_thread(std::tr1::bind(&DiskCacheLayer::workerThread, this));
+	}
+}
+
+DiskCacheLayer::~DiskCacheLayer() {
+	{
+		boost::lock_guard<boost::mutex> lock(mQueueLock);
+		mExiting = true;
+	}
+	mQueueCV.notify_all();
+	mWorkers.join_all(); // every queued request has now finished.
+	delete mOpenFiles;
+
+	mCleaningUp = true; // don't allow destroyCacheEntry to delete files.
+}
+
+DiskCacheLayer::DiskRequestPtr DiskCacheLayer::nextRequest() {
+	boost::unique_lock<boost::mutex> lock(mQueueLock);
+	while (true) {
+		std::deque<Fingerprint>::iterator write = mWriteOrder.begin();
+		while (write != mWriteOrder.end() && mBusyFiles.find(*write) != mBusyFiles.end()) {
+			++write;
+		}
+		bool canWrite = (write != mWriteOrder.end());
+		if (!mReadQueue.empty() && (!canWrite || mReadsInARow < MAX_READS_BEFORE_WRITE)) {
+			DiskRequestPtr req = mReadQueue.front();
+			mReadQueue.pop_front();
+			++mReadsInARow;
+			return req;
+		}
+		if (canWrite) {
+			PendingWriteMap::iterator pending = mPendingWrites.find(*write);
+			DiskRequestPtr req = (*pending).second;
+			mPendingWrites.erase(pending);
+			mBusyFiles.insert(*write);
+			mWriteOrder.erase(write);
+			mReadsInARow = 0;
+			return req;
+		}
+		if (mExiting && mWriteOrder.empty()) {
+			return DiskRequestPtr();
+		}
+		mQueueCV.wait(lock);
+	}
+}
+
+void DiskCacheLayer::finishedFile(const Fingerprint &fileId) {
+	{
+		boost::lock_guard<boost::mutex> lock(mQueueLock);
+		mBusyFiles.erase(fileId);
+	}
+	// A write to the same file may have been waiting for this one.
+	mQueueCV.notify_all();
+}
+
+void DiskCacheLayer::queueWrite(const Fingerprint &fileId, const DenseDataPtr &data) {
+	{
+		boost::lock_guard<boost::mutex> lock(mQueueLock);
+		DiskRequestPtr &pending = mPendingWrites[fileId];
+		if (!pending) {
+			pending = DiskRequestPtr(
+				new DiskRequest(DiskRequest::OPWRITE, RemoteFileId(fileId, URI(URIContext(),"")), *data));
+			mWriteOrder.push_back(fileId);
+		} else if (pending->op == DiskRequest::OPDELETE) {
+			pending->op = DiskRequest::OPWRITE;
+			pending->deleteFirst = true;
+		}
+		pending->data.push_back(data);
+	}
+	mQueueCV.notify_one();
+}
 
-			if (rangesStr.empty()) {
-				std::string renameToPath = mPrefix + fileId;
-				// first do atomic rename, the delete ranges file.
-				rename(filePath.c_str(), renameToPath.c_str());
-				unlink(rangesPath.c_str());
+void DiskCacheLayer::queueDelete(const Fingerprint &fileId) {
+	{
+		boost::lock_guard<boost::mutex> lock(mQueueLock);
+		DiskRequestPtr &pending = mPendingWrites[fileId];
+		if (!pending) {
+			pending = DiskRequestPtr(
+				new DiskRequest(DiskRequest::OPDELETE, RemoteFileId(fileId, URI(URIContext(),"")), Range(true)));
+			mWriteOrder.push_back(fileId);
+		} else {
+			// Whatever was waiting to be written is no longer wanted.
+			pending->op = DiskRequest::OPDELETE;
+			pending->data.clear();
+			pending->deleteFirst = false;
+		}
+	}
+	mQueueCV.notify_one();
+}
+
+void DiskCacheLayer::workerThread() {
+	while (true) {
+		DiskRequestPtr req = nextRequest();
+		if (!req) {
+			break;
+		}
+		if (req->op == DiskRequest::OPREAD) {
+			doRead(req);
+		} else {
+			if (req->op == DiskRequest::OPWRITE) {
+				doWrite(req);
 			} else {
-				std::string rangesTempPath = rangesPath + ".temp";
-				FILE * fp = fopen(rangesTempPath.c_str(), "wb");
-				fwrite(rangesStr.data(), 1, rangesStr.length(), fp);
-				fclose(fp);
-				rename(rangesTempPath.c_str(), rangesPath.c_str());
+				doDelete(req->fileId.fingerprint());
 			}
-		} else if (req->op == DiskRequest::OPREAD) {
-			bool useWholeFile = false;
-			{
-				CacheMap::read_iterator iter(mFiles);
-				if (iter.find(req->fileId.fingerprint())) {
-					CacheData *rlist = static_cast<CacheData*>(*iter);
-					if (rlist->wholeFile()) {
-						useWholeFile = true;
-					} else if (!rlist->contains(req->toRead)) {
-						// this range is already written to disk.
-						CacheLayer::getData(req->fileId, req->toRead, req->finished);
-						continue;
-					}
-				}
+			finishedFile(req->fileId.fingerprint());
+		}
+	}
+}
+
+void DiskCacheLayer::doWrite(const DiskRequestPtr &req) {
+	// Note: TransferLayer::populatePreviousCaches has already been called.
+	const Fingerprint &fprint = req->fileId.fingerprint();
+	if (req->deleteFirst) {
+		doDelete(fprint);
+	}
+	std::string fileId = fprint.convertToHexString();
+	std::vector<DenseDataPtr> toWrite;
+	{
+		CacheMap::write_iterator writer(mFiles);
+		const CacheData *rlist = NULL;
+		if (writer.find(fprint)) {
+			rlist = static_cast<const CacheData*>(*writer);
+			if (rlist->wholeFile()) {
+				// the whole file is already written to disk.
+				return;
 			}
-			std::string fileId = req->fileId.fingerprint().convertToHexString();
-			std::string filePath = mPrefix + fileId;
-			if (!useWholeFile) {
-				filePath += PARTIAL_SUFFIX;
+		}
+		cache_usize_type required = 0;
+		for (std::vector<DenseDataPtr>::const_iterator iter = req->data.begin(); iter != req->data.end(); ++iter) {
+			if (!rlist || !rlist->contains(**iter)) {
+				toWrite.push_back(*iter);
+				required += (*iter)->length();
 			}
-			int fd = open(filePath.c_str(), O_RDONLY);
-			if (fd < 0) {
-				SILOG(transfer,error, "Failed to open " << fileId <<
-					"for writing; reason: " << errno);
+		}
+		if (toWrite.empty()) {
+			// these ranges are already written to disk.
+			return;
+		}
+		if (!mFiles.alloc(required, writer)) {
+			return;
+		}
+	}
+
+	std::string filePath = mPrefix + fileId + PARTIAL_SUFFIX;
+	OpenFiles::HandlePtr handle;
+	int fd;
+	if (mOpenFiles) {
+		handle = mOpenFiles->get(filePath, true);
+		fd = handle ? handle->fd : -1;
+	} else {
+		fd = open(filePath.c_str(), O_CREAT|O_WRONLY, 0666);
+	}
+	if (fd < 0) {
+		SILOG(transfer,error, "Failed to open " << fileId <<
+			"for writing; reason: " << errno);
+		return;
+	}
+	for (std::vector<DenseDataPtr>::const_iterator iter = toWrite.begin(); iter != toWrite.end(); ++iter) {
+		writeAt(fd, (*iter)->data(), (size_t)(*iter)->length(), (*iter)->startbyte(), handle.get() != NULL);
+	}
+	cache_usize_type diskUsage;
+	{
+		struct stat64 st;
+		fstat64(fd, &st);
+		diskUsage = getDiskUsage(&st);
+	}
+	if (!handle) {
+		close(fd);
+	}
+
+	RangeList ranges;
+	{
+		CacheMap::write_iterator writer(mFiles);
+
+		if (writer.insert(fprint, diskUsage)) {
+			*writer = new CacheData;
+		} else {
+			writer.update(diskUsage);
+		}
+		RangeList &data = static_cast<CacheData*>(*writer)->mRanges;
+		for (std::vector<DenseDataPtr>::const_iterator iter = toWrite.begin(); iter != toWrite.end(); ++iter) {
+			(*iter)->addToList(**iter, data);
+		}
+		if (Range(true).isContainedBy(data)) {
+			data.clear();
+		} else {
+			ranges = data;
+		}
+	}
+
+	if (ranges.empty()) {
+		std::string renameToPath = mPrefix + fileId;
+		if (mOpenFiles) {
+			mOpenFiles->forget(filePath);
+		}
+		rename(filePath.c_str(), renameToPath.c_str());
+	}
+	mIndex.put(fprint, diskUsage, ranges);
+}
+
+void DiskCacheLayer::doRead(const DiskRequestPtr &req) {
+	bool useWholeFile = false;
+	{
+		CacheMap::read_iterator iter(mFiles);
+		if (iter.find(req->fileId.fingerprint())) {
+			const CacheData *rlist = static_cast<const CacheData*>(*iter);
+			if (rlist->wholeFile()) {
+				useWholeFile = true;
+			} else if (!rlist->contains(req->toRead)) {
+				// this range is already written to disk.
 				CacheLayer::getData(req->fileId, req->toRead, req->finished);
-				continue;
-			}
-			if (req->toRead.goesToEndOfFile()) {
-				struct stat64 st;
-				fstat64(fd, &st);
-				req->toRead.setLength(st.st_size, true);
+				return;
 			}
-			// FIXME: may not work with 64-bit files?
-			lseek(fd, req->toRead.startbyte(), SEEK_SET);
-			MutableDenseDataPtr datum(new DenseData(req->toRead));
-			read(fd, datum->writableData(), (size_t)req->toRead.length());
-			close(fd);
-
-			CacheLayer::populateParentCaches(req->fileId.fingerprint(), datum);
-			SparseData data;
-			data.addValidData(datum);
-			req->finished(&data);
-		} else if (req->op == DiskRequest::OPDELETE) {
-			std::string fileId = req->fileId.fingerprint().convertToHexString();
-			std::string filePath = mPrefix + fileId;
-			unlink(filePath.c_str());
-			std::string rangesPath = filePath + RANGES_SUFFIX;
-			unlink(rangesPath.c_str());
-			std::string partialPath = filePath + PARTIAL_SUFFIX;
-			unlink(partialPath.c_str());
 		}
 	}
+	std::string fileId = req->fileId.fingerprint().convertToHexString();
+	std::string filePath = mPrefix + fileId;
+	if (!useWholeFile) {
+		filePath += PARTIAL_SUFFIX;
+	}
+	OpenFiles::HandlePtr handle;
+	int fd;
+	if (mOpenFiles) {
+		handle = mOpenFiles->get(filePath, false);
+		fd = handle ? handle->fd : -1;
+	} else {
+		fd = open(filePath.c_str(), O_RDONLY);
+	}
+	if (fd < 0) {
+		SILOG(transfer,error, "Failed to open " << fileId <<
+			"for writing; reason: " << errno);
+		CacheLayer::getData(req->fileId, req->toRead, req->finished);
+		return;
+	}
+	struct stat64 st;
+	if (req->toRead.goesToEndOfFile() || useWholeFile) {
+		fstat64(fd, &st);
+	}
+	if (req->toRead.goesToEndOfFile()) {
+		req->toRead.setLength((size_t)(st.st_size - req->toRead.startbyte()), true);
+	}
+	DenseDataPtr datum;
+#ifndef _WIN32
+	if (useWholeFile && mMapMinSize && req->toRead.length() >= mMapMinSize &&
+			req->toRead.endbyte() <= (cache_usize_type)st.st_size) {
+		std::tr1::shared_ptr<MappedFile> mapping(new MappedFile(fd, (size_t)st.st_size));
+		if (mapping->data()) {
+			// Whole files are never written again, so the mapping stays valid.
+			datum = DenseDataPtr(new DenseData(req->toRead, mapping->data() + req->toRead.startbyte(), mapping));
+		}
+	}
+#endif
+	if (!datum) {
+		MutableDenseDataPtr copy(new DenseData(req->toRead));
+		readAt(fd, copy->writableData(), (size_t)req->toRead.length(), req->toRead.startbyte(), handle.get() != NULL);
+		datum = copy;
+	}
+	if (!handle) {
+		close(fd);
+	}
+
+	mIndex.touch(req->fileId.fingerprint());
+
+	CacheLayer::populateParentCaches(req->fileId.fingerprint(), datum);
+	SparseData data;
+	data.addValidData(datum);
+	req->finished(&data);
+}
+
+void DiskCacheLayer::doDelete(const Fingerprint &fprint) {
 	{
-		boost::unique_lock<boost::mutex> wake_cv(destroyLock);
-		destroyCV.notify_one();
+		CacheMap::read_iterator iter(mFiles);
+		if (iter.find(fprint)) {
+			// written again since the delete was queued.
+			return;
+		}
+	}
+	mIndex.remove(fprint);
+	std::string fileId = fprint.convertToHexString();
+	std::string filePath = mPrefix + fileId;
+	std::string partialPath = filePath + PARTIAL_SUFFIX;
+	if (mOpenFiles) {
+		mOpenFiles->forget(filePath);
+		mOpenFiles->forget(partialPath);
 	}
+	unlink(filePath.c_str());
+	unlink(partialPath.c_str());
 }
 
 void DiskCacheLayer::unserialize() {
@@ -318,6 +654,34 @@ void DiskCacheLayer::unserialize() {
 		++slash;
 	}
 
+	DiskCacheIndex::EntryList entries;
+	if (mIndex.load(entries)) {
+		// least recently accessed first, so the policy evicts those first.
+		CacheMap::write_iterator writer (mFiles);
+		for (DiskCacheIndex::EntryList::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+			if (writer.insert((*iter).first, (*iter).second.mSize)) {
+				CacheData *cdata = new CacheData();
+				cdata->mRanges.swap((*iter).second.mRanges);
+				*writer = cdata;
+			}
+		}
+		return;
+	}
+
+	SILOG(transfer,info,"No index in " << mPrefix << "; scanning the directory");
+	scanDirectory(entries);
+	if (mIndex.reset(entries)) {
+		// the index now holds the ranges of every partial file.
+		for (DiskCacheIndex::EntryList::const_iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+			if (!(*iter).second.mRanges.empty()) {
+				std::string rangeFile (mPrefix + (*iter).first.convertToHexString() + RANGES_SUFFIX);
+				unlink(rangeFile.c_str());
+			}
+		}
+	}
+}
+
+void DiskCacheLayer::scanDirectory(DiskCacheIndex::EntryList &entries) {
 	DIR *mydir = opendir (mPrefix.c_str());
 	if(mydir) {
 		dirent *myentry;
@@ -331,6 +695,9 @@ void DiskCacheLayer::unserialize() {
 					strName.substr(strName.length()-strlen(RANGES_SUFFIX)) == RANGES_SUFFIX) {
 				continue; // will find range files later.
 			}
+			if (strName.compare(0, strlen(INDEX_NAME), INDEX_NAME) == 0) {
+				continue; // the index, or a compaction of it left by a crash.
+			}
 			totalLength = sizeFromDirentry(pathName, myentry, isdir);
 			if (isdir) {
 				continue; // ignore directories (including . and ..)
@@ -389,6 +756,15 @@ void DiskCacheLayer::unserialize() {
 		closedir(mydir);
 		// And we are done reading the directory.
 	}
+
+	CacheMap::read_iterator iter (mFiles);
+	while (iter.iterate()) {
+		DiskCacheIndex::Entry entry;
+		entry.mSize = iter.getSize();
+		entry.mRanges = static_cast<const CacheData*>(*iter)->mRanges;
+		entry.mLastAccess = 0; // the directory does not say.
+		entries.push_back(DiskCacheIndex::EntryPair(iter.getId(), entry));
+	}
 }
 
 }
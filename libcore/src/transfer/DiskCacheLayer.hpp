@@ -39,15 +39,30 @@
 
 #include "CacheLayer.hpp"
 #include "CacheMap.hpp"
-#include "util/ThreadSafeQueue.hpp"
+#include "DiskCacheIndex.hpp"
 
 namespace Sirikata {
 namespace Transfer {
 
-// should really be a config option.
-//#define NUM_WORKER_THREADS 10
-
-/// Disk Cache keeps track of what files are on disk, and manages a helper thread to retrieve it.
+/**
+ * Disk Cache keeps track of what files are on disk, and manages a pool of
+ * helper threads to retrieve it.
+ *
+ * The number of threads is the transfer.diskworkers option.  Reads wait in
+ * their own queue and are handed out ahead of writes, so a burst of slow
+ * writes does not hold up cached reads for long.  Writes and deletes wait
+ * in a queue of files: data for a file that is already waiting is added to
+ * its write, which then costs one open and one ranges update, and no two
+ * threads ever write or delete the same file at once.
+ *
+ * Whole files of at least transfer.diskmapsize bytes are memory mapped
+ * instead of read, so the DenseData passed to the callback and to the caches
+ * before this one is served from the page cache rather than a heap copy.
+ *
+ * Which files are cached, and which ranges of partial files, is kept in a
+ * DiskCacheIndex in the same directory.  Only a cache directory without an
+ * index, such as one written before the index existed, is scanned on startup.
+ */
 class SIRIKATA_EXPORT DiskCacheLayer : public CacheLayer {
 public:
 	struct CacheData : public CacheEntry {
@@ -65,32 +80,71 @@ public:
 
 private:
 
-	struct DiskRequest;
-	ThreadSafeQueue<std::tr1::shared_ptr<DiskRequest> > mRequestQueue; // must be initialized before the thread.
-	boost::thread mWorkerThread;
-
-	CacheMap mFiles;
-
-
-	std::string mPrefix; // directory or prefix name with trailing slash.
+	enum {
+		/// After this many reads in a row, a waiting write goes next.
+		MAX_READS_BEFORE_WRITE = 16
+	};
 
 	struct DiskRequest {
-		enum Operation {OPREAD, OPWRITE, OPDELETE, OPEXIT} op;
+		enum Operation {OPREAD, OPWRITE, OPDELETE} op;
 
 		DiskRequest(Operation op, const RemoteFileId &myURI, const Range &myRange)
-			:op(op), fileId(myURI), toRead(myRange) {}
+			:op(op), fileId(myURI), toRead(myRange), deleteFirst(false) {}
 
 		RemoteFileId fileId;
 		Range toRead;
 		TransferCallback finished;
-		DenseDataPtr data; // if NULL, read data.
-
+		std::vector<DenseDataPtr> data; // for OPWRITE: every piece queued for this file, oldest first.
+		bool deleteFirst; // for OPWRITE: a delete was queued before the data.
 	};
+	typedef std::tr1::shared_ptr<DiskRequest> DiskRequestPtr;
+	typedef std::tr1::unordered_map<Fingerprint, DiskRequestPtr, Fingerprint::Hasher> PendingWriteMap;
+
+	/// Files opened for positional I/O, defined in DiskCacheLayer.cpp.
+	struct OpenFiles;
+
+	boost::mutex mQueueLock;
+	boost::condition_variable mQueueCV;
+	std::deque<DiskRequestPtr> mReadQueue;
+	std::deque<Fingerprint> mWriteOrder; // files with a write or delete waiting, oldest first.
+	PendingWriteMap mPendingWrites;
+	std::tr1::unordered_set<Fingerprint, Fingerprint::Hasher> mBusyFiles; // being written or deleted.
+	unsigned int mReadsInARow;
+	bool mExiting;
+
+	CacheMap mFiles;
+
+	std::string mPrefix; // directory or prefix name with trailing slash.
+
+	DiskCacheIndex mIndex;
+
+	OpenFiles *mOpenFiles; // NULL unless transfer.diskpositionalio is set.
+
+	cache_usize_type mMapMinSize; // 0 never maps files.
+
+	boost::thread_group mWorkers;
 
-	boost::mutex destroyLock;
-	boost::condition_variable destroyCV;
 	bool mCleaningUp; // do not delete any files.
 
+	/// Waits for the next request, or returns NULL once exiting and every queue is empty.
+	DiskRequestPtr nextRequest();
+
+	/// Lets other threads write or delete fileId again.
+	void finishedFile(const Fingerprint &fileId);
+
+	void queueWrite(const Fingerprint &fileId, const DenseDataPtr &data);
+
+	void queueDelete(const Fingerprint &fileId);
+
+	void doRead(const DiskRequestPtr &req);
+
+	void doWrite(const DiskRequestPtr &req);
+
+	void doDelete(const Fingerprint &fileId);
+
+	/// Adds every file in the cache directory to mFiles and to entries, for a directory without an index.
+	void scanDirectory(DiskCacheIndex::EntryList &entries);
+
 public:
 	void workerThread(); // defined in DiskCache.cpp
 	void unserialize(); // defined in DiskCache.cpp
@@ -98,24 +152,15 @@ public:
 	void readDataFromDisk(const RemoteFileId &fileURI,
 			const Range &requestedRange,
 			const TransferCallback&callback) {
-		std::tr1::shared_ptr<DiskRequest> req (
+		DiskRequestPtr req (
 				new DiskRequest(DiskRequest::OPREAD, fileURI, requestedRange));
 		req->finished = callback;
 
-		mRequestQueue.push(req);
-	}
-
-	void serializeRanges(const RangeList &list, std::string &out) {
-		std::ostringstream outs;
-
-		for (RangeList::const_iterator liter = list.begin(); liter != list.end(); ++liter) {
-			cache_ssize_type len = (cache_ssize_type)((*liter).length());
-			if ((*liter).goesToEndOfFile()) {
-				len = -len;
-			}
-			outs << (*liter).startbyte() << " " << len << "; ";
+		{
+			boost::lock_guard<boost::mutex> lock(mQueueLock);
+			mReadQueue.push_back(req);
 		}
-		out = outs.str();
+		mQueueCV.notify_one();
 	}
 
 	void unserializeRanges(RangeList &rlist, std::istream &iranges) {
@@ -144,21 +189,15 @@ public:
 
 protected:
 	virtual void populateCache(const Fingerprint& fileId, const DenseDataPtr &data) {
-		std::tr1::shared_ptr<DiskRequest> req (
-				new DiskRequest(DiskRequest::OPWRITE, RemoteFileId(fileId, URI(URIContext(),"")), *data));
-		req->data = data;
-
-		mRequestQueue.push(req);
+		queueWrite(fileId, data);
 
-		CacheLayer::populateParentCaches(req->fileId.fingerprint(), data);
+		CacheLayer::populateParentCaches(fileId, data);
 	}
 
 	virtual void destroyCacheEntry(const Fingerprint &fileId, CacheEntry *cacheLayerData, cache_usize_type releaseSize) {
 		if (!mCleaningUp) {
 			// don't want to erase the disk cache when exiting the program.
-			std::string fileName = fileId.convertToHexString();
-			std::tr1::shared_ptr<DiskRequest> req
-				(new DiskRequest(DiskRequest::OPDELETE, RemoteFileId(fileId, URI(URIContext(),"")), Range(true)));
+			queueDelete(fileId);
 		}
 		CacheData *toDelete = static_cast<CacheData*>(cacheLayerData);
 		delete toDelete;
@@ -166,31 +205,11 @@ protected:
 
 public:
 
-	DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext)
-			: CacheLayer(tryNext),
-			mWorkerThread(std::tr1::bind(&DiskCacheLayer::workerThread, this)),
-			mFiles(this, policy),
-			mPrefix(prefix+"/"),
-			mCleaningUp(false) {
-
-		try {
-			unserialize();
-		} catch (...) {
-			SILOG(transfer,fatal,"ERROR loading file list!");
-			/// do nothing
-		}
-	}
-
-	virtual ~DiskCacheLayer() {
-		std::tr1::shared_ptr<DiskRequest> req
-			(new DiskRequest(DiskRequest::OPEXIT, RemoteFileId(Fingerprint(), URI(URIContext(),"")), Range(true)));
-		boost::unique_lock<boost::mutex> sleep_cv(destroyLock);
-		mRequestQueue.push(req);
-		destroyCV.wait(sleep_cv); // we know the thread has terminated.
+	/// Loads the list of files under prefix, then starts transfer.diskworkers threads.
+	DiskCacheLayer(CachePolicy *policy, const std::string &prefix, CacheLayer *tryNext);
 
-		mCleaningUp = true; // don't allow destroyCacheEntry to delete files.
-
-	}
+	/// Finishes every queued request before returning.
+	virtual ~DiskCacheLayer();
 
 	virtual void purgeFromCache(const Fingerprint &fileId) {
 		CacheMap::write_iterator iter(mFiles);
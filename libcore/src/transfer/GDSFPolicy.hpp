@@ -0,0 +1,138 @@
+/*  Sirikata Transfer -- Content Transfer management system
+ *  GDSFPolicy.hpp
+ *
+ *  Copyright (c) 2008, Patrick Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SIRIKATA_GDSFPolicy_HPP__
+#define SIRIKATA_GDSFPolicy_HPP__
+
+#include "CachePolicy.hpp"
+
+namespace Sirikata {
+namespace Transfer {
+
+/**
+ * GreedyDual-Size-Frequency (Cherkasova): evicts the entry with the lowest
+ * priority, where an entry's priority is the inflation value at its last use
+ * plus its use count divided by its size.
+ *
+ * Small, often used entries are kept ahead of large ones, so a single large
+ * file cannot push out hundreds of small materials.  The inflation value is
+ * raised to the priority of every evicted entry, so entries that have not
+ * been used in a long while age out whatever their count was.
+ */
+class GDSFPolicy : public CachePolicy {
+
+	typedef std::multimap<double, Fingerprint> PriorityMap;
+
+	struct GDSFData : public Data {
+		PriorityMap::iterator mIter;
+		cache_usize_type mSize;
+		uint32 mFrequency;
+
+		GDSFData(cache_usize_type size)
+			: mSize(size), mFrequency(1) {
+		}
+	};
+
+	/// Lowest priority first; equal priorities are kept least recently used first.
+	PriorityMap mPriorities;
+
+	/// The priority of the last entry picked for eviction (L in the paper).
+	double mInflation;
+
+	double priority(const GDSFData *gdsfdata) const {
+		return mInflation + (double)gdsfdata->mFrequency / (double)(gdsfdata->mSize ? gdsfdata->mSize : 1);
+	}
+
+	void reprioritize(const Fingerprint &id, GDSFData *gdsfdata) {
+		mPriorities.erase(gdsfdata->mIter);
+		gdsfdata->mIter = mPriorities.insert(PriorityMap::value_type(priority(gdsfdata), id));
+	}
+
+public:
+	GDSFPolicy(cache_usize_type allocatedSpace, float maxSizePct=0.5)
+		: CachePolicy(allocatedSpace, maxSizePct), mInflation(0) {
+	}
+
+	virtual void use(const Fingerprint &id, Data* data, cache_usize_type size) {
+		GDSFData *gdsfdata = static_cast<GDSFData*>(data);
+		if (gdsfdata->mFrequency < 0xffffffff) {
+			++gdsfdata->mFrequency;
+		}
+		reprioritize(id, gdsfdata);
+	}
+
+	virtual void useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize) {
+		static_cast<GDSFData*>(data)->mSize = newsize;
+		use(id, data, newsize);
+		CachePolicy::updateSpace(oldsize, newsize);
+	}
+
+	virtual void destroy(const Fingerprint &id, Data* data, cache_usize_type size) {
+		GDSFData *gdsfdata = static_cast<GDSFData*>(data);
+
+		CachePolicy::updateSpace(size, 0);
+
+		SILOG(transfer,debug,"[GDSFPolicy] Freeing " << id << " (" << size << " bytes); " << mFreeSpace << " free");
+		mPriorities.erase(gdsfdata->mIter);
+		delete gdsfdata;
+	}
+
+	virtual Data* create(const Fingerprint &id, cache_usize_type size) {
+		CachePolicy::updateSpace(0, size);
+
+		GDSFData *gdsfdata = new GDSFData(size);
+		gdsfdata->mIter = mPriorities.insert(PriorityMap::value_type(priority(gdsfdata), id));
+		return gdsfdata;
+	}
+
+	virtual bool nextItem(
+			cache_usize_type requiredSpace,
+			Fingerprint &myprint)
+	{
+		if (mFreeSpace < (cache_ssize_type)requiredSpace && !mPriorities.empty()) {
+			PriorityMap::iterator lowest = mPriorities.begin();
+			if ((*lowest).first > mInflation) {
+				mInflation = (*lowest).first;
+			}
+			myprint = (*lowest).second;
+			return true;
+		} else {
+			return false;
+		}
+	}
+};
+
+}
+}
+
+#endif /* SIRIKATA_GDSFPolicy_HPP__ */
@@ -36,6 +36,7 @@
 
 #include "CacheLayer.hpp"
 #include "CacheMap.hpp"
+#include "CacheAccessLog.hpp"
 
 namespace Sirikata {
 /** MemoryCacheLayer.hpp -- MemoryCacheLayer -- the first layer of transfer cache. */
@@ -51,6 +52,8 @@ public:
 private:
 	typedef CacheMap MemoryMap;
 	MemoryMap mData;
+	/// Where to record answered requests, if transfer.accesslog named a file when this layer was made.
+	std::tr1::shared_ptr<CacheAccessLog> mAccessLog;
 
 protected:
 	virtual void populateCache(const Fingerprint &fileId, const DenseDataPtr &respondData) {
@@ -63,7 +66,6 @@ protected:
 					CacheData *cdata = new CacheData;
 					*writer = cdata;
 					cdata->mSparse.addValidData(respondData);
-					writer.use();
 				} else {
 					CacheData *cdata = static_cast<CacheData*>(*writer);
 					cdata->mSparse.addValidData(respondData);
@@ -81,6 +83,15 @@ protected:
 		CacheLayer::populateParentCaches(fileId, respondData);
 	}
 
+	/// Records a request answered by a later layer in log before passing the answer on.
+	static void logResponse(const std::tr1::shared_ptr<CacheAccessLog> &log, const Fingerprint &fileId,
+			const TransferCallback &callback, const SparseData *data) {
+		if (data) {
+			log->record(fileId, data->getSpaceUsed());
+		}
+		callback(data);
+	}
+
 	virtual void destroyCacheEntry(const Fingerprint &fileId, CacheEntry *cacheLayerData, cache_usize_type releaseSize) {
 		CacheData *toDelete = static_cast<CacheData*>(cacheLayerData);
 		delete toDelete;
@@ -89,7 +100,8 @@ protected:
 public:
 	MemoryCacheLayer(CachePolicy *policy, CacheLayer *tryNext)
 			: CacheLayer(tryNext),
-			mData(this, policy) {
+			mData(this, policy),
+			mAccessLog(CacheAccessLog::current()) {
 	}
 
 	virtual void purgeFromCache(const Fingerprint &fileId) {
@@ -117,6 +129,7 @@ public:
 				if (sparseData.contains(requestedRange)) {
 					haveData = true;
 					foundData = sparseData;
+					iter.use();
 				}
 			}
 		}
@@ -126,7 +139,14 @@ public:
 					++iter) {
 				CacheLayer::populateParentCaches(uri.fingerprint(), iter.getPtr());
 			}
+			if (mAccessLog) {
+				mAccessLog->record(uri.fingerprint(), foundData.getSpaceUsed());
+			}
 			callback(&foundData);
+		} else if (mAccessLog) {
+			using std::tr1::placeholders::_1;
+			CacheLayer::getData(uri, requestedRange,
+				std::tr1::bind(&MemoryCacheLayer::logResponse, mAccessLog, uri.fingerprint(), callback, _1));
 		} else {
 			CacheLayer::getData(uri, requestedRange, callback);
 		}
@@ -40,28 +40,60 @@ namespace Sirikata {
 namespace Transfer {
 
 
-/// Represents a single block of data, and also knows the range of the file it came from.
+/**
+ * Represents a single block of data, and also knows the range of the file it came from.
+ *
+ * The data is usually held in a vector of its own, but may instead be borrowed
+ * from memory that something else owns, such as a memory mapped file, which is
+ * kept alive as long as the DenseData refers to it.
+ */
 class DenseData : Noncopyable, public Range {
 	std::vector<unsigned char> mData;
+	/// If not NULL, the data is here rather than in mData, and mBacking keeps it valid.
+	const unsigned char *mBorrowed;
+	std::tr1::shared_ptr<void> mBacking;
+
+	/// Copies borrowed data into mData so that it may be changed.
+	void ownData() {
+		if (mBorrowed) {
+			mData.assign(mBorrowed, mBorrowed + (size_t)length());
+			mBorrowed = NULL;
+			mBacking = std::tr1::shared_ptr<void>();
+		}
+	}
 
 public:
-	/// The only constructor--the length can be changed later with setLength().
+	/// Allocates room for range--the length can be changed later with setLength().
 	DenseData(const Range &range)
-			:Range(range) {
+			:Range(range), mBorrowed(NULL) {
 		if (range.length()) {
 			mData.resize((std::vector<unsigned char>::size_type)range.length());
 		}
 	}
 
 	DenseData(const std::string &str, bool wholeFile=true)
-			:Range(wholeFile) {
+			:Range(wholeFile), mBorrowed(NULL) {
 		setLength(str.length(), wholeFile);
 		std::copy(str.begin(), str.end(), writableData());
 	}
 
+	/**
+	 * Refers to range.length() bytes at data without copying them.
+	 * @param backing  owns data, and is held until this DenseData is destroyed
+	 *                 or its data is changed.
+	 */
+	DenseData(const Range &range, const unsigned char *data, const std::tr1::shared_ptr<void> &backing)
+			:Range(range), mBorrowed(data), mBacking(backing) {
+	}
+
 	/// equals dataAt(startbyte()).
 	inline const unsigned char *data() const {
-		return &(mData[0]);
+		return mBorrowed ? mBorrowed : &(mData[0]);
+	}
+
+	/// Whether the data is borrowed rather than held in a vector of its own.
+	inline bool isBorrowed() const {
+		return mBorrowed != NULL;
 	}
 
 	inline const unsigned char *begin() const {
@@ -72,8 +104,9 @@ public:
 		return data()+length();
 	}
 
-	/// Returns a non-const data, starting at startbyte().
+	/// Returns a non-const data, starting at startbyte().  Borrowed data is copied first.
 	inline unsigned char *writableData() {
+		ownData();
 		return &(mData[0]);
 	}
 
@@ -85,7 +118,7 @@ public:
 		if (offset >= endbyte() || offset < startbyte()) {
 			return NULL;
 		}
-		return &(mData[(std::vector<unsigned char>::size_type)(offset-startbyte())]);
+		return data() + (size_t)(offset-startbyte());
 	}
 
 	inline std::string asString() const {
@@ -94,6 +127,7 @@ public:
 
 	/// Sets the length of the range, as well as allocates more space in the data vector.
 	inline void setLength(size_t len, bool is_npos) {
+		ownData();
 		Range::setLength(len, is_npos);
 		mData.resize(len);
 		//message1.reserve(size);
@@ -54,6 +54,9 @@ public:
     template<typename T> static T dec(volatile T*scalar) {
         return (T)InterlockedDecrement((volatile LONG*)scalar);
     }
+    template<typename T> static bool cas(volatile T*scalar, T comparand, T exchange) {
+        return InterlockedCompareExchange((volatile LONG*)scalar,(LONG)exchange,(LONG)comparand)==(LONG)comparand;
+    }
 };
 template<> class SizedAtomicValue<8> {
 public:
@@ -66,6 +69,9 @@ public:
     template<typename T> static T dec(volatile T*scalar) {
         return (T)InterlockedDecrement64((volatile LONGLONG*)scalar);
     }
+    template<typename T> static bool cas(volatile T*scalar, T comparand, T exchange) {
+        return InterlockedCompareExchange64((volatile LONGLONG*)scalar,(LONGLONG)exchange,(LONGLONG)comparand)==(LONGLONG)comparand;
+    }
 };
 #elif defined(__APPLE__)
 template<int size> class SizedAtomicValue {
@@ -83,6 +89,9 @@ public:
     template <typename T> static T dec(volatile T*scalar) {
         return (T)OSAtomicDecrement32((int32*)scalar);
     }
+    template <typename T> static bool cas(volatile T*scalar, T comparand, T exchange) {
+        return OSAtomicCompareAndSwap32Barrier((int32)comparand,(int32)exchange,(int32*)scalar);
+    }
 };
 
 template<> class SizedAtomicValue<8> {
@@ -96,6 +105,9 @@ public:
     template <typename T> static T dec(volatile T*scalar) {
         return (T)OSAtomicDecrement64((int64*)scalar);
     }
+    template <typename T> static bool cas(volatile T*scalar, T comparand, T exchange) {
+        return OSAtomicCompareAndSwap64Barrier((int64)comparand,(int64)exchange,(int64*)scalar);
+    }
 };
 #else
 template<int size> class SizedAtomicValue {
@@ -109,6 +121,9 @@ public:
     template <typename T> static T dec(volatile T*scalar) {
         return __sync_sub_and_fetch(scalar, 1);
     }
+    template <typename T> static bool cas(volatile T*scalar, T comparand, T exchange) {
+        return __sync_bool_compare_and_swap(scalar, comparand, exchange);
+    }
 };
 #endif
 #ifdef _WIN32
@@ -153,11 +168,12 @@ public:
     bool operator ==(const AtomicValue& other) const{
         return *(T*)getThisAlignedAddress(mMemory)==*(T*)getThisAlignedAddress(other.mMemory);
     }
+    ///reads through the volatile pointer so that loops spinning on the value really do see other threads' writes
     operator T ()const {
-        return *(T*)getThisAlignedAddress(mMemory);
+        return *getThisAlignedAddress(mMemory);
     }
     T read() const {
-        return *(T*)getThisAlignedAddress(mMemory);
+        return *getThisAlignedAddress(mMemory);
     }
     T operator +=(const T&other) {
         return SizedAtomicValue<sizeof(T)>::add(getThisAlignedAddress(mMemory),other);
@@ -174,6 +190,10 @@ public:
     T operator++(int) {
         return (++*this)-(T)1;
     }
+    ///Atomically replaces the value with exchange if it still equals comparand: returns true if the swap happened
+    bool compareAndSwap(T comparand, T exchange) {
+        return SizedAtomicValue<sizeof(T)>::cas(getThisAlignedAddress(mMemory),comparand,exchange);
+    }
     T operator--(int) {
         return (--*this)+(T)1;
     }
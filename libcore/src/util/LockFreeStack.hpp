@@ -0,0 +1,163 @@
+/*  Sirikata Utilities -- Sirikata Synchronization Utilities
+ *  LockFreeStack.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_LOCK_FREE_STACK_HPP_
+#define _SIRIKATA_LOCK_FREE_STACK_HPP_
+#include "util/AtomicTypes.hpp"
+namespace Sirikata {
+
+/**
+ * A last in first out stack whose push() and pop() may be called from any number of threads without taking a lock.
+ * Elements sit in nodes that are numbered rather than pointed to, and the top of the stack is a single 64 bit word holding
+ * the number of the top node along with a tag that every push and pop changes, so one compare and swap moves the top and
+ * a thread whose node was popped and pushed back while it looked at it fails its swap instead of corrupting the stack.
+ * Nodes are never freed while the stack lives: popped ones go on a second stack of spare nodes for later pushes, and
+ * new ones come from blocks that double in size, so the stack only ever allocates as it grows past its largest size so far
+ */
+template <typename T> class LockFreeStack {
+    class Node {
+    public:
+        T mValue;
+        ///One more than the number of the node beneath this one, or 0 at the bottom of the stack
+        AtomicValue<uint32> mNext;
+    };
+    enum {
+        ///The first block holds 1<<FIRST_BLOCK_BITS nodes and each block after holds twice as many as the one before
+        FIRST_BLOCK_BITS=4,
+        ///Enough blocks that every 32 bit node number has one
+        MAX_BLOCKS=32-FIRST_BLOCK_BITS
+    };
+    AtomicValue<Node*> mBlocks[MAX_BLOCKS];
+    ///How many node numbers have been handed out
+    AtomicValue<uint32> mNodeCount;
+    ///The tag in the high 32 bits and one more than the number of the top node in the low 32 bits: 0 there when empty
+    AtomicValue<uint64> mTop;
+    ///The same as mTop for the nodes that hold nothing
+    AtomicValue<uint64> mSpare;
+    //noncopyable
+    LockFreeStack(const LockFreeStack&);
+    LockFreeStack&operator=(const LockFreeStack&);
+
+    static uint32 blockOf(uint32 node, uint32&offset) {
+        uint32 shifted=(node>>FIRST_BLOCK_BITS)+1;
+        uint32 block=0;
+        while (shifted>>(block+1)) {
+            ++block;
+        }
+        offset=node-(((1<<block)-1)<<FIRST_BLOCK_BITS);
+        return block;
+    }
+    ///Finds the node numbered node, which must have been handed out by newNode
+    Node*nodeAt(uint32 node) {
+        uint32 offset;
+        uint32 block=blockOf(node,offset);
+        return mBlocks[block].read()+offset;
+    }
+    ///Hands out a node that has never been used, making its block if no one has yet
+    uint32 newNode() {
+        uint32 node=mNodeCount++;
+        assert(node<(((1u<<MAX_BLOCKS)-1)<<FIRST_BLOCK_BITS)&&"LockFreeStack is out of node numbers");
+        uint32 offset;
+        uint32 block=blockOf(node,offset);
+        if (mBlocks[block].read()==NULL) {
+            Node*nodes=new Node[(size_t)1<<(block+FIRST_BLOCK_BITS)];
+            if (!mBlocks[block].compareAndSwap(NULL,nodes)) {
+                delete []nodes;//another thread made the block first
+            }
+        }
+        return node;
+    }
+    /**
+     * Puts node on top of stack. The low 32 bits of the top are read in one piece even where the 64 bit read may tear,
+     * so the node number is always one that was really there, and a torn tag just fails the swap
+     */
+    void pushNode(AtomicValue<uint64>&stack, uint32 node) {
+        Node*top=nodeAt(node);
+        uint64 former;
+        do {
+            former=stack.read();
+            top->mNext=(uint32)former;
+        }while (!stack.compareAndSwap(former,(((former>>32)+1)<<32)|(node+1)));
+    }
+    ///Takes the top node off stack, returning false if stack is empty
+    bool popNode(AtomicValue<uint64>&stack, uint32&node) {
+        uint64 former;
+        do {
+            former=stack.read();
+            if ((uint32)former==0)
+                return false;
+            node=(uint32)former-1;
+        }while (!stack.compareAndSwap(former,(((former>>32)+1)<<32)|nodeAt(node)->mNext.read()));
+        return true;
+    }
+public:
+    LockFreeStack():mNodeCount(0),mTop(0),mSpare(0) {
+        for (int i=0;i<MAX_BLOCKS;++i) {
+            mBlocks[i]=NULL;
+        }
+    }
+    ~LockFreeStack() {
+        for (int i=0;i<MAX_BLOCKS;++i) {
+            delete []mBlocks[i].read();
+        }
+    }
+    ///Pushes a copy of value onto the stack from any thread
+    void push(const T&value) {
+        uint32 node;
+        if (!popNode(mSpare,node)) {
+            node=newNode();
+        }
+        nodeAt(node)->mValue=value;
+        pushNode(mTop,node);
+    }
+    /**
+     * Pops the top value from the stack and places it in value.
+     * \returns whether value was changed (if the stack had at least one item)
+     */
+    bool pop(T&value) {
+        uint32 node;
+        if (!popNode(mTop,node))
+            return false;
+        Node*popped=nodeAt(node);
+        value=popped->mValue;
+        popped->mValue=T();
+        pushNode(mSpare,node);
+        return true;
+    }
+    ///Returns true if the stack was empty at some point during the call
+    bool probablyEmpty() {
+        return (uint32)mTop.read()==0;
+    }
+};
+
+}
+#endif
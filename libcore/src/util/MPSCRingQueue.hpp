@@ -0,0 +1,160 @@
+/*  Sirikata Utilities -- Sirikata Synchronization Utilities
+ *  MPSCRingQueue.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIRIKATA_MPSC_RING_QUEUE_HPP_
+#define _SIRIKATA_MPSC_RING_QUEUE_HPP_
+#include "util/AtomicTypes.hpp"
+#include "util/ThreadSafeQueue.hpp"
+namespace Sirikata {
+
+/**
+ * A queue with any number of pushing threads but only one popping thread at a time.
+ * Elements live in a fixed size ring of sequenced cells (after Vyukov's bounded queue):
+ * a push claims a cell with a single compare and swap and publishes it with a single increment, and
+ * the consumer drains every published cell in one batch, so pushing threads never wait on a lock or on each other.
+ * If the ring fills up, pushes spill to a locked overflow deque, and every push keeps going there until the consumer
+ * has emptied both, so the elements from any one thread still come out in the order they went in.
+ */
+template <typename T> class MPSCRingQueue {
+    class Cell {
+    public:
+        ///equals the cell's position while free, position+1 once published
+        AtomicValue<uint32> mSequence;
+        T mValue;
+    };
+    Cell*mCells;
+    uint32 mMask;
+    ///keeps the producers' counter off the cache line of the consumer's
+    char mPadding[64];
+    ///The position the next push will claim
+    AtomicValue<uint32> mEnqueuePosition;
+    char mPadding2[64];
+    ///The position the consumer will read next: only touched by the consumer
+    uint32 mDequeuePosition;
+    ///Nonzero while elements may be waiting in mOverflow: new elements must then queue behind them there
+    AtomicValue<uint32> mOverflowing;
+    std::deque<T> mOverflow;
+    ThreadSafeQueueNS::Lock*mOverflowLock;
+    //noncopyable
+    MPSCRingQueue(const MPSCRingQueue&);
+    MPSCRingQueue&operator=(const MPSCRingQueue&);
+
+    ///Places value in the ring if a cell is free, returning false if the ring is full
+    bool tryPush(const T&value) {
+        uint32 position=mEnqueuePosition.read();
+        Cell*cell;
+        for (;;) {
+            cell=&mCells[position&mMask];
+            int32 difference=(int32)(cell->mSequence.read()-position);
+            if (difference==0) {
+                if (mEnqueuePosition.compareAndSwap(position,position+1))
+                    break;
+            }else if (difference<0) {
+                return false;//the consumer has not yet freed this cell from the last time around
+            }
+            position=mEnqueuePosition.read();
+        }
+        cell->mValue=value;
+        ++cell->mSequence;//publish
+        return true;
+    }
+public:
+    ///Makes a queue whose ring holds capacity elements: capacity must be a power of two
+    explicit MPSCRingQueue(uint32 capacity)
+        : mCells(new Cell[capacity]),mMask(capacity-1),mEnqueuePosition(0),mDequeuePosition(0),mOverflowing(0),
+          mOverflowLock(ThreadSafeQueueNS::lockCreate()) {
+        assert((capacity&mMask)==0&&"MPSCRingQueue capacity must be a power of two");
+        for (uint32 i=0;i<capacity;++i) {
+            mCells[i].mSequence=i;
+        }
+    }
+    ~MPSCRingQueue() {
+        delete []mCells;
+        ThreadSafeQueueNS::lockDestroy(mOverflowLock);
+    }
+    ///Pushes value onto the queue from any thread
+    void push(const T&value) {
+        if (mOverflowing.read()==0&&tryPush(value))
+            return;
+        ThreadSafeQueueNS::lock(mOverflowLock);
+        if (mOverflowing.read()==0&&tryPush(value)) {
+            ThreadSafeQueueNS::unlock(mOverflowLock);
+            return;
+        }
+        mOverflowing=1;
+        try {
+            mOverflow.push_back(value);
+        }catch (...) {
+            ThreadSafeQueueNS::unlock(mOverflowLock);
+            throw;
+        }
+        ThreadSafeQueueNS::unlock(mOverflowLock);
+    }
+    /**
+     * Appends everything that has been pushed so far to the back of out. Only one thread may pop at once.
+     * A push that is still in progress holds back the overflow, so out may come back short (or empty) while
+     * another thread is in the middle of a push. That thread will see its element is queued once push returns
+     */
+    void popAll(std::deque<T>&out) {
+        for (;;) {
+            Cell*cell=&mCells[mDequeuePosition&mMask];
+            if (cell->mSequence.read()!=mDequeuePosition+1)
+                break;
+            out.push_back(cell->mValue);
+            cell->mValue=T();
+            cell->mSequence+=mMask;//frees the cell for position+capacity
+            ++mDequeuePosition;
+        }
+        //the overflow may only be taken once every element pushed ahead of it is out of the ring
+        if (mOverflowing.read()&&mEnqueuePosition.read()==mDequeuePosition) {
+            ThreadSafeQueueNS::lock(mOverflowLock);
+            if (mEnqueuePosition.read()==mDequeuePosition) {
+                try {
+                    out.insert(out.end(),mOverflow.begin(),mOverflow.end());
+                }catch (...) {
+                    ThreadSafeQueueNS::unlock(mOverflowLock);
+                    throw;
+                }
+                mOverflow.clear();
+                mOverflowing=0;
+            }
+            ThreadSafeQueueNS::unlock(mOverflowLock);
+        }
+    }
+    ///Returns true if nothing has been pushed that the consumer has not popped. Only meaningful to the consumer
+    bool probablyEmpty() {
+        return mEnqueuePosition.read()==mDequeuePosition&&mOverflowing.read()==0;
+    }
+};
+
+}
+#endif
@@ -74,4 +74,11 @@ public:
         TS_ASSERT_EQUALS(test+1+235,output);
 #endif
     }
+    void testAtomicCompareAndSwap32( void ) {
+        AtomicValue<Sirikata::uint32> a(17);
+        TS_ASSERT(!a.compareAndSwap(16,40));
+        TS_ASSERT_EQUALS(a.read(),17u);
+        TS_ASSERT(a.compareAndSwap(17,40));
+        TS_ASSERT_EQUALS(a.read(),40u);
+    }
 };
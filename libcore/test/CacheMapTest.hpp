@@ -0,0 +1,295 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  CacheMapTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "transfer/CacheMap.hpp"
+#include "transfer/LRUPolicy.hpp"
+#include "task/Time.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata;
+/**
+ * Checks the sharded CacheMap: that uses recorded by readers still steer the CachePolicy,
+ * and that under readers and writers on many threads the policy is never entered twice at once
+ * and never hears of an entry it has already destroyed.
+ * testReaderScaling prints how lookups hold up as reader threads are added
+ */
+class CacheMapTest : public CxxTest::TestSuite
+{
+    typedef Transfer::Fingerprint Fingerprint;
+    typedef Transfer::CacheMap CacheMap;
+    typedef Transfer::cache_usize_type cache_usize_type;
+    enum {
+        NUM_ENTRIES=256,
+        ENTRY_SIZE=100,
+        ///Room for a quarter of the entries, so the writers keep evicting
+        CACHE_SIZE=NUM_ENTRIES*ENTRY_SIZE/4,
+        OPERATIONS_PER_THREAD=20000,
+        MAX_READERS=8,
+        LOOKUPS_PER_RUN=1<<19
+    };
+    ///Counts what the CacheMap destroys
+    class CountingLayer : public Transfer::CacheLayer {
+    public:
+        class Entry : public CacheEntry {
+        };
+        AtomicValue<uint32> mCreated;
+        AtomicValue<uint32> mDestroyed;
+        CountingLayer():Transfer::CacheLayer(NULL),mCreated(0),mDestroyed(0) {}
+        CacheMap::CacheData newEntry() {
+            ++mCreated;
+            return new Entry;
+        }
+    protected:
+        virtual void destroyCacheEntry(const Fingerprint &fileId, CacheEntry *cacheLayerData, cache_usize_type releaseSize) {
+            ++mDestroyed;
+            delete static_cast<Entry*>(cacheLayerData);
+        }
+    };
+    ///An LRUPolicy that notices being called from two threads at once, or about data it no longer owns
+    class CheckingPolicy : public Transfer::LRUPolicy {
+        AtomicValue<uint32> mInside;
+        std::set<Data*> mLive;
+        void enter() {
+            if (++mInside!=1) mFailed=true;
+        }
+        void leave() {
+            --mInside;
+        }
+        void checkLive(Data*data) {
+            if (mLive.find(data)==mLive.end()) mFailed=true;
+        }
+    public:
+        bool mFailed;
+        CheckingPolicy():Transfer::LRUPolicy(CACHE_SIZE),mInside(0),mFailed(false) {}
+        virtual void use(const Fingerprint &id, Data* data, cache_usize_type size) {
+            enter();
+            checkLive(data);
+            LRUPolicy::use(id,data,size);
+            leave();
+        }
+        virtual void useAndUpdate(const Fingerprint &id, Data* data, cache_usize_type oldsize, cache_usize_type newsize) {
+            enter();
+            checkLive(data);
+            LRUPolicy::use(id,data,newsize);
+            updateSpace(oldsize,newsize);
+            leave();
+        }
+        virtual void destroy(const Fingerprint &id, Data* data, cache_usize_type size) {
+            enter();
+            checkLive(data);
+            mLive.erase(data);
+            LRUPolicy::destroy(id,data,size);
+            leave();
+        }
+        virtual Data* create(const Fingerprint &id, cache_usize_type size) {
+            enter();
+            Data*data=LRUPolicy::create(id,size);
+            mLive.insert(data);
+            leave();
+            return data;
+        }
+        virtual bool cachable(cache_usize_type requiredSpace) {
+            enter();
+            bool retval=LRUPolicy::cachable(requiredSpace);
+            leave();
+            return retval;
+        }
+        virtual bool nextItem(cache_usize_type requiredSpace, Fingerprint &myprint) {
+            enter();
+            bool retval=LRUPolicy::nextItem(requiredSpace,myprint);
+            leave();
+            return retval;
+        }
+        size_t numLive()const {
+            return mLive.size();
+        }
+    };
+    std::vector<Fingerprint> mIds;
+    static void insert(CacheMap&map, CountingLayer&layer, const Fingerprint&id) {
+        CacheMap::write_iterator writer(map);
+        if (map.alloc(ENTRY_SIZE,writer)) {
+            if (writer.insert(id,ENTRY_SIZE)) {
+                *writer=layer.newEntry();
+            }
+            writer.use();
+        }
+    }
+    static bool contains(CacheMap&map, const Fingerprint&id) {
+        CacheMap::read_iterator reader(map);
+        return reader.find(id);
+    }
+    ///Looks up random entries, using each one found: returns how many were found
+    uint32 read(CacheMap*map, uint32 seed, uint32 count, bool*sawEmptyEntry) {
+        uint32 found=0;
+        for (uint32 i=0;i<count;++i) {
+            seed=seed*1103515245+12345;
+            CacheMap::read_iterator reader(*map);
+            if (reader.find(mIds[(seed>>8)%NUM_ENTRIES])) {
+                if (*reader==NULL) *sawEmptyEntry=true;
+                reader.use();
+                ++found;
+            }
+        }
+        return found;
+    }
+    void readForThread(CacheMap*map, uint32 seed, uint32 count, bool*sawEmptyEntry) {
+        read(map,seed,count,sawEmptyEntry);
+    }
+    ///Inserts, updates and purges random entries
+    void write(CacheMap*map, CountingLayer*layer, uint32 seed, uint32 count) {
+        for (uint32 i=0;i<count;++i) {
+            seed=seed*1103515245+12345;
+            const Fingerprint&id=mIds[(seed>>8)%NUM_ENTRIES];
+            switch ((seed>>4)%4) {
+              case 0: {
+                CacheMap::write_iterator writer(*map);
+                if (writer.find(id)) {
+                    writer.erase();
+                }
+                break;
+              }
+              case 1: {
+                CacheMap::write_iterator writer(*map);
+                if (writer.find(id)) {
+                    writer.update(ENTRY_SIZE);
+                }
+                break;
+              }
+              default:
+                insert(*map,*layer,id);
+            }
+        }
+    }
+public:
+    CacheMapTest() {
+        for (uint32 i=0;i<NUM_ENTRIES;++i) {
+            std::ostringstream name;
+            name<<"entry "<<i;
+            mIds.push_back(Fingerprint::computeDigest(name.str()));
+        }
+    }
+    void testIterateAllShards( void ) {
+        CountingLayer layer;
+        CheckingPolicy policy;
+        {
+            CacheMap map(&layer,&policy);
+            for (uint32 i=0;i<CACHE_SIZE/ENTRY_SIZE;++i) {
+                insert(map,layer,mIds[i]);
+            }
+            std::set<Fingerprint> seen;
+            CacheMap::read_iterator reader(map);
+            while (reader.iterate()) {
+                seen.insert(reader.getId());
+            }
+            TS_ASSERT_EQUALS(seen.size(),(size_t)CACHE_SIZE/ENTRY_SIZE);
+            TS_ASSERT(!reader.iterate());
+        }
+        TS_ASSERT_EQUALS(layer.mDestroyed.read(),layer.mCreated.read());
+        TS_ASSERT_EQUALS(policy.numLive(),0u);
+        TS_ASSERT(!policy.mFailed);
+    }
+    void testReadersKeepEntries( void ) {
+        CountingLayer layer;
+        CheckingPolicy policy;
+        CacheMap map(&layer,&policy);
+        uint32 capacity=CACHE_SIZE/ENTRY_SIZE;
+        for (uint32 i=0;i<capacity;++i) {
+            insert(map,layer,mIds[i]);
+        }
+        //only recorded in the shard's buffer, but the eviction must still see it
+        {
+            CacheMap::read_iterator reader(map);
+            TS_ASSERT(reader.find(mIds[0]));
+            reader.use();
+        }
+        insert(map,layer,mIds[capacity]);
+        TS_ASSERT(contains(map,mIds[0]));
+        TS_ASSERT(!contains(map,mIds[1]));
+        TS_ASSERT(contains(map,mIds[capacity]));
+        TS_ASSERT(!policy.mFailed);
+    }
+    void testConcurrentReadersAndWriters( void ) {
+        CountingLayer layer;
+        CheckingPolicy policy;
+        bool sawEmptyEntry=false;
+        {
+            CacheMap map(&layer,&policy);
+            std::vector<boost::thread*> threads;
+            for (uint32 i=0;i<MAX_READERS;++i) {
+                if (i%2==0) {
+                    threads.push_back(new boost::thread(boost::bind(&CacheMapTest::write,this,&map,&layer,i,(uint32)OPERATIONS_PER_THREAD)));
+                }
+                threads.push_back(new boost::thread(boost::bind(&CacheMapTest::readForThread,this,&map,i+100,(uint32)OPERATIONS_PER_THREAD,&sawEmptyEntry)));
+            }
+            for (size_t i=0;i<threads.size();++i) {
+                threads[i]->join();
+                delete threads[i];
+            }
+            size_t entries=0;
+            CacheMap::read_iterator reader(map);
+            while (reader.iterate()) {
+                ++entries;
+            }
+            TS_ASSERT_EQUALS(entries,policy.numLive());
+            TS_ASSERT(entries<=(size_t)CACHE_SIZE/ENTRY_SIZE);
+        }
+        TS_ASSERT(!sawEmptyEntry);
+        TS_ASSERT(!policy.mFailed);
+        TS_ASSERT_EQUALS(layer.mDestroyed.read(),layer.mCreated.read());
+        TS_ASSERT_EQUALS(policy.numLive(),0u);
+    }
+    void testReaderScaling( void ) {
+        CountingLayer layer;
+        CheckingPolicy policy;
+        CacheMap map(&layer,&policy);
+        for (uint32 i=0;i<CACHE_SIZE/ENTRY_SIZE;++i) {
+            insert(map,layer,mIds[i]);
+        }
+        bool sawEmptyEntry=false;
+        for (uint32 numReaders=1;numReaders<=MAX_READERS;numReaders*=2) {
+            std::vector<boost::thread*> threads;
+            Task::AbsTime start=Task::AbsTime::now();
+            for (uint32 i=0;i<numReaders;++i) {
+                threads.push_back(new boost::thread(boost::bind(&CacheMapTest::readForThread,this,&map,i,(uint32)LOOKUPS_PER_RUN/numReaders,&sawEmptyEntry)));
+            }
+            for (size_t i=0;i<threads.size();++i) {
+                threads[i]->join();
+                delete threads[i];
+            }
+            double seconds=(double)(Task::AbsTime::now()-start);
+            std::cerr<<"\nCacheMapTest "<<numReaders<<" readers: "<<(seconds>0?LOOKUPS_PER_RUN/seconds/1000000.:0)<<" M lookups/s";
+        }
+        std::cerr<<'\n';
+        TS_ASSERT(!sawEmptyEntry);
+        TS_ASSERT(!policy.mFailed);
+    }
+};
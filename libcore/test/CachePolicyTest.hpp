@@ -0,0 +1,200 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  CachePolicyTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "transfer/CacheSimulator.hpp"
+#include "transfer/MemoryCacheLayer.hpp"
+#include <cxxtest/TestSuite.h>
+#include <cstdio>
+using namespace Sirikata;
+/**
+ * Replays made up request sequences through each CachePolicy with a CacheSimulator:
+ * ARC and GDSF must keep often used entries through a one-off scan that pushes them out of LRU,
+ * and GDSF must keep many small entries over one large one. ARC must do the same in a MemoryCacheLayer.
+ * Also checks that an access log reads back what was recorded
+ */
+class CachePolicyTest : public CxxTest::TestSuite
+{
+    typedef Transfer::Fingerprint Fingerprint;
+    typedef Transfer::CacheSimulator CacheSimulator;
+    enum {
+        ENTRY_SIZE=100,
+        CACHE_ENTRIES=100,
+        HOT_ENTRIES=20,
+        HOT_USES=10,
+        SCAN_ENTRIES=300
+    };
+    static Fingerprint fileId(const std::string&kind,int which) {
+        std::ostringstream name;
+        name<<kind<<which;
+        return Fingerprint::computeDigest(name.str());
+    }
+    static Transfer::CachePolicy*makePolicy(const std::string&name) {
+        return Transfer::CachePolicy::makePolicy(name,CACHE_ENTRIES*ENTRY_SIZE);
+    }
+    ///Uses the hot entries, scans through many entries used once, and returns how many hot entries are still cached
+    static uint64 hotHitsAfterScan(const std::string&policy) {
+        CacheSimulator simulator(makePolicy(policy));
+        for (int use=0;use<HOT_USES;++use) {
+            for (int i=0;i<HOT_ENTRIES;++i) {
+                simulator.access(fileId("hot",i),ENTRY_SIZE);
+            }
+        }
+        for (int i=0;i<SCAN_ENTRIES;++i) {
+            simulator.access(fileId("scan",i),ENTRY_SIZE);
+        }
+        uint64 hitsBefore=simulator.getResult().mHits;
+        for (int i=0;i<HOT_ENTRIES;++i) {
+            simulator.access(fileId("hot",i),ENTRY_SIZE);
+        }
+        return simulator.getResult().mHits-hitsBefore;
+    }
+    ///Answers every request with ENTRY_SIZE bytes, counting the requests that get this far
+    class OriginLayer:public Transfer::CacheLayer {
+    public:
+        int mRequests;
+        OriginLayer():Transfer::CacheLayer(NULL),mRequests(0) {
+        }
+        virtual void getData(const Transfer::RemoteFileId&fid,const Transfer::Range&requestedRange,
+                             const Transfer::TransferCallback&callback) {
+            ++mRequests;
+            Transfer::DenseDataPtr data(new Transfer::DenseData(std::string(ENTRY_SIZE,'x')));
+            populateParentCaches(fid.fingerprint(),data);
+            Transfer::SparseData sparse;
+            sparse.addValidData(data);
+            callback(&sparse);
+        }
+    };
+    static void ignoreData(const Transfer::SparseData*) {
+    }
+    static void request(Transfer::CacheLayer&layer,const Fingerprint&id) {
+        layer.getData(Transfer::RemoteFileId(id,Transfer::URI(Transfer::URIContext(),"http://localhost/")),
+                      Transfer::Range(true),&CachePolicyTest::ignoreData);
+    }
+    ///hotHitsAfterScan through a MemoryCacheLayer in front of an OriginLayer, counting the requests the memory layer answers
+    static int layerHotHitsAfterScan(const std::string&policyName) {
+        Transfer::CachePolicy*policy=makePolicy(policyName);
+        int hits;
+        {
+            OriginLayer origin;
+            Transfer::MemoryCacheLayer memory(policy,&origin);
+            for (int use=0;use<HOT_USES;++use) {
+                for (int i=0;i<HOT_ENTRIES;++i) {
+                    request(memory,fileId("hot",i));
+                }
+            }
+            for (int i=0;i<SCAN_ENTRIES;++i) {
+                request(memory,fileId("scan",i));
+            }
+            int missesBefore=origin.mRequests;
+            for (int i=0;i<HOT_ENTRIES;++i) {
+                request(memory,fileId("hot",i));
+            }
+            hits=HOT_ENTRIES-(origin.mRequests-missesBefore);
+        }
+        delete policy;
+        return hits;
+    }
+public:
+    void testMakePolicy( void ) {
+        const char*names[]={"lru","arc","gdsf"};
+        for (size_t i=0;i<sizeof(names)/sizeof(names[0]);++i) {
+            Transfer::CachePolicy*policy=Transfer::CachePolicy::makePolicy(names[i],1000);
+            TS_ASSERT(policy!=NULL);
+            delete policy;
+        }
+        TS_ASSERT(Transfer::CachePolicy::makePolicy("mru",1000)==NULL);
+    }
+    void testScanResistance( void ) {
+        TS_ASSERT_EQUALS(hotHitsAfterScan("lru"),0u);
+        TS_ASSERT_EQUALS(hotHitsAfterScan("arc"),(uint64)HOT_ENTRIES);
+        TS_ASSERT_EQUALS(hotHitsAfterScan("gdsf"),(uint64)HOT_ENTRIES);
+    }
+    void testLayerScanResistance( void ) {
+        TS_ASSERT_EQUALS(layerHotHitsAfterScan("lru"),0);
+        TS_ASSERT_EQUALS(layerHotHitsAfterScan("arc"),(int)HOT_ENTRIES);
+        TS_ASSERT_EQUALS(layerHotHitsAfterScan("gdsf"),(int)HOT_ENTRIES);
+    }
+    void testLargeEntriesGoFirst( void ) {
+        CacheSimulator simulator(makePolicy("gdsf"));
+        int numSmall=CACHE_ENTRIES/2;
+        for (int i=0;i<numSmall;++i) {
+            simulator.access(fileId("small",i),ENTRY_SIZE);
+        }
+        // Each takes nearly half the cache, so the second must push out something.
+        simulator.access(fileId("large",0),ENTRY_SIZE*CACHE_ENTRIES/2-1);
+        simulator.access(fileId("large",1),ENTRY_SIZE*CACHE_ENTRIES/2-1);
+        uint64 hitsBefore=simulator.getResult().mHits;
+        for (int i=0;i<numSmall;++i) {
+            simulator.access(fileId("small",i),ENTRY_SIZE);
+        }
+        TS_ASSERT_EQUALS(simulator.getResult().mHits-hitsBefore,(uint64)numSmall);
+        TS_ASSERT_EQUALS(simulator.getResult().mHitBytes,(uint64)numSmall*ENTRY_SIZE);
+    }
+    void testGrowingEntry( void ) {
+        const char*names[]={"lru","arc","gdsf"};
+        for (size_t i=0;i<sizeof(names)/sizeof(names[0]);++i) {
+            CacheSimulator simulator(makePolicy(names[i]));
+            simulator.access(fileId("partial",0),ENTRY_SIZE);
+            simulator.access(fileId("partial",0),ENTRY_SIZE*2);
+            simulator.access(fileId("partial",0),ENTRY_SIZE);
+            simulator.access(fileId("partial",0),ENTRY_SIZE*2);
+            TS_ASSERT_EQUALS(simulator.getResult().mRequests,4u);
+            TS_ASSERT_EQUALS(simulator.getResult().mHits,2u);
+            TS_ASSERT_DELTA(simulator.getResult().byteHitRatio(),0.5,1e-9);
+        }
+    }
+    void testAccessLogRoundTrip( void ) {
+        std::string filename="CachePolicyTest.accesslog";
+        {
+            Transfer::CacheAccessLog log(filename);
+            TS_ASSERT(log.isOpen());
+            for (int i=0;i<10;++i) {
+                log.record(fileId("logged",i%3),(Transfer::cache_usize_type)ENTRY_SIZE*(i%3+1));
+            }
+        }
+        std::vector<Transfer::CacheAccessLog::Access> accesses;
+        TS_ASSERT(Transfer::CacheAccessLog::read(filename,accesses));
+        TS_ASSERT_EQUALS(accesses.size(),10u);
+        for (size_t i=0;i<accesses.size();++i) {
+            TS_ASSERT_EQUALS(accesses[i].mFileId,fileId("logged",i%3));
+            TS_ASSERT_EQUALS(accesses[i].mSize,(Transfer::cache_usize_type)ENTRY_SIZE*(i%3+1));
+            if (i) {
+                TS_ASSERT(accesses[i].mTime>=accesses[i-1].mTime);
+            }
+        }
+        CacheSimulator simulator(makePolicy("arc"));
+        simulator.run(accesses);
+        TS_ASSERT_EQUALS(simulator.getResult().mHits,7u);
+        std::remove(filename.c_str());
+        TS_ASSERT(!Transfer::CacheAccessLog::read(filename,accesses));
+    }
+};
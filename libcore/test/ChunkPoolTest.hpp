@@ -0,0 +1,110 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  ChunkPoolTest.hpp
+ *
+ *  Copyright (c) 2008, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPDefinitions.hpp"
+#include "network/ChunkPool.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+class ChunkPoolTest : public CxxTest::TestSuite
+{
+    static void releaseAll(std::vector<Chunk*>*chunks) {
+        for (size_t i=0;i<chunks->size();++i) {
+            ChunkPool::release((*chunks)[i]);
+        }
+    }
+public:
+    void testSizes( void ) {
+        size_t sizes[]={0,1,63,64,65,1000,16384,65536,65537,1024*1024};
+        for (size_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);++i) {
+            Chunk*chunk=ChunkPool::allocate(sizes[i]);
+            TS_ASSERT_EQUALS(chunk->size(),sizes[i]);
+            ChunkPool::release(chunk);
+        }
+        ChunkPool::release(NULL);
+    }
+    void testLocalReuse( void ) {
+        Chunk*first=ChunkPool::allocate(100);
+        ChunkPool::release(first);
+        ChunkPool::Statistics before=ChunkPool::getStatistics();
+        Chunk*second=ChunkPool::allocate(120);
+        TS_ASSERT_EQUALS(first,second);
+        TS_ASSERT_EQUALS(second->size(),120u);
+        ChunkPool::Statistics after=ChunkPool::getStatistics();
+        TS_ASSERT_EQUALS(after.mLocalHits,before.mLocalHits+1);
+        TS_ASSERT_EQUALS(after.mMisses,before.mMisses);
+        ChunkPool::release(second);
+    }
+    void testCopy( void ) {
+        Sirikata::uint8 data[]={1,2,3,4,5};
+        Chunk*chunk=ChunkPool::allocate(data,data+sizeof(data));
+        TS_ASSERT_EQUALS(chunk->size(),sizeof(data));
+        TS_ASSERT(std::equal(chunk->begin(),chunk->end(),data));
+        ChunkPool::release(chunk);
+    }
+    void testShare( void ) {
+        Chunk*shared=ChunkPool::allocate(300);
+        ChunkPool::share(shared,2);
+        ChunkPool::release(shared);
+        ChunkPool::release(shared);
+        Chunk*other=ChunkPool::allocate(300);
+        TS_ASSERT_DIFFERS(other,shared);
+        ChunkPool::release(shared);
+        Chunk*recycled=ChunkPool::allocate(300);
+        TS_ASSERT_EQUALS(recycled,shared);
+        ChunkPool::release(recycled);
+        ChunkPool::release(other);
+    }
+    void testUnpooled( void ) {
+        ChunkPool::Statistics before=ChunkPool::getStatistics();
+        ChunkPool::release(ChunkPool::allocate(1024*1024));
+        ChunkPool::Statistics after=ChunkPool::getStatistics();
+        TS_ASSERT_EQUALS(after.mUnpooled,before.mUnpooled+1);
+    }
+    void testCrossThreadRelease( void ) {
+        //like a user thread sending packets the io thread frees: the chunks must find their way back through the global list
+        std::vector<Chunk*> chunks;
+        for (int i=0;i<1000;++i) {
+            chunks.push_back(ChunkPool::allocate(200));
+        }
+        boost::thread releaser(boost::bind(&ChunkPoolTest::releaseAll,&chunks));
+        releaser.join();
+        ChunkPool::Statistics before=ChunkPool::getStatistics();
+        chunks.clear();
+        for (int i=0;i<1000;++i) {
+            chunks.push_back(ChunkPool::allocate(200));
+        }
+        ChunkPool::Statistics after=ChunkPool::getStatistics();
+        TS_ASSERT(after.mGlobalHits>before.mGlobalHits);
+        TS_ASSERT(after.mMisses-before.mMisses<1000);
+        releaseAll(&chunks);
+    }
+};
@@ -0,0 +1,140 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  DatagramTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPStream.hpp"
+#include "network/TCPStreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "options/Options.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Connects with the UDP side channel offered and checks that reliable traffic is untouched while unreliable packets,
+ * both those short enough for a datagram and those that must still go over TCP, reach the other end
+ */
+class DatagramTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_UNRELIABLE=64,
+        SHORT_LENGTH=100,
+        LONG_LENGTH=4000
+    };
+    IOService*mIO;
+    boost::thread*mThread;
+    Sirikata::AtomicValue<int> mReliable;
+    Sirikata::AtomicValue<int> mShortUnreliable;
+    Sirikata::AtomicValue<int> mLongUnreliable;
+    Sirikata::AtomicValue<int> mOutOfOrder;
+    std::vector<Stream*> mAccepted;
+    void dataCallback(const Chunk&data) {
+        if (data.size()&&data[0]=='R') {
+            //reliable packets carry their sequence number
+            if ((int)data[1]!=mReliable.read()) {
+                ++mOutOfOrder;
+            }
+            ++mReliable;
+        }else if (data.size()==SHORT_LENGTH) {
+            ++mShortUnreliable;
+        }else if (data.size()==LONG_LENGTH) {
+            ++mLongUnreliable;
+        }
+    }
+    void newStreamCallback(Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            using std::tr1::placeholders::_1;
+            mAccepted.push_back(newStream);
+            setCallbacks(&Stream::ignoreConnectionStatus,std::tr1::bind(&DatagramTest::dataCallback,this,_1));
+        }
+    }
+    void waitFor(Sirikata::AtomicValue<int>&count, int target) {
+        for (int waits=0;count.read()<target&&waits<500;++waits) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+    }
+    void sendReliable(Stream*s,int sequence) {
+        std::string reliable("R ");
+        reliable[1]=(char)sequence;
+        s->send(Chunk(reliable.begin(),reliable.end()),ReliableOrdered);
+    }
+public:
+    DatagramTest():mReliable(0),mShortUnreliable(0),mLongUnreliable(0),mOutOfOrder(0) {
+    }
+    void setUp( void ) {
+        Sirikata::OptionSet::getOptions("tcpsst")->parse("--datagrams=true");
+        mIO=IOServiceFactory::makeIOService();
+    }
+    void tearDown( void ) {
+        Sirikata::OptionSet::getOptions("tcpsst")->parse("--datagrams=false");
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    void testUnreliableOverDatagrams( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        TCPStreamListener listener(*mIO);
+        listener.listen(Address("127.0.0.1","9162"),std::tr1::bind(&DatagramTest::newStreamCallback,this,_1,_2));
+        mThread=new boost::thread(std::tr1::bind(&IOServiceFactory::runService,mIO));
+        TCPStream connector(*mIO);
+        connector.connect(Address("127.0.0.1","9162"),
+                          &Stream::ignoreSubstreamCallback,
+                          &Stream::ignoreConnectionStatus,
+                          &Stream::ignoreBytesReceived);
+        //the stream has to be opened over TCP before datagrams for it are accepted
+        sendReliable(&connector,0);
+        waitFor(mReliable,1);
+        TS_ASSERT_EQUALS(mReliable.read(),1);
+        //give the side channel negotiation, which follows the handshake, time to finish
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        for (int i=0;i<NUM_UNRELIABLE;++i) {
+            connector.send(Chunk(SHORT_LENGTH,'u'),Unreliable);
+            connector.send(Chunk(LONG_LENGTH,'l'),Unreliable);
+            sendReliable(&connector,i+1);
+        }
+        waitFor(mReliable,NUM_UNRELIABLE+1);
+        waitFor(mShortUnreliable,NUM_UNRELIABLE);
+        //long unreliable packets share the TCP sockets with everything else and may still be in flight
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        TS_ASSERT_EQUALS(mReliable.read(),NUM_UNRELIABLE+1);
+        TS_ASSERT_EQUALS(mOutOfOrder.read(),0);
+        //nothing queues up in front of datagrams, so a loopback UDP socket has no reason to drop them
+        TS_ASSERT_EQUALS(mShortUnreliable.read(),(int)NUM_UNRELIABLE);
+        //but this burst queues far more than the TCP sockets drop unreliable packets past, so only some of the long ones arrive
+        TS_ASSERT_LESS_THAN(0,mLongUnreliable.read());
+        TS_ASSERT_LESS_THAN_EQUALS(mLongUnreliable.read(),(int)NUM_UNRELIABLE);
+        connector.close();
+        for (size_t i=0;i<mAccepted.size();++i) {
+            mAccepted[i]->close();
+            delete mAccepted[i];
+        }
+        IOServiceFactory::stopService(mIO);
+        mThread->join();
+        delete mThread;
+    }
+};
@@ -0,0 +1,175 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  DiskCacheIndexTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "transfer/DiskCacheIndex.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace Sirikata;
+/**
+ * Writes a DiskCacheIndex and reads it back with a new one: removed entries must stay removed,
+ * ranges and the order of last access must survive, a journal cut off in the middle of a record
+ * must keep every record before the cut, and rewriting one entry over and over must not grow the journal.
+ * Only puts and removes may compact the journal: touches, which come from reads, must only append
+ */
+class DiskCacheIndexTest : public CxxTest::TestSuite
+{
+    typedef Transfer::Fingerprint Fingerprint;
+    typedef Transfer::Range Range;
+    typedef Transfer::DiskCacheIndex DiskCacheIndex;
+    std::string mPath;
+    static Fingerprint fileId(int which) {
+        std::ostringstream name;
+        name<<"diskindex"<<which;
+        return Fingerprint::computeDigest(name.str());
+    }
+    static off_t fileSize(const std::string&path) {
+        struct stat st;
+        return stat(path.c_str(),&st)==0?st.st_size:-1;
+    }
+    static void sleepPastNow() {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+    }
+public:
+    DiskCacheIndexTest():mPath("diskCacheIndexTest.index") {
+    }
+    void setUp( void ) {
+        unlink(mPath.c_str());
+    }
+    void tearDown( void ) {
+        unlink(mPath.c_str());
+    }
+    void testMissing( void ) {
+        DiskCacheIndex index(mPath);
+        DiskCacheIndex::EntryList entries;
+        TS_ASSERT(!index.load(entries));
+        TS_ASSERT(entries.empty());
+    }
+    void testReload( void ) {
+        Transfer::RangeList ranges;
+        Range(0,100,Transfer::LENGTH).addToList(Range(0,100,Transfer::LENGTH),ranges);
+        Range(500,true).addToList(Range(500,true),ranges);
+        {
+            DiskCacheIndex index(mPath);
+            TS_ASSERT(index.reset(DiskCacheIndex::EntryList()));
+            index.put(fileId(0),4096,Transfer::RangeList());
+            sleepPastNow();
+            index.put(fileId(1),8192,ranges);
+            sleepPastNow();
+            index.put(fileId(2),512,Transfer::RangeList());
+            index.remove(fileId(1));
+            sleepPastNow();
+            index.put(fileId(3),1024,ranges);
+            TS_ASSERT_EQUALS(index.size(),3u);
+            TS_ASSERT_EQUALS(index.records(),5u);
+        }
+        DiskCacheIndex index(mPath);
+        DiskCacheIndex::EntryList entries;
+        TS_ASSERT(index.load(entries));
+        TS_ASSERT_EQUALS(entries.size(),3u);
+        if (entries.size()==3) {
+            TS_ASSERT(entries[0].first==fileId(0));
+            TS_ASSERT_EQUALS(entries[0].second.mSize,4096u);
+            TS_ASSERT(entries[0].second.mRanges.empty());
+            TS_ASSERT(entries[1].first==fileId(2));
+            TS_ASSERT(entries[2].first==fileId(3));
+            TS_ASSERT_EQUALS(entries[2].second.mSize,1024u);
+            TS_ASSERT(entries[2].second.mRanges==ranges);
+        }
+    }
+    void testDamagedTail( void ) {
+        {
+            DiskCacheIndex index(mPath);
+            TS_ASSERT(index.reset(DiskCacheIndex::EntryList()));
+            for (int i=0;i<10;++i) {
+                index.put(fileId(i),1000+i,Transfer::RangeList());
+            }
+        }
+        // as if the last record were only half written.
+        TS_ASSERT_EQUALS(truncate(mPath.c_str(),fileSize(mPath)-10),0);
+        {
+            DiskCacheIndex index(mPath);
+            DiskCacheIndex::EntryList entries;
+            TS_ASSERT(index.load(entries));
+            TS_ASSERT_EQUALS(entries.size(),9u);
+            TS_ASSERT_EQUALS(index.records(),9u);
+            index.put(fileId(9),1009,Transfer::RangeList());
+        }
+        DiskCacheIndex index(mPath);
+        DiskCacheIndex::EntryList entries;
+        TS_ASSERT(index.load(entries));
+        TS_ASSERT_EQUALS(entries.size(),10u);
+        TS_ASSERT_EQUALS(index.records(),10u);
+    }
+    void testCompaction( void ) {
+        off_t oneEntrySize;
+        {
+            DiskCacheIndex index(mPath);
+            TS_ASSERT(index.reset(DiskCacheIndex::EntryList()));
+            index.put(fileId(0),1,Transfer::RangeList());
+            oneEntrySize=fileSize(mPath);
+            for (int i=0;i<10*DiskCacheIndex::MIN_COMPACT_RECORDS;++i) {
+                index.put(fileId(1),i,Transfer::RangeList());
+            }
+            TS_ASSERT_LESS_THAN_EQUALS(index.records(),(size_t)DiskCacheIndex::MIN_COMPACT_RECORDS);
+            TS_ASSERT_LESS_THAN(fileSize(mPath),oneEntrySize*DiskCacheIndex::MIN_COMPACT_RECORDS);
+        }
+        DiskCacheIndex index(mPath);
+        DiskCacheIndex::EntryList entries;
+        TS_ASSERT(index.load(entries));
+        TS_ASSERT_EQUALS(entries.size(),2u);
+        if (entries.size()==2) {
+            TS_ASSERT(entries[1].first==fileId(1));
+            TS_ASSERT_EQUALS(entries[1].second.mSize,(Transfer::cache_usize_type)(10*DiskCacheIndex::MIN_COMPACT_RECORDS-1));
+        }
+        index.compact();
+        TS_ASSERT_EQUALS(index.records(),2u);
+    }
+    void testTouchDoesNotCompact( void ) {
+        DiskCacheIndex index(mPath);
+        DiskCacheIndex::EntryList stale(1);
+        stale[0].first=fileId(0);
+        stale[0].second.mSize=1;
+        stale[0].second.mLastAccess=0;
+        TS_ASSERT(index.reset(stale));
+        // one record short of compacting, so the next record finds the journal due for it.
+        for (int i=1;i<DiskCacheIndex::MIN_COMPACT_RECORDS;++i) {
+            index.put(fileId(1),i,Transfer::RangeList());
+        }
+        TS_ASSERT_EQUALS(index.records(),(size_t)DiskCacheIndex::MIN_COMPACT_RECORDS);
+        index.touch(fileId(0));
+        TS_ASSERT_EQUALS(index.records(),(size_t)DiskCacheIndex::MIN_COMPACT_RECORDS+1);
+        index.put(fileId(1),0,Transfer::RangeList());
+        TS_ASSERT_EQUALS(index.records(),2u);
+    }
+};
@@ -0,0 +1,264 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  DiskCacheLayerTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "transfer/DiskCacheLayer.hpp"
+#include "transfer/MemoryCacheLayer.hpp"
+#include "transfer/LRUPolicy.hpp"
+#include "options/Options.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+using namespace Sirikata;
+/**
+ * Feeds a DiskCacheLayer from a layer that makes up file contents, with and without positional I/O:
+ * every answer must be right, the halves of a file written back to back must come back as one file
+ * after the layer is made again over the same directory, and purged files must leave the disk.
+ * A directory without an index, as written before there was one, must be scanned and indexed.
+ * Whole files must be served from a mapping that outlives the layer
+ */
+class DiskCacheLayerTest : public CxxTest::TestSuite
+{
+    typedef Transfer::Fingerprint Fingerprint;
+    typedef Transfer::Range Range;
+    typedef Transfer::RemoteFileId RemoteFileId;
+    enum {
+        NUM_FILES=96,
+        FILE_SIZE=3000,
+        HALF_SIZE=FILE_SIZE/2
+    };
+    ///Answers every request at once with made up contents, and offers them to the layers before it
+    class SourceLayer : public Transfer::CacheLayer {
+    public:
+        AtomicValue<uint32> mRequests;
+        SourceLayer():Transfer::CacheLayer(NULL),mRequests(0) {}
+        virtual void getData(const RemoteFileId &fid, const Range &requestedRange, const Transfer::TransferCallback&callback) {
+            ++mRequests;
+            Range toSend(requestedRange);
+            if (toSend.goesToEndOfFile()) {
+                toSend.setLength(FILE_SIZE-toSend.startbyte(),true);
+            }
+            Transfer::MutableDenseDataPtr data(new Transfer::DenseData(toSend));
+            for (Range::base_type i=0;i<toSend.length();++i) {
+                data->writableData()[i]=byteAt(fid.fingerprint(),toSend.startbyte()+i);
+            }
+            populateParentCaches(fid.fingerprint(),data);
+            Transfer::SparseData sparse;
+            sparse.addValidData(data);
+            callback(&sparse);
+        }
+    };
+    std::string mDir;
+    AtomicValue<int> mAnswered;
+    AtomicValue<int> mWrong;
+    AtomicValue<int> mBorrowed;
+    static unsigned char byteAt(const Fingerprint&fileId,Range::base_type offset) {
+        return (unsigned char)(fileId.rawData()[0]+offset*7);
+    }
+    static RemoteFileId fileId(int which) {
+        std::ostringstream name;
+        name<<"diskcache"<<which;
+        return RemoteFileId(Fingerprint::computeDigest(name.str()),Transfer::URI(Transfer::URIContext(),"http://localhost/"));
+    }
+    static bool exists(const std::string&path) {
+        struct stat st;
+        return stat(path.c_str(),&st)==0;
+    }
+    void check(Fingerprint fileId,Range expected,const Transfer::SparseData*data) {
+        bool right=(data!=NULL);
+        for (Range::base_type offset=expected.startbyte();right&&offset<expected.endbyte();++offset) {
+            Range::length_type length;
+            const unsigned char*got=data->dataAt(offset,length);
+            right=(got!=NULL&&*got==byteAt(fileId,offset));
+        }
+        if (!right) {
+            ++mWrong;
+        }
+        if (right&&data->DenseDataList::begin()!=data->DenseDataList::end()&&data->DenseDataList::begin()->isBorrowed()) {
+            ++mBorrowed;
+        }
+        ++mAnswered;
+    }
+    void getData(Transfer::CacheLayer*layer,const RemoteFileId&fid,const Range&range,Range expected) {
+        using std::tr1::placeholders::_1;
+        layer->getData(fid,range,std::tr1::bind(&DiskCacheLayerTest::check,this,fid.fingerprint(),expected,_1));
+    }
+    void waitFor(int target) {
+        for (int waits=0;mAnswered.read()<target&&waits<1000;++waits) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+    }
+    void fillAndReload() {
+        mAnswered=0;
+        mWrong=0;
+        Range firstHalf(0,HALF_SIZE,Transfer::LENGTH);
+        Range secondHalf(HALF_SIZE,HALF_SIZE,Transfer::LENGTH,true);
+        Range wholeFile(0,FILE_SIZE,Transfer::LENGTH,true);
+        SourceLayer source;
+        {
+            Transfer::LRUPolicy policy(FILE_SIZE*NUM_FILES*4);
+            Transfer::DiskCacheLayer disk(&policy,mDir,&source);
+            int requests=0;
+            for (int i=0;i<NUM_FILES;++i) {
+                getData(&disk,fileId(i),firstHalf,firstHalf);
+                ++requests;
+                if (i%3) {
+                    getData(&disk,fileId(i),secondHalf,secondHalf);
+                    ++requests;
+                }
+            }
+            waitFor(requests);
+            TS_ASSERT_EQUALS(mAnswered.read(),requests);
+            // leaving the scope finishes every queued write.
+        }
+        TS_ASSERT_EQUALS(mWrong.read(),0);
+        TS_ASSERT(exists(mDir+"/index"));
+        mAnswered=0;
+        uint32 sourceRequests=source.mRequests.read();
+        {
+            Transfer::LRUPolicy policy(FILE_SIZE*NUM_FILES*4);
+            Transfer::DiskCacheLayer disk(&policy,mDir,&source);
+            for (int i=0;i<NUM_FILES;++i) {
+                getData(&disk,fileId(i),i%3?Range(true):firstHalf,i%3?wholeFile:firstHalf);
+            }
+            waitFor(NUM_FILES);
+            TS_ASSERT_EQUALS(mAnswered.read(),(int)NUM_FILES);
+            TS_ASSERT_EQUALS(mWrong.read(),0);
+            // all of it came from disk.
+            TS_ASSERT_EQUALS(source.mRequests.read(),sourceRequests);
+            for (int i=0;i<NUM_FILES;++i) {
+                std::string path=mDir+"/"+fileId(i).fingerprint().convertToHexString();
+                TS_ASSERT(exists(i%3?path:path+".part"));
+                disk.purgeFromCache(fileId(i).fingerprint());
+            }
+        }
+        for (int i=0;i<NUM_FILES;++i) {
+            std::string path=mDir+"/"+fileId(i).fingerprint().convertToHexString();
+            TS_ASSERT(!exists(path));
+            TS_ASSERT(!exists(path+".part"));
+            TS_ASSERT(!exists(path+".ranges"));
+        }
+    }
+public:
+    DiskCacheLayerTest():mDir("diskCacheLayerTest"),mAnswered(0),mWrong(0),mBorrowed(0) {
+    }
+    void tearDown( void ) {
+        Sirikata::OptionSet::getOptions("transfer")->parse("--diskpositionalio=true");
+        Sirikata::OptionSet::getOptions("transfer")->parse("--diskmapsize=65536");
+    }
+    void testPositionalIO( void ) {
+        Sirikata::OptionSet::getOptions("transfer")->parse("--diskpositionalio=true");
+        fillAndReload();
+    }
+    void testSeekAndReadIO( void ) {
+        Sirikata::OptionSet::getOptions("transfer")->parse("--diskpositionalio=false");
+        fillAndReload();
+    }
+    void testScanWithoutIndex( void ) {
+        // a directory written before the index: a whole file, and half a file with its ranges in text.
+        mkdir(mDir.c_str(),0755);
+        unlink((mDir+"/index").c_str());
+        RemoteFileId whole=fileId(0),partial=fileId(1);
+        std::string wholePath=mDir+"/"+whole.fingerprint().convertToHexString();
+        std::string partialPath=mDir+"/"+partial.fingerprint().convertToHexString();
+        {
+            std::ofstream wholeFile(wholePath.c_str(),std::ios::binary);
+            for (Range::base_type i=0;i<FILE_SIZE;++i) {
+                wholeFile.put((char)byteAt(whole.fingerprint(),i));
+            }
+            std::ofstream partialFile((partialPath+".part").c_str(),std::ios::binary);
+            for (Range::base_type i=0;i<HALF_SIZE;++i) {
+                partialFile.put((char)byteAt(partial.fingerprint(),i));
+            }
+            std::ofstream ranges((partialPath+".ranges").c_str());
+            ranges<<"0 "<<HALF_SIZE<<"; ";
+        }
+        mAnswered=0;
+        mWrong=0;
+        SourceLayer source;
+        for (int reload=0;reload<2;++reload) {
+            Transfer::LRUPolicy policy(FILE_SIZE*4);
+            Transfer::DiskCacheLayer disk(&policy,mDir,&source);
+            TS_ASSERT(exists(mDir+"/index"));
+            TS_ASSERT(!exists(partialPath+".ranges"));
+            getData(&disk,whole,Range(true),Range(0,FILE_SIZE,Transfer::LENGTH,true));
+            getData(&disk,partial,Range(0,HALF_SIZE,Transfer::LENGTH),Range(0,HALF_SIZE,Transfer::LENGTH));
+            waitFor(2*(reload+1));
+            if (reload) {
+                disk.purgeFromCache(whole.fingerprint());
+                disk.purgeFromCache(partial.fingerprint());
+            }
+        }
+        TS_ASSERT_EQUALS(mAnswered.read(),4);
+        TS_ASSERT_EQUALS(mWrong.read(),0);
+        TS_ASSERT_EQUALS(source.mRequests.read(),0u);
+        TS_ASSERT(!exists(wholePath));
+        TS_ASSERT(!exists(partialPath+".part"));
+    }
+    void testMappedWholeFile( void ) {
+        Sirikata::OptionSet::getOptions("transfer")->parse("--diskmapsize=1024");
+        mAnswered=0;
+        mWrong=0;
+        mBorrowed=0;
+        RemoteFileId fid=fileId(0);
+        SourceLayer source;
+        {
+            Transfer::LRUPolicy policy(FILE_SIZE*4);
+            Transfer::DiskCacheLayer disk(&policy,mDir,&source);
+            disk.purgeFromCache(fid.fingerprint());
+            getData(&disk,fid,Range(true),Range(0,FILE_SIZE,Transfer::LENGTH,true));
+            waitFor(1);
+        }
+        TS_ASSERT_EQUALS(mBorrowed.read(),0);
+        Transfer::LRUPolicy memoryPolicy(FILE_SIZE*4);
+        Transfer::MemoryCacheLayer memory(&memoryPolicy,NULL);
+        {
+            Transfer::LRUPolicy policy(FILE_SIZE*4);
+            Transfer::DiskCacheLayer disk(&policy,mDir,NULL);
+            getData(&disk,fid,Range(100,HALF_SIZE,Transfer::LENGTH),Range(100,HALF_SIZE,Transfer::LENGTH));
+            getData(&disk,fid,Range(100,true),Range(100,FILE_SIZE-100,Transfer::LENGTH,true));
+            waitFor(3);
+            memory.setNext(&disk);
+            getData(&memory,fid,Range(true),Range(0,FILE_SIZE,Transfer::LENGTH,true));
+            waitFor(4);
+            TS_ASSERT_EQUALS(mBorrowed.read(),3);
+            memory.setNext(NULL);
+            disk.purgeFromCache(fid.fingerprint());
+        }
+        // The memory cache still holds the mapping of the purged file.
+        getData(&memory,fid,Range(true),Range(0,FILE_SIZE,Transfer::LENGTH,true));
+        TS_ASSERT_EQUALS(mAnswered.read(),5);
+        TS_ASSERT_EQUALS(mBorrowed.read(),4);
+        TS_ASSERT_EQUALS(mWrong.read(),0);
+    }
+};
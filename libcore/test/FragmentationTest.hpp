@@ -0,0 +1,142 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  FragmentationTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPStream.hpp"
+#include "network/TCPStreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Sends a long message on one stream and then a short one on another stream of the same connection, socket and priority:
+ * once the ends have offered to reassemble frames the long message goes out in frames and the short one overtakes it
+ */
+class FragmentationTest : public CxxTest::TestSuite
+{
+    enum {
+        SHORT_LENGTH=100,
+        LONG_LENGTH=4*1024*1024
+    };
+    IOService*mIO;
+    boost::thread*mThread;
+    Sirikata::AtomicValue<int> mReceived;
+    Sirikata::AtomicValue<int> mMismatched;
+    std::vector<Stream*> mAccepted;
+    ///The lengths of the messages received, in the order they arrived
+    std::vector<size_t> mArrivals;
+    boost::mutex mArrivalsMutex;
+    static Chunk makeMessage(size_t length) {
+        Chunk message(length);
+        for (size_t i=0;i<message.size();++i) {
+            message[i]=(Sirikata::uint8)(i*13+length);
+        }
+        return message;
+    }
+    void dataCallback(const Chunk&data) {
+        if (data!=makeMessage(data.size())) {
+            ++mMismatched;
+        }
+        {
+            boost::lock_guard<boost::mutex> lok(mArrivalsMutex);
+            mArrivals.push_back(data.size());
+        }
+        ++mReceived;
+    }
+    void newStreamCallback(Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            using std::tr1::placeholders::_1;
+            mAccepted.push_back(newStream);
+            setCallbacks(&Stream::ignoreConnectionStatus,std::tr1::bind(&FragmentationTest::dataCallback,this,_1));
+        }
+    }
+    void waitFor(Sirikata::AtomicValue<int>&count, int target) {
+        for (int waits=0;count.read()<target&&waits<1000;++waits) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+    }
+public:
+    FragmentationTest():mReceived(0),mMismatched(0) {
+    }
+    void setUp( void ) {
+        mIO=IOServiceFactory::makeIOService();
+    }
+    void tearDown( void ) {
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    void testShortMessageOvertakes( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        {
+            TCPStreamListener listener(*mIO);
+            listener.listen(Address("127.0.0.1","9195"),std::tr1::bind(&FragmentationTest::newStreamCallback,this,_1,_2));
+            mThread=new boost::thread(std::tr1::bind(&IOServiceFactory::runService,mIO));
+            TCPStream connector(*mIO);
+            //one socket, so the streams cannot get past each other by taking different ones
+            connector.setNumSockets(1);
+            connector.setMaxFrameSize(16000);
+            connector.connect(Address("127.0.0.1","9195"),
+                              &Stream::ignoreSubstreamCallback,
+                              &Stream::ignoreConnectionStatus,
+                              &Stream::ignoreBytesReceived);
+            Stream*other=connector.factory();
+            TS_ASSERT(other->cloneFrom(&connector,&Stream::ignoreConnectionStatus,&Stream::ignoreBytesReceived));
+            connector.send(makeMessage(SHORT_LENGTH),ReliableOrdered);
+            other->send(makeMessage(SHORT_LENGTH),ReliableOrdered);
+            waitFor(mReceived,2);
+            //give the listener's offer to reassemble frames time to arrive
+            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+            connector.send(makeMessage(LONG_LENGTH),ReliableOrdered);
+            other->send(makeMessage(SHORT_LENGTH),ReliableOrdered);
+            waitFor(mReceived,4);
+            TS_ASSERT_EQUALS(mReceived.read(),4);
+            TS_ASSERT_EQUALS(mMismatched.read(),0);
+            {
+                boost::lock_guard<boost::mutex> lok(mArrivalsMutex);
+                TS_ASSERT_EQUALS(mArrivals.size(),4u);
+                if (mArrivals.size()==4) {
+                    TS_ASSERT_EQUALS(mArrivals[2],(size_t)SHORT_LENGTH);
+                    TS_ASSERT_EQUALS(mArrivals[3],(size_t)LONG_LENGTH);
+                }
+            }
+            other->close();
+            delete other;
+            connector.close();
+            for (size_t i=0;i<mAccepted.size();++i) {
+                mAccepted[i]->close();
+                delete mAccepted[i];
+            }
+            mAccepted.clear();
+            IOServiceFactory::stopService(mIO);
+            mThread->join();
+            delete mThread;
+        }
+    }
+};
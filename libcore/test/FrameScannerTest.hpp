@@ -0,0 +1,140 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  FrameScannerTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPStream.hpp"
+#include "network/FrameScanner.hpp"
+#include <cxxtest/TestSuite.h>
+using namespace Sirikata::Network;
+/**
+ * Builds buffers of packets with StreamIDs and lengths of every serialized width and checks that FrameScanner finds
+ * each packet where it was put, stops at a packet that is cut short and returns no more frames than it is asked for
+ */
+class FrameScannerTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::uint8 uint8;
+    typedef Sirikata::uint32 uint32;
+    class Expected {
+    public:
+        uint32 mID;
+        uint32 mOffset;
+        uint32 mLength;
+    };
+    static void append(Chunk&buffer,uint32 value) {
+        uint8 serialized[Stream::uint30::MAX_SERIALIZED_LENGTH];
+        unsigned int length=Stream::uint30(value).serialize(serialized,Stream::uint30::MAX_SERIALIZED_LENGTH);
+        buffer.insert(buffer.end(),serialized,serialized+length);
+    }
+    static void appendPacket(Chunk&buffer,std::vector<Expected>&expected,uint32 id,uint32 payload) {
+        Chunk serializedID;
+        append(serializedID,id);
+        append(buffer,(uint32)(serializedID.size()+payload));
+        buffer.insert(buffer.end(),serializedID.begin(),serializedID.end());
+        Expected packet;
+        packet.mID=id;
+        packet.mOffset=(uint32)buffer.size();
+        packet.mLength=payload;
+        expected.push_back(packet);
+        buffer.resize(buffer.size()+payload,(uint8)0x81);
+    }
+    void checkFrames(const FrameScanner::Frame*frames,size_t numFrames,const std::vector<Expected>&expected,size_t first) {
+        for (size_t i=0;i<numFrames&&first+i<expected.size();++i) {
+            TS_ASSERT_EQUALS(frames[i].mID.read(),expected[first+i].mID);
+            TS_ASSERT_EQUALS(frames[i].mOffset,expected[first+i].mOffset);
+            TS_ASSERT_EQUALS(frames[i].mLength,expected[first+i].mLength);
+        }
+    }
+public:
+    void testWidths( void ) {
+        Chunk buffer;
+        std::vector<Expected> expected;
+        uint32 ids[]={1,127,128,16383,16384,(1<<30)-1};
+        uint32 payloads[]={0,1,3,125,126,200,16380,20000};
+        for (size_t i=0;i<sizeof(ids)/sizeof(ids[0]);++i) {
+            for (size_t j=0;j<sizeof(payloads)/sizeof(payloads[0]);++j) {
+                appendPacket(buffer,expected,ids[i],payloads[j]);
+            }
+        }
+        FrameScanner::Frame frames[64];
+        size_t consumed;
+        size_t numFrames=FrameScanner::scan(&buffer[0],buffer.size(),frames,64,consumed);
+        TS_ASSERT_EQUALS(numFrames,expected.size());
+        TS_ASSERT_EQUALS(consumed,buffer.size());
+        checkFrames(frames,numFrames,expected,0);
+    }
+    void testBatchesAndPartialPacket( void ) {
+        Chunk buffer;
+        std::vector<Expected> expected;
+        for (uint32 i=0;i<20;++i) {
+            appendPacket(buffer,expected,i*1000+1,i%3);
+        }
+        size_t whole=buffer.size();
+        Chunk partial;
+        std::vector<Expected> ignored;
+        appendPacket(partial,ignored,5,300);
+        //every cut of the last packet, down to half its length header, must be left for the next read
+        for (size_t cut=1;cut<partial.size();++cut) {
+            Chunk received(buffer);
+            received.insert(received.end(),partial.begin(),partial.begin()+cut);
+            FrameScanner::Frame frames[8];
+            size_t pos=0;
+            size_t found=0;
+            size_t numFrames;
+            do {
+                size_t consumed;
+                numFrames=FrameScanner::scan(&received[pos],received.size()-pos,frames,8,consumed);
+                TS_ASSERT(numFrames<=8);
+                for (size_t i=0;i<numFrames;++i) {
+                    frames[i].mOffset+=(uint32)pos;
+                }
+                checkFrames(frames,numFrames,expected,found);
+                found+=numFrames;
+                pos+=consumed;
+            }while (numFrames==8);
+            TS_ASSERT_EQUALS(found,expected.size());
+            TS_ASSERT_EQUALS(pos,whole);
+        }
+    }
+    void testTooShortForStreamID( void ) {
+        //a packet whose StreamID runs past its end is an empty control packet, as Stream::uint30::unserialize leaves it
+        Chunk buffer;
+        buffer.push_back(1);
+        buffer.push_back(0x80);
+        std::vector<Expected> expected;
+        appendPacket(buffer,expected,7,2);
+        FrameScanner::Frame frames[4];
+        size_t consumed;
+        TS_ASSERT_EQUALS(FrameScanner::scan(&buffer[0],buffer.size(),frames,4,consumed),2u);
+        TS_ASSERT_EQUALS(consumed,buffer.size());
+        TS_ASSERT_EQUALS(frames[0].mID,Stream::StreamID());
+        TS_ASSERT_EQUALS(frames[0].mLength,0u);
+        checkFrames(frames+1,1,expected,0);
+    }
+};
@@ -0,0 +1,217 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  GatherSendTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPDefinitions.hpp"
+#include "network/Stream.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "task/Time.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Compares the throughput of the two ways ASIOSocketWrapper has shipped a queue of Chunks to a socket:
+ * copying them into a packet sized buffer (the old path) and handing the socket a buffer sequence that points
+ * straight at the Chunks, with runs of tiny Chunks coalesced into one segment (the gather path) for a few packet size mixes
+ * over a loopback connection
+ */
+class GatherSendTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::uint8 uint8;
+    typedef Sirikata::uint64 uint64;
+    enum {
+        ///Size of the static buffer the copy path coalesced packets into
+        COPY_BUFFER_SIZE=1400,
+        ///Limits on a single gathered write and on coalescing tiny packets, matching ASIOSocketWrapper
+        MAX_GATHER_BUFFERS=64,
+        MAX_GATHER_BYTES=65536,
+        COALESCE_THRESHOLD=512,
+        COALESCE_BUFFER_SIZE=4096,
+        ///Bytes pushed through the socket for each measurement
+        BYTES_PER_RUN=8*1024*1024
+    };
+    IOService*mIO;
+    boost::asio::ip::tcp::socket*mSender;
+    boost::asio::ip::tcp::socket*mReceiver;
+    uint64 mReceivedBytes;
+    uint64 mReceivedSum;
+    void drain(uint64 expected) {
+        std::vector<uint8> buffer(65536);
+        uint64 received=0;
+        uint64 sum=0;
+        boost::system::error_code error;
+        while (received<expected&&!error) {
+            std::size_t len=mReceiver->read_some(boost::asio::buffer(&buffer[0],buffer.size()),error);
+            for (std::size_t i=0;i<len;++i) {
+                sum+=buffer[i];
+            }
+            received+=len;
+        }
+        mReceivedBytes=received;
+        mReceivedSum=sum;
+    }
+    void copySend(const std::deque<Chunk*>&packets) {
+        uint8 buffer[COPY_BUFFER_SIZE];
+        std::deque<Chunk*>::const_iterator i=packets.begin(),ie=packets.end();
+        size_t offset=0;
+        while (i!=ie) {
+            if ((*i)->size()-offset>COPY_BUFFER_SIZE) {
+                boost::asio::write(*mSender,boost::asio::buffer(&*(*i)->begin()+offset,(*i)->size()-offset));
+                offset=0;
+                ++i;
+                continue;
+            }
+            size_t bufferLocation=0;
+            while (i!=ie&&bufferLocation<COPY_BUFFER_SIZE) {
+                size_t toCopy=(*i)->size()-offset;
+                if (toCopy>COPY_BUFFER_SIZE-bufferLocation) {
+                    toCopy=COPY_BUFFER_SIZE-bufferLocation;
+                }
+                std::memcpy(buffer+bufferLocation,&*(*i)->begin()+offset,toCopy);
+                bufferLocation+=toCopy;
+                offset+=toCopy;
+                if (offset==(*i)->size()) {
+                    offset=0;
+                    ++i;
+                }
+            }
+            boost::asio::write(*mSender,boost::asio::buffer(buffer,bufferLocation));
+        }
+    }
+    void gatherSend(const std::deque<Chunk*>&packets) {
+        uint8 coalesceBuffer[COALESCE_BUFFER_SIZE];
+        std::vector<boost::asio::const_buffer> gather;
+        std::deque<Chunk*>::const_iterator i=packets.begin(),ie=packets.end();
+        while (i!=ie) {
+            gather.clear();
+            size_t gatheredBytes=0;
+            size_t coalesced=0;
+            bool lastCoalesced=false;
+            for (;i!=ie&&gather.size()<MAX_GATHER_BUFFERS&&gatheredBytes<MAX_GATHER_BYTES;++i) {
+                size_t size=(*i)->size();
+                if (size<COALESCE_THRESHOLD) {
+                    if (coalesced+size>COALESCE_BUFFER_SIZE) {
+                        break;
+                    }
+                    std::memcpy(coalesceBuffer+coalesced,&*(*i)->begin(),size);
+                    if (lastCoalesced) {
+                        gather.back()=boost::asio::buffer(coalesceBuffer+coalesced-boost::asio::buffer_size(gather.back()),
+                                                          boost::asio::buffer_size(gather.back())+size);
+                    }else {
+                        gather.push_back(boost::asio::buffer(coalesceBuffer+coalesced,size));
+                    }
+                    coalesced+=size;
+                    lastCoalesced=true;
+                }else {
+                    gather.push_back(boost::asio::buffer(&*(*i)->begin(),size));
+                    lastCoalesced=false;
+                }
+                gatheredBytes+=size;
+            }
+            boost::asio::write(*mSender,gather);
+        }
+    }
+    double measure(const std::vector<size_t>&sizeMix, bool gather) {
+        std::deque<Chunk*> packets;
+        uint64 totalBytes=0;
+        uint64 totalSum=0;
+        for (size_t which=0;totalBytes<BYTES_PER_RUN;++which) {
+            Chunk*packet=new Chunk(sizeMix[which%sizeMix.size()]);
+            for (size_t j=0;j<packet->size();++j) {
+                (*packet)[j]=(uint8)(which+j);
+                totalSum+=(*packet)[j];
+            }
+            totalBytes+=packet->size();
+            packets.push_back(packet);
+        }
+        boost::thread reader(std::tr1::bind(&GatherSendTest::drain,this,totalBytes));
+        Sirikata::Task::AbsTime start=Sirikata::Task::AbsTime::now();
+        if (gather) {
+            gatherSend(packets);
+        }else {
+            copySend(packets);
+        }
+        reader.join();
+        double seconds=(double)(Sirikata::Task::AbsTime::now()-start);
+        TS_ASSERT_EQUALS(mReceivedBytes,totalBytes);
+        TS_ASSERT_EQUALS(mReceivedSum,totalSum);
+        while (!packets.empty()) {
+            delete packets.front();
+            packets.pop_front();
+        }
+        return seconds>0?totalBytes/seconds/(1024.*1024.):0;
+    }
+    void compare(const char*name,const std::vector<size_t>&sizeMix) {
+        double copyRate=0;
+        double gatherRate=0;
+        //report the best of a few runs since a loopback socket is at the mercy of the scheduler
+        for (int run=0;run<3;++run) {
+            copyRate=std::max(copyRate,measure(sizeMix,false));
+            gatherRate=std::max(gatherRate,measure(sizeMix,true));
+        }
+        std::cerr<<"\nGatherSendTest "<<name<<": copy "<<copyRate<<" MB/s, gather "<<gatherRate<<" MB/s";
+    }
+public:
+    void setUp( void ) {
+        using namespace boost::asio::ip;
+        mIO=IOServiceFactory::makeIOService();
+        tcp::acceptor acceptor(*mIO,tcp::endpoint(address_v4::loopback(),0));
+        mSender=new tcp::socket(*mIO);
+        mReceiver=new tcp::socket(*mIO);
+        mSender->connect(acceptor.local_endpoint());
+        acceptor.accept(*mReceiver);
+        mSender->set_option(tcp::no_delay(true));
+    }
+    void tearDown( void ) {
+        delete mSender;
+        delete mReceiver;
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    void testTinyPackets( void ) {
+        compare("64 byte packets",std::vector<size_t>(1,64));
+    }
+    void testSmallPackets( void ) {
+        compare("1 KB packets",std::vector<size_t>(1,1024));
+    }
+    void testLargePackets( void ) {
+        compare("64 KB packets",std::vector<size_t>(1,65536));
+    }
+    void testMixedPackets( void ) {
+        std::vector<size_t> mix;
+        for (int i=0;i<16;++i) {
+            mix.push_back(64);
+        }
+        for (int i=0;i<4;++i) {
+            mix.push_back(1024);
+        }
+        mix.push_back(65536);
+        compare("64 B/1 KB/64 KB mix",mix);
+    }
+};
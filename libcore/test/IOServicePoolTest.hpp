@@ -0,0 +1,139 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  IOServicePoolTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPStream.hpp"
+#include "network/TCPStreamListener.hpp"
+#include "network/IOServicePool.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Connects several streams to a TCPStreamListener built on an IOServicePool and checks that each accepted
+ * connection has all of its callbacks made from a single thread while the connections are spread over the pool
+ */
+class IOServicePoolTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_SERVICES=4,
+        NUM_CONNECTIONS=8,
+        MESSAGES_PER_CONNECTION=64
+    };
+    typedef std::map<int,std::set<boost::thread::id> > ThreadMap;
+    boost::mutex mMutex;
+    ///which threads each accepted connection has been called back from
+    ThreadMap mListenerThreads;
+    std::vector<Stream*> mAccepted;
+    Sirikata::AtomicValue<int> mReceived;
+    void noteThread(int id) {
+        boost::lock_guard<boost::mutex> lok(mMutex);
+        mListenerThreads[id].insert(boost::this_thread::get_id());
+    }
+    void connectionCallback(int id, Stream::ConnectionStatus stat, const std::string&reason) {
+        noteThread(id);
+    }
+    void dataRecvCallback(int id, const Chunk&data) {
+        noteThread(id);
+        ++mReceived;
+    }
+    void newStreamCallback(Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            using std::tr1::placeholders::_1;
+            using std::tr1::placeholders::_2;
+            int id;
+            {
+                boost::lock_guard<boost::mutex> lok(mMutex);
+                id=(int)mAccepted.size();
+                mAccepted.push_back(newStream);
+            }
+            noteThread(id);
+            setCallbacks(std::tr1::bind(&IOServicePoolTest::connectionCallback,this,id,_1,_2),
+                         std::tr1::bind(&IOServicePoolTest::dataRecvCallback,this,id,_1));
+        }
+    }
+    static void ignoreNewStream(Stream*newStream, Stream::SetCallbacks&) {
+        delete newStream;
+    }
+    static void ignoreConnection(Stream::ConnectionStatus, const std::string&) {
+    }
+    static void ignoreData(const Chunk&) {
+    }
+public:
+    IOServicePoolTest():mReceived(0) {
+    }
+    void testConnectionsStayOnOneThread( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        IOServicePool pool(NUM_SERVICES);
+        TS_ASSERT_EQUALS(pool.size(),(unsigned int)NUM_SERVICES);
+        pool.run();
+        std::vector<TCPStream*> connectors;
+        {
+            TCPStreamListener listener(pool);
+            listener.listen(Address("127.0.0.1","9152"),std::tr1::bind(&IOServicePoolTest::newStreamCallback,this,_1,_2));
+            for (int i=0;i<NUM_CONNECTIONS;++i) {
+                TCPStream*connector=new TCPStream(pool.nextService());
+                connector->connect(Address("127.0.0.1","9152"),
+                                   &IOServicePoolTest::ignoreNewStream,
+                                   &IOServicePoolTest::ignoreConnection,
+                                   &IOServicePoolTest::ignoreData);
+                connectors.push_back(connector);
+            }
+            for (int i=0;i<MESSAGES_PER_CONNECTION;++i) {
+                for (size_t j=0;j<connectors.size();++j) {
+                    std::string message="message";
+                    connectors[j]->send(Chunk(message.begin(),message.end()),(i%2)?ReliableUnordered:ReliableOrdered);
+                }
+            }
+            for (int waits=0;mReceived.read()<NUM_CONNECTIONS*MESSAGES_PER_CONNECTION&&waits<3000;++waits) {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+            }
+            TS_ASSERT_EQUALS(mReceived.read(),(int)NUM_CONNECTIONS*MESSAGES_PER_CONNECTION);
+            for (size_t i=0;i<connectors.size();++i) {
+                connectors[i]->close();
+            }
+            pool.stop();
+        }
+        std::set<boost::thread::id> allThreads;
+        TS_ASSERT_EQUALS(mListenerThreads.size(),(size_t)NUM_CONNECTIONS);
+        for (ThreadMap::iterator i=mListenerThreads.begin();i!=mListenerThreads.end();++i) {
+            TS_ASSERT_EQUALS(i->second.size(),1u);
+            allThreads.insert(i->second.begin(),i->second.end());
+        }
+        //connections are dealt out in turn so every thread of the pool ends up with some
+        TS_ASSERT_EQUALS(allThreads.size(),(size_t)NUM_SERVICES);
+        for (size_t i=0;i<connectors.size();++i) {
+            delete connectors[i];
+        }
+        for (size_t i=0;i<mAccepted.size();++i) {
+            delete mAccepted[i];
+        }
+    }
+};
@@ -0,0 +1,132 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  KeepaliveTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPStream.hpp"
+#include "network/TCPStreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "options/Options.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Pings quickly over a connection whose ends run on IOServices of their own, checks that both ends learn each socket's round trip time,
+ * then stops the listener's IOService so it no longer answers and checks that the connecting end reports the connection gone
+ */
+class KeepaliveTest : public CxxTest::TestSuite
+{
+    IOService*mConnectorIO;
+    IOService*mListenerIO;
+    Sirikata::AtomicValue<int> mDisconnections;
+    Sirikata::AtomicValue<int> mNumAccepted;
+    std::vector<Stream*> mAccepted;
+    void connectionCallback(Stream::ConnectionStatus status,const std::string&reason) {
+        if (status!=Stream::Connected) {
+            ++mDisconnections;
+        }
+    }
+    void newStreamCallback(Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            mAccepted.push_back(newStream);
+            setCallbacks(&Stream::ignoreConnectionStatus,&Stream::ignoreBytesReceived);
+            ++mNumAccepted;
+        }
+    }
+    ///Waits up to 5 seconds for every socket of stream's connection to have had a ping answered
+    static bool waitForRoundTrips(TCPStream&stream) {
+        for (int waits=0;waits<500;++waits) {
+            NetworkMetrics::ConnectionSnapshot snapshot;
+            stream.getConnectionSnapshot(snapshot);
+            bool answered=!snapshot.mRoundTripTime.empty();
+            for (size_t i=0;i<snapshot.mRoundTripTime.size();++i) {
+                if (snapshot.mRoundTripTime[i]==0) {
+                    answered=false;
+                }
+            }
+            if (answered)
+                return true;
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+        return false;
+    }
+public:
+    KeepaliveTest():mDisconnections(0),mNumAccepted(0) {
+    }
+    void setUp( void ) {
+        //parse resets every option it is not given, so both go in one call
+        Sirikata::OptionSet::getOptions("tcpsst")->parse("--keepalive=0.02 --keepalivetimeout=0.2");
+        mConnectorIO=IOServiceFactory::makeIOService();
+        mListenerIO=IOServiceFactory::makeIOService();
+    }
+    void tearDown( void ) {
+        Sirikata::OptionSet::getOptions("tcpsst")->parse("--keepalive=5 --keepalivetimeout=30");
+        IOServiceFactory::destroyIOService(mConnectorIO);
+        IOServiceFactory::destroyIOService(mListenerIO);
+    }
+    void testRoundTripAndDeadPeer( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        TCPStreamListener listener(*mListenerIO);
+        listener.listen(Address("127.0.0.1","9182"),std::tr1::bind(&KeepaliveTest::newStreamCallback,this,_1,_2));
+        boost::thread listenerThread(std::tr1::bind(&IOServiceFactory::runService,mListenerIO));
+        TCPStream connector(*mConnectorIO);
+        connector.connect(Address("127.0.0.1","9182"),
+                          &Stream::ignoreSubstreamCallback,
+                          std::tr1::bind(&KeepaliveTest::connectionCallback,this,_1,_2),
+                          &Stream::ignoreBytesReceived);
+        //run only returns at once if the service has no work yet, so the connect goes first
+        boost::thread connectorThread(std::tr1::bind(&IOServiceFactory::runService,mConnectorIO));
+        connector.send(Chunk(1,'x'),ReliableOrdered);
+        TS_ASSERT(waitForRoundTrips(connector));
+        TS_ASSERT_LESS_THAN(0u,connector.getRoundTripTime());
+        for (int waits=0;mNumAccepted.read()==0&&waits<500;++waits) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+        TS_ASSERT_EQUALS(mNumAccepted.read(),1);
+        if (mNumAccepted.read()) {
+            TS_ASSERT(waitForRoundTrips(*static_cast<TCPStream*>(mAccepted[0])));
+        }
+        TS_ASSERT_EQUALS(mDisconnections.read(),0);
+        //the listener's sockets stay open but nothing answers the pings any more
+        IOServiceFactory::stopService(mListenerIO);
+        listenerThread.join();
+        for (int waits=0;mDisconnections.read()==0&&waits<500;++waits) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+        TS_ASSERT_EQUALS(mDisconnections.read(),1);
+        connector.close();
+        for (size_t i=0;i<mAccepted.size();++i) {
+            mAccepted[i]->close();
+            delete mAccepted[i];
+        }
+        IOServiceFactory::stopService(mConnectorIO);
+        connectorThread.join();
+    }
+};
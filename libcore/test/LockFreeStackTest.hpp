@@ -0,0 +1,158 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  LockFreeStackTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/LockFreeStack.hpp"
+#include "util/ThreadSafeQueue.hpp"
+#include "task/Time.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata;
+/**
+ * Checks the LockFreeStack that MultiplexedSocket keeps its free StreamIDs in by having 1 to 16 threads hand out and give back
+ * IDs the way streams that are opened and closed at a great rate do, against both it and the ThreadSafeQueue it replaced.
+ * Every ID handed out must be one no other thread holds, and every ID must be back on the stack at the end
+ */
+class LockFreeStackTest : public CxxTest::TestSuite
+{
+    enum {
+        ///Open and close cycles per run, split evenly among the threads
+        CYCLES_PER_RUN=1<<20,
+        ///Each thread keeps up to this many IDs open at once, and may be partway through giving one more back
+        HELD_PER_THREAD=4,
+        MAX_THREADS=16,
+        MAX_IDS=MAX_THREADS*(HELD_PER_THREAD+1)
+    };
+    class Run {
+    public:
+        ///Nonzero while some thread holds the ID
+        AtomicValue<uint32> mHeld[MAX_IDS];
+        ///The next ID to hand out when none are free, as MultiplexedSocket's mHighestStreamID is
+        AtomicValue<uint32> mNextID;
+        AtomicValue<uint32> mReady;
+        AtomicValue<uint32> mFailures;
+        Run():mNextID(0),mReady(0),mFailures(0) {
+            for (int i=0;i<MAX_IDS;++i) {
+                mHeld[i]=0;
+            }
+        }
+    };
+    template <class Stack> static void cycle(Stack*stack, Run*run, uint32 cycles, uint32 numThreads) {
+        ++run->mReady;
+        while (run->mReady.read()<numThreads) {
+        }
+        uint32 held[HELD_PER_THREAD];
+        uint32 numHeld=0;
+        for (uint32 i=0;i<cycles;++i) {
+            if (numHeld==HELD_PER_THREAD||(numHeld&&(i&1))) {
+                uint32 id=held[--numHeld];
+                run->mHeld[id]=0;
+                stack->push(id);
+            }else {
+                uint32 id;
+                if (!stack->pop(id)) {
+                    id=run->mNextID++;
+                }
+                if (id>=MAX_IDS||!run->mHeld[id].compareAndSwap(0,1)) {
+                    ++run->mFailures;//handed out an ID that was never given back or that another thread has
+                    continue;
+                }
+                held[numHeld++]=id;
+            }
+        }
+        while (numHeld) {
+            uint32 id=held[--numHeld];
+            run->mHeld[id]=0;
+            stack->push(id);
+        }
+    }
+    ///Runs numThreads threads against stack: returns millions of open and close cycles per second
+    template <class Stack> double run(Stack&stack, uint32 numThreads) {
+        Run run;
+        uint32 perThread=CYCLES_PER_RUN/numThreads;
+        std::vector<boost::thread*> threads;
+        Task::AbsTime start=Task::AbsTime::now();
+        for (uint32 i=0;i<numThreads;++i) {
+            threads.push_back(new boost::thread(boost::bind(&LockFreeStackTest::cycle<Stack>,&stack,&run,perThread,numThreads)));
+        }
+        for (uint32 i=0;i<numThreads;++i) {
+            threads[i]->join();
+            delete threads[i];
+        }
+        double seconds=(double)(Task::AbsTime::now()-start);
+        TS_ASSERT_EQUALS(run.mFailures.read(),0u);
+        //every ID ever handed out is back exactly once
+        std::vector<bool> seen(MAX_IDS,false);
+        uint32 id,count=0;
+        while (stack.pop(id)) {
+            TS_ASSERT(id<run.mNextID.read()&&!seen[id]);
+            if (id<MAX_IDS) {
+                seen[id]=true;
+            }
+            ++count;
+        }
+        TS_ASSERT_EQUALS(count,run.mNextID.read());
+        return seconds>0?perThread*numThreads/seconds/1000000.:0;
+    }
+public:
+    void testLastInFirstOut( void ) {
+        LockFreeStack<uint32> stack;
+        TS_ASSERT(stack.probablyEmpty());
+        //enough to need several blocks of nodes
+        for (uint32 i=0;i<1000;++i) {
+            stack.push(i);
+        }
+        uint32 value=0;
+        for (uint32 i=1000;i-->500;) {
+            TS_ASSERT(stack.pop(value));
+            TS_ASSERT_EQUALS(value,i);
+        }
+        //the popped nodes are reused
+        for (uint32 i=500;i<1000;++i) {
+            stack.push(i);
+        }
+        for (uint32 i=1000;i-->0;) {
+            TS_ASSERT(stack.pop(value));
+            TS_ASSERT_EQUALS(value,i);
+        }
+        TS_ASSERT(!stack.pop(value));
+        TS_ASSERT(stack.probablyEmpty());
+    }
+    void testContention( void ) {
+        for (uint32 numThreads=1;numThreads<=MAX_THREADS;numThreads*=2) {
+            LockFreeStack<uint32> lockFree;
+            ThreadSafeQueue<uint32> locked;
+            double lockFreeRate=run(lockFree,numThreads);
+            double lockedRate=run(locked,numThreads);
+            std::cerr<<"\nLockFreeStackTest "<<numThreads<<" threads: lock free "<<lockFreeRate<<" M/s, locked "<<lockedRate<<" M/s";
+        }
+        std::cerr<<'\n';
+    }
+};
@@ -0,0 +1,212 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  LoopbackStreamTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/LoopbackStream.hpp"
+#include "network/LoopbackStreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include <cxxtest/TestSuite.h>
+using namespace Sirikata::Network;
+/**
+ * Drives both ends of loopback connections from one IOService polled by the test itself,
+ * so every callback happens at a known point and the results are the same on every run
+ */
+class LoopbackStreamTest : public CxxTest::TestSuite
+{
+    IOService*mIO;
+    ///what each stream end saw: data as is and connection events as "C" followed by a code
+    std::map<std::string,std::vector<std::string> > mEvents;
+    std::vector<Stream*> mAccepted;
+    int mNullSubstreams;
+    int mReadyCount;
+    void connectionCallback(const std::string&name, Stream::ConnectionStatus stat, const std::string&reason) {
+        mEvents[name].push_back(stat==Stream::Connected?"C+":(stat==Stream::Disconnected?"C-":"CX"));
+    }
+    void dataCallback(const std::string&name, const Chunk&data) {
+        mEvents[name].push_back(std::string(data.begin(),data.end()));
+    }
+    void viewCallback(const std::string&name, const ChunkView&data) {
+        mEvents[name].push_back(std::string(data.begin(),data.end()));
+    }
+    void substreamCallback(const std::string&prefix, Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        if (newStream) {
+            std::ostringstream name;
+            name<<prefix<<mAccepted.size();
+            mAccepted.push_back(newStream);
+            setCallbacks(std::tr1::bind(&LoopbackStreamTest::connectionCallback,this,name.str(),_1,_2),
+                         std::tr1::bind(&LoopbackStreamTest::dataCallback,this,name.str(),_1));
+        }else {
+            ++mNullSubstreams;
+        }
+    }
+    void readyCallback() {
+        ++mReadyCount;
+    }
+    ///Runs everything that is queued, including whatever those handlers queue in turn
+    void deliverAll() {
+        do {
+            IOServiceFactory::resetService(mIO);
+        }while (IOServiceFactory::pollService(mIO));
+    }
+    static Chunk chunk(const std::string&s) {
+        return Chunk(s.begin(),s.end());
+    }
+    LoopbackStream*connect(const Address&addy, const std::string&name) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        LoopbackStream*connector=new LoopbackStream(*mIO);
+        connector->connect(addy,
+                           std::tr1::bind(&LoopbackStreamTest::substreamCallback,this,"connector",_1,_2),
+                           std::tr1::bind(&LoopbackStreamTest::connectionCallback,this,name,_1,_2),
+                           std::tr1::bind(&LoopbackStreamTest::dataCallback,this,name,_1));
+        return connector;
+    }
+public:
+    void setUp( void ) {
+        mIO=IOServiceFactory::makeIOService();
+        mNullSubstreams=0;
+        mReadyCount=0;
+    }
+    void tearDown( void ) {
+        for (size_t i=0;i<mAccepted.size();++i) {
+            delete mAccepted[i];
+        }
+        mAccepted.clear();
+        mEvents.clear();
+        deliverAll();
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    void testSendCloneAndClose( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        Address addy("loopback","sendcloneclose");
+        LoopbackStreamListener listener(*mIO);
+        TS_ASSERT(listener.listen(addy,std::tr1::bind(&LoopbackStreamTest::substreamCallback,this,"listener",_1,_2)));
+        TS_ASSERT(!LoopbackStreamListener(*mIO).listen(addy,&Stream::ignoreSubstreamCallback));
+        LoopbackStream*connector=connect(addy,"connector");
+        //sends may start before the other end has accepted the stream
+        connector->send(chunk("first"),ReliableOrdered);
+        connector->send(chunk("second"),ReliableUnordered);
+        connector->send(chunk(""),Unreliable);
+        LoopbackStream substream(*mIO);
+        TS_ASSERT(substream.cloneFromViews(connector,
+                                           std::tr1::bind(&LoopbackStreamTest::connectionCallback,this,"substream",_1,_2),
+                                           std::tr1::bind(&LoopbackStreamTest::viewCallback,this,"substream",_1)));
+        TS_ASSERT_EQUALS(substream.getID().read(),3u);
+        substream.send(chunk("third"),ReliableOrdered);
+        TS_ASSERT(mEvents.empty());
+        deliverAll();
+        TS_ASSERT_EQUALS(mAccepted.size(),2u);
+        TS_ASSERT_EQUALS(mEvents["connector"].size(),1u);
+        TS_ASSERT_EQUALS(mEvents["connector"][0],"C+");
+        TS_ASSERT_EQUALS(mEvents["listener0"].size(),3u);
+        TS_ASSERT_EQUALS(mEvents["listener0"][0],"first");
+        TS_ASSERT_EQUALS(mEvents["listener0"][1],"second");
+        TS_ASSERT_EQUALS(mEvents["listener0"][2],"");
+        TS_ASSERT_EQUALS(mEvents["listener1"].size(),1u);
+        TS_ASSERT_EQUALS(mEvents["listener1"][0],"third");
+
+        mAccepted[1]->send(chunk("reply"),ReliableOrdered);
+        //a substream opened by the listener reaches the connector's substream callback
+        LoopbackStream fromListener(*mIO);
+        TS_ASSERT(fromListener.cloneFrom(mAccepted[0],&Stream::ignoreConnectionStatus,&Stream::ignoreBytesReceived));
+        TS_ASSERT_EQUALS(fromListener.getID().read(),2u);
+        fromListener.send(chunk("pushed"),ReliableOrdered);
+        deliverAll();
+        TS_ASSERT_EQUALS(mEvents["substream"].size(),1u);
+        TS_ASSERT_EQUALS(mEvents["substream"][0],"reply");
+        TS_ASSERT_EQUALS(mEvents["connector2"].size(),1u);
+        TS_ASSERT_EQUALS(mEvents["connector2"][0],"pushed");
+
+        connector->close();
+        connector->send(chunk("too late"),ReliableOrdered);
+        deliverAll();
+        TS_ASSERT_EQUALS(mEvents["listener0"].size(),4u);
+        TS_ASSERT_EQUALS(mEvents["listener0"][3],"C-");
+        //the other streams are unaffected
+        substream.send(chunk("still open"),ReliableOrdered);
+        deliverAll();
+        TS_ASSERT_EQUALS(mEvents["listener1"].size(),2u);
+        TS_ASSERT_EQUALS(mEvents["listener1"][1],"still open");
+        delete connector;
+    }
+    void testConnectionFailed( void ) {
+        LoopbackStream*connector=connect(Address("loopback","nobody"),"connector");
+        deliverAll();
+        TS_ASSERT_EQUALS(mEvents["connector"].size(),1u);
+        TS_ASSERT_EQUALS(mEvents["connector"][0],"CX");
+        LoopbackStream substream(*mIO);
+        TS_ASSERT(!substream.cloneFrom(connector,&Stream::ignoreConnectionStatus,&Stream::ignoreBytesReceived));
+        delete connector;
+    }
+    void testLastStreamDisconnects( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        Address addy("loopback","laststream");
+        LoopbackStreamListener listener(*mIO);
+        listener.listen(addy,std::tr1::bind(&LoopbackStreamTest::substreamCallback,this,"listener",_1,_2));
+        LoopbackStream*connector=connect(addy,"connector");
+        deliverAll();
+        TS_ASSERT_EQUALS(mAccepted.size(),1u);
+        delete mAccepted[0];
+        mAccepted.clear();
+        deliverAll();
+        TS_ASSERT_EQUALS(mEvents["connector"].size(),2u);
+        TS_ASSERT_EQUALS(mEvents["connector"][1],"C-");
+        TS_ASSERT_EQUALS(mNullSubstreams,1);
+        delete connector;
+        deliverAll();
+        TS_ASSERT_EQUALS(mNullSubstreams,2);
+    }
+    void testSendWindow( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        Address addy("loopback","sendwindow");
+        LoopbackStreamListener listener(*mIO);
+        listener.listen(addy,std::tr1::bind(&LoopbackStreamTest::substreamCallback,this,"listener",_1,_2));
+        LoopbackStream*connector=connect(addy,"connector");
+        connector->setSendWindow(4096,std::tr1::bind(&LoopbackStreamTest::readyCallback,this));
+        Chunk packet(1024);
+        TS_ASSERT(connector->send(packet,ReliableOrdered));
+        TS_ASSERT(connector->send(packet,ReliableOrdered));
+        TS_ASSERT(connector->send(packet,ReliableOrdered));
+        TS_ASSERT(!connector->send(packet,ReliableOrdered));
+        TS_ASSERT_EQUALS(connector->getQueuedBytes(),4096u);
+        TS_ASSERT_EQUALS(mReadyCount,0);
+        //the bytes count against the window until the other end has received them
+        deliverAll();
+        TS_ASSERT_EQUALS(mEvents["listener0"].size(),4u);
+        TS_ASSERT_EQUALS(connector->getQueuedBytes(),0u);
+        TS_ASSERT_EQUALS(mReadyCount,1);
+        delete connector;
+    }
+};
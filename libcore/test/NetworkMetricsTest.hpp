@@ -0,0 +1,75 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  NetworkMetricsTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Platform.hpp"
+#include "network/NetworkMetrics.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Counts from several threads at once and checks that a snapshot adds them all up, including the counts of threads that have since exited
+ */
+class NetworkMetricsTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_THREADS=4,
+        NUM_ADDS=20000
+    };
+    static void countThread() {
+        for (int i=0;i<NUM_ADDS;++i) {
+            NetworkMetrics::add(NetworkMetrics::SOCKET_READS);
+            NetworkMetrics::add(NetworkMetrics::BYTES_RECEIVED,3);
+        }
+    }
+public:
+    void testThreadsAddUp( void ) {
+        NetworkMetrics::Snapshot before=NetworkMetrics::snapshot();
+        std::vector<boost::thread*> threads;
+        for (int i=0;i<NUM_THREADS;++i) {
+            threads.push_back(new boost::thread(&NetworkMetricsTest::countThread));
+        }
+        countThread();
+        for (int i=0;i<NUM_THREADS;++i) {
+            threads[i]->join();
+            delete threads[i];
+        }
+        NetworkMetrics::Snapshot after=NetworkMetrics::snapshot();
+        TS_ASSERT_EQUALS(after[NetworkMetrics::SOCKET_READS]-before[NetworkMetrics::SOCKET_READS],
+                         (Sirikata::uint64)(NUM_THREADS+1)*NUM_ADDS);
+        TS_ASSERT_EQUALS(after[NetworkMetrics::BYTES_RECEIVED]-before[NetworkMetrics::BYTES_RECEIVED],
+                         (Sirikata::uint64)(NUM_THREADS+1)*NUM_ADDS*3);
+        TS_ASSERT_EQUALS(after[NetworkMetrics::PACKETS_SENT],before[NetworkMetrics::PACKETS_SENT]);
+    }
+    void testNames( void ) {
+        TS_ASSERT_EQUALS(std::string(NetworkMetrics::name(NetworkMetrics::BYTES_SENT)),"bytes_sent");
+        TS_ASSERT_EQUALS(std::string(NetworkMetrics::name(NetworkMetrics::STREAMS_CLOSED)),"streams_closed");
+    }
+};
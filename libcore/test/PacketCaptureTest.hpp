@@ -0,0 +1,228 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  PacketCaptureTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPStream.hpp"
+#include "network/TCPStreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "network/PacketReplay.hpp"
+#include "options/Options.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+class PacketCaptureTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::uint8 uint8;
+    ///The messages each stream has received, in order
+    std::map<unsigned int,std::vector<Chunk> > mReceived;
+    std::vector<Stream*> mStreams;
+    Sirikata::AtomicValue<int> mCount;
+    void dataCallback(unsigned int id,const Chunk&data) {
+        mReceived[id].push_back(data);
+        ++mCount;
+    }
+    void newStreamCallback(Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            using std::tr1::placeholders::_1;
+            mStreams.push_back(newStream);
+            setCallbacks(&Stream::ignoreConnectionStatus,
+                         std::tr1::bind(&PacketCaptureTest::dataCallback,this,((TCPStream*)newStream)->getID().read(),_1));
+        }
+    }
+    void closeStreams() {
+        for (size_t i=0;i<mStreams.size();++i) {
+            mStreams[i]->close();
+            delete mStreams[i];
+        }
+        mStreams.clear();
+    }
+    static PacketCapture::Record makeRecord(Sirikata::uint32 connection,Sirikata::uint32 socket,unsigned int stream,const Chunk&data) {
+        PacketCapture::Record record;
+        record.mTime=0;
+        record.mConnection=connection;
+        record.mSocket=socket;
+        record.mStream=Stream::StreamID(stream);
+        record.mData=data;
+        return record;
+    }
+    ///A frame of a message too large to send whole, which goes out as a control packet
+    static PacketCapture::Record makeFragment(Sirikata::uint32 connection,unsigned int stream,const Chunk&data,bool last) {
+        Chunk frame(1,last?TCPStream::TCPStreamLastFragment:TCPStream::TCPStreamFragment);
+        uint8 id[Stream::StreamID::MAX_SERIALIZED_LENGTH];
+        unsigned int idLength=Stream::StreamID(stream).serialize(id,Stream::StreamID::MAX_SERIALIZED_LENGTH);
+        frame.insert(frame.end(),id,id+idLength);
+        frame.insert(frame.end(),data.begin(),data.end());
+        return makeRecord(connection,0,0,frame);
+    }
+public:
+    PacketCaptureTest():mCount(0) {
+    }
+    void tearDown( void ) {
+        closeStreams();
+        mReceived.clear();
+        mCount=0;
+    }
+    void testRecordAndRead( void ) {
+        const char*filename="packet_capture_test.sstcap";
+        Chunk big(40000);
+        for (size_t i=0;i<big.size();++i) {
+            big[i]=(uint8)i;
+        }
+        {
+            PacketCapture capture(filename);
+            TS_ASSERT(capture.isOpen());
+            std::string hello("hello");
+            Chunk helloChunk(hello.begin(),hello.end());
+            capture.record(3,0,Stream::StreamID(1),ChunkView(helloChunk));
+            capture.record(3,1,Stream::StreamID(),ChunkView(Chunk()));
+            capture.record(4,2,Stream::StreamID(12345),ChunkView(big));
+        }
+        std::vector<PacketCapture::Record> records;
+        TS_ASSERT(PacketCapture::read(filename,records));
+        TS_ASSERT_EQUALS(records.size(),3u);
+        if (records.size()==3) {
+            TS_ASSERT_EQUALS(records[0].mConnection,3u);
+            TS_ASSERT_EQUALS(records[0].mSocket,0u);
+            TS_ASSERT_EQUALS(records[0].mStream.read(),1u);
+            TS_ASSERT_EQUALS(std::string(records[0].mData.begin(),records[0].mData.end()),"hello");
+            TS_ASSERT_EQUALS(records[1].mSocket,1u);
+            TS_ASSERT_EQUALS(records[1].mStream,Stream::StreamID());
+            TS_ASSERT(records[1].mData.empty());
+            TS_ASSERT_EQUALS(records[2].mConnection,4u);
+            TS_ASSERT_EQUALS(records[2].mStream.read(),12345u);
+            TS_ASSERT(records[2].mData==big);
+            TS_ASSERT(records[0].mTime<=records[1].mTime&&records[1].mTime<=records[2].mTime);
+        }
+        //cut the last packet short: the records before it must still be returned
+        std::vector<char> contents;
+        {
+            std::ifstream in(filename,std::ios::binary);
+            contents.assign(std::istreambuf_iterator<char>(in),std::istreambuf_iterator<char>());
+        }
+        {
+            std::ofstream out(filename,std::ios::binary|std::ios::trunc);
+            out.write(&contents[0],contents.size()-100);
+        }
+        records.clear();
+        TS_ASSERT(!PacketCapture::read(filename,records));
+        TS_ASSERT_EQUALS(records.size(),2u);
+        std::remove(filename);
+        TS_ASSERT(!PacketCapture::read(filename,records));
+    }
+    void testReplay( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        std::vector<PacketCapture::Record> records;
+        std::vector<Chunk> expected1,expected3,expected5;
+        Chunk whole(30000);
+        for (size_t i=0;i<whole.size();++i) {
+            whole[i]=(uint8)(i*7);
+        }
+        for (int i=0;i<200;++i) {
+            Chunk small(1+i*13%300,(uint8)i);
+            expected1.push_back(small);
+            records.push_back(makeRecord(9,0,1,small));
+            if (i==50) {
+                //larger than a receive slab, so it is read into a chunk of its own
+                expected3.push_back(whole);
+                records.push_back(makeRecord(9,1,3,whole));
+            }
+            if (i==100) {
+                expected5.push_back(whole);
+                records.push_back(makeFragment(9,5,Chunk(whole.begin(),whole.begin()+20000),false));
+                records.push_back(makeFragment(9,5,Chunk(whole.begin()+20000,whole.end()),true));
+            }
+        }
+        PacketReplay replay(records);
+        TS_ASSERT_EQUALS(replay.getNumPackets(),records.size());
+        TS_ASSERT_EQUALS(replay.getNumConnections(),1u);
+        for (int run=0;run<2;++run) {
+            IOService*io=IOServiceFactory::makeIOService();
+            replay.run(*io,std::tr1::bind(&PacketCaptureTest::newStreamCallback,this,_1,_2));
+            TS_ASSERT(mReceived[1]==expected1);
+            TS_ASSERT(mReceived[3]==expected3);
+            TS_ASSERT(mReceived[5]==expected5);
+            closeStreams();
+            mReceived.clear();
+            IOServiceFactory::destroyIOService(io);
+        }
+    }
+    void testCaptureLiveConnection( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        const char*filename="packet_capture_live.sstcap";
+        const int numMessages=100;
+        Sirikata::OptionSet::getOptions("tcpsst")->parse(std::string("--capture=")+filename);
+        IOService*io=IOServiceFactory::makeIOService();
+        std::map<unsigned int,std::vector<Chunk> > live;
+        {
+            //the listener and connector must be gone before the IOService they use
+            TCPStreamListener listener(*io);
+            listener.listen(Address("127.0.0.1","9172"),std::tr1::bind(&PacketCaptureTest::newStreamCallback,this,_1,_2));
+            boost::thread thread(std::tr1::bind(&IOServiceFactory::runService,io));
+            TCPStream connector(*io);
+            connector.connect(Address("127.0.0.1","9172"),
+                              &Stream::ignoreSubstreamCallback,
+                              &Stream::ignoreConnectionStatus,
+                              &Stream::ignoreBytesReceived);
+            for (int i=0;i<numMessages;++i) {
+                connector.send(Chunk(i%10==0?20000:1+i*31%500,(uint8)i),ReliableOrdered);
+            }
+            for (int waits=0;mCount.read()<numMessages&&waits<500;++waits) {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+            }
+            TS_ASSERT_EQUALS(mCount.read(),numMessages);
+            std::tr1::shared_ptr<PacketCapture> capture=PacketCapture::current();
+            TS_ASSERT(capture);
+            if (capture) {
+                capture->flush();
+            }
+            IOServiceFactory::stopService(io);
+            thread.join();
+            live.swap(mReceived);
+            closeStreams();
+            connector.close();
+        }
+        //an empty value does not parse, but leaving the option out puts it back to its empty default
+        Sirikata::OptionSet::getOptions("tcpsst")->parse("");
+        TS_ASSERT(!PacketCapture::current());
+
+        std::vector<PacketCapture::Record> records;
+        TS_ASSERT(PacketCapture::read(filename,records));
+        TS_ASSERT(records.size()>=(size_t)numMessages);
+        IOService*replayIO=IOServiceFactory::makeIOService();
+        PacketReplay(records).run(*replayIO,std::tr1::bind(&PacketCaptureTest::newStreamCallback,this,_1,_2));
+        TS_ASSERT(mReceived==live);
+        closeStreams();
+        IOServiceFactory::destroyIOService(replayIO);
+        IOServiceFactory::destroyIOService(io);
+        std::remove(filename);
+    }
+};
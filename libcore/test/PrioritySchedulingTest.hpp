@@ -0,0 +1,185 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  PrioritySchedulingTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPDefinitions.hpp"
+#include "network/TCPStream.hpp"
+#include "network/ChunkPool.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "util/ThreadSafeQueue.hpp"
+#include "network/ASIOSocketWrapper.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Queues packets of several priority classes behind a send that is already in flight on an ASIOSocketWrapper
+ * then lets the io service drain them over a loopback connection, checking the order they reach the other end in:
+ * an interactive packet must not wait behind a backlog of bulk packets, busy classes must share the socket by weight
+ * and the streams of one class must take turns
+ */
+class PrioritySchedulingTest : public CxxTest::TestSuite
+{
+    typedef Sirikata::uint8 uint8;
+    enum {
+        ///Every packet is this long and filled with a tag saying which class and position it was queued with
+        PACKET_SIZE=1024,
+        BULK_TAG=1,
+        NORMAL_TAG=2,
+        INTERACTIVE_TAG=3
+    };
+    IOService*mIO;
+    TCPSocket*mSender;
+    TCPSocket*mReceiver;
+    std::vector<uint8> mReceived;
+    void drain() {
+        boost::asio::read(*mReceiver,boost::asio::buffer(&mReceived[0],mReceived.size()));
+    }
+    /**
+     * Sends the packets through a fresh wrapper: the first goes straight to the wire and every other one
+     * is queued behind it before the io service gets to run, each on the stream streams gives it (all on one if it is empty).
+     * Returns the tags in the order they arrived
+     */
+    std::vector<uint8> sendAll(const std::vector<std::pair<uint8,StreamPriority> >&packets,
+                               const std::vector<Stream::StreamID>&streams=std::vector<Stream::StreamID>()) {
+        ASIOSocketWrapper wrapper(mSender);
+        std::tr1::shared_ptr<MultiplexedSocket> noParent;
+        for (size_t i=0;i<packets.size();++i) {
+            Chunk*packet=ChunkPool::allocate(PACKET_SIZE);
+            std::fill(packet->begin(),packet->end(),packets[i].first);
+            wrapper.rawSend(noParent,packet,packets[i].second,streams.empty()?Stream::StreamID():streams[i]);
+        }
+        mReceived.resize(packets.size()*PACKET_SIZE);
+        boost::thread reader(std::tr1::bind(&PrioritySchedulingTest::drain,this));
+        mIO->run();
+        mIO->reset();
+        reader.join();
+        std::vector<uint8> retval;
+        for (size_t i=0;i<mReceived.size();i+=PACKET_SIZE) {
+            retval.push_back(mReceived[i]);
+            TS_ASSERT_EQUALS(mReceived[i],mReceived[i+PACKET_SIZE-1]);
+        }
+        return retval;
+    }
+public:
+    void setUp( void ) {
+        using namespace boost::asio::ip;
+        mIO=IOServiceFactory::makeIOService();
+        tcp::acceptor acceptor(*mIO,tcp::endpoint(address_v4::loopback(),0));
+        mSender=new TCPSocket(*mIO);
+        mReceiver=new TCPSocket(*mIO);
+        mSender->connect(acceptor.local_endpoint());
+        acceptor.accept(*mReceiver);
+    }
+    void tearDown( void ) {
+        delete mSender;
+        delete mReceiver;
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    void testInteractiveOvertakesBulk( void ) {
+        const size_t numBulk=256;
+        const size_t numInteractive=8;
+        std::vector<std::pair<uint8,StreamPriority> > packets(numBulk,std::pair<uint8,StreamPriority>(BULK_TAG,BulkPriority));
+        packets.insert(packets.end(),numInteractive,std::pair<uint8,StreamPriority>(INTERACTIVE_TAG,InteractivePriority));
+        std::vector<uint8> arrived=sendAll(packets);
+        TS_ASSERT_EQUALS(arrived.size(),packets.size());
+        size_t lastInteractive=0;
+        for (size_t i=0;i<arrived.size();++i) {
+            if (arrived[i]==INTERACTIVE_TAG) {
+                lastInteractive=i;
+            }
+        }
+        //only the bulk packet that was already on the wire may precede them
+        TS_ASSERT_EQUALS(lastInteractive,numInteractive);
+    }
+    void testWeightedShare( void ) {
+        const size_t numEach=128;
+        std::vector<std::pair<uint8,StreamPriority> > packets;
+        for (size_t i=0;i<numEach;++i) {
+            packets.push_back(std::pair<uint8,StreamPriority>(BULK_TAG,BulkPriority));
+            packets.push_back(std::pair<uint8,StreamPriority>(NORMAL_TAG,NormalPriority));
+        }
+        std::vector<uint8> arrived=sendAll(packets);
+        TS_ASSERT_EQUALS(arrived.size(),packets.size());
+        //while both classes are backlogged normal traffic gets four times the bytes of bulk traffic
+        size_t bulk=0;
+        size_t normal=0;
+        for (size_t i=1;i<=100;++i) {
+            if (arrived[i]==BULK_TAG) ++bulk;
+            if (arrived[i]==NORMAL_TAG) ++normal;
+        }
+        TS_ASSERT_EQUALS(bulk,20u);
+        TS_ASSERT_EQUALS(normal,80u);
+        //and once normal traffic is done nothing is lost
+        TS_ASSERT_EQUALS((size_t)std::count(arrived.begin(),arrived.end(),(uint8)BULK_TAG),numEach);
+    }
+    void testStreamsTakeTurns( void ) {
+        //the frames of a long message on one stream, then a packet from another stream of the same class
+        const size_t numFrames=128;
+        std::vector<std::pair<uint8,StreamPriority> > packets;
+        std::vector<Stream::StreamID> streams;
+        for (size_t i=0;i<numFrames;++i) {
+            packets.push_back(std::pair<uint8,StreamPriority>((uint8)(i+1),NormalPriority));
+            streams.push_back(Stream::StreamID(1));
+        }
+        packets.push_back(std::pair<uint8,StreamPriority>(0,NormalPriority));
+        streams.push_back(Stream::StreamID(3));
+        std::vector<uint8> arrived=sendAll(packets,streams);
+        TS_ASSERT_EQUALS(arrived.size(),packets.size());
+        size_t overtaker=std::find(arrived.begin(),arrived.end(),0)-arrived.begin();
+        //behind the frame already on the wire and the one whose turn came first
+        TS_ASSERT_LESS_THAN_EQUALS(overtaker,2u);
+        uint8 lastFrame=0;
+        for (size_t i=0;i<arrived.size();++i) {
+            if (arrived[i]) {
+                TS_ASSERT(arrived[i]>lastFrame);
+                lastFrame=arrived[i];
+            }
+        }
+    }
+    void testSameClassKeepsOrder( void ) {
+        std::vector<std::pair<uint8,StreamPriority> > packets;
+        for (uint8 i=0;i<200;++i) {
+            packets.push_back(std::pair<uint8,StreamPriority>(i,(i%2)?NormalPriority:InteractivePriority));
+        }
+        std::vector<uint8> arrived=sendAll(packets);
+        TS_ASSERT_EQUALS(arrived.size(),packets.size());
+        uint8 lastOdd=0;
+        uint8 lastEven=0;
+        for (size_t i=1;i<arrived.size();++i) {
+            if (arrived[i]%2) {
+                TS_ASSERT(arrived[i]>lastOdd);
+                lastOdd=arrived[i];
+            }else {
+                TS_ASSERT(arrived[i]>lastEven);
+                lastEven=arrived[i];
+            }
+        }
+    }
+};
@@ -0,0 +1,129 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SendQueueContentionTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/MPSCRingQueue.hpp"
+#include "util/ThreadSafeQueue.hpp"
+#include "task/Time.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata;
+/**
+ * Measures how the per socket send queue holds up when many application threads send on one connection:
+ * 1 to 32 producer threads push into an MPSCRingQueue (as ASIOSocketWrapper now does) or a ThreadSafeQueue (as it used to)
+ * while a single consumer drains it in batches the way the send path does.
+ * Every run also checks that nothing is lost and that each producer's elements come out in the order they went in,
+ * including with a ring small enough to keep spilling into the overflow
+ */
+class SendQueueContentionTest : public CxxTest::TestSuite
+{
+    enum {
+        ///Elements pushed per run, split evenly among the producers
+        ELEMENTS_PER_RUN=1<<20,
+        ///The element encodes its producer in the top bits and its sequence number in the rest
+        PRODUCER_SHIFT=24,
+        SEQUENCE_MASK=(1<<PRODUCER_SHIFT)-1,
+        MAX_PRODUCERS=32
+    };
+    template <class Queue> static void produce(Queue*queue, uint32 producer, uint32 count, AtomicValue<uint32>*ready, uint32 numProducers) {
+        //wait for everyone so the producers really do contend
+        ++*ready;
+        while (ready->read()<numProducers) {
+        }
+        for (uint32 i=0;i<count;++i) {
+            queue->push((producer<<PRODUCER_SHIFT)|i);
+        }
+    }
+    static void popBatch(MPSCRingQueue<uint32>&queue, std::deque<uint32>&batch) {
+        queue.popAll(batch);
+    }
+    static void popBatch(ThreadSafeQueue<uint32>&queue, std::deque<uint32>&batch) {
+        queue.swap(batch);
+    }
+    ///Runs numProducers producers against queue, draining it on this thread: returns millions of elements per second
+    template <class Queue> double run(Queue&queue, uint32 numProducers) {
+        uint32 perProducer=ELEMENTS_PER_RUN/numProducers;
+        uint32 total=perProducer*numProducers;
+        uint32 nextSequence[MAX_PRODUCERS]={0};
+        AtomicValue<uint32> ready(0);
+        std::vector<boost::thread*> producers;
+        Task::AbsTime start=Task::AbsTime::now();
+        for (uint32 i=0;i<numProducers;++i) {
+            producers.push_back(new boost::thread(boost::bind(&SendQueueContentionTest::produce<Queue>,&queue,i,perProducer,&ready,numProducers)));
+        }
+        uint32 received=0;
+        bool inOrder=true;
+        std::deque<uint32> batch;
+        while (received<total) {
+            batch.clear();
+            popBatch(queue,batch);
+            if (batch.empty()) {
+                boost::this_thread::yield();
+            }
+            for (std::deque<uint32>::const_iterator i=batch.begin(),ie=batch.end();i!=ie;++i) {
+                uint32 producer=*i>>PRODUCER_SHIFT;
+                if (producer>=numProducers||(*i&SEQUENCE_MASK)!=nextSequence[producer]) {
+                    inOrder=false;
+                }else {
+                    ++nextSequence[producer];
+                }
+            }
+            received+=(uint32)batch.size();
+        }
+        double seconds=(double)(Task::AbsTime::now()-start);
+        for (uint32 i=0;i<numProducers;++i) {
+            producers[i]->join();
+            delete producers[i];
+        }
+        TS_ASSERT(inOrder);
+        TS_ASSERT_EQUALS(received,total);
+        return seconds>0?total/seconds/1000000.:0;
+    }
+public:
+    void testContention( void ) {
+        for (uint32 numProducers=1;numProducers<=MAX_PRODUCERS;numProducers*=2) {
+            MPSCRingQueue<uint32> ring(1024);
+            ThreadSafeQueue<uint32> locked;
+            double ringRate=run(ring,numProducers);
+            double lockedRate=run(locked,numProducers);
+            std::cerr<<"\nSendQueueContentionTest "<<numProducers<<" producers: ring "<<ringRate<<" M/s, locked "<<lockedRate<<" M/s";
+            TS_ASSERT(ring.probablyEmpty());
+        }
+        std::cerr<<'\n';
+    }
+    void testOverflowOrdering( void ) {
+        //a ring this small overflows constantly, so order must survive the hand offs between ring and overflow
+        for (uint32 numProducers=1;numProducers<=MAX_PRODUCERS;numProducers*=4) {
+            MPSCRingQueue<uint32> ring(8);
+            run(ring,numProducers);
+            TS_ASSERT(ring.probablyEmpty());
+        }
+    }
+};
@@ -0,0 +1,132 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  SendWindowTest.hpp
+ *
+ *  Copyright (c) 2008, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPDefinitions.hpp"
+#include "network/ChunkPool.hpp"
+#include "network/SendWindow.hpp"
+#include "network/TCPStream.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "util/ThreadSafeQueue.hpp"
+#include "network/ASIOSocketWrapper.hpp"
+#include "network/MultiplexedSocket.hpp"
+#include <cxxtest/TestSuite.h>
+using namespace Sirikata::Network;
+class SendWindowTest : public CxxTest::TestSuite
+{
+    int mReadyCalls;
+    void ready() {
+        ++mReadyCalls;
+    }
+public:
+    void setUp( void ) {
+        mReadyCalls=0;
+    }
+    void testFillAndDrain( void ) {
+        SendWindow*window=new SendWindow;
+        window->setWindow(4000,std::tr1::bind(&SendWindowTest::ready,this));
+        std::vector<Chunk*> chunks;
+        for (int i=0;i<3;++i) {
+            chunks.push_back(ChunkPool::allocate(1000));
+            TS_ASSERT(window->attach(chunks.back()));
+        }
+        TS_ASSERT_EQUALS(window->getQueuedBytes(),3000u);
+        chunks.push_back(ChunkPool::allocate(1000));
+        TS_ASSERT(!window->attach(chunks.back()));
+        //the producer is owed a callback only once the queue is down to half the window
+        ChunkPool::release(chunks[0]);
+        TS_ASSERT_EQUALS(mReadyCalls,0);
+        ChunkPool::release(chunks[1]);
+        TS_ASSERT_EQUALS(mReadyCalls,1);
+        TS_ASSERT_EQUALS(window->getQueuedBytes(),2000u);
+        ChunkPool::release(chunks[2]);
+        ChunkPool::release(chunks[3]);
+        TS_ASSERT_EQUALS(mReadyCalls,1);
+        TS_ASSERT_EQUALS(window->getQueuedBytes(),0u);
+        window->release();
+    }
+    void testSharedChunkCountsOnce( void ) {
+        SendWindow*window=new SendWindow;
+        Chunk*chunk=ChunkPool::allocate(500);
+        window->attach(chunk);
+        ChunkPool::share(chunk,2);
+        ChunkPool::release(chunk);
+        ChunkPool::release(chunk);
+        TS_ASSERT_EQUALS(window->getQueuedBytes(),500u);
+        ChunkPool::release(chunk);
+        TS_ASSERT_EQUALS(window->getQueuedBytes(),0u);
+        window->release();
+    }
+    void testGrowingWindowReleasesProducer( void ) {
+        SendWindow*window=new SendWindow;
+        window->setWindow(1000,std::tr1::bind(&SendWindowTest::ready,this));
+        Chunk*chunk=ChunkPool::allocate(1500);
+        TS_ASSERT(!window->attach(chunk));
+        window->setWindow(4000,std::tr1::bind(&SendWindowTest::ready,this));
+        TS_ASSERT_EQUALS(mReadyCalls,1);
+        ChunkPool::release(chunk);
+        TS_ASSERT_EQUALS(mReadyCalls,1);
+        window->release();
+    }
+    void testFailedConnectionRetiresQueue( void ) {
+        using namespace boost::asio::ip;
+        IOService*io=IOServiceFactory::makeIOService();
+        {
+            tcp::acceptor acceptor(*io,tcp::endpoint(address_v4::loopback(),0));
+            TCPSocket*sender=new TCPSocket(*io);
+            TCPSocket receiver(*io);
+            sender->connect(acceptor.local_endpoint());
+            acceptor.accept(receiver);
+            std::tr1::shared_ptr<MultiplexedSocket> connection=
+                MultiplexedSocket::construct<MultiplexedSocket>(io,Sirikata::UUID::random(),std::vector<TCPSocket*>(1,sender),&Stream::ignoreSubstreamCallback);
+            SendWindow*window=new SendWindow;
+            //far more than the socket buffers hold, so most of it is still queued when the other end goes away
+            for (int i=0;i<64;++i) {
+                Chunk*chunk=ChunkPool::allocate(256*1024);
+                window->attach(chunk);
+                connection->getASIOSocketWrapper(0).rawSend(connection,chunk,NormalPriority,Stream::StreamID(1));
+            }
+            //closing with the data unread resets the connection, failing the send in flight
+            receiver.close();
+            io->run();
+            TS_ASSERT_EQUALS(window->getQueuedBytes(),0u);
+            window->release();
+        }
+        IOServiceFactory::destroyIOService(io);
+    }
+    void testOutlivesStream( void ) {
+        SendWindow*window=new SendWindow;
+        Chunk*chunk=ChunkPool::allocate(100);
+        window->attach(chunk);
+        //the stream lets go first: the queued chunk keeps the window alive until it is retired
+        window->release();
+        ChunkPool::release(chunk);
+    }
+};
@@ -0,0 +1,243 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  StreamCompressionTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPStream.hpp"
+#include "network/TCPStreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include "network/StreamCompression.hpp"
+#include "options/Options.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Checks that the codec gets back what it compressed, alone and in a history, and rejects what it did not make,
+ * then sends repetitive messages of every reliability over a connection that has offered to decompress them,
+ * and small compressed ones while long ones that do not compress are being reassembled from their frames
+ */
+class StreamCompressionTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_MESSAGES=64,
+        MESSAGE_LENGTH=3000,
+        NUM_LARGE=8,
+        LARGE_LENGTH=60000
+    };
+    IOService*mIO;
+    boost::thread*mThread;
+    Sirikata::AtomicValue<int> mReceived;
+    Sirikata::AtomicValue<int> mMismatched;
+    Sirikata::AtomicValue<int> mLargeReceived;
+    std::vector<Stream*> mAccepted;
+    static Chunk makeMessage(int which) {
+        Chunk message(MESSAGE_LENGTH);
+        for (size_t i=0;i<message.size();++i) {
+            message[i]="object 17 position velocity orientation "[i%40];
+        }
+        message[which%MESSAGE_LENGTH]=(Sirikata::uint8)which;
+        message[0]=(Sirikata::uint8)which;
+        return message;
+    }
+    static Chunk makeLargeMessage(int which) {
+        Chunk message(LARGE_LENGTH);
+        Sirikata::uint32 seed=which;
+        for (size_t i=0;i<message.size();++i) {
+            seed=seed*1103515245+12345;
+            message[i]=(Sirikata::uint8)(seed>>16);
+        }
+        message[0]=(Sirikata::uint8)which;
+        return message;
+    }
+    void dataCallback(const Chunk&data) {
+        if (data.size()==LARGE_LENGTH) {
+            if (data!=makeLargeMessage(data[0])) {
+                ++mMismatched;
+            }
+            ++mLargeReceived;
+            return;
+        }
+        if (data.empty()||data!=makeMessage(data[0])) {
+            ++mMismatched;
+        }
+        ++mReceived;
+    }
+    void newStreamCallback(Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            using std::tr1::placeholders::_1;
+            mAccepted.push_back(newStream);
+            setCallbacks(&Stream::ignoreConnectionStatus,std::tr1::bind(&StreamCompressionTest::dataCallback,this,_1));
+        }
+    }
+    void waitFor(Sirikata::AtomicValue<int>&count, int target) {
+        for (int waits=0;count.read()<target&&waits<500;++waits) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+    }
+public:
+    StreamCompressionTest():mReceived(0),mMismatched(0),mLargeReceived(0) {
+    }
+    void setUp( void ) {
+        mReceived=0;
+        mMismatched=0;
+        mLargeReceived=0;
+        Sirikata::OptionSet::getOptions("tcpsst")->parse("--compression=true");
+        mIO=IOServiceFactory::makeIOService();
+    }
+    void tearDown( void ) {
+        Sirikata::OptionSet::getOptions("tcpsst")->parse("--compression=false");
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    void testHistory( void ) {
+        StreamCompressor compressor;
+        StreamDecompressor decompressor;
+        size_t firstLength=0;
+        for (int i=0;i<8;++i) {
+            Chunk message=makeMessage(i);
+            Chunk compressed;
+            TS_ASSERT(compressor.compress(&message[0],message.size(),compressed));
+            if (i==0) {
+                firstLength=compressed.size();
+            }else {
+                //later messages are mostly copies of the ones before
+                TS_ASSERT_LESS_THAN(compressed.size(),firstLength);
+            }
+            Chunk decompressed;
+            TS_ASSERT(decompressor.decompress(&compressed[0],compressed.size(),decompressed));
+            TS_ASSERT(decompressed==message);
+        }
+    }
+    void testStandaloneAndMalformed( void ) {
+        Chunk message=makeMessage(3);
+        Chunk compressed;
+        TS_ASSERT(StreamCompressor::compressStandalone(&message[0],message.size(),compressed));
+        TS_ASSERT_LESS_THAN(compressed.size(),message.size()/4);
+        Chunk decompressed;
+        TS_ASSERT(StreamDecompressor::decompressStandalone(&compressed[0],compressed.size(),decompressed));
+        TS_ASSERT(decompressed==message);
+        //cut short or pointing back before the message
+        TS_ASSERT(!StreamDecompressor::decompressStandalone(&compressed[0],compressed.size()-1,decompressed));
+        StreamCompressor compressor;
+        Chunk first;
+        Chunk second;
+        TS_ASSERT(compressor.compress(&message[0],message.size(),first));
+        TS_ASSERT(compressor.compress(&message[0],message.size(),second));
+        StreamDecompressor decompressor;
+        TS_ASSERT(!decompressor.decompress(&second[0],second.size(),decompressed));
+        //bytes that do not repeat are left alone
+        Chunk noise(1000);
+        Sirikata::uint32 seed=12345;
+        for (size_t i=0;i<noise.size();++i) {
+            seed=seed*1103515245+12345;
+            noise[i]=(Sirikata::uint8)(seed>>16);
+        }
+        Chunk noiseCompressed;
+        TS_ASSERT(!StreamCompressor::compressStandalone(&noise[0],noise.size(),noiseCompressed));
+        TS_ASSERT(noiseCompressed.empty());
+    }
+    void testCompressedConnection( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        TCPStreamListener listener(*mIO);
+        listener.listen(Address("127.0.0.1","9192"),std::tr1::bind(&StreamCompressionTest::newStreamCallback,this,_1,_2));
+        mThread=new boost::thread(std::tr1::bind(&IOServiceFactory::runService,mIO));
+        TCPStream connector(*mIO);
+        connector.setMaxFrameSize(1000);
+        connector.connect(Address("127.0.0.1","9192"),
+                          &Stream::ignoreSubstreamCallback,
+                          &Stream::ignoreConnectionStatus,
+                          &Stream::ignoreBytesReceived);
+        connector.send(makeMessage(0),ReliableOrdered);
+        waitFor(mReceived,1);
+        //give the listener's offer, which follows the handshake, time to arrive
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        for (int i=1;i<=NUM_MESSAGES;++i) {
+            connector.send(makeMessage(i),i%3==0?ReliableUnordered:ReliableOrdered);
+        }
+        connector.send(makeMessage(NUM_MESSAGES+1),Unreliable);
+        waitFor(mReceived,NUM_MESSAGES+2);
+        TS_ASSERT_EQUALS(mReceived.read(),NUM_MESSAGES+2);
+        TS_ASSERT_EQUALS(mMismatched.read(),0);
+        connector.close();
+        for (size_t i=0;i<mAccepted.size();++i) {
+            mAccepted[i]->close();
+            delete mAccepted[i];
+        }
+        mAccepted.clear();
+        IOServiceFactory::stopService(mIO);
+        mThread->join();
+        delete mThread;
+    }
+    void testInterleavedFragments( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        TCPStreamListener listener(*mIO);
+        listener.listen(Address("127.0.0.1","9193"),std::tr1::bind(&StreamCompressionTest::newStreamCallback,this,_1,_2));
+        mThread=new boost::thread(std::tr1::bind(&IOServiceFactory::runService,mIO));
+        TCPStream connector(*mIO);
+        connector.setNumSockets(3);
+        connector.setMaxFrameSize(1000);
+        connector.connect(Address("127.0.0.1","9193"),
+                          &Stream::ignoreSubstreamCallback,
+                          &Stream::ignoreConnectionStatus,
+                          &Stream::ignoreBytesReceived);
+        connector.send(makeMessage(0),ReliableOrdered);
+        waitFor(mReceived,1);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        int reliable=1;
+        int sent=1;
+        for (int i=0;i<NUM_LARGE;++i) {
+            //the long message goes out in frames on the ordered socket while the short ones may take the others
+            connector.send(makeLargeMessage(i),ReliableOrdered);
+            for (int j=1;j<=8;++j) {
+                StreamReliability reliability=j%2?Unreliable:ReliableUnordered;
+                connector.send(makeMessage(i*8+j),reliability);
+                if (reliability!=Unreliable) {
+                    ++reliable;
+                }
+                ++sent;
+            }
+        }
+        waitFor(mLargeReceived,NUM_LARGE);
+        waitFor(mReceived,reliable);
+        TS_ASSERT_EQUALS(mLargeReceived.read(),NUM_LARGE);
+        TS_ASSERT_LESS_THAN_EQUALS(reliable,mReceived.read());
+        TS_ASSERT_LESS_THAN_EQUALS(mReceived.read(),sent);
+        TS_ASSERT_EQUALS(mMismatched.read(),0);
+        connector.close();
+        for (size_t i=0;i<mAccepted.size();++i) {
+            mAccepted[i]->close();
+            delete mAccepted[i];
+        }
+        mAccepted.clear();
+        IOServiceFactory::stopService(mIO);
+        mThread->join();
+        delete mThread;
+    }
+};
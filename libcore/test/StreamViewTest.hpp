@@ -0,0 +1,154 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  StreamViewTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "network/TCPStream.hpp"
+#include "network/TCPStreamListener.hpp"
+#include "network/IOServiceFactory.hpp"
+#include <cxxtest/TestSuite.h>
+#include <boost/thread.hpp>
+using namespace Sirikata::Network;
+/**
+ * Drives a connection entirely through the view callbacks: the listener's substreams take setViewCallbacks
+ * and echo what they get, the connector uses connectViews and a clone of it cloneFromViews.
+ * The listener keeps every view it is handed, which must still hold its packet once the receive buffers have moved on
+ */
+class StreamViewTest : public CxxTest::TestSuite
+{
+    enum {
+        NUM_MESSAGES=96
+    };
+    IOService*mIO;
+    boost::thread*mThread;
+    Sirikata::AtomicValue<int> mReceived;
+    Sirikata::AtomicValue<int> mEchoed;
+    Sirikata::AtomicValue<int> mMismatched;
+    Sirikata::AtomicValue<int> mBorrowed;
+    std::vector<Stream*> mAccepted;
+    std::vector<ChunkView> mHeld;
+    static size_t messageLength(int which) {
+        //from a few bytes to several times a receive slab
+        static const size_t lengths[]={3,200,1400,9000,17000,70000};
+        return lengths[which%(sizeof(lengths)/sizeof(lengths[0]))];
+    }
+    static Chunk makeMessage(int which) {
+        Chunk message(messageLength(which));
+        for (size_t i=0;i<message.size();++i) {
+            message[i]=(Sirikata::uint8)(which*7+i);
+        }
+        message[0]=(Sirikata::uint8)which;
+        return message;
+    }
+    static bool matches(const ChunkView&data) {
+        return !data.empty()&&data.copy()==makeMessage(data[0]);
+    }
+    void listenerViewCallback(Stream*stream,const ChunkView&data) {
+        if (!matches(data)) {
+            ++mMismatched;
+        }
+        if (!data.slab()) {
+            ++mBorrowed;
+        }
+        mHeld.push_back(data);
+        ++mReceived;
+        stream->send(data.copy(),ReliableOrdered);
+    }
+    void connectorViewCallback(const ChunkView&data) {
+        if (!matches(data)) {
+            ++mMismatched;
+        }
+        ++mEchoed;
+    }
+    void newStreamCallback(Stream*newStream, Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            using std::tr1::placeholders::_1;
+            mAccepted.push_back(newStream);
+            setCallbacks.setViewCallbacks(&Stream::ignoreConnectionStatus,
+                                          std::tr1::bind(&StreamViewTest::listenerViewCallback,this,newStream,_1));
+        }
+    }
+    void waitFor(Sirikata::AtomicValue<int>&count, int target) {
+        for (int waits=0;count.read()<target&&waits<500;++waits) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+    }
+public:
+    StreamViewTest():mReceived(0),mEchoed(0),mMismatched(0),mBorrowed(0) {
+    }
+    void setUp( void ) {
+        mIO=IOServiceFactory::makeIOService();
+    }
+    void tearDown( void ) {
+        IOServiceFactory::destroyIOService(mIO);
+    }
+    void testViewCallbacks( void ) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        {
+            TCPStreamListener listener(*mIO);
+            listener.listen(Address("127.0.0.1","9194"),std::tr1::bind(&StreamViewTest::newStreamCallback,this,_1,_2));
+            mThread=new boost::thread(std::tr1::bind(&IOServiceFactory::runService,mIO));
+            TCPStream connector(*mIO);
+            connector.connectViews(Address("127.0.0.1","9194"),
+                                   &Stream::ignoreSubstreamCallback,
+                                   &Stream::ignoreConnectionStatus,
+                                   std::tr1::bind(&StreamViewTest::connectorViewCallback,this,_1));
+            Stream*clone=connector.factory();
+            TS_ASSERT(clone->cloneFromViews(&connector,
+                                            &Stream::ignoreConnectionStatus,
+                                            std::tr1::bind(&StreamViewTest::connectorViewCallback,this,_1)));
+            for (int i=0;i<NUM_MESSAGES;++i) {
+                (i%2?clone:&connector)->send(makeMessage(i),ReliableOrdered);
+            }
+            waitFor(mEchoed,NUM_MESSAGES);
+            TS_ASSERT_EQUALS(mReceived.read(),NUM_MESSAGES);
+            TS_ASSERT_EQUALS(mEchoed.read(),NUM_MESSAGES);
+            TS_ASSERT_EQUALS(mMismatched.read(),0);
+            TS_ASSERT_EQUALS(mBorrowed.read(),0);
+            clone->close();
+            delete clone;
+            connector.close();
+            for (size_t i=0;i<mAccepted.size();++i) {
+                mAccepted[i]->close();
+                delete mAccepted[i];
+            }
+            mAccepted.clear();
+            IOServiceFactory::stopService(mIO);
+            mThread->join();
+            delete mThread;
+        }
+        //the views outlive the connection that filled their slabs
+        TS_ASSERT_EQUALS(mHeld.size(),(size_t)NUM_MESSAGES);
+        for (size_t i=0;i<mHeld.size();++i) {
+            TS_ASSERT(matches(mHeld[i]));
+        }
+        mHeld.clear();
+    }
+};
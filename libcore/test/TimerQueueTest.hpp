@@ -0,0 +1,284 @@
+/*  Sirikata Tests -- Sirikata Test Suite
+ *  TimerQueueTest.hpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util/Standard.hh"
+#include "task/TimerQueue.hpp"
+#include <cxxtest/TestSuite.h>
+using namespace Sirikata;
+/**
+ * Checks the timing wheel behind Task::TimerQueue: order, cancellation and rescheduling,
+ * and events far enough ahead to be cascaded down every wheel.
+ * testBenchmark races it against the std::map<AbsTime,std::list<TimedEvent> > it replaced
+ */
+class TimerQueueTest : public CxxTest::TestSuite
+{
+    enum {
+        BENCHMARK_EVENTS=1<<18,
+        ///The benchmark spreads its events over this many milliseconds and processes once a millisecond
+        BENCHMARK_SPAN=10000
+    };
+    typedef Task::AbsTime AbsTime;
+    typedef Task::DeltaTime DeltaTime;
+    typedef Task::SubscriptionId SubscriptionId;
+    std::vector<int> mFired;
+    std::vector<AbsTime> mFiredAt;
+    AbsTime mNow;
+    Task::TimerQueue *mQueue;
+    SubscriptionId mId;
+    int mRepeats;
+    DeltaTime record(int which) {
+        mFired.push_back(which);
+        mFiredAt.push_back(mNow);
+        return DeltaTime::seconds(-1);
+    }
+    DeltaTime repeat(int which, DeltaTime again) {
+        record(which);
+        return --mRepeats>0?again:DeltaTime::seconds(-1);
+    }
+    DeltaTime cancelSelf(int which) {
+        record(which);
+        mQueue->unschedule(mId);
+        return DeltaTime::seconds(0);
+    }
+    static DeltaTime count(uint32*fired) {
+        ++*fired;
+        return DeltaTime::seconds(-1);
+    }
+    Task::TimedEvent event(int which) {
+        return std::tr1::bind(&TimerQueueTest::record,this,which);
+    }
+    AbsTime at(int64 ms) {
+        return mNow+DeltaTime::milliseconds(ms);
+    }
+    void process(Task::TimerQueue&queue, int64 ms) {
+        mNow=mNow+DeltaTime::milliseconds(ms);
+        queue.processTimerQueue(mNow);
+    }
+    ///The queue the TimerQueue replaced, with an index from id to time so that unschedule need only search one list
+    class MapTimerQueue {
+        std::map<AbsTime,std::list<std::pair<SubscriptionId,Task::TimedEvent> > > mQueue;
+        std::map<SubscriptionId,AbsTime> mTimes;
+        SubscriptionId mNextId;
+    public:
+        MapTimerQueue():mNextId(0) {}
+        SubscriptionId scheduleId(AbsTime nextTime, const Task::TimedEvent&ev) {
+            mQueue[nextTime].push_back(std::pair<SubscriptionId,Task::TimedEvent>(mNextId,ev));
+            mTimes.insert(std::pair<SubscriptionId,AbsTime>(mNextId,nextTime));
+            return mNextId++;
+        }
+        void unschedule(const SubscriptionId&removeId) {
+            std::map<SubscriptionId,AbsTime>::iterator time=mTimes.find(removeId);
+            if (time==mTimes.end()) return;
+            std::list<std::pair<SubscriptionId,Task::TimedEvent> >&events=mQueue[time->second];
+            for (std::list<std::pair<SubscriptionId,Task::TimedEvent> >::iterator i=events.begin(),ie=events.end();i!=ie;++i) {
+                if (i->first==removeId) {
+                    events.erase(i);
+                    break;
+                }
+            }
+            if (events.empty()) mQueue.erase(time->second);
+            mTimes.erase(time);
+        }
+        void processTimerQueue(AbsTime now) {
+            while (!mQueue.empty()&&mQueue.begin()->first<=now) {
+                std::list<std::pair<SubscriptionId,Task::TimedEvent> > events;
+                events.swap(mQueue.begin()->second);
+                mQueue.erase(mQueue.begin());
+                for (std::list<std::pair<SubscriptionId,Task::TimedEvent> >::iterator i=events.begin(),ie=events.end();i!=ie;++i) {
+                    mTimes.erase(i->first);
+                    i->second();
+                }
+            }
+        }
+    };
+    ///Schedules BENCHMARK_EVENTS events, cancels every other one and runs the rest: returns millions of events per second
+    template <class Queue> double run(Queue&queue) {
+        uint32 fired=0;
+        AbsTime base=AbsTime::now();
+        AbsTime start=base;
+        std::vector<SubscriptionId> ids(BENCHMARK_EVENTS);
+        uint32 random=12345;
+        for (uint32 i=0;i<BENCHMARK_EVENTS;++i) {
+            random=random*1103515245+12345;
+            ids[i]=queue.scheduleId(base+DeltaTime::microseconds((int64)((random>>8)%(BENCHMARK_SPAN*1000))),
+                                    std::tr1::bind(&TimerQueueTest::count,&fired));
+        }
+        for (uint32 i=0;i<BENCHMARK_EVENTS;i+=2) {
+            queue.unschedule(ids[i]);
+        }
+        //one more tick for the events due in the last one
+        for (int64 ms=0;ms<=BENCHMARK_SPAN+1;++ms) {
+            queue.processTimerQueue(base+DeltaTime::milliseconds(ms));
+        }
+        double seconds=(double)(AbsTime::now()-start);
+        TS_ASSERT_EQUALS(fired,(uint32)BENCHMARK_EVENTS/2);
+        return seconds>0?BENCHMARK_EVENTS/seconds/1000000.:0;
+    }
+public:
+    TimerQueueTest():mNow(AbsTime::null()),mQueue(NULL),mId(-1),mRepeats(0) {}
+    void setUp( void ) {
+        mFired.clear();
+        mFiredAt.clear();
+        //start on a tick so that each process() below ends on one
+        int64 us=(AbsTime::now()-AbsTime::null()).toMicroseconds();
+        mNow=AbsTime::microseconds(us-us%Task::TimerQueue::TICK_MICROSECONDS);
+        mQueue=NULL;
+        mId=-1;
+        mRepeats=0;
+    }
+    void testOrder( void ) {
+        Task::TimerQueue queue;
+        queue.schedule(at(30),event(3));
+        queue.schedule(at(10),event(1));
+        queue.schedule(at(20),event(2));
+        queue.schedule(at(10),event(4));
+        process(queue,15);
+        TS_ASSERT_EQUALS(mFired.size(),2u);
+        process(queue,100);
+        TS_ASSERT_EQUALS(mFired.size(),4u);
+        if (mFired.size()==4) {
+            TS_ASSERT_EQUALS(mFired[0]+mFired[1],5);
+            TS_ASSERT_EQUALS(mFired[2],2);
+            TS_ASSERT_EQUALS(mFired[3],3);
+        }
+        TS_ASSERT_EQUALS(queue.numScheduled(),0u);
+    }
+    void testNeverEarly( void ) {
+        Task::TimerQueue queue;
+        AbsTime due=at(5)+DeltaTime::microseconds(1);
+        queue.schedule(due,event(1));
+        process(queue,5);
+        TS_ASSERT(mFired.empty());
+        mNow=due;
+        queue.processTimerQueue(mNow);
+        TS_ASSERT(mFired.empty());
+        process(queue,1);
+        TS_ASSERT_EQUALS(mFired.size(),1u);
+    }
+    void testUnschedule( void ) {
+        Task::TimerQueue queue;
+        SubscriptionId first=queue.scheduleId(at(10),event(1));
+        queue.scheduleId(at(10),event(2));
+        queue.unschedule(first);
+        queue.unschedule(first);
+        TS_ASSERT_EQUALS(queue.numScheduled(),1u);
+        //the entry first used is reused: its old id must not cancel the new event
+        SubscriptionId reused=queue.scheduleId(at(10),event(3));
+        TS_ASSERT_DIFFERS(reused,first);
+        queue.unschedule(first);
+        queue.unschedule(-1);
+        process(queue,10);
+        TS_ASSERT_EQUALS(mFired.size(),2u);
+        if (mFired.size()==2) {
+            TS_ASSERT_EQUALS(mFired[0]+mFired[1],5);
+        }
+    }
+    void testRepeat( void ) {
+        Task::TimerQueue queue;
+        mRepeats=3;
+        queue.schedule(at(1),std::tr1::bind(&TimerQueueTest::repeat,this,1,DeltaTime::milliseconds((int64)10)));
+        process(queue,1);
+        TS_ASSERT_EQUALS(mFired.size(),1u);
+        process(queue,9);
+        TS_ASSERT_EQUALS(mFired.size(),1u);
+        process(queue,1);
+        TS_ASSERT_EQUALS(mFired.size(),2u);
+        process(queue,1000);
+        TS_ASSERT_EQUALS(mFired.size(),3u);
+        TS_ASSERT_EQUALS(queue.numScheduled(),0u);
+    }
+    void testZeroWaitsForNextCall( void ) {
+        Task::TimerQueue queue;
+        mRepeats=3;
+        queue.schedule(at(1),std::tr1::bind(&TimerQueueTest::repeat,this,1,DeltaTime::seconds(0)));
+        process(queue,1000);
+        TS_ASSERT_EQUALS(mFired.size(),1u);
+        queue.processTimerQueue(mNow);
+        TS_ASSERT_EQUALS(mFired.size(),1u);
+        process(queue,1);
+        TS_ASSERT_EQUALS(mFired.size(),2u);
+        process(queue,1);
+        TS_ASSERT_EQUALS(mFired.size(),3u);
+    }
+    void testUnscheduleSelf( void ) {
+        Task::TimerQueue queue;
+        mQueue=&queue;
+        mId=queue.scheduleId(at(1),std::tr1::bind(&TimerQueueTest::cancelSelf,this,1));
+        process(queue,1);
+        process(queue,1);
+        TS_ASSERT_EQUALS(mFired.size(),1u);
+        TS_ASSERT_EQUALS(queue.numScheduled(),0u);
+    }
+    void testCascade( void ) {
+        Task::TimerQueue queue;
+        //one for each wheel and one beyond the last
+        int64 aheadMs[]={200,60000,20000000,(int64)5000000000LL};
+        for (int i=0;i<4;++i) {
+            queue.schedule(at(aheadMs[i]),event(i));
+        }
+        AbsTime base=mNow;
+        for (int i=0;i<4;++i) {
+            //jump to just before each event, then walk up to it a millisecond at a time
+            mNow=base+DeltaTime::milliseconds(aheadMs[i]-3);
+            queue.processTimerQueue(mNow);
+            TS_ASSERT_EQUALS(mFired.size(),(size_t)i);
+            for (int step=0;step<6;++step) {
+                process(queue,1);
+            }
+            TS_ASSERT_EQUALS(mFired.size(),(size_t)i+1);
+            if (mFired.size()==(size_t)i+1) {
+                TS_ASSERT_EQUALS(mFired[i],i);
+                TS_ASSERT(mFiredAt[i]>=base+DeltaTime::milliseconds(aheadMs[i]));
+                TS_ASSERT(mFiredAt[i]<=base+DeltaTime::milliseconds(aheadMs[i]+2));
+            }
+        }
+    }
+    void testLongGap( void ) {
+        //events still waiting to cascade down when a single call passes their time must run in that call
+        Task::TimerQueue queue;
+        queue.schedule(at((int64)5000000000LL),event(2));
+        queue.schedule(at(70000),event(1));
+        process(queue,(int64)6000000000LL);
+        TS_ASSERT_EQUALS(mFired.size(),2u);
+        if (mFired.size()==2) {
+            TS_ASSERT_EQUALS(mFired[0],1);
+            TS_ASSERT_EQUALS(mFired[1],2);
+        }
+    }
+    void testBenchmark( void ) {
+        Task::TimerQueue wheel;
+        MapTimerQueue map;
+        double wheelRate=run(wheel);
+        double mapRate=run(map);
+        std::cerr<<"\nTimerQueueTest "<<BENCHMARK_EVENTS<<" events: wheel "<<wheelRate<<" M/s, map "<<mapRate<<" M/s\n";
+        TS_ASSERT_EQUALS(wheel.numScheduled(),0u);
+    }
+};
@@ -0,0 +1,395 @@
+/*  Sirikata TCPSST Benchmark
+ *  main.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <util/Standard.hh>
+#include <options/Options.hpp>
+#include <task/Time.hpp>
+#include <network/TCPStream.hpp>
+#include <network/TCPStreamListener.hpp>
+#include <network/IOServiceFactory.hpp>
+#include <network/FrameScanner.hpp>
+#include <boost/thread.hpp>
+
+namespace Sirikata {
+namespace {
+OptionValue*sSockets;
+OptionValue*sSizes;
+OptionValue*sStreams;
+OptionValue*sReliabilities;
+OptionValue*sMessages;
+OptionValue*sMaxBytes;
+OptionValue*sWindow;
+OptionValue*sPort;
+OptionValue*sFrameScan;
+InitializeGlobalOptions gBenchOptions("tcpsstbench",
+    sSockets=new OptionValue("sockets","1,3,8",OptionValueType<std::string>(),"Comma separated numbers of TCP sockets per connection to measure"),
+    sSizes=new OptionValue("sizes","16,1024,16384,262144",OptionValueType<std::string>(),"Comma separated message sizes in bytes to measure: messages always have room for the 8 byte send time"),
+    sStreams=new OptionValue("streams","1,8",OptionValueType<std::string>(),"Comma separated numbers of streams sharing the connection to measure"),
+    sReliabilities=new OptionValue("reliability","ordered,unordered,unreliable",OptionValueType<std::string>(),"Comma separated reliability modes to measure"),
+    sMessages=new OptionValue("messages","20000",OptionValueType<unsigned int>(),"Most messages sent by each run"),
+    sMaxBytes=new OptionValue("maxbytes","268435456",OptionValueType<size_t>(),"Runs with large messages send fewer of them so that no run sends more than this many bytes"),
+    sWindow=new OptionValue("window","1048576",OptionValueType<size_t>(),"The send window of each stream: senders wait for it to drain to half before sending more"),
+    sPort=new OptionValue("port","9190",OptionValueType<unsigned int>(),"The loopback port the benchmark listens on"),
+    sFrameScan=new OptionValue("framescan","",OptionValueType<std::string>(),"Comma separated largest payloads of the tiny packets to split a receive buffer into, one packet at a time and with FrameScanner, instead of measuring connections"),
+    NULL);
+
+std::vector<std::string> splitList(const std::string&list) {
+    std::vector<std::string> retval;
+    std::string::size_type start=0;
+    while (start<=list.size()) {
+        std::string::size_type end=list.find(',',start);
+        if (end==std::string::npos)
+            end=list.size();
+        if (end>start)
+            retval.push_back(list.substr(start,end-start));
+        start=end+1;
+    }
+    return retval;
+}
+std::vector<unsigned int> splitNumbers(const std::string&list) {
+    std::vector<std::string> items=splitList(list);
+    std::vector<unsigned int> retval;
+    for (size_t i=0;i<items.size();++i) {
+        retval.push_back((unsigned int)atoi(items[i].c_str()));
+    }
+    return retval;
+}
+bool parseReliability(const std::string&name,Network::StreamReliability&reliability) {
+    if (name=="ordered") {
+        reliability=Network::ReliableOrdered;
+    }else if (name=="unordered") {
+        reliability=Network::ReliableUnordered;
+    }else if (name=="unreliable") {
+        reliability=Network::Unreliable;
+    }else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * One measurement: a connection over loopback carrying a number of streams, all of which a single thread fills with
+ * messages of one size as fast as their send windows allow. Each message carries the time it was sent, so the
+ * receiving end, which lives in the same process, can tell how long it took to arrive
+ */
+class BenchmarkRun {
+public:
+    enum {
+        ///Bytes at the front of every message: the microsecond it was sent
+        HEADER_LENGTH=8,
+        ///How long the receiver may go without a message before the rest are taken to be dropped
+        STALL_MILLISECONDS=1000
+    };
+    unsigned int mNumSockets;
+    size_t mMessageSize;
+    unsigned int mNumStreams;
+    Network::StreamReliability mReliability;
+    unsigned int mNumMessages;
+    size_t mWindow;
+
+    Network::IOService*mIO;
+    std::vector<Network::Stream*> mSenders;
+    std::vector<Network::Stream*> mReceivers;
+    AtomicValue<int> mConnected;
+    AtomicValue<uint32> mReceived;
+    uint64 mReceivedBytes;
+    ///Microseconds each message took to arrive, in the order they arrived: only touched by the IO thread
+    std::vector<uint32> mLatencies;
+    Task::AbsTime mStart;
+    Task::AbsTime mLastReceive;
+    boost::mutex mWindowMutex;
+    boost::condition_variable mWindowDrained;
+
+    BenchmarkRun():mConnected(0),mReceived(0),mReceivedBytes(0),mStart(Task::AbsTime::null()),mLastReceive(Task::AbsTime::null()) {
+    }
+    void connectionCallback(Network::Stream::ConnectionStatus status,const std::string&reason) {
+        if (status==Network::Stream::Connected) {
+            ++mConnected;
+        }else if (status==Network::Stream::ConnectionFailed) {
+            std::cerr<<"Benchmark connection failed: "<<reason<<"\n";
+        }
+    }
+    void bytesReceived(const Network::ChunkView&data) {
+        Task::AbsTime now=Task::AbsTime::now();
+        if (data.size()>=HEADER_LENGTH) {
+            uint64 sent=0;
+            std::memcpy(&sent,data.data(),HEADER_LENGTH);
+            mLatencies.push_back((uint32)(now-Task::AbsTime::microseconds((int64)sent)).toMicroseconds());
+        }
+        mReceivedBytes+=data.size();
+        mLastReceive=now;
+        ++mReceived;
+    }
+    void newStream(Network::Stream*newStream,Network::Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            using std::tr1::placeholders::_1;
+            mReceivers.push_back(newStream);
+            setCallbacks.setViewCallbacks(&Network::Stream::ignoreConnectionStatus,std::tr1::bind(&BenchmarkRun::bytesReceived,this,_1));
+        }
+    }
+    void windowDrained() {
+        boost::lock_guard<boost::mutex> lok(mWindowMutex);
+        mWindowDrained.notify_all();
+    }
+    ///Sends every message, round robin over the streams, waiting on any stream whose window is full
+    void sendAll() {
+        Network::Chunk message(mMessageSize);
+        for (unsigned int i=0;i<mNumMessages;++i) {
+            Network::Stream*stream=mSenders[i%mSenders.size()];
+            while (stream->getQueuedBytes()>mWindow/2) {
+                boost::unique_lock<boost::mutex> lok(mWindowMutex);
+                //timed so that a drain reported between the check and the wait cannot be missed for long
+                mWindowDrained.timed_wait(lok,boost::posix_time::milliseconds(1));
+            }
+            uint64 now=(uint64)(Task::AbsTime::now()-Task::AbsTime::microseconds(0)).toMicroseconds();
+            std::memcpy(&message[0],&now,HEADER_LENGTH);
+            stream->send(message,mReliability);
+        }
+    }
+    ///Runs the measurement on port, returning false if the connection could not be made
+    bool run(unsigned int port) {
+        using std::tr1::placeholders::_1;
+        using std::tr1::placeholders::_2;
+        std::ostringstream service;
+        service<<port;
+        mIO=Network::IOServiceFactory::makeIOService();
+        mLatencies.reserve(mNumMessages);
+        bool retval=false;
+        {
+            Network::TCPStreamListener listener(*mIO);
+            listener.listen(Network::Address("127.0.0.1",service.str()),std::tr1::bind(&BenchmarkRun::newStream,this,_1,_2));
+            boost::thread thread(std::tr1::bind(&Network::IOServiceFactory::runService,mIO));
+            Network::TCPStream*connector=new Network::TCPStream(*mIO);
+            connector->setNumSockets(mNumSockets);
+            connector->setSendWindow(mWindow,std::tr1::bind(&BenchmarkRun::windowDrained,this));
+            connector->connectViews(Network::Address("127.0.0.1",service.str()),
+                                    &Network::Stream::ignoreSubstreamCallback,
+                                    std::tr1::bind(&BenchmarkRun::connectionCallback,this,_1,_2),
+                                    std::tr1::bind(&BenchmarkRun::bytesReceived,this,_1));
+            mSenders.push_back(connector);
+            for (unsigned int i=1;i<mNumStreams;++i) {
+                Network::Stream*clone=connector->factory();
+                clone->cloneFromViews(connector,&Network::Stream::ignoreConnectionStatus,std::tr1::bind(&BenchmarkRun::bytesReceived,this,_1));
+                clone->setSendWindow(mWindow,std::tr1::bind(&BenchmarkRun::windowDrained,this));
+                mSenders.push_back(clone);
+            }
+            for (int waits=0;mConnected.read()==0&&waits<500;++waits) {
+                boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+            }
+            if (mConnected.read()) {
+                retval=true;
+                mStart=Task::AbsTime::now();
+                mLastReceive=mStart;
+                sendAll();
+                //unreliable messages may never arrive: stop once none have for a while
+                uint32 lastCount=0;
+                for (int stalls=0;mReceived.read()<mNumMessages&&stalls<STALL_MILLISECONDS/10;) {
+                    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+                    uint32 count=mReceived.read();
+                    stalls=(count==lastCount)?stalls+1:0;
+                    lastCount=count;
+                }
+            }
+            Network::IOServiceFactory::stopService(mIO);
+            thread.join();
+            for (size_t i=0;i<mSenders.size();++i) {
+                mSenders[i]->close();
+                delete mSenders[i];
+            }
+            for (size_t i=0;i<mReceivers.size();++i) {
+                mReceivers[i]->close();
+                delete mReceivers[i];
+            }
+        }
+        Network::IOServiceFactory::destroyIOService(mIO);
+        return retval;
+    }
+    static void printHeader(std::ostream&out) {
+        out<<"sockets,size,streams,reliability,sent,received,seconds,messages_per_second,bytes_per_second,p50_latency_us,p99_latency_us\n";
+    }
+    void printResult(std::ostream&out,const std::string&reliabilityName) {
+        double seconds=(mLastReceive-mStart).toSeconds();
+        std::sort(mLatencies.begin(),mLatencies.end());
+        uint32 p50=mLatencies.empty()?0:mLatencies[mLatencies.size()/2];
+        uint32 p99=mLatencies.empty()?0:mLatencies[mLatencies.size()*99/100];
+        out<<mNumSockets<<','<<mMessageSize<<','<<mNumStreams<<','<<reliabilityName<<','
+           <<mNumMessages<<','<<mReceived.read()<<','<<seconds<<','
+           <<(seconds>0?mReceived.read()/seconds:0)<<','<<(seconds>0?mReceivedBytes/seconds:0)<<','
+           <<p50<<','<<p99<<'\n';
+        out.flush();
+    }
+};
+
+/**
+ * Times splitting a receive buffer full of packets of up to maxPayload bytes, for streams whose IDs take 1, 2 and 4 bytes,
+ * the way ASIOReadBuffer::translateBuffer used to, decoding one packet at a time, and with FrameScanner
+ */
+class FrameScanBenchmark {
+public:
+    enum {
+        BUFFER_LENGTH=65536,
+        ///How long each way of splitting the buffer is timed for
+        MILLISECONDS=200
+    };
+    Network::Chunk mBuffer;
+    size_t mNumPackets;
+    ///What the scans found, added up so that they cannot be optimized away
+    uint64 mChecksum;
+    explicit FrameScanBenchmark(unsigned int maxPayload):mNumPackets(0),mChecksum(0) {
+        uint32 seed=1;
+        uint8 header[2*Network::Stream::uint30::MAX_SERIALIZED_LENGTH];
+        while (true) {
+            seed=seed*1103515245+12345;
+            uint32 ids[3]={1+(seed>>8)%100,128+(seed>>8)%16000,16384+(seed>>4)%1000000};
+            Network::Stream::StreamID id(ids[(seed>>16)%3]);
+            size_t payload=maxPayload?(seed>>20)%(maxPayload+1):0;
+            unsigned int idLength=id.serialize(header+Network::Stream::uint30::MAX_SERIALIZED_LENGTH,Network::Stream::uint30::MAX_SERIALIZED_LENGTH);
+            unsigned int lengthLength=Network::Stream::uint30((uint32)(idLength+payload)).serialize(header,Network::Stream::uint30::MAX_SERIALIZED_LENGTH);
+            if (mBuffer.size()+lengthLength+idLength+payload>BUFFER_LENGTH)
+                break;
+            mBuffer.insert(mBuffer.end(),header,header+lengthLength);
+            mBuffer.insert(mBuffer.end(),header+Network::Stream::uint30::MAX_SERIALIZED_LENGTH,header+Network::Stream::uint30::MAX_SERIALIZED_LENGTH+idLength);
+            mBuffer.resize(mBuffer.size()+payload,(uint8)payload);
+            ++mNumPackets;
+        }
+    }
+    uint64 scanOneAtATime()const {
+        uint64 checksum=0;
+        const uint8*buffer=&mBuffer[0];
+        size_t pos=0;
+        unsigned int headerLength;
+        Network::Stream::uint30 packetLength;
+        while ((headerLength=(unsigned int)(mBuffer.size()-pos))!=0&&packetLength.unserialize(buffer+pos,headerLength)) {
+            unsigned int idLength=packetLength.read();
+            Network::Stream::StreamID id;
+            id.unserialize(buffer+pos+headerLength,idLength);
+            checksum+=id.read()+pos+headerLength+idLength;
+            pos+=headerLength+packetLength.read();
+        }
+        return checksum;
+    }
+    uint64 scanBatches()const {
+        uint64 checksum=0;
+        const uint8*buffer=&mBuffer[0];
+        size_t pos=0;
+        Network::FrameScanner::Frame frames[Network::FrameScanner::MAX_FRAMES];
+        size_t numFrames;
+        do {
+            size_t consumed;
+            numFrames=Network::FrameScanner::scan(buffer+pos,mBuffer.size()-pos,frames,Network::FrameScanner::MAX_FRAMES,consumed);
+            for (size_t i=0;i<numFrames;++i) {
+                checksum+=frames[i].mID.read()+pos+frames[i].mOffset;
+            }
+            pos+=consumed;
+        }while (numFrames==Network::FrameScanner::MAX_FRAMES);
+        return checksum;
+    }
+    ///Returns the nanoseconds per packet of scanning the buffer over and over for MILLISECONDS
+    double time(uint64 (FrameScanBenchmark::*scan)()const) {
+        Task::AbsTime start=Task::AbsTime::now();
+        Task::AbsTime stop=start+Task::DeltaTime::milliseconds((int64)MILLISECONDS);
+        uint64 scans=0;
+        Task::AbsTime now=start;
+        while (now<stop) {
+            for (int i=0;i<16;++i) {
+                mChecksum+=(this->*scan)();
+            }
+            scans+=16;
+            now=Task::AbsTime::now();
+        }
+        return (now-start).toSeconds()*1e9/((double)scans*mNumPackets);
+    }
+    static void printHeader(std::ostream&out) {
+        out<<"max_payload,packets,one_at_a_time_ns_per_packet,frame_scanner_ns_per_packet\n";
+    }
+    void printResult(std::ostream&out,unsigned int maxPayload) {
+        double one=time(&FrameScanBenchmark::scanOneAtATime);
+        double batch=time(&FrameScanBenchmark::scanBatches);
+        if (scanOneAtATime()!=scanBatches()) {
+            std::cerr<<"FrameScanner disagrees with decoding one packet at a time for payloads up to "<<maxPayload<<"\n";
+        }
+        out<<maxPayload<<','<<mNumPackets<<','<<one<<','<<batch<<'\n';
+        out.flush();
+    }
+};
+}
+}
+
+int main(int argc,const char**argv) {
+    using namespace Sirikata;
+    OptionSet::getOptions("tcpsstbench")->parse(argc,argv);
+    std::vector<unsigned int> frameScanPayloads=splitNumbers(sFrameScan->as<std::string>());
+    if (!frameScanPayloads.empty()) {
+        FrameScanBenchmark::printHeader(std::cout);
+        for (size_t i=0;i<frameScanPayloads.size();++i) {
+            FrameScanBenchmark(frameScanPayloads[i]).printResult(std::cout,frameScanPayloads[i]);
+        }
+        return 0;
+    }
+    std::vector<unsigned int> sockets=splitNumbers(sSockets->as<std::string>());
+    std::vector<unsigned int> sizes=splitNumbers(sSizes->as<std::string>());
+    std::vector<unsigned int> streams=splitNumbers(sStreams->as<std::string>());
+    std::vector<std::string> reliabilities=splitList(sReliabilities->as<std::string>());
+    unsigned int port=sPort->as<unsigned int>();
+    BenchmarkRun::printHeader(std::cout);
+    int failures=0;
+    for (size_t s=0;s<sockets.size();++s) {
+        for (size_t z=0;z<sizes.size();++z) {
+            for (size_t n=0;n<streams.size();++n) {
+                for (size_t r=0;r<reliabilities.size();++r) {
+                    BenchmarkRun run;
+                    if (!parseReliability(reliabilities[r],run.mReliability)) {
+                        std::cerr<<"Unknown reliability \""<<reliabilities[r]<<"\": use ordered, unordered or unreliable\n";
+                        return 1;
+                    }
+                    run.mNumSockets=sockets[s];
+                    run.mMessageSize=sizes[z]<BenchmarkRun::HEADER_LENGTH?(size_t)BenchmarkRun::HEADER_LENGTH:sizes[z];
+                    run.mNumStreams=streams[n]?streams[n]:1;
+                    run.mNumMessages=sMessages->as<unsigned int>();
+                    if (run.mNumMessages>sMaxBytes->as<size_t>()/run.mMessageSize) {
+                        run.mNumMessages=(unsigned int)(sMaxBytes->as<size_t>()/run.mMessageSize);
+                    }
+                    run.mWindow=sWindow->as<size_t>();
+                    //a fresh port for every run so that one run's lingering sockets cannot get in the next one's way
+                    if (run.run(port++)) {
+                        run.printResult(std::cout,reliabilities[r]);
+                    }else {
+                        std::cerr<<"Could not connect for "<<sockets[s]<<" sockets, "<<sizes[z]<<" byte messages, "
+                                 <<streams[n]<<" streams, "<<reliabilities[r]<<"\n";
+                        ++failures;
+                    }
+                }
+            }
+        }
+    }
+    return failures?1:0;
+}
@@ -0,0 +1,110 @@
+/*  Sirikata TCPSST Replay
+ *  main.cpp
+ *
+ *  Copyright (c) 2009, Daniel Reiter Horn
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of Sirikata nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <util/Standard.hh>
+#include <options/Options.hpp>
+#include <network/IOServiceFactory.hpp>
+#include <network/PacketReplay.hpp>
+
+namespace Sirikata {
+namespace {
+OptionValue*sCapture;
+OptionValue*sIterations;
+InitializeGlobalOptions gReplayOptions("tcpsstreplay",
+    sCapture=new OptionValue("capture","",OptionValueType<std::string>(),"The packet capture to replay, as recorded by the capture option of tcpsst"),
+    sIterations=new OptionValue("iterations","1",OptionValueType<unsigned int>(),"How many times to replay the capture"),
+    NULL);
+
+///Accepts every stream the replay opens and counts what it receives, as cheaply as a receiver can
+class ReplayReceiver {
+public:
+    std::vector<Network::Stream*> mStreams;
+    uint64 mPackets;
+    uint64 mBytes;
+    ReplayReceiver():mPackets(0),mBytes(0) {
+    }
+    void bytesReceived(const Network::ChunkView&data) {
+        ++mPackets;
+        mBytes+=data.size();
+    }
+    void newStream(Network::Stream*newStream,Network::Stream::SetCallbacks&setCallbacks) {
+        if (newStream) {
+            using std::tr1::placeholders::_1;
+            mStreams.push_back(newStream);
+            setCallbacks.setViewCallbacks(&Network::Stream::ignoreConnectionStatus,std::tr1::bind(&ReplayReceiver::bytesReceived,this,_1));
+        }
+    }
+    void closeStreams() {
+        for (size_t i=0;i<mStreams.size();++i) {
+            mStreams[i]->close();
+            delete mStreams[i];
+        }
+        mStreams.clear();
+    }
+};
+}
+}
+
+int main(int argc,const char**argv) {
+    using namespace Sirikata;
+    using namespace Sirikata::Network;
+    using std::tr1::placeholders::_1;
+    using std::tr1::placeholders::_2;
+    OptionSet::getOptions("tcpsstreplay")->parse(argc,argv);
+    std::string filename=sCapture->as<std::string>();
+    std::vector<PacketCapture::Record> records;
+    if (!PacketCapture::read(filename,records)) {
+        if (records.empty()) {
+            std::cerr<<"Could not read a packet capture from \""<<filename<<"\"\n";
+            return 1;
+        }
+        std::cerr<<"Packet capture \""<<filename<<"\" is truncated: replaying the first "<<records.size()<<" packets\n";
+    }
+    PacketReplay replay(records);
+    records.clear();
+    std::cout<<replay.getNumPackets()<<" packets, "<<replay.getNumBytes()<<" bytes on "<<replay.getNumConnections()
+             <<" connections, captured over "<<replay.getCapturedDuration().toSeconds()<<" s\n";
+    unsigned int iterations=sIterations->as<unsigned int>();
+    for (unsigned int i=0;i<iterations;++i) {
+        IOService*io=IOServiceFactory::makeIOService();
+        ReplayReceiver receiver;
+        double seconds=replay.run(*io,std::tr1::bind(&ReplayReceiver::newStream,&receiver,_1,_2)).toSeconds();
+        receiver.closeStreams();
+        IOServiceFactory::destroyIOService(io);
+        std::cout<<"replay "<<i<<": "<<receiver.mPackets<<" messages, "<<receiver.mBytes<<" bytes delivered in "<<seconds<<" s";
+        if (seconds>0) {
+            std::cout<<" ("<<replay.getNumPackets()/seconds<<" packets/s, "<<replay.getNumBytes()/seconds/1048576.<<" MB/s)";
+        }
+        std::cout<<"\n";
+    }
+    return 0;
+}